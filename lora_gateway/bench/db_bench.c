@@ -0,0 +1,446 @@
+/*
+ * bench/db_bench.c - Database Query Benchmark
+ * Fills a scratch database with synthetic sensor history using the
+ * real schema from database.c, archives the cold partitions, checks
+ * query plans, then times the query functions the MQTT db/query
+ * handler calls, paged and chunked get_range streaming, the full
+ * request round-trip with and without the prepared statement cache
+ * and the result cache, latest readings, short ranges and aggregates
+ * from the in-memory ring and live window stats against SQLite, and
+ * reads/inserts under concurrent load.
+ *
+ * Build: make bench
+ * Run:   ./bin/db_bench [db_path] [days] [interval_sec]
+ * Exit code is non-zero if any query plan regressed to a table scan.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <cjson/cJSON.h>
+
+#include "gateway.h"
+#include "database.h"
+#include "db_writer.h"
+#include "db_cache.h"
+#include "utils.h"
+
+/* Globals normally defined in main.c */
+gateway_state_t gateway = {0};
+database_state_t db_state = {0};
+
+#define BENCH_NODES         MAX_NODES
+#define BENCH_REPEAT        5
+#define BENCH_ROUNDTRIPS    200
+#define BENCH_LOAD_SEC      2
+
+static void populate(int days, int interval_sec) {
+    sqlite3_stmt *stmt;
+    time_t now = time(NULL);
+    time_t start = now - (time_t)days * 24 * 3600;
+    long rows = 0;
+
+    uint64_t t0 = get_monotonic_us();
+    sqlite3_exec(db_state.db, "BEGIN;", 0, 0, 0);
+
+    // Writer thread is stopped here, so borrow its partition statement
+    for (time_t ts = start; ts < now; ts += interval_sec) {
+        if (ts < db_state.part_start || ts >= db_state.part_end) {
+            db_partition_prepare(ts);
+        }
+        stmt = db_state.stmt_sensor;
+        for (int node = 1; node <= BENCH_NODES; node++) {
+            sqlite3_reset(stmt);
+            sqlite3_bind_int64(stmt, 1, ts);
+            sqlite3_bind_int(stmt, 2, node);
+            // float, as db_save_sensor_data() queues them
+            sqlite3_bind_double(stmt, 3, (float)(20.0 + (rand() % 100) / 10.0));
+            sqlite3_bind_double(stmt, 4, (float)(50.0 + (rand() % 300) / 10.0));
+            sqlite3_bind_int(stmt, 5, 200 + rand() % 600);
+            sqlite3_bind_int(stmt, 6, 1500 + rand() % 1500);
+            sqlite3_bind_int(stmt, 7, -40 - rand() % 60);
+            sqlite3_bind_int(stmt, 8, rand() % 12);
+            sqlite3_step(stmt);
+            rows++;
+        }
+    }
+
+    sqlite3_exec(db_state.db, "COMMIT;", 0, 0, 0);
+
+    double secs = (get_monotonic_us() - t0) / 1e6;
+    printf("Populated %ld rows (%d days @ %ds, %d nodes) in %.1f s\n\n",
+           rows, days, interval_sec, BENCH_NODES, secs);
+}
+
+/* Storage per row, hot partitions (table + indexes) vs archive blocks */
+static void archive_report(void) {
+    const char *sql[2] = {
+        "SELECT (SELECT COUNT(*) FROM sensor_data), "
+        "SUM(pgsize) FROM dbstat WHERE name LIKE 'sensor_p_%';",
+        "SELECT SUM(count), SUM(length(data)) FROM sensor_archive;",
+    };
+    const char *label[2] = { "hot", "archived" };
+
+    for (int i = 0; i < 2; i++) {
+        sqlite3_stmt *stmt;
+        // dbstat is optional in SQLite builds
+        if (sqlite3_prepare_v2(db_state.db, sql[i], -1, &stmt, 0) != SQLITE_OK) {
+            printf("  %-9s (n/a: %s)\n", label[i], sqlite3_errmsg(db_state.db));
+            continue;
+        }
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            long rows = (long)sqlite3_column_int64(stmt, 0);
+            long bytes = (long)sqlite3_column_int64(stmt, 1);
+            printf("  %-9s %9ld rows  %8ld KB  %6.1f bytes/row\n", label[i], rows,
+                   bytes / 1024, rows > 0 ? (double)bytes / rows : 0.0);
+        }
+        sqlite3_finalize(stmt);
+    }
+}
+
+static void time_query(const char *label, char *(*fn)(int, int), int node_id, int arg) {
+    uint64_t best = UINT64_MAX;
+    size_t bytes = 0;
+
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        uint64_t t0 = get_monotonic_us();
+        char *json = fn(node_id, arg);
+        uint64_t elapsed = get_monotonic_us() - t0;
+
+        if (elapsed < best) best = elapsed;
+        if (json) {
+            bytes = strlen(json);
+            free(json);
+        }
+    }
+
+    printf("  %-28s %9.2f ms  %9zu bytes\n", label, best / 1000.0, bytes);
+}
+
+static char *range_raw(int node_id, int hours) {
+    return db_query_range_sensors(node_id, hours, 0);
+}
+
+static char *range_500(int node_id, int hours) {
+    return db_query_range_sensors(node_id, hours, 500);
+}
+
+/* Same work as the db/query handler in mqtt.c, minus the publish:
+ * result cache lookup (when use_cache), query, spliced response */
+static char *db_roundtrip(const char *payload, int use_cache) {
+    cJSON *request = cJSON_Parse(payload);
+    const char *action = "";
+    char *data_str = NULL;
+
+    cJSON *action_json = cJSON_GetObjectItem(request, "action");
+    cJSON *node_json = cJSON_GetObjectItem(request, "node_id");
+    cJSON *arg_json = cJSON_GetObjectItem(request, "arg");
+    int node_id = cJSON_IsNumber(node_json) ? node_json->valueint : 1;
+    int arg = cJSON_IsNumber(arg_json) ? arg_json->valueint : 24;
+
+    if (cJSON_IsString(action_json)) action = action_json->valuestring;
+
+    int cacheable = use_cache && strcmp(action, "get_range") != 0;
+    uint32_t generation = db_cache_generation(node_id);
+    if (cacheable) {
+        data_str = db_cache_get(payload, node_id);
+    }
+
+    if (data_str != NULL) {
+        cacheable = 0;
+    } else if (strcmp(action, "get_latest") == 0) {
+        data_str = db_query_latest_sensors(node_id, arg);
+    } else if (strcmp(action, "get_range") == 0) {
+        data_str = db_query_range_sensors(node_id, arg, 500);
+    } else if (strcmp(action, "get_aggregate") == 0) {
+        data_str = db_query_aggregate(node_id, arg);
+    } else if (strcmp(action, "get_actuator_history") == 0) {
+        data_str = db_query_actuator_history(node_id, arg);
+    } else if (strcmp(action, "get_stats") == 0) {
+        data_str = db_query_stats();
+    }
+    if (cacheable && data_str != NULL) {
+        db_cache_put(payload, node_id, generation, data_str);
+    }
+
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "success", data_str != NULL);
+    cJSON_AddStringToObject(response, "action", action);
+    char *head = cJSON_PrintUnformatted(response);
+    size_t head_len = strlen(head) - 1;
+    size_t data_len = data_str ? strlen(data_str) : 0;
+
+    char *response_str = malloc(head_len + data_len + 16);
+    memcpy(response_str, head, head_len);
+    sprintf(response_str + head_len, ",\"data\":%s}", data_str ? data_str : "null");
+
+    free(head);
+    free(data_str);
+    cJSON_Delete(response);
+    cJSON_Delete(request);
+    return response_str;
+}
+
+static double roundtrip_us(const char *payload, int use_cache) {
+    uint64_t t0 = get_monotonic_us();
+    for (int i = 0; i < BENCH_ROUNDTRIPS; i++) {
+        free(db_roundtrip(payload, use_cache));
+    }
+    return (double)(get_monotonic_us() - t0) / BENCH_ROUNDTRIPS;
+}
+
+static void time_roundtrips(void) {
+    static const char *requests[] = {
+        "{\"action\":\"get_latest\",\"node_id\":1,\"arg\":10}",
+        "{\"action\":\"get_latest\",\"node_id\":0,\"arg\":10}",
+        "{\"action\":\"get_range\",\"node_id\":1,\"arg\":24}",
+        "{\"action\":\"get_aggregate\",\"node_id\":1,\"arg\":720}",
+        "{\"action\":\"get_actuator_history\",\"node_id\":1,\"arg\":20}",
+        "{\"action\":\"get_stats\"}",
+    };
+
+    printf("━━━ db/query ROUND-TRIP (mean of %d, us) ━━━\n", BENCH_ROUNDTRIPS);
+    printf("  %-58s %9s %9s %9s\n", "request", "prepare", "cached", "result");
+    for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); i++) {
+        db_query_cache_enable(0);
+        double uncached = roundtrip_us(requests[i], 0);
+        db_query_cache_enable(1);
+        double cached = roundtrip_us(requests[i], 0);
+        double result = roundtrip_us(requests[i], 1);
+        printf("  %-58s %9.1f %9.1f %9.1f\n", requests[i], uncached, cached, result);
+    }
+    printf("  result cache: %u hits, %u misses\n\n", 
+           db_state.cache_hits, db_state.cache_misses);
+}
+
+/* Paged, chunked get_range as the db/query handler streams it */
+typedef struct {
+    int chunks;
+    size_t bytes;
+    size_t max_chunk;
+    int64_t next_after_ts;
+} stream_stats_t;
+
+static int count_chunk(const char *rows, size_t len, int seq, int last,
+                       int64_t next_after_ts, void *ctx) {
+    stream_stats_t *st = ctx;
+    (void)rows;
+    (void)seq;
+    st->chunks++;
+    st->bytes += len;
+    if (len > st->max_chunk) st->max_chunk = len;
+    if (last) st->next_after_ts = next_after_ts;
+    return 0;
+}
+
+static void time_stream(const char *label, int hours) {
+    db_range_query_t q = { .node_id = 1, .hours = hours, .limit = DB_RANGE_PAGE_ROWS };
+    stream_stats_t st = {0};
+    int pages = 0;
+    long rows = 0;
+
+    uint64_t t0 = get_monotonic_us();
+    do {
+        int n = db_stream_range_sensors(&q, count_chunk, &st);
+        if (n < 0) break;
+        rows += n;
+        pages++;
+        q.after_ts = st.next_after_ts;
+    } while (q.after_ts > 0);
+    double ms = (get_monotonic_us() - t0) / 1000.0;
+
+    char *whole = db_query_range_sensors(1, hours, 0);
+    cJSON *arr = whole ? cJSON_Parse(whole) : NULL;
+    int expected = arr ? cJSON_GetArraySize(arr) : -1;
+    cJSON_Delete(arr);
+    free(whole);
+
+    printf("  %-28s %9.2f ms  %ld rows in %d pages / %d chunks, largest %zu bytes%s\n",
+           label, ms, rows, pages, st.chunks, st.max_chunk,
+           rows == expected ? "" : "  ✗ row count differs from unpaged");
+}
+
+/* get_range with max_points: payload should not grow with the window */
+static int collect_chunk(const char *rows, size_t len, int seq, int last,
+                         int64_t next_after_ts, void *ctx) {
+    (void)rows;
+    (void)seq;
+    (void)last;
+    (void)next_after_ts;
+    *(size_t *)ctx += len;
+    return 0;
+}
+
+static void time_downsample(void) {
+    static const char *modes[] = { "lttb", "minmax", "avg" };
+    static const int windows[] = { 24, 24 * 7, 24 * 30, 24 * 90 };
+
+    printf("━━━ DOWNSAMPLED get_range (max_points 500, best of %d) ━━━\n", BENCH_REPEAT);
+    printf("  %-8s %-8s %9s %7s %9s\n", "hours", "mode", "ms", "rows", "bytes");
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+        for (int m = 0; m < 3; m++) {
+            db_range_query_t q = { .node_id = 1, .hours = windows[w], .max_points = 500,
+                                   .downsample = m, .limit = DB_RANGE_PAGE_ROWS };
+            uint64_t best = UINT64_MAX;
+            size_t bytes = 0;
+            int rows = 0;
+
+            for (int i = 0; i < BENCH_REPEAT; i++) {
+                bytes = 0;
+                uint64_t t0 = get_monotonic_us();
+                rows = db_stream_range_sensors(&q, collect_chunk, &bytes);
+                uint64_t elapsed = get_monotonic_us() - t0;
+                if (elapsed < best) best = elapsed;
+            }
+            printf("  %-8d %-8s %9.2f %7d %9zu\n", 
+                   windows[w], modes[m], best / 1000.0, rows, bytes);
+        }
+    }
+    printf("\n");
+}
+
+static volatile int load_running;
+
+static void *range_load(void *arg) {
+    while (load_running) {
+        free(db_query_range_sensors(1, 24 * 7, 0));
+    }
+    return NULL;
+}
+
+/* Dashboard-style raw range queries on every worker, while this thread
+ * keeps inserting and asking for the latest readings */
+static void time_concurrent(void) {
+    pthread_t load[DB_QUERY_WORKERS];
+    uint64_t worst = 0;
+    int queries = 0, rows = 0;
+
+    load_running = 1;
+    for (int i = 0; i < DB_QUERY_WORKERS; i++) {
+        pthread_create(&load[i], NULL, range_load, NULL);
+    }
+
+    uint32_t inserts = db_state.total_inserts;
+    uint64_t t0 = get_monotonic_us();
+    while (get_monotonic_us() - t0 < BENCH_LOAD_SEC * 1000000ULL) {
+        uint64_t q0 = get_monotonic_us();
+        free(db_query_latest_sensors(1, 10));
+        uint64_t elapsed = get_monotonic_us() - q0;
+        if (elapsed > worst) worst = elapsed;
+        queries++;
+
+        if (db_save_sensor_data(1 + rows % BENCH_NODES, 25.0f, 60.0f, 
+                                500, 2000, -70, 7) == 0) {
+            rows++;
+        }
+        usleep(1000);
+    }
+
+    load_running = 0;
+    for (int i = 0; i < DB_QUERY_WORKERS; i++) {
+        pthread_join(load[i], NULL);
+    }
+
+    printf("━━━ CONCURRENT (%d x range(7d) for %d s) ━━━\n", 
+           DB_QUERY_WORKERS, BENCH_LOAD_SEC);
+    printf("  latest(node 1, 10): %d queries, worst %.2f ms\n", queries, worst / 1000.0);
+    printf("  inserts: %d queued, %u committed meanwhile\n\n", 
+           rows, db_state.total_inserts - inserts);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "/tmp/db_bench.db";
+    int days = argc > 2 ? atoi(argv[2]) : 365;
+    int interval = argc > 3 ? atoi(argv[3]) : 60;
+
+    remove(path);
+    if (db_init_at(path) < 0) {
+        return 1;
+    }
+    // Let the startup maintenance pass finish so populate owns the connection
+    db_writer_stop();
+
+    populate(days, interval);
+
+    // Reopen so rollup tables are backfilled the same way an upgraded
+    // database would be
+    db_cleanup();
+    memset(&db_state, 0, sizeof(db_state));
+    if (db_init_at(path) < 0) {
+        return 1;
+    }
+
+    // Startup queued the archive pass; closing drains the writer queue
+    uint64_t t0 = get_monotonic_us();
+    db_cleanup();
+    double archive_secs = (get_monotonic_us() - t0) / 1e6;
+    memset(&db_state, 0, sizeof(db_state));
+    if (db_init_at(path) < 0) {
+        return 1;
+    }
+
+    printf("━━━ ARCHIVE (older than %d days, %.1f s) ━━━\n", 
+           DB_ARCHIVE_AFTER_DAYS, archive_secs);
+    archive_report();
+    printf("\n");
+
+    printf("━━━ QUERY PLANS ━━━\n");
+    int regressions = db_check_query_plans(1);
+    if (regressions < 0) {
+        fprintf(stderr, "✗ Query plans not checked: database not open\n");
+        db_cleanup();
+        return 1;
+    }
+    printf("\n");
+
+    printf("━━━ QUERY TIMES (best of %d) ━━━\n", BENCH_REPEAT);
+    time_query("latest(node 1, 10)", db_query_latest_sensors, 1, 10);
+    time_query("latest(all, 10)", db_query_latest_sensors, 0, 10);
+    time_query("range(node 1, 1h)", range_raw, 1, 1);
+    time_query("range(node 1, 24h)", range_raw, 1, 24);
+    time_query("range(node 1, 7d)", range_raw, 1, 24 * 7);
+    time_query("range(node 1, 7d, 500 pts)", range_500, 1, 24 * 7);
+    time_query("range(node 1, 30d, archived)", range_raw, 1, 24 * 30);
+    time_query("range(node 1, 90d, 500 pts)", range_500, 1, 24 * 90);
+    time_query("aggregate(node 1, 24h)", db_query_aggregate, 1, 24);
+    time_query("aggregate(node 1, 30d)", db_query_aggregate, 1, 24 * 30);
+    time_query("aggregate(node 1, 365d)", db_query_aggregate, 1, 24 * 365);
+    time_query("actuator_history(node 1)", db_query_actuator_history, 1, 20);
+    printf("\n");
+
+    printf("━━━ RECENT READINGS: SQLite vs ring / live stats (best of %d) ━━━\n", BENCH_REPEAT);
+    for (int ring = 0; ring <= 1; ring++) {
+        db_sensor_ring_enable(ring);
+        printf("  [%s]\n", ring ? "ring" : "SQLite");
+        time_query("latest(node 1, 10)", db_query_latest_sensors, 1, 10);
+        time_query("latest(node 1, 500)", db_query_latest_sensors, 1, 500);
+        time_query("latest(all, 10)", db_query_latest_sensors, 0, 10);
+        time_query("range(node 1, 1h)", range_raw, 1, 1);
+        time_query("aggregate(node 1, 1h)", db_query_aggregate, 1, 1);
+        time_query("aggregate(node 1, 24h)", db_query_aggregate, 1, 24);
+    }
+    printf("\n");
+
+    printf("━━━ STREAMED get_range (pages of %d rows) ━━━\n", DB_RANGE_PAGE_ROWS);
+    time_stream("range(node 1, 7d)", 24 * 7);
+    time_stream("range(node 1, 30d, archived)", 24 * 30);
+    printf("\n");
+
+    time_downsample();
+
+    time_roundtrips();
+    time_concurrent();
+
+    db_cleanup();
+
+    if (regressions > 0) {
+        printf("✗ %d query plan regression(s)\n", regressions);
+        return 1;
+    }
+    printf("✓ All query plans use indexes\n");
+    return 0;
+}
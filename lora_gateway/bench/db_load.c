@@ -0,0 +1,340 @@
+/*
+ * bench/db_load.c - Ingest + Query Load per SQLite Tuning Profile
+ * For each profile in database.h: a fresh database with the real
+ * schema and a few days of history, then NODES x RATE readings per
+ * second replayed through db_save_sensor_data() (writer thread, group
+ * commit) while DB_QUERY_WORKERS threads run a dashboard query mix
+ * through the db_query_* functions. Reports committed inserts/s,
+ * p50/p99/max commit latency, background checkpoints (count, longest,
+ * largest WAL seen) and p50/p99 per query, then times
+ * AUTOINCREMENT against plain rowid keys for the log tables.
+ *
+ * Build: make bench
+ * Run:   ./bin/db_load [db_dir] [nodes] [rate_hz] [seconds] [profile|all]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include "gateway.h"
+#include "database.h"
+#include "db_writer.h"
+#include "utils.h"
+
+/* Globals normally defined in main.c */
+gateway_state_t gateway = {0};
+database_state_t db_state = {0};
+
+#define LOAD_HISTORY_DAYS   7
+#define LOAD_HISTORY_STEP   60      // seconds between history readings
+#define LOAD_MAX_SAMPLES    100000  // per query kind per thread
+#define LOAD_LOG_ROWS       20000   // AUTOINCREMENT vs rowid inserts
+#define LOAD_LOG_BATCH      500
+
+typedef enum {
+    LQ_LATEST,
+    LQ_RANGE_1H,
+    LQ_RANGE_7D_500,
+    LQ_AGGREGATE_24H,
+    LQ_KINDS
+} load_query_t;
+
+static const char *query_names[LQ_KINDS] = {
+    "latest(10)", "range(1h)", "range(7d, 500 pts)", "aggregate(24h)"
+};
+
+typedef struct {
+    int id;
+    int nodes;
+    uint32_t *samples[LQ_KINDS];
+    int count[LQ_KINDS];
+} load_worker_t;
+
+typedef struct {
+    const char *profile;
+    double committed_per_sec;
+    uint32_t drops;
+    uint32_t commit_p50_us, commit_p99_us, commit_max_us;
+    uint32_t checkpoints, checkpoint_max_us;
+    uint64_t wal_max_bytes;
+    uint32_t query_p50_us[LQ_KINDS], query_p99_us[LQ_KINDS];
+} load_result_t;
+
+static volatile int load_running;
+
+/* History with the writer stopped, borrowing its partition statement */
+static void populate(int nodes) {
+    time_t now = time(NULL);
+    time_t start = now - (time_t)LOAD_HISTORY_DAYS * 24 * 3600;
+
+    sqlite3_exec(db_state.db, "BEGIN;", 0, 0, 0);
+    for (time_t ts = start; ts < now; ts += LOAD_HISTORY_STEP) {
+        if (ts < db_state.part_start || ts >= db_state.part_end) {
+            db_partition_prepare(ts);
+        }
+        sqlite3_stmt *stmt = db_state.stmt_sensor;
+        for (int node = 1; node <= nodes; node++) {
+            sqlite3_reset(stmt);
+            sqlite3_bind_int64(stmt, 1, ts);
+            sqlite3_bind_int(stmt, 2, node);
+            sqlite3_bind_double(stmt, 3, (float)(20.0 + (rand() % 100) / 10.0));
+            sqlite3_bind_double(stmt, 4, (float)(50.0 + (rand() % 300) / 10.0));
+            sqlite3_bind_int(stmt, 5, 200 + rand() % 600);
+            sqlite3_bind_int(stmt, 6, 1500 + rand() % 1500);
+            sqlite3_bind_int(stmt, 7, -40 - rand() % 60);
+            sqlite3_bind_int(stmt, 8, rand() % 12);
+            sqlite3_step(stmt);
+        }
+    }
+    sqlite3_exec(db_state.db, "COMMIT;", 0, 0, 0);
+}
+
+static char *run_query(load_query_t kind, int node_id) {
+    switch (kind) {
+    case LQ_LATEST:         return db_query_latest_sensors(node_id, 10);
+    case LQ_RANGE_1H:       return db_query_range_sensors(node_id, 1, 0);
+    case LQ_RANGE_7D_500:   return db_query_range_sensors(node_id, 24 * 7, 500);
+    case LQ_AGGREGATE_24H:  return db_query_aggregate(node_id, 24);
+    default:                return NULL;
+    }
+}
+
+static void *query_worker(void *arg) {
+    load_worker_t *w = arg;
+    int nodes = w->nodes < MAX_NODES ? w->nodes : MAX_NODES;
+
+    for (int i = w->id; load_running; i++) {
+        load_query_t kind = (load_query_t)(i % LQ_KINDS);
+
+        uint64_t t0 = get_monotonic_us();
+        free(run_query(kind, 1 + i % nodes));
+        uint32_t elapsed = (uint32_t)(get_monotonic_us() - t0);
+
+        if (w->count[kind] < LOAD_MAX_SAMPLES) {
+            w->samples[kind][w->count[kind]++] = elapsed;
+        }
+    }
+    return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(uint32_t *v, int n, double p) {
+    if (n == 0) return 0;
+    int i = (int)(p * n + 0.5) - 1;
+    return v[i < 0 ? 0 : (i >= n ? n - 1 : i)];
+}
+
+static int run_profile(const char *dir, const char *name, int nodes, int rate_hz,
+                       int seconds, load_result_t *res) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/db_load_%s.db", dir, name);
+    char side[540];
+    remove(path);
+    snprintf(side, sizeof(side), "%s-wal", path);
+    remove(side);
+    snprintf(side, sizeof(side), "%s-shm", path);
+    remove(side);
+
+    if (db_set_profile(name) < 0) {
+        fprintf(stderr, "Unknown profile %s\n", name);
+        return -1;
+    }
+
+    // Fresh file (page_size applies), history, then reopen so the
+    // rollups are backfilled the way an upgraded database would be
+    memset(&db_state, 0, sizeof(db_state));
+    if (db_init_at(path) < 0) return -1;
+    db_writer_stop();
+    populate(nodes);
+    db_cleanup();
+    memset(&db_state, 0, sizeof(db_state));
+    if (db_init_at(path) < 0) return -1;
+
+    // Every query goes to SQLite - this measures the database
+    db_sensor_ring_enable(0);
+
+    load_worker_t workers[DB_QUERY_WORKERS];
+    pthread_t threads[DB_QUERY_WORKERS];
+    load_running = 1;
+    for (int i = 0; i < DB_QUERY_WORKERS; i++) {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].id = i;
+        workers[i].nodes = nodes;
+        for (int k = 0; k < LQ_KINDS; k++) {
+            workers[i].samples[k] = malloc(sizeof(uint32_t) * LOAD_MAX_SAMPLES);
+        }
+        pthread_create(&threads[i], NULL, query_worker, &workers[i]);
+    }
+
+    // Paced ingest: readings due by now go out, then a short sleep.
+    // Commits trail the queue by up to one batch, so the committed rate
+    // is counted from one batch period in (steady state) to the end
+    db_writer_reset_commit_stats();
+    db_state.checkpoint_count = 0;
+    db_state.checkpoint_time_max_us = 0;
+    db_state.wal_bytes_max = 0;
+    uint32_t drops0 = db_state.queue_drops;
+    uint32_t inserts0 = 0;
+    uint64_t t0 = get_monotonic_us(), t_steady = 0;
+    uint64_t elapsed;
+    long sent = 0;
+    while ((elapsed = get_monotonic_us() - t0) < (uint64_t)seconds * 1000000) {
+        if (t_steady == 0 && elapsed >= DB_BATCH_MAX_MS * 1000ULL) {
+            t_steady = elapsed;
+            inserts0 = db_state.total_inserts;
+        }
+        long due = (long)(elapsed * nodes * rate_hz / 1000000);
+        for (; sent < due; sent++) {
+            db_save_sensor_data(1 + sent % nodes, 20.0f + sent % 100 / 10.0f, 60.0f,
+                                (uint16_t)(200 + sent % 600), 2000, -70, 7);
+        }
+        usleep(1000);
+    }
+    uint32_t committed = db_state.total_inserts - inserts0;
+
+    load_running = 0;
+    for (int i = 0; i < DB_QUERY_WORKERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    res->profile = name;
+    res->committed_per_sec = committed / ((elapsed - t_steady) / 1e6);
+    res->drops = db_state.queue_drops - drops0;
+    res->commit_p50_us = db_writer_commit_percentile_us(0.50);
+    res->commit_p99_us = db_writer_commit_percentile_us(0.99);
+    res->commit_max_us = db_state.commit_time_max_us;
+    res->checkpoints = db_state.checkpoint_count;
+    res->checkpoint_max_us = db_state.checkpoint_time_max_us;
+    res->wal_max_bytes = db_state.wal_bytes_max;
+
+    for (int k = 0; k < LQ_KINDS; k++) {
+        int n = 0;
+        for (int i = 0; i < DB_QUERY_WORKERS; i++) n += workers[i].count[k];
+
+        uint32_t *all = malloc(sizeof(uint32_t) * (n ? n : 1));
+        n = 0;
+        for (int i = 0; i < DB_QUERY_WORKERS; i++) {
+            memcpy(all + n, workers[i].samples[k], sizeof(uint32_t) * workers[i].count[k]);
+            n += workers[i].count[k];
+            free(workers[i].samples[k]);
+        }
+        qsort(all, n, sizeof(uint32_t), cmp_u32);
+        res->query_p50_us[k] = percentile(all, n, 0.50);
+        res->query_p99_us[k] = percentile(all, n, 0.99);
+        free(all);
+    }
+
+    db_cleanup();
+    return 0;
+}
+
+/* Same log-table shape with and without AUTOINCREMENT (which also
+ * updates sqlite_sequence on every insert) */
+static double log_insert_us(const char *dir, int autoincrement) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/db_load_log.db", dir);
+    remove(path);
+
+    sqlite3 *db;
+    if (sqlite3_open(path, &db) != SQLITE_OK) return -1;
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", 0, 0, 0);
+
+    char sql[256];
+    snprintf(sql, sizeof(sql),
+             "CREATE TABLE actuator_logs (id INTEGER PRIMARY KEY%s,"
+             "timestamp INTEGER NOT NULL, node_id INTEGER NOT NULL,"
+             "actuator TEXT NOT NULL, state INTEGER NOT NULL,"
+             "trigger_type TEXT, trigger_value REAL);",
+             autoincrement ? " AUTOINCREMENT" : "");
+    sqlite3_exec(db, sql, 0, 0, 0);
+
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, "INSERT INTO actuator_logs (timestamp, node_id, actuator, "
+                       "state, trigger_type, trigger_value) VALUES (?, ?, 'fan', ?, 'AUTO', ?);",
+                       -1, &stmt, 0);
+
+    uint64_t t0 = get_monotonic_us();
+    for (int i = 0; i < LOAD_LOG_ROWS; i++) {
+        if (i % LOAD_LOG_BATCH == 0) sqlite3_exec(db, "BEGIN;", 0, 0, 0);
+        sqlite3_bind_int64(stmt, 1, 1700000000 + i);
+        sqlite3_bind_int(stmt, 2, 1 + i % MAX_NODES);
+        sqlite3_bind_int(stmt, 3, i & 1);
+        sqlite3_bind_double(stmt, 4, 25.0 + i % 10);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (i % LOAD_LOG_BATCH == LOAD_LOG_BATCH - 1) sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+    }
+    double us = (double)(get_monotonic_us() - t0) / LOAD_LOG_ROWS;
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    remove(path);
+    return us;
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    int nodes = argc > 2 ? atoi(argv[2]) : MAX_NODES;
+    int rate_hz = argc > 3 ? atoi(argv[3]) : 100;
+    int seconds = argc > 4 ? atoi(argv[4]) : 10;
+    const char *only = argc > 5 ? argv[5] : "all";
+
+    if (nodes < 1 || rate_hz < 1 || seconds * 1000 <= DB_BATCH_MAX_MS) {
+        fprintf(stderr, "Usage: %s [db_dir] [nodes] [rate_hz] [seconds] [profile|all]\n", argv[0]);
+        return 1;
+    }
+
+    int count;
+    const db_profile_t *profiles = db_list_profiles(&count);
+    load_result_t *results = calloc(count, sizeof(load_result_t));
+    int ran = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (strcmp(only, "all") != 0 && strcmp(only, profiles[i].name) != 0) {
+            continue;
+        }
+        if (run_profile(dir, profiles[i].name, nodes, rate_hz, seconds, &results[ran]) < 0) {
+            return 1;
+        }
+        ran++;
+    }
+    if (ran == 0) {
+        fprintf(stderr, "Unknown profile %s\n", only);
+        return 1;
+    }
+
+    printf("\n━━━ LOAD: %d nodes x %d Hz = %d rows/s offered, %d s, %d query threads ━━━\n",
+           nodes, rate_hz, nodes * rate_hz, seconds, DB_QUERY_WORKERS);
+    printf("  %-10s %9s %6s %24s %14s %8s", "profile", "ins/s", "drops",
+           "commit p50/p99/max", "ckpt n/max", "WAL KB");
+    for (int k = 0; k < LQ_KINDS; k++) {
+        printf(" %19s", query_names[k]);
+    }
+    printf("   (ms)\n");
+    for (int i = 0; i < ran; i++) {
+        load_result_t *r = &results[i];
+        printf("  %-10s %9.1f %6u %7.2f/%7.2f/%-8.2f %4u/%-9.2f %8llu", r->profile,
+               r->committed_per_sec, r->drops, r->commit_p50_us / 1000.0,
+               r->commit_p99_us / 1000.0, r->commit_max_us / 1000.0, r->checkpoints,
+               r->checkpoint_max_us / 1000.0, (unsigned long long)(r->wal_max_bytes / 1024));
+        for (int k = 0; k < LQ_KINDS; k++) {
+            printf(" %9.2f/%-9.2f", r->query_p50_us[k] / 1000.0, r->query_p99_us[k] / 1000.0);
+        }
+        printf("\n");
+    }
+
+    printf("\n━━━ LOG TABLES: %d inserts in batches of %d ━━━\n", LOAD_LOG_ROWS, LOAD_LOG_BATCH);
+    printf("  INTEGER PRIMARY KEY AUTOINCREMENT  %6.2f us/row\n", log_insert_us(dir, 1));
+    printf("  INTEGER PRIMARY KEY (rowid)        %6.2f us/row\n", log_insert_us(dir, 0));
+
+    free(results);
+    return 0;
+}
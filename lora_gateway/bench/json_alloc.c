@@ -0,0 +1,356 @@
+/*
+ * bench/json_alloc.c - Heap Allocations per Packet on the Publish Path
+ * Every received packet serializes the nodes/node{id} document and
+ * used to rewrite the dashboard file. This times the cJSON way the
+ * gateway first did it (tree, cJSON_Print, stdio), json_writer with a
+ * plain write() per packet (payload.c through json_writer.h), and what
+ * it does now - the dashboard only marked dirty, snapshot.c writing it
+ * at most every SNAPSHOT_INTERVAL_MS - counting malloc/calloc/realloc
+ * calls with wrappers around glibc's allocator.
+ * Exit code is non-zero if the new output does not parse or either
+ * json_writer path allocates at all.
+ *
+ * Build: make bench
+ * Run:   ./bin/json_alloc [file_path] [nodes] [packets]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cjson/cJSON.h>
+
+#include "gateway.h"
+#include "json_writer.h"
+#include "payload.h"
+#include "snapshot.h"
+#include "utils.h"
+
+/* Globals normally defined in main.c */
+gateway_state_t gateway = {0};
+
+#define ALLOC_DEFAULT_NODES     3
+#define ALLOC_DEFAULT_PACKETS   20000
+
+/* ---- allocation counting ---- */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread int counting = 0;
+static __thread unsigned long alloc_calls = 0;
+static __thread unsigned long alloc_bytes = 0;
+
+void *malloc(size_t size) {
+    if (counting) {
+        alloc_calls++;
+        alloc_bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    if (counting) {
+        alloc_calls++;
+        alloc_bytes += n * size;
+    }
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (counting) {
+        alloc_calls++;
+        alloc_bytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+/* ---- before: cJSON tree per document ---- */
+
+static cJSON *cjson_node_document(int node_id, const node_data_t *node) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "node_id", node_id);
+    cJSON_AddNumberToObject(root, "timestamp", (double)node->last_update);
+
+    cJSON *sensors = cJSON_CreateObject();
+    cJSON_AddNumberToObject(sensors, "temperature", node->temperature);
+    cJSON_AddNumberToObject(sensors, "humidity", node->humidity);
+    cJSON_AddNumberToObject(sensors, "light", node->light);
+    cJSON_AddNumberToObject(sensors, "soil_moisture", node->soil_moisture);
+    cJSON_AddItemToObject(root, "sensors", sensors);
+
+    cJSON *actuators = cJSON_CreateObject();
+    cJSON_AddNumberToObject(actuators, "fan", node->actuators.fan_state);
+    cJSON_AddNumberToObject(actuators, "light", node->actuators.light_state);
+    cJSON_AddNumberToObject(actuators, "pump", node->actuators.pump_state);
+    cJSON_AddItemToObject(root, "actuators", actuators);
+
+    cJSON *signal = cJSON_CreateObject();
+    cJSON_AddNumberToObject(signal, "rssi", node->last_rssi);
+    cJSON_AddNumberToObject(signal, "snr", node->last_snr);
+    cJSON_AddItemToObject(root, "signal", signal);
+
+    cJSON *stats = cJSON_CreateObject();
+    cJSON_AddNumberToObject(stats, "rx_count", node->rx_count);
+    cJSON_AddNumberToObject(stats, "tx_count", node->tx_count);
+    cJSON_AddItemToObject(root, "stats", stats);
+
+    cJSON_AddBoolToObject(root, "auto_mode", node->thresholds.enabled);
+    return root;
+}
+
+static cJSON *cjson_dashboard(void) {
+    char timestamp[32];
+    get_timestamp(timestamp, sizeof(timestamp));
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "timestamp", timestamp);
+    cJSON_AddNumberToObject(root, "unix_time", (double)time(NULL));
+
+    cJSON *nodes = cJSON_CreateObject();
+    for (int i = 0; i < MAX_NODES; i++) {
+        const node_data_t *n = &gateway.nodes[i];
+        if (n->last_update == 0) {
+            continue;
+        }
+        char node_key[16];
+        snprintf(node_key, sizeof(node_key), "node%d", i+1);
+
+        cJSON *node = cJSON_CreateObject();
+        cJSON_AddNumberToObject(node, "temp", n->temperature);
+        cJSON_AddNumberToObject(node, "humid", n->humidity);
+        cJSON_AddNumberToObject(node, "light", n->light);
+        cJSON_AddNumberToObject(node, "soil", n->soil_moisture);
+        cJSON_AddNumberToObject(node, "rssi", n->last_rssi);
+        cJSON_AddNumberToObject(node, "snr", n->last_snr);
+        cJSON_AddNumberToObject(node, "rx_count", n->rx_count);
+        cJSON_AddNumberToObject(node, "tx_count", n->tx_count);
+        cJSON_AddNumberToObject(node, "last_update", (double)n->last_update);
+
+        cJSON *actuators = cJSON_CreateObject();
+        cJSON_AddNumberToObject(actuators, "fan", n->actuators.fan_state);
+        cJSON_AddNumberToObject(actuators, "light", n->actuators.light_state);
+        cJSON_AddNumberToObject(actuators, "pump", n->actuators.pump_state);
+        cJSON_AddItemToObject(node, "actuators", actuators);
+
+        cJSON_AddBoolToObject(node, "auto_mode", n->thresholds.enabled);
+        if (n->thresholds.enabled) {
+            cJSON *thresholds = cJSON_CreateObject();
+            cJSON *temp_th = cJSON_CreateObject();
+            cJSON_AddNumberToObject(temp_th, "min", n->thresholds.temp_min);
+            cJSON_AddNumberToObject(temp_th, "max", n->thresholds.temp_max);
+            cJSON_AddItemToObject(thresholds, "temp", temp_th);
+            cJSON *light_th = cJSON_CreateObject();
+            cJSON_AddNumberToObject(light_th, "min", n->thresholds.light_min);
+            cJSON_AddNumberToObject(light_th, "max", n->thresholds.light_max);
+            cJSON_AddItemToObject(thresholds, "light", light_th);
+            cJSON *soil_th = cJSON_CreateObject();
+            cJSON_AddNumberToObject(soil_th, "min", n->thresholds.soil_min);
+            cJSON_AddNumberToObject(soil_th, "max", n->thresholds.soil_max);
+            cJSON_AddItemToObject(thresholds, "soil", soil_th);
+            cJSON_AddItemToObject(node, "thresholds", thresholds);
+        }
+        cJSON_AddItemToObject(nodes, node_key, node);
+    }
+    cJSON_AddItemToObject(root, "nodes", nodes);
+
+    cJSON *gw_stats = cJSON_CreateObject();
+    cJSON_AddNumberToObject(gw_stats, "rx_nodata", gateway.rx_nodata);
+    cJSON_AddNumberToObject(gw_stats, "rx_crc_error", gateway.rx_crc_error);
+    cJSON_AddNumberToObject(gw_stats, "rx_crc_recovery", gateway.rx_crc_recovery);
+    cJSON_AddNumberToObject(gw_stats, "json_parse_error", gateway.json_parse_error);
+    cJSON_AddNumberToObject(gw_stats, "auto_commands", gateway.auto_commands);
+    cJSON_AddNumberToObject(gw_stats, "mqtt_connected", gateway.mqtt_connected);
+    cJSON_AddNumberToObject(gw_stats, "mqtt_publish_count", gateway.mqtt_publish_count);
+    cJSON_AddNumberToObject(gw_stats, "mqtt_error_count", gateway.mqtt_error_count);
+    cJSON_AddItemToObject(root, "gateway", gw_stats);
+    return root;
+}
+
+/* ---- one packet each way ---- */
+
+typedef struct {
+    unsigned long calls;
+    unsigned long bytes;
+    size_t node_len;
+    size_t dash_len;
+} packet_cost_t;
+
+static volatile size_t sink;
+
+static void packet_cjson(int node_id, const char *path, packet_cost_t *c) {
+    cJSON *doc = cjson_node_document(node_id, &gateway.nodes[node_id - 1]);
+    char *payload = cJSON_PrintUnformatted(doc);
+    c->node_len = strlen(payload);
+    sink += c->node_len;            // stands in for mosquitto_publish()
+    free(payload);
+    cJSON_Delete(doc);
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return;
+    }
+    cJSON *root = cjson_dashboard();
+    char *json_string = cJSON_Print(root);
+    c->dash_len = strlen(json_string);
+    fprintf(fp, "%s", json_string);
+    free(json_string);
+    cJSON_Delete(root);
+    fclose(fp);
+}
+
+static void packet_writer(int node_id, const char *path, packet_cost_t *c) {
+    size_t len;
+    jw_t *w = jw_begin();
+    jw_object(w, NULL);
+    payload_node_fields(w, node_id, &gateway.nodes[node_id - 1]);
+    jw_object_end(w);
+    if (jw_finish(w, &len) != NULL) {
+        c->node_len = len;
+        sink += len;
+    }
+
+    w = jw_begin();
+    payload_dashboard(w);
+    const char *json = jw_finish(w, &len);
+    if (json == NULL) {
+        return;
+    }
+    c->dash_len = len;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    if (write(fd, json, len) < 0) {
+        perror("write");
+    }
+    close(fd);
+}
+
+/* Now: the dashboard is only marked dirty, snapshot.c writes it when due */
+static void packet_snapshot(int node_id, const char *path, packet_cost_t *c) {
+    size_t len;
+    (void)path;                     // snapshot_configure() in main()
+    jw_t *w = jw_begin();
+    jw_object(w, NULL);
+    payload_node_fields(w, node_id, &gateway.nodes[node_id - 1]);
+    jw_object_end(w);
+    if (jw_finish(w, &len) != NULL) {
+        c->node_len = len;
+        sink += len;
+    }
+
+    snapshot_mark_dirty();
+    if (gateway.snapshot_writes > 0) {
+        c->dash_len = (size_t)(gateway.snapshot_bytes / gateway.snapshot_writes);
+    }
+}
+
+typedef void (*packet_fn)(int node_id, const char *path, packet_cost_t *c);
+
+static void run(const char *label, packet_fn fn, const char *path,
+                int nodes, int packets, packet_cost_t *total) {
+    packet_cost_t c = {0};
+
+    // Warm up: first fopen/localtime/thread buffer touch allocate once
+    fn(1, path, &c);
+
+    alloc_calls = 0;
+    alloc_bytes = 0;
+    uint64_t t0 = get_monotonic_us();
+    counting = 1;
+    for (int i = 0; i < packets; i++) {
+        node_data_t *n = &gateway.nodes[i % nodes];
+        n->temperature = 18.0f + (float)(i % 97) / 10.0f;
+        n->humidity = 40.0f + (float)(i % 211) / 10.0f;
+        n->light = (uint16_t)(i % 1000);
+        n->rx_count++;
+        fn(i % nodes + 1, path, &c);
+    }
+    counting = 0;
+    uint64_t elapsed = get_monotonic_us() - t0;
+
+    total->calls = alloc_calls;
+    total->bytes = alloc_bytes;
+    total->node_len = c.node_len;
+    total->dash_len = c.dash_len;
+
+    printf("  %-22s %10.1f %12.0f %10.2f %8zu %8zu\n", label,
+           (double)alloc_calls / packets, (double)alloc_bytes / packets,
+           (double)elapsed / packets, c.node_len, c.dash_len);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "/tmp/json_alloc.json";
+    int nodes = argc > 2 ? atoi(argv[2]) : ALLOC_DEFAULT_NODES;
+    int packets = argc > 3 ? atoi(argv[3]) : ALLOC_DEFAULT_PACKETS;
+    if (nodes < 1 || nodes > MAX_NODES) {
+        nodes = ALLOC_DEFAULT_NODES;
+    }
+    if (packets < 1) {
+        packets = ALLOC_DEFAULT_PACKETS;
+    }
+
+    time_t now = time(NULL);
+    for (int i = 0; i < nodes; i++) {
+        node_data_t *n = &gateway.nodes[i];
+        n->last_update = now;
+        n->soil_moisture = 512;
+        n->last_rssi = -70 - i;
+        n->last_snr = 8;
+        // Every other node in auto mode, so the dashboard carries thresholds
+        if (i % 2 == 0) {
+            n->thresholds.enabled = 1;
+            n->thresholds.temp_min = 18.5f;
+            n->thresholds.temp_max = 28.0f;
+            n->thresholds.light_min = 200;
+            n->thresholds.light_max = 800;
+            n->thresholds.soil_min = 300;
+            n->thresholds.soil_max = 700;
+        }
+    }
+
+    printf("━━━ PUBLISH PATH: %d packets, %d nodes, dashboard at %s ━━━\n",
+           packets, nodes, path);
+    printf("  %-22s %10s %12s %10s %8s %8s\n", "",
+           "allocs/pkt", "bytes/pkt", "us/pkt", "node B", "dash B");
+
+    packet_cost_t before, after;
+    run("cJSON tree + stdio", packet_cjson, path, nodes, packets, &before);
+    run("json_writer + write()", packet_writer, path, nodes, packets, &after);
+    snapshot_configure(path, SNAPSHOT_INTERVAL_MS);
+    packet_cost_t coalesced;
+    run("json_writer, coalesced", packet_snapshot, path, nodes, packets, &coalesced);
+    snapshot_flush();
+    printf("  %u dashboard snapshots for %d packets (at most one per %d ms, rename)\n",
+           gateway.snapshot_writes, packets + 1, SNAPSHOT_INTERVAL_MS);
+
+    int failed = 0;
+    jw_t *w = jw_begin();
+    payload_dashboard(w);
+    cJSON *check = cJSON_Parse(jw_finish(w, NULL));
+    if (check == NULL) {
+        printf("✗ json_writer dashboard does not parse\n");
+        failed = 1;
+    }
+    cJSON_Delete(check);
+    if (after.calls > 0) {
+        printf("✗ json_writer path allocated %lu times\n", after.calls);
+        failed = 1;
+    }
+    if (coalesced.calls > 0) {
+        printf("✗ coalesced snapshot path allocated %lu times\n", coalesced.calls);
+        failed = 1;
+    }
+
+    unlink(path);
+    return failed;
+}
@@ -0,0 +1,179 @@
+/*
+ * bench/mqtt_route.c - Inbound MQTT Messages per Second through the Router
+ * Routes a mix of control messages - threshold pushes, actuator and
+ * auto switches, text commands, db queries and topics nobody handles -
+ * with mqtt_route() and with the strstr/sscanf/strcmp chain that
+ * mqtt_on_message() used to run (dispatch only, no side effects), the
+ * latter also with the RX line it printed for every message, to
+ * /dev/null. Exit code is non-zero if mqtt_route() misroutes the mix.
+ *
+ * Build: make bench
+ * Run:   ./bin/mqtt_route [messages]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gateway.h"
+#include "mqtt.h"
+#include "mqtt_router.h"
+#include "utils.h"
+
+/* Globals normally defined in main.c */
+gateway_state_t gateway = {0};
+
+#define ROUTE_DEFAULT_MESSAGES  2000000
+#define ROUTE_MIX               64
+
+typedef struct {
+    char topic[96];
+    char payload[64];
+    size_t len;
+    int route;                  // expected
+} route_msg_t;
+
+static route_msg_t mix[ROUTE_MIX];
+static FILE *devnull;
+static volatile int sink;
+
+static void add(int i, int route, const char *payload, const char *fmt, int node) {
+    snprintf(mix[i].topic, sizeof(mix[i].topic), fmt, node);
+    snprintf(mix[i].payload, sizeof(mix[i].payload), payload, node);
+    mix[i].len = strlen(mix[i].payload);
+    mix[i].route = route;
+}
+
+/* Mostly threshold pushes, as in a bulk update, then the rest */
+static void build_mix(void) {
+    for (int i = 0; i < ROUTE_MIX; i++) {
+        int node = i % MAX_NODES + 1;
+        switch (i % 8) {
+        case 0:
+        case 1:
+            add(i, MR_THRESHOLD, "18.5,28", MQTT_TOPIC_PREFIX "/control/node%d/threshold/temp", node);
+            break;
+        case 2:
+            add(i, MR_THRESHOLD, "300,700", MQTT_TOPIC_PREFIX "/control/node%d/threshold/soil", node);
+            break;
+        case 3:
+            add(i, MR_ACTUATOR, "on", MQTT_TOPIC_PREFIX "/control/node%d/fan", node);
+            break;
+        case 4:
+            add(i, MR_AUTO, "off", MQTT_TOPIC_PREFIX "/control/node%d/auto", node);
+            break;
+        case 5:
+            add(i, MR_THRESHOLD, "settemp %d 18 28", MQTT_TOPIC_PREFIX "/command", node);
+            break;
+        case 6:
+            add(i, MR_DB_QUERY, "{\"action\":\"get_stats\",\"request_id\":\"r%d\"}",
+                MQTT_TOPIC_PREFIX "/db/query", node);
+            break;
+        default:
+            add(i, -1, "on", MQTT_TOPIC_PREFIX "/control/node%d/heater", node);
+            break;
+        }
+    }
+}
+
+/* ---- before: the chain mqtt_on_message() ran ---- */
+
+static int route_chain(const char *topic, const char *payload) {
+    if (strstr(topic, "/db/query") != NULL) {
+        return MR_DB_QUERY;
+    }
+    if (strstr(topic, "/command") != NULL) {
+        int node_id;
+        char val[32];
+        float val1, val2;
+        if (sscanf(payload, "fan %d %s", &node_id, val) == 2) return MR_ACTUATOR;
+        if (sscanf(payload, "light %d %s", &node_id, val) == 2) return MR_ACTUATOR;
+        if (sscanf(payload, "pump %d %s", &node_id, val) == 2) return MR_ACTUATOR;
+        if (sscanf(payload, "all %d %s", &node_id, val) == 2) return MR_ACTUATOR;
+        if (sscanf(payload, "auto %d %s", &node_id, val) == 2) return MR_AUTO;
+        if (sscanf(payload, "settemp %d %f %f", &node_id, &val1, &val2) == 3) return MR_THRESHOLD;
+        if (sscanf(payload, "setlight %d %f %f", &node_id, &val1, &val2) == 3) return MR_THRESHOLD;
+        if (sscanf(payload, "setsoil %d %f %f", &node_id, &val1, &val2) == 3) return MR_THRESHOLD;
+        return -1;
+    }
+
+    int node_id = 0;
+    char command[32] = {0};
+    char value[32] = {0};
+    if (sscanf(topic, "lora/gateway/control/node%d/%s", &node_id, command) == 2) {
+        strncpy(value, payload, sizeof(value) - 1);
+        if (strcmp(command, "fan") == 0) return MR_ACTUATOR;
+        if (strcmp(command, "light") == 0) return MR_ACTUATOR;
+        if (strcmp(command, "pump") == 0) return MR_ACTUATOR;
+        if (strcmp(command, "all") == 0) return MR_ACTUATOR;
+        if (strcmp(command, "auto") == 0) return MR_AUTO;
+        // threshold/... lands here too, so it was never applied
+        return -1;
+    }
+    return -1;
+}
+
+typedef int (*route_fn)(const route_msg_t *m);
+
+static int run_router(const route_msg_t *m) {
+    mr_cmd_t cmd;
+    return mqtt_route(m->topic, m->payload, m->len, &cmd);
+}
+
+static int run_chain(const route_msg_t *m) {
+    return route_chain(m->topic, m->payload);
+}
+
+static int run_chain_logged(const route_msg_t *m) {
+    char timestamp[32];
+    get_timestamp(timestamp, sizeof(timestamp));
+    fprintf(devnull, "[%s]  MQTT RX: %s => %s\n", timestamp, m->topic, m->payload);
+    return route_chain(m->topic, m->payload);
+}
+
+static int run(const char *label, route_fn fn, int messages) {
+    int wrong = 0;
+    for (int i = 0; i < ROUTE_MIX; i++) {
+        wrong += fn(&mix[i]) != mix[i].route;
+    }
+
+    uint64_t t0 = get_monotonic_us();
+    for (int i = 0; i < messages; i++) {
+        sink += fn(&mix[i % ROUTE_MIX]);
+    }
+    uint64_t elapsed = get_monotonic_us() - t0;
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+
+    printf("  %-26s %12.0f %10.1f %8d\n", label,
+           messages * 1e6 / elapsed, elapsed * 1000.0 / messages, wrong);
+    return wrong;
+}
+
+int main(int argc, char *argv[]) {
+    int messages = argc > 1 ? atoi(argv[1]) : ROUTE_DEFAULT_MESSAGES;
+    if (messages < 1) {
+        messages = ROUTE_DEFAULT_MESSAGES;
+    }
+    devnull = fopen("/dev/null", "w");
+    if (devnull == NULL) {
+        perror("/dev/null");
+        return 1;
+    }
+    build_mix();
+
+    printf("━━━ INBOUND ROUTING: %d messages, mix of %d ━━━\n", messages, ROUTE_MIX);
+    printf("  %-26s %12s %10s %8s\n", "", "msgs/s", "ns/msg", "misrouted");
+
+    run("strstr/sscanf + RX printf", run_chain_logged, messages / 10);
+    run("strstr/sscanf chain", run_chain, messages);
+    int wrong = run("mqtt_route() trie", run_router, messages);
+
+    fclose(devnull);
+    if (wrong > 0) {
+        printf("✗ mqtt_route() misrouted %d of %d\n", wrong, ROUTE_MIX);
+        return 1;
+    }
+    return 0;
+}
@@ -14,6 +14,10 @@
 #define TX_WAIT_TIME        80
 #define STATS_INTERVAL      30
 
+// Auto control acts on each reading (0), or on the node's mean over this
+// live window, seconds - one of NODE_STATS_WINDOW_SEC (node_stats.h)
+#define AUTO_CONTROL_SMOOTH_SEC 0
+
 // MQTT Configuration
 #define MQTT_BROKER         "localhost"
 #define MQTT_PORT           1883
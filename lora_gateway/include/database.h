@@ -8,8 +8,68 @@
 #define DB_PATH "/home/debian/lora_gateway.db"
 #define DB_BACKUP_DIR "/home/debian/backups"
 
+/* Background backup - throttled page copy, then gzip */
+#define DB_BACKUP_INTERVAL      (24 * 3600) // automatic backup period (s)
+#define DB_BACKUP_STEP_PAGES    64          // pages per sqlite3_backup_step
+#define DB_BACKUP_STEP_SLEEP_MS 20          // pause between steps
+#define DB_BACKUP_GZIP_LEVEL    6
+
+/* Writer thread - inserts are queued and committed in batches */
+#define DB_QUEUE_DEPTH      2048    // max pending records, newest dropped when full
+#define DB_BATCH_MAX_ROWS   500     // commit after this many rows...
+#define DB_BATCH_MAX_MS     1000    // ...or this long after the first row
+
+/* SQLite tuning profiles (bench/db_load.c compares them), chosen at
+ * startup with --db-profile NAME */
+#define DB_PROFILE_DEFAULT  "emmc"
+
+typedef struct {
+    const char *name;
+    const char *synchronous;    // OFF | NORMAL | FULL
+    int page_size;              // bytes, new database files only
+    int cache_kib;              // page cache per connection
+    int mmap_mib;               // memory-mapped reads, 0 = off
+    const char *temp_store;     // DEFAULT | FILE | MEMORY
+    int checkpoint_pages;       // WAL pages before a background checkpoint
+    const char *about;
+} db_profile_t;
+
+/* WAL checkpoints - db_checkpoint.c, never inside a commit */
+#define DB_CHECKPOINT_POLL_MS       1000
+#define DB_CHECKPOINT_INTERVAL_MS   30000   // PASSIVE at least this often while frames wait
+#define DB_CHECKPOINT_IDLE_MS       5000    // no commits this long: TRUNCATE the WAL
+#define DB_WAL_SIZE_LIMIT           (4 * 1024 * 1024)   // journal_size_limit, bytes
+
+/* Read path - queries use their own read-only connections (WAL readers
+ * never block the writer), db/query requests run on worker threads */
+#define DB_QUERY_WORKERS        2
+#define DB_READERS              (DB_QUERY_WORKERS + 1)  // + console / main thread
+#define DB_QUERY_QUEUE_DEPTH    32      // pending db/query requests, rejected when full
+
+/* Result cache for repeated db/query requests (db_cache.c) */
+#define DB_CACHE_ENTRIES        32
+#define DB_CACHE_KEY_LEN        96
+#define DB_CACHE_MAX_BYTES      16384   // larger results are not cached
+#define DB_CACHE_TTL_MS         10000   // also expire - time windows slide without new rows
+
+/* get_range responses - rows are streamed in chunks, one page at a time */
+#define DB_RANGE_CHUNK_BYTES    8192    // max JSON bytes of rows per chunk
+#define DB_RANGE_PAGE_ROWS      2000    // default and max rows per page (limit)
+#define DB_RANGE_MIN_POINTS     3       // max_points: LTTB's first, one bucket, last
+#define DB_RANGE_MAX_POINTS     DB_RANGE_PAGE_ROWS  // and at most one page
+#define DB_QUERY_MAX_HOURS      (366 * 24)  // longest get_range / get_aggregate window
+
+/* Sensor partitions - one table per period behind the sensor_data view */
+#define DB_PARTITION_DAYS   7       // also the retention granularity
+#define DB_VACUUM_STEP_PAGES 256    // pages released per incremental_vacuum step
+#define DB_ARCHIVE_AFTER_DAYS 14    // closed partitions older than this go to sensor_archive
+
 /* Database Functions - Initialization */
+int db_set_profile(const char *name);       // before db_init, -1 if unknown
+const db_profile_t *db_get_profile(void);
+const db_profile_t *db_list_profiles(int *count);
 int db_init(void);
+int db_init_at(const char *path);
 void db_cleanup(void);
 
 /* Database Functions - Save Data */
@@ -20,21 +80,76 @@ int db_log_actuator_change(int node_id, const char *actuator, int state,
                            const char *trigger_type, float trigger_value);
 int db_log_command(int node_id, const char *cmd, const char *val, 
                    const char *source);
+
+/* Several commands committed in one transaction: all queued, or none (-1) */
+typedef struct {
+    int node_id;
+    const char *cmd;
+    const char *val;
+} db_command_t;
+
+int db_log_commands(const db_command_t *cmds, int count, const char *source);
 int db_save_gateway_stats(void);
 
 /* Database Functions - Query (returns JSON strings) */
 char* db_query_latest_sensors(int node_id, int limit);
-char* db_query_range_sensors(int node_id, int hours);
+char* db_query_range_sensors(int node_id, int hours, int max_points);
 char* db_query_aggregate(int node_id, int hours);
+char* db_query_aggregate_window(int node_id, int seconds);
 char* db_query_actuator_history(int node_id, int limit);
 char* db_query_stats(void);
 
+/* get_range reduction when the window holds more than max_points rows */
+#define DB_DOWNSAMPLE_LTTB      0   // one row per time bucket, keeps the line's shape
+#define DB_DOWNSAMPLE_MINMAX    1   // min and max row per time bucket
+#define DB_DOWNSAMPLE_AVG       2   // rollup bucket averages
+
+/* get_range parameters - the db/query request fields of the same name */
+typedef struct {
+    int node_id;
+    int hours;
+    int max_points;     // 0 = every raw row
+    int downsample;     // DB_DOWNSAMPLE_*
+    int field;          // ds_field_t that LTTB / min-max follow
+    int64_t after_ts;   // page cursor, 0 = window start
+    int limit;          // rows per page, <= 0 = no limit
+} db_range_query_t;
+
+/*
+ * Streamed get_range. Rows newer than after_ts are written as a JSON
+ * array of at most DB_RANGE_CHUNK_BYTES and passed to emit, seq
+ * counting from 0; the last chunk of the page has last = 1 and
+ * next_after_ts set to the cursor for the next page when limit rows
+ * were returned and more remain (else 0). A downsampled range is
+ * always a single page. A non-zero return from emit stops the query.
+ * Returns rows written, -1 on error.
+ */
+typedef int (*db_chunk_fn_t)(const char *rows, size_t len, int seq, int last,
+                             int64_t next_after_ts, void *ctx);
+int db_stream_range_sensors(const db_range_query_t *q, db_chunk_fn_t emit, void *ctx);
+
 /* Database Functions - Display (console output) */
 void db_show_recent_data(int node_id, int limit);
 void db_show_statistics(void);
 
+/* Query plan regression check (EXPLAIN QUERY PLAN), returns regressions */
+int db_check_query_plans(int verbose);
+
+/* Read queries reuse statements prepared by db_init; 0 = prepare per
+ * call, as before the cache (benchmark baseline only) */
+void db_query_cache_enable(int enable);
+
+/* Recent readings ring (sensor_ring.c) answers get_latest, dbshow and
+ * short raw get_range windows, and live window stats (node_stats.c)
+ * get_aggregate; 0 = always SQLite (benchmark baseline) */
+void db_sensor_ring_enable(int enable);
+
 /* Database Maintenance */
 int db_cleanup_old_data(int days_to_keep);
+int db_partition_prepare(time_t ts);        // writer thread
+int db_partition_drop_before(time_t cutoff); // writer thread
+int db_archive_old_data(int days_hot);
+int db_partition_archive_before(time_t cutoff); // writer thread
 int db_backup(void);
 
 #endif // __DATABASE_H__
\ No newline at end of file
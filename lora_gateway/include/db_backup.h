@@ -0,0 +1,11 @@
+#ifndef __DB_BACKUP_H__
+#define __DB_BACKUP_H__
+
+#include <time.h>
+
+/* Background online backup (sqlite3_backup, throttled, gzip output) */
+int db_backup_start(void);              // -1 if already running
+void db_backup_schedule(time_t now);    // main loop, every stats interval
+void db_backup_stop(void);              // abort + join, before db close
+
+#endif // __DB_BACKUP_H__
@@ -0,0 +1,27 @@
+#ifndef __DB_CACHE_H__
+#define __DB_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Result cache for repeated db/query requests (dashboard polling).
+ * Entries are the serialized "data" JSON, keyed by request text and
+ * tied to one node's generation; the writer bumps a node's generation
+ * whenever it commits rows for that node, which invalidates them.
+ * node_id 0 (all nodes, totals) follows every commit.
+ */
+
+/* Read before running the query and pass to db_cache_put, so a commit
+ * that lands in between leaves the entry already stale */
+uint32_t db_cache_generation(int node_id);
+
+/* Copy of the cached data (free it), NULL on a miss */
+char *db_cache_get(const char *key, int node_id);
+void db_cache_put(const char *key, int node_id, uint32_t generation, const char *data);
+
+/* Writer thread, after a commit: bit n of node_mask = node n */
+void db_cache_invalidate(uint32_t node_mask);
+void db_cache_clear(void);
+
+#endif // __DB_CACHE_H__
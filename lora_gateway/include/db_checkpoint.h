@@ -0,0 +1,12 @@
+#ifndef __DB_CHECKPOINT_H__
+#define __DB_CHECKPOINT_H__
+
+#include <sqlite3.h>
+
+/* Background WAL checkpoints. Automatic checkpoints are off, so a
+ * commit never runs one; this thread checkpoints from its own
+ * connection: PASSIVE by WAL size or age, TRUNCATE once writes idle */
+int db_checkpoint_start(sqlite3 *writer);   // hooks the writer connection
+void db_checkpoint_stop(void);              // final TRUNCATE + join, before db close
+
+#endif // __DB_CHECKPOINT_H__
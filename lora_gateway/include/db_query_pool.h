@@ -0,0 +1,28 @@
+#ifndef __DB_QUERY_POOL_H__
+#define __DB_QUERY_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Where a request wants its response: MQTT v5 response topic and
+ * correlation data, each NULL when the request had none. malloc'd */
+typedef struct {
+    char *topic;
+    void *correlation;
+    uint16_t correlation_len;
+} db_reply_to_t;
+
+/* Runs one request; payload is a NUL-terminated copy, freed afterwards
+ * together with reply_to */
+typedef void (*db_query_handler_t)(const char *payload, const db_reply_to_t *reply_to);
+
+/* Query workers - db/query requests run here, off the MQTT thread,
+ * each on one of the read-only connections (see database.c) */
+int db_query_pool_start(void);
+void db_query_pool_stop(void);              // pending requests are dropped
+/* On success the pool takes reply_to's buffers and clears *reply_to
+ * (may be NULL); a rejected request leaves them with the caller */
+int db_query_submit(db_query_handler_t handler, const char *payload, size_t len,
+                    db_reply_to_t *reply_to);
+
+#endif // __DB_QUERY_POOL_H__
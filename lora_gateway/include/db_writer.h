@@ -0,0 +1,65 @@
+#ifndef __DB_WRITER_H__
+#define __DB_WRITER_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/* Record types handled by the writer thread */
+typedef enum {
+    DB_REC_SENSOR = 0,
+    DB_REC_ACTUATOR,
+    DB_REC_COMMAND,
+    DB_REC_STATS,
+    DB_REC_RETENTION,   // drop partitions ending before timestamp
+    DB_REC_ARCHIVE      // compress partitions ending before timestamp
+} db_record_type_t;
+
+/* One queued insert. Values are captured at enqueue time so the
+ * stored timestamp is the reading time, not the commit time. */
+typedef struct {
+    db_record_type_t type;
+    time_t timestamp;
+    int node_id;
+    uint16_t group_left;    // rows of its group after this one (set by the writer)
+    union {
+        struct {
+            float temp;
+            float hum;
+            uint16_t light;
+            uint16_t soil;
+            int32_t rssi;
+            int32_t snr;
+        } sensor;
+        struct {
+            char actuator[16];
+            int state;
+            char trigger_type[16];
+            float trigger_value;
+        } actuator;
+        struct {
+            char command[32];
+            char value[64];
+            char source[16];
+        } command;
+        struct {
+            uint32_t rx_count;
+            uint32_t tx_count;
+            uint32_t crc_errors;
+            uint32_t json_errors;
+            uint32_t auto_commands;
+        } stats;
+    } u;
+} db_record_t;
+
+int db_writer_start(void);
+void db_writer_stop(void);
+int db_writer_enqueue(const db_record_t *rec);
+/* count records committed in one transaction: all queued, or none (-1) */
+int db_writer_enqueue_group(const db_record_t *recs, int count);
+void db_writer_update_rate(int interval_sec);
+
+/* Commit latency distribution (~19% buckets) since start or reset */
+uint32_t db_writer_commit_percentile_us(double p);
+void db_writer_reset_commit_stats(void);
+
+#endif // __DB_WRITER_H__
@@ -0,0 +1,78 @@
+#ifndef __DOWNSAMPLE_H__
+#define __DOWNSAMPLE_H__
+
+#include <stdint.h>
+
+/*
+ * Streaming downsampling of time-ordered sensor rows to at most
+ * max_points, over equal time buckets of the window [lo, hi]:
+ *   DS_LTTB    Largest-Triangle-Three-Buckets on one field - one row
+ *              per bucket, chosen to keep the shape of the line
+ *   DS_MINMAX  the rows holding the min and max of one field in each
+ *              bucket - every extreme survives
+ * Rows are fed one at a time as the query steps. Memory is two buckets
+ * of rows for LTTB, two rows for min/max; never the whole window.
+ */
+
+typedef enum {
+    DS_LTTB,
+    DS_MINMAX
+} ds_mode_t;
+
+typedef enum {
+    DS_FIELD_TEMPERATURE,
+    DS_FIELD_HUMIDITY,
+    DS_FIELD_LIGHT,
+    DS_FIELD_SOIL,
+    DS_FIELDS
+} ds_field_t;
+
+typedef struct {
+    int64_t ts;
+    double value[DS_FIELDS];    // ds_field_t order
+    double rssi;                // rollup rows: bucket means
+    double snr;
+    int samples;                // readings behind a rollup row, -1 = raw row
+} ds_row_t;
+
+/* Non-zero return stops the stream and is passed back */
+typedef int (*ds_emit_fn_t)(const ds_row_t *row, void *ctx);
+
+typedef struct {
+    ds_mode_t mode;
+    int field;
+    int64_t lo;
+    int64_t span;
+    int buckets;
+    ds_emit_fn_t emit;
+    void *ctx;
+    int rows_in;
+    int rows_out;
+    int error;                  // first emit error, nothing emitted after it
+
+    /* LTTB: cur is complete and waits for next (being filled) */
+    ds_row_t selected;          // last row emitted, the triangle's first vertex
+    ds_row_t *cur, *next;
+    int cur_n, next_n;
+    int cur_cap, next_cap;
+    int next_bucket;
+    double next_ts_sum, next_value_sum;
+
+    /* MINMAX: extremes of the open bucket */
+    ds_row_t min, max;
+    int mm_bucket;
+    int mm_n;
+} ds_state_t;
+
+void ds_init(ds_state_t *ds, ds_mode_t mode, ds_field_t field,
+             int64_t lo, int64_t hi, int max_points,
+             ds_emit_fn_t emit, void *ctx);
+
+/* Rows must arrive in time order. Returns 0, or emit's error */
+int ds_add(ds_state_t *ds, const ds_row_t *row);
+
+/* Emits what is still buffered (unless an emit failed) and frees it.
+ * Always call once after ds_init. Returns 0, or emit's error */
+int ds_finish(ds_state_t *ds);
+
+#endif // __DOWNSAMPLE_H__
@@ -0,0 +1,60 @@
+#ifndef __JSON_WRITER_H__
+#define __JSON_WRITER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed-schema JSON straight into a buffer: no tree, no allocation.
+ * Keys are written as given (literals, never escaped); pass NULL for
+ * array elements. Commas are tracked per nesting level. On overflow
+ * the writer stops appending and jw_finish() returns NULL.
+ *
+ * JW_CBOR writes the same calls as CBOR (RFC 8949) instead: maps and
+ * arrays of indefinite length, integral numbers as integers, the rest
+ * as float32 when exact, else float64.
+ */
+
+#define JW_BUFFER_BYTES 16384   // per thread, see jw_begin()
+#define JW_MAX_DEPTH    16
+
+#define JW_JSON         0
+#define JW_CBOR         1
+
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+    int depth;
+    uint32_t has_items;         // bit d: level d already has a member
+    int overflow;               // or raw JSON that did not parse (CBOR)
+    int format;                 // JW_JSON / JW_CBOR
+} jw_t;
+
+void jw_init(jw_t *w, char *buf, size_t cap, int format);
+
+/* The calling thread's writer, emptied. One document at a time: the
+ * result of jw_finish() is valid until the next jw_begin() */
+jw_t *jw_begin(void);
+jw_t *jw_begin_as(int format);
+
+void jw_object(jw_t *w, const char *key);
+void jw_object_end(jw_t *w);
+void jw_array(jw_t *w, const char *key);
+void jw_array_end(jw_t *w);
+
+void jw_int(jw_t *w, const char *key, int64_t v);
+void jw_bool(jw_t *w, const char *key, int v);
+void jw_string(jw_t *w, const char *key, const char *s);
+/* Already serialized JSON, copied as is - or converted, for JW_CBOR */
+void jw_raw(jw_t *w, const char *key, const char *json, size_t len);
+
+/* float: shortest decimal that reads back as the same float
+ * (22.3, not 22.299999237060547). double: the text cJSON prints */
+void jw_float(jw_t *w, const char *key, float v);
+void jw_double(jw_t *w, const char *key, double v);
+
+/* The document (NUL-terminated for JW_JSON), or NULL if it did not fit */
+const char *jw_finish(jw_t *w, size_t *len);
+
+#endif // __JSON_WRITER_H__
@@ -2,13 +2,13 @@
 #define __LORA_H__
 
 #include <stdint.h>
+#include "types.h"
 
 int lora_init(void);
 int lora_send_command(int node_id, const char *cmd, const char *val);
 int lora_send_command_json(int node_id, const char *cmd, const char *val);
 int lora_send_command_text(const char *cmd_str);
+int lora_send_batch(const lora_cmd_t *cmds, int count);     // sent, paced
 void lora_clear_and_restart_rx(void);
 
 #endif // __LORA_H__
-
-#endif
\ No newline at end of file
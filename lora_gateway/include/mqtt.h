@@ -14,18 +14,75 @@
 #define MQTT_RECONNECT_INTERVAL  5
 #define MQTT_MAX_RECONNECT_ATTEMPTS 10
 
+/* MQTT v5: db/query responses go to the request's response topic, with
+ * its correlation data; requests without one get the shared topic.
+ * Response topics under MQTT_TOPIC_PREFIX must be below
+ * MQTT_DB_RESPONSE_TOPIC/, so a reply can never land on control/# */
+#define MQTT_DB_RESPONSE_TOPIC   "lora/gateway/db/response"
+
+/* Bulk control (mqtt_bulk.c): control/bulk results go to the request's
+ * response topic (same rules as db/query), else to MQTT_BULK_RESULT_TOPIC */
+#define MQTT_BULK_RESULT_TOPIC   "lora/gateway/bulk/result"
+#define MQTT_BULK_MAX_ENTRIES    32
+
+/* Offline spool (mqtt_spool.c): node data published while disconnected */
+#define MQTT_SPOOL_PATH          "/home/debian/mqtt_spool.bin"
+#define MQTT_SPOOL_BYTES         (4 * 1024 * 1024)  // ~15k readings, oldest dropped first
+#define MQTT_SPOOL_DRAIN_PER_SEC 50                 // replay rate after reconnect
+#define MQTT_SPOOL_DRAIN_TICK_MS 100
+
+/* Outbound queue (mqtt_outq.c): every publish but gateway status, by
+ * class - alerts, node data, stats, db responses - with a byte cap each */
+#define MQTT_OUTQ_MAX_INFLIGHT   16     // unacknowledged; below libmosquitto's 20
+#define MQTT_OUTQ_ALERT_BYTES    (64 * 1024)
+#define MQTT_OUTQ_NODE_BYTES     (256 * 1024)   // then the spool
+#define MQTT_OUTQ_STATS_BYTES    (32 * 1024)    // then the oldest are dropped
+#define MQTT_OUTQ_DB_BYTES       (512 * 1024)   // then query workers wait...
+#define MQTT_OUTQ_DB_WAIT_MS     2000           // ...this long, and give up
+
+/* Batched node data (--mqtt-nodes batch|both; per-node topics by default) */
+#define MQTT_BATCH_TOPIC         "lora/gateway/nodes/batch"
+#define MQTT_BATCH_LINGER_MS     500    // publish this long after the first reading...
+#define MQTT_BATCH_MAX_ENTRIES   64     // ...or once this many are waiting
+
+/* Delta node data (--mqtt-delta): changed fields only, full keyframes */
+#define MQTT_DELTA_KEYFRAME_SEC  120
+#define MQTT_DELTA_TEMPERATURE   0.1    // deadbands: smaller moves are not changes
+#define MQTT_DELTA_HUMIDITY      0.5
+#define MQTT_DELTA_LIGHT         5
+#define MQTT_DELTA_SOIL          10
+#define MQTT_DELTA_RSSI          3
+#define MQTT_DELTA_SNR           2
+
 /* MQTT Functions */
 int mqtt_init(void);
 void mqtt_cleanup(void);
 
 /* Callbacks */
-void mqtt_on_connect(struct mosquitto *mosq, void *obj, int rc);
+void mqtt_on_connect(struct mosquitto *mosq, void *obj, int rc, int flags,
+                     const mosquitto_property *props);
 void mqtt_on_disconnect(struct mosquitto *mosq, void *obj, int rc);
 void mqtt_on_publish(struct mosquitto *mosq, void *obj, int mid);
-void mqtt_on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg);
+void mqtt_on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg,
+                     const mosquitto_property *props);
+
+/* Node data publishing: "per-node", "batch" or "both", before mqtt_init */
+int mqtt_set_node_publish(const char *mode);
+int mqtt_set_node_delta(int enable);
+int mqtt_set_topic_aliases(int enable);
+int mqtt_set_debug(int enable);     // log every inbound message and command
+
+/* nodes/# and stats payloads: "json" (default) or "cbor" - CBOR
+ * documents are indefinite-length maps, so the first byte is 0xbf
+ * where JSON has '{'. db/query asks per request ("format":"cbor") */
+int mqtt_set_payload_format(const char *name);
+int mqtt_payload_format(void);
 
 /* Publishing functions */
+int mqtt_publish_data(const char *topic, const char *payload, size_t len);
 void mqtt_publish_node_data(int node_id);
 void mqtt_publish_gateway_stats(void);
+void mqtt_publish_node_stats(int node_id);
+void mqtt_publish_alert(int node_id, const char *actuator, int state, float value);
 
 #endif // __MQTT_H__
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef __MQTT_BATCH_H__
+#define __MQTT_BATCH_H__
+
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Batched node data on MQTT_BATCH_TOPIC: readings are collected for up
+ * to MQTT_BATCH_LINGER_MS after the first one, or MQTT_BATCH_MAX_ENTRIES
+ * of them, and go out as one array message. A full batch is published
+ * by the caller that filled it; a lingering one by the batch thread.
+ */
+
+#define MQTT_BATCH_HIST_BUCKETS 8   // batch sizes 1, 2, <=4, <=8 ... <=64, more
+
+int mqtt_batch_start(void);
+void mqtt_batch_stop(void);         // publishes what is left, then joins
+
+/* Snapshot of the node's last reading into the open batch */
+void mqtt_batch_add(int node_id, const node_data_t *node);
+
+/* Batches published per size bucket, since start */
+void mqtt_batch_histogram(uint32_t out[MQTT_BATCH_HIST_BUCKETS]);
+
+#endif // __MQTT_BATCH_H__
@@ -0,0 +1,78 @@
+#ifndef __MQTT_BULK_H__
+#define __MQTT_BULK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mqtt.h"
+
+/*
+ * Bulk control on control/bulk: one message sets thresholds, AUTO mode
+ * and actuators of many nodes. A request is a list of entries, applied
+ * in order, each a node selector and the fields it sets:
+ *
+ *   {"request_id":"b1","set":[
+ *     {"nodes":"all","threshold":{"temp":[18,28],"soil":[300,700]}},
+ *     {"nodes":[1,3],"auto":"off","fan":"on"}]}
+ *
+ * "nodes" is "all", a node id or a list of ids; "auto", "fan", "light",
+ * "pump" and "all" take "on" or "off"; thresholds take [min,max].
+ *
+ * Binary form: MB_MAGIC, one byte of entry count, then MB_ENTRY_BYTES
+ * per entry, little-endian in mb_entry_t order (nodes, set, on, a zero
+ * 16-bit pad, then floats and 16-bit ranges).
+ *
+ * The whole request is staged on a copy of the node settings first; a
+ * bad entry, or an actuator for a node left in AUTO mode, rejects all
+ * of it and nothing changes.
+ */
+
+#define MB_MAGIC            "LB\x01"    // 3 bytes, then the entry count
+#define MB_HEADER_BYTES     4
+#define MB_ENTRY_BYTES      24
+
+/* mb_entry_t.set / .on bits */
+enum {
+    MB_TEMP     = 1 << 0,       // temp_min, temp_max
+    MB_LIGHT_TH = 1 << 1,       // light_min, light_max
+    MB_SOIL     = 1 << 2,       // soil_min, soil_max
+    MB_AUTO     = 1 << 3,
+    MB_FAN      = 1 << 4,
+    MB_LIGHT    = 1 << 5,
+    MB_PUMP     = 1 << 6,
+};
+#define MB_ACTUATORS    (MB_FAN | MB_LIGHT | MB_PUMP)
+#define MB_FIELDS       (MB_TEMP | MB_LIGHT_TH | MB_SOIL | MB_AUTO | MB_ACTUATORS)
+
+typedef struct {
+    uint32_t nodes;             // bit n: node n
+    uint8_t set;                // MB_* fields given
+    uint8_t on;                 // MB_AUTO, MB_FAN..MB_PUMP: on
+    float temp_min;
+    float temp_max;
+    uint16_t light_min;
+    uint16_t light_max;
+    uint16_t soil_min;
+    uint16_t soil_max;
+} mb_entry_t;
+
+typedef struct {
+    char request_id[64];        // JSON form only
+    int count;
+    mb_entry_t entries[MQTT_BULK_MAX_ENTRIES];
+} mb_request_t;
+
+typedef struct {
+    uint32_t nodes;             // changed, bit n: node n
+    int commands;               // command_history rows, one transaction
+    int downlinks;              // sent in one lora_send_batch()
+    char error[96];
+} mb_result_t;
+
+/* Decode and check a request; 0, or -1 with result->error. payload is
+ * len bytes, NUL-terminated. No side effects */
+int mqtt_bulk_parse(const char *payload, size_t len, mb_request_t *req, mb_result_t *result);
+
+/* All of a parsed request, or none of it; 0, or -1 with result->error */
+int mqtt_bulk_apply(const mb_request_t *req, mb_result_t *result);
+
+#endif // __MQTT_BULK_H__
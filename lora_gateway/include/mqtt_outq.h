@@ -0,0 +1,68 @@
+#ifndef __MQTT_OUTQ_H__
+#define __MQTT_OUTQ_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Outbound publish queue. Publishers copy their message in and return;
+ * one sender thread hands messages to libmosquitto in class order, at
+ * most MQTT_OUTQ_MAX_INFLIGHT of them not yet acknowledged (PUBACK, or
+ * written out for QoS 0), so a slow broker backs up here - bounded by
+ * a byte cap per class - instead of in libmosquitto's unbounded queue.
+ * Within a class, messages go out in the order they were submitted.
+ */
+
+typedef enum {
+    MQ_ALERT,       // auto-control actions
+    MQ_NODE,        // node data: full -> rejected, the caller spools it
+    MQ_STATS,       // stats, retained state: full -> oldest dropped
+    MQ_DB,          // db responses: full -> rejected, after wait_ms
+    MQ_CLASSES
+} mq_class_t;
+
+typedef struct {
+    const char *topic;
+    const void *payload;
+    size_t len;
+    int qos;
+    int retain;
+    uint16_t alias;             // nodes/node{id}: alias {id}, decided at send time
+    const void *correlation;    // MQTT v5 correlation data, or NULL
+    uint16_t correlation_len;
+    int format;                 // JW_CBOR: content type application/cbor
+} mq_msg_t;
+
+/* Publishes one message (sender thread); 0 with *mid set, or -1 */
+typedef int (*mq_send_fn)(const mq_msg_t *msg, int *mid);
+
+typedef struct {
+    uint32_t depth[MQ_CLASSES];     // messages waiting
+    uint32_t bytes[MQ_CLASSES];     // their memory, against the class cap
+    uint32_t dropped[MQ_CLASSES];   // since start
+    uint32_t inflight;
+    uint32_t acked;                 // since the last mqtt_outq_stats()...
+    double latency_avg_ms;          // ...queued -> acked
+    double latency_max_ms;
+} mq_stats_t;
+
+int mqtt_outq_start(mq_send_fn send);
+void mqtt_outq_stop(void);          // node data still queued goes to the spool
+
+/* Copy a message into its class; 0, or -1 when the class is full (after
+ * its policy) or the queue is stopped. Where full means rejected, wait
+ * up to wait_ms for room first - never from the MQTT loop thread, which
+ * is the one that frees it */
+int mqtt_outq_submit(mq_class_t cls, const mq_msg_t *msg, int wait_ms);
+
+/* From the publish callback: mid is no longer in flight */
+void mqtt_outq_acked(int mid);
+
+/* After a (re)connect: what was in flight is libmosquitto's to resend,
+ * no longer counted against MQTT_OUTQ_MAX_INFLIGHT; sending resumes */
+void mqtt_outq_connected(void);
+
+/* Snapshot; starts a new latency window */
+void mqtt_outq_stats(mq_stats_t *out);
+
+#endif // __MQTT_OUTQ_H__
@@ -0,0 +1,51 @@
+#ifndef __MQTT_ROUTER_H__
+#define __MQTT_ROUTER_H__
+
+#include <stddef.h>
+
+/*
+ * Inbound topic router. Topics under MQTT_TOPIC_PREFIX are matched one
+ * level at a time against a static trie; the node{N} level yields the
+ * node id on the way. Text commands on command are parsed against a
+ * verb table into the same typed command, so both forms share handlers:
+ *
+ *   control/node{N}/fan|light|pump|all    on|off      fan 2 on
+ *   control/node{N}/auto                  on|off      auto 2 off
+ *   control/node{N}/threshold/temp        min,max     settemp 2 18 28
+ *   control/node{N}/threshold/light|soil  min,max     setlight|setsoil 2 min max
+ *   control/bulk                          JSON or binary (mqtt_bulk.h)
+ *   db/query                              JSON
+ *
+ * Routing has no side effects (bench/mqtt_route.c runs it alone).
+ */
+
+typedef enum {
+    MR_DB_QUERY,
+    MR_ACTUATOR,        // arg: MR_FAN..MR_ALL, on
+    MR_AUTO,            // on
+    MR_THRESHOLD,       // arg: MR_TH_TEMP..MR_TH_SOIL, min, max
+    MR_BULK,            // payload is the request
+    MR_ROUTES
+} mr_route_t;
+
+enum { MR_FAN, MR_LIGHT, MR_PUMP, MR_ALL };
+enum { MR_TH_TEMP, MR_TH_LIGHT, MR_TH_SOIL };
+
+typedef struct {
+    int node_id;            // 1..MAX_NODES
+    int arg;
+    int on;
+    float min;
+    float max;
+} mr_cmd_t;
+
+/* Route of a message and its command, or -1: unknown topic, node out of
+ * range, or a payload that does not fit the route. payload is len bytes,
+ * NUL-terminated (libmosquitto adds one) */
+int mqtt_route(const char *topic, const char *payload, size_t len, mr_cmd_t *cmd);
+
+/* Names as the nodes and the command log know them */
+const char *mqtt_route_actuator(int arg);       // "fan", "light", "pump", "all"
+const char *mqtt_route_threshold(int arg);      // "temp", "light", "soil"
+
+#endif // __MQTT_ROUTER_H__
@@ -0,0 +1,30 @@
+#ifndef __MQTT_SPOOL_H__
+#define __MQTT_SPOOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Store-and-forward spool for publishes made while the broker is away.
+ * One fixed-size, mmap'd segment file used as a ring: records are
+ * appended at the head with a CRC each, the oldest are dropped when a
+ * new one does not fit, and a drain thread replays them in order at
+ * MQTT_SPOOL_DRAIN_PER_SEC once connected. Survives a restart; a torn
+ * record at the head is cut off when the file is opened again.
+ */
+
+int mqtt_spool_open(const char *path);  // map (or create) + start draining
+void mqtt_spool_close(void);            // join drain thread, sync, unmap
+
+/* Queue a publish for later, with its payload format (JW_JSON / JW_CBOR)
+ * for the content type on replay; 0, or -1 when there is no spool */
+int mqtt_spool_append(const char *topic, const void *payload, size_t len, int format);
+
+/* Records waiting. While > 0, new publishes go through the spool too,
+ * so subscribers see them in order */
+uint32_t mqtt_spool_pending(void);
+
+/* Wake the drain thread (after a connect) */
+void mqtt_spool_kick(void);
+
+#endif // __MQTT_SPOOL_H__
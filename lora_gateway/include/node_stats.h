@@ -0,0 +1,57 @@
+#ifndef __NODE_STATS_H__
+#define __NODE_STATS_H__
+
+#include <stdint.h>
+#include "ts_archive.h"
+
+/*
+ * Live sliding-window statistics per node and channel: count, mean,
+ * variance (Welford), min and max over each of NODE_STATS_WINDOW_SEC.
+ * A window is NODE_STATS_BUCKETS time buckets; each bucket keeps its
+ * own Welford accumulator and extremes, and the window total is
+ * updated per reading and re-merged from the buckets when the oldest
+ * one expires - so reads are O(1) and nothing is ever subtracted.
+ * The window edge moves one bucket at a time (5 s / 1 min / 24 min).
+ * Fed alongside the recent readings ring (db_save_sensor_data), and
+ * seeded from it at startup.
+ */
+
+#define NODE_STATS_WINDOWS      3
+#define NODE_STATS_WINDOW_SEC   { 300, 3600, 86400 }    // 5 min, 1 h, 24 h; see node_stats.c
+#define NODE_STATS_BUCKETS      60
+
+typedef enum {
+    NS_TEMPERATURE,
+    NS_HUMIDITY,
+    NS_LIGHT,
+    NS_SOIL,
+    NS_CHANNELS
+} ns_channel_t;
+
+typedef struct {
+    uint32_t count;
+    double mean;
+    double m2;                  // sum of squared deviations from mean
+    double min;
+    double max;
+} ns_summary_t;
+
+/* Startup: every window is incomplete until it has run for its length */
+void node_stats_reset(void);
+
+/* Readings must come in roughly time order; ones older than a window
+ * are ignored by that window */
+void node_stats_add(int node_id, const ts_point_t *pt);
+
+/* The node has no readings before `from` that were not added */
+void node_stats_cover(int node_id, int64_t from);
+
+/* Summary per channel over the window of window_sec (one of
+ * NODE_STATS_WINDOW_SEC). Returns the reading count, or -1 when there
+ * is no such window. *complete = the window saw every reading in it */
+int node_stats_get(int node_id, int window_sec, ns_summary_t out[NS_CHANNELS],
+                   int *complete);
+
+double ns_stddev(const ns_summary_t *s);
+
+#endif // __NODE_STATS_H__
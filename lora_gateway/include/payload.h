@@ -0,0 +1,15 @@
+#ifndef __PAYLOAD_H__
+#define __PAYLOAD_H__
+
+#include "json_writer.h"
+#include "types.h"
+
+/* JSON documents written on every packet, through json_writer.h */
+
+/* Members of the nodes/node{id} document, inside an open object */
+void payload_node_fields(jw_t *w, int node_id, const node_data_t *node);
+
+/* The whole /tmp/gateway_data.json document */
+void payload_dashboard(jw_t *w);
+
+#endif // __PAYLOAD_H__
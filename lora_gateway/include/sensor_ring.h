@@ -0,0 +1,35 @@
+#ifndef __SENSOR_RING_H__
+#define __SENSOR_RING_H__
+
+#include "ts_archive.h"
+
+/*
+ * Last SENSOR_RING_CAPACITY readings of each node (1..MAX_NODES), kept
+ * in memory next to gateway.nodes[] so get_latest, dbshow and short
+ * get_range windows never touch SQLite. Seeded from the database at
+ * startup, then fed by db_save_sensor_data() as readings are queued,
+ * so it is never ahead of or behind what the dashboard has been sent.
+ * Readers copy rows out under one short lock; -1 means "not all in
+ * memory, ask SQLite".
+ */
+
+#define SENSOR_RING_CAPACITY    1024    // per node, ~85 min at a 5 s interval
+
+void sensor_ring_reset(void);
+
+/* Startup: rows newest first; complete = the node has no older rows */
+void sensor_ring_seed(int node_id, const ts_point_t *pts, int n, int complete);
+void sensor_ring_push(int node_id, const ts_point_t *pt);
+
+/* Newest first, exactly max rows (fewer only when that is all the node
+ * has), or -1 */
+int sensor_ring_latest(int node_id, ts_point_t *out, int max);
+
+/* Newest first across all nodes, or -1 */
+int sensor_ring_latest_all(ts_point_t *out, int *node_ids, int max);
+
+/* Every row with timestamp >= lo, oldest first, or -1 when the ring
+ * does not reach back to lo or holds more than max such rows */
+int sensor_ring_range(int node_id, int64_t lo, ts_point_t *out, int max);
+
+#endif // __SENSOR_RING_H__
@@ -0,0 +1,24 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+/*
+ * Dashboard snapshot: the payload_dashboard() document in one file for
+ * the web dashboard. Packets only mark it dirty; it is serialized and
+ * written at most every SNAPSHOT_INTERVAL_MS, and only when dirty, to a
+ * temporary file renamed over the old one - readers see the previous
+ * document or the next, never part of one. Main loop thread only.
+ */
+
+#define SNAPSHOT_PATH            "/tmp/gateway_data.json"
+#define SNAPSHOT_INTERVAL_MS     1000    // default; --snapshot-ms
+#define SNAPSHOT_INTERVAL_MAX_MS 60000
+
+/* Another file or interval (0: every change), before the first
+ * snapshot - --snapshot-ms, benches */
+void snapshot_configure(const char *path, int interval_ms);
+
+void snapshot_mark_dirty(void);     // state changed; written when due
+void snapshot_tick(void);           // from the main loop: writes a due snapshot
+void snapshot_flush(void);          // writes a dirty snapshot now (shutdown)
+
+#endif // __SNAPSHOT_H__
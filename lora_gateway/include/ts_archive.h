@@ -0,0 +1,35 @@
+#ifndef __TS_ARCHIVE_H__
+#define __TS_ARCHIVE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Columnar block codec for cold sensor data (one node per block):
+ *   timestamps            delta-of-delta, variable bit buckets
+ *   temperature/humidity  XOR of float32 bit patterns (Gorilla)
+ *   light/soil/rssi/snr   zigzag varint of the delta to the previous value
+ * Lossless for readings that started out as float/int, which is what
+ * db_save_sensor_data() takes.
+ */
+
+#define TS_BLOCK_MAX_POINTS     1024
+#define TS_BLOCK_MAX_BYTES(n)   (64 + (size_t)(n) * 40)    // worst case
+
+typedef struct {
+    int64_t timestamp;
+    float temperature;
+    float humidity;
+    int32_t light;
+    int32_t soil_moisture;
+    int32_t rssi;
+    int32_t snr;
+} ts_point_t;
+
+/* Returns encoded size, 0 if n is out of range or cap too small */
+size_t ts_block_encode(const ts_point_t *pts, int n, uint8_t *out, size_t cap);
+
+/* Returns number of points decoded, -1 if the block is corrupt */
+int ts_block_decode(const uint8_t *in, size_t len, ts_point_t *out, int max);
+
+#endif // __TS_ARCHIVE_H__
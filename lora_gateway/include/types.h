@@ -7,6 +7,7 @@
 #include <mosquitto.h>
 
 #define MAX_NODES 3
+#define DB_ROLLUP_LEVELS 3   // 1-minute, 1-hour, 1-day
 
 typedef struct {
     uint8_t fan_state;
@@ -24,6 +25,13 @@ typedef struct {
     uint16_t soil_max;
 } threshold_config_t;
 
+/* One downlink of a batch (lora_send_batch) */
+typedef struct {
+    int node_id;
+    const char *cmd;        // "fan", "light", "pump", "all"
+    const char *val;        // "on", "off"
+} lora_cmd_t;
+
 typedef struct {
     float temperature;
     float humidity;
@@ -60,6 +68,20 @@ typedef struct {
     int mqtt_connected;
     uint32_t mqtt_publish_count;
     uint32_t mqtt_error_count;
+    uint32_t mqtt_spooled;          // publishes held back (mqtt_spool.c)
+    uint32_t mqtt_spool_pending;
+    uint32_t mqtt_spool_replayed;
+    uint32_t mqtt_spool_dropped;    // oldest overwritten, spool full
+    uint32_t mqtt_batches;          // messages on MQTT_BATCH_TOPIC (mqtt_batch.c)
+    uint32_t mqtt_batch_readings;
+    uint32_t mqtt_keyframes;        // delta mode: full documents...
+    uint32_t mqtt_deltas;           // ...changed fields only...
+    uint32_t mqtt_deltas_suppressed;    // ...and readings with nothing new
+    uint32_t mqtt_aliased;          // nodes/node{id} sent as a topic alias
+    uint32_t mqtt_db_direct;        // db responses to a v5 response topic
+    uint32_t snapshot_writes;       // dashboard files written (snapshot.c)...
+    uint64_t snapshot_bytes;
+    uint32_t snapshot_coalesced;    // ...and packets folded into a later one
 } gateway_state_t;
 
 typedef struct {
@@ -68,10 +90,53 @@ typedef struct {
     sqlite3_stmt *stmt_actuator;
     sqlite3_stmt *stmt_command;
     sqlite3_stmt *stmt_stats;
+    sqlite3_stmt *stmt_rollup[DB_ROLLUP_LEVELS];
     
     uint32_t total_inserts;
     uint32_t insert_errors;
     time_t last_backup_time;
+
+    /* Writer thread (group commit) metrics */
+    uint32_t queue_depth;
+    uint32_t queue_high_water;
+    uint32_t queue_drops;
+    uint32_t commit_count;
+    uint32_t commit_errors;
+    uint32_t last_batch_rows;
+    uint64_t commit_time_total_us;
+    uint32_t commit_time_last_us;
+    uint32_t commit_time_max_us;
+    float insert_rate;              // rows/s committed, over last STATS_INTERVAL
+
+    /* Background backup (db_backup.c) */
+    volatile int backup_running;
+    int backup_percent;
+    uint32_t backup_count;
+    uint32_t backup_errors;
+    uint32_t backup_last_ms;
+    uint64_t backup_last_bytes;     // compressed size
+
+    /* Query workers (db_query_pool.c) */
+    uint32_t query_count;
+    uint32_t query_rejects;         // queue full or shutting down
+    uint32_t query_queue_depth;
+    uint32_t query_time_max_us;
+    uint32_t cache_hits;            // db/query answered from db_cache.c
+    uint32_t cache_misses;
+
+    /* WAL checkpoints (db_checkpoint.c) */
+    uint32_t checkpoint_count;
+    uint32_t checkpoint_busy;       // PASSIVE/TRUNCATE that could not finish
+    uint32_t checkpoint_errors;
+    uint32_t checkpoint_truncates;
+    uint32_t checkpoint_time_last_us;
+    uint32_t checkpoint_time_max_us;
+    uint64_t wal_bytes;
+    uint64_t wal_bytes_max;
+
+    /* Partition stmt_sensor currently inserts into, [start, end) */
+    time_t part_start;
+    time_t part_end;
 } database_state_t;
 
 #endif // __TYPES_H__
\ No newline at end of file
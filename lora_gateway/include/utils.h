@@ -2,7 +2,11 @@
 #define __UTILS_H__
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 void get_timestamp(char *buf, size_t len);
+uint64_t get_monotonic_us(void);
+int mkdir_p(const char *path, mode_t mode);
 
-#endif // __UTILS_H__
\ No newline at end of file
+#endif // __UTILS_H__
@@ -7,6 +7,8 @@
 #include "gateway.h"
 #include "lora.h"
 #include "database.h"
+#include "mqtt.h"
+#include "node_stats.h"
 #include "utils.h"
 #include "config.h"
 #include <stdio.h>
@@ -28,6 +30,16 @@ void check_auto_control(int node_id, float temp, float hum,
     
     // If auto mode is disabled, do nothing
     if (!th->enabled) return;
+
+    // Smoothed inputs: the node's live window means, not this one reading
+    ns_summary_t s[NS_CHANNELS];
+    if (AUTO_CONTROL_SMOOTH_SEC > 0 &&
+        node_stats_get(node_id, AUTO_CONTROL_SMOOTH_SEC, s, NULL) > 0) {
+        temp = (float)s[NS_TEMPERATURE].mean;
+        hum = (float)s[NS_HUMIDITY].mean;
+        light = (uint16_t)s[NS_LIGHT].mean;
+        soil = (uint16_t)s[NS_SOIL].mean;
+    }
     
     char timestamp[32];
     get_timestamp(timestamp, sizeof(timestamp));
@@ -49,6 +61,7 @@ void check_auto_control(int node_id, float temp, float hum,
         
         // Log to database
         db_log_actuator_change(node_id, "fan", 1, "AUTO", temp);
+        mqtt_publish_alert(node_id, "fan", 1, temp);
         
         usleep(500000);  // 500ms delay
     } 
@@ -64,6 +77,7 @@ void check_auto_control(int node_id, float temp, float hum,
         
         // Log to database
         db_log_actuator_change(node_id, "fan", 0, "AUTO", temp);
+        mqtt_publish_alert(node_id, "fan", 0, temp);
         
         usleep(500000);
     }
@@ -85,6 +99,7 @@ void check_auto_control(int node_id, float temp, float hum,
         
         // Log to database
         db_log_actuator_change(node_id, "light", 1, "AUTO", (float)light);
+        mqtt_publish_alert(node_id, "light", 1, (float)light);
         
         usleep(500000);
     } 
@@ -100,6 +115,7 @@ void check_auto_control(int node_id, float temp, float hum,
         
         // Log to database
         db_log_actuator_change(node_id, "light", 0, "AUTO", (float)light);
+        mqtt_publish_alert(node_id, "light", 0, (float)light);
         
         usleep(500000);
     }
@@ -121,6 +137,7 @@ void check_auto_control(int node_id, float temp, float hum,
         
         // Log to database
         db_log_actuator_change(node_id, "pump", 1, "AUTO", (float)soil);
+        mqtt_publish_alert(node_id, "pump", 1, (float)soil);
         
         usleep(500000);
     } 
@@ -136,6 +153,7 @@ void check_auto_control(int node_id, float temp, float hum,
         
         // Log to database
         db_log_actuator_change(node_id, "pump", 0, "AUTO", (float)soil);
+        mqtt_publish_alert(node_id, "pump", 0, (float)soil);
         
         usleep(500000);
     }
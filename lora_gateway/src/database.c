@@ -6,41 +6,388 @@
  */
 
 #include "database.h"
+#include "db_writer.h"
+#include "db_backup.h"
+#include "db_checkpoint.h"
+#include "db_query_pool.h"
+#include "db_cache.h"
+#include "ts_archive.h"
+#include "sensor_ring.h"
+#include "node_stats.h"
+#include "downsample.h"
 #include "gateway.h"
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <sqlite3.h>
 #include <cjson/cJSON.h>
 
 /*====================================================================
- * DATABASE INITIALIZATION
+ * QUERY STATEMENTS
+ * Every read query, prepared once by db_init and reused with bound
+ * parameters. The same table drives db_check_query_plans(). Queries
+ * over the sensor_data view re-prepare themselves (SQLITE_SCHEMA)
+ * when the writer adds or drops a partition.
  *====================================================================*/
 
-int db_init(void) {
-    int rc;
-    char *err_msg = NULL;
+typedef enum {
+    Q_LATEST_NODE,
+    Q_LATEST_ALL,
+    Q_RANGE_RAW,
+    Q_RANGE_ROLLUP,                                     // + rollup level
+    Q_AGG_ROLLUP = Q_RANGE_ROLLUP + DB_ROLLUP_LEVELS,   // + rollup level
+    Q_AGG_RAW = Q_AGG_ROLLUP + DB_ROLLUP_LEVELS,
+    Q_ROW_ESTIMATE,
+    Q_ACTUATOR_HISTORY,
+    Q_TOTALS,
+    Q_NODE_STATS,
+    Q_ARCHIVE_ASC,
+    Q_ARCHIVE_DESC,
+    Q_COUNT
+} query_id_t;
+
+typedef struct {
+    const char *name;
+    const char *sql;
+    int full_scan;      // counts whole tables by design, not plan checked
+} query_def_t;
+
+#define RANGE_ROLLUP_SQL(table) \
+    "SELECT bucket, " \
+    "temp_sum / count, hum_sum / count, " \
+    "CAST(light_sum AS REAL) / count, CAST(soil_sum AS REAL) / count, " \
+    "CAST(rssi_sum AS REAL) / count, CAST(snr_sum AS REAL) / count, count " \
+    "FROM " table " WHERE node_id = ?1 AND bucket >= ?2 ORDER BY bucket ASC;"
+
+#define AGG_ROLLUP_SQL(table) \
+    "SELECT SUM(count), " \
+    "SUM(temp_sum), MIN(temp_min), MAX(temp_max), " \
+    "SUM(hum_sum), MIN(hum_min), MAX(hum_max), " \
+    "SUM(light_sum), MIN(light_min), MAX(light_max), " \
+    "SUM(soil_sum), MIN(soil_min), MAX(soil_max) " \
+    "FROM " table " WHERE node_id = ?1 AND bucket >= ?2 AND bucket < ?3;"
+
+/* Rollup entries follow rollup_levels[] order (1m, 1h, 1d) */
+static const query_def_t query_defs[Q_COUNT] = {
+    [Q_LATEST_NODE] = { "latest_sensors(node)",
+        "SELECT timestamp, "
+        "temperature, humidity, light, soil_moisture, rssi, snr "
+        "FROM sensor_data WHERE node_id = ?1 ORDER BY timestamp DESC LIMIT ?2;" },
+    [Q_LATEST_ALL] = { "latest_sensors(all)",
+        "SELECT node_id, timestamp, "
+        "temperature, humidity, light, soil_moisture, rssi, snr "
+        "FROM sensor_data ORDER BY timestamp DESC LIMIT ?1;" },
+    [Q_RANGE_RAW] = { "range_sensors",
+        "SELECT timestamp, "
+        "temperature, humidity, light, soil_moisture, rssi, snr, 1 "
+        "FROM sensor_data WHERE node_id = ?1 AND timestamp >= ?2 "
+        "ORDER BY timestamp ASC;" },
+    [Q_RANGE_ROLLUP + 0] = { "range_sensors(1m)", RANGE_ROLLUP_SQL("sensor_rollup_1m") },
+    [Q_RANGE_ROLLUP + 1] = { "range_sensors(1h)", RANGE_ROLLUP_SQL("sensor_rollup_1h") },
+    [Q_RANGE_ROLLUP + 2] = { "range_sensors(1d)", RANGE_ROLLUP_SQL("sensor_rollup_1d") },
+    [Q_AGG_ROLLUP + 0] = { "aggregate(1m)", AGG_ROLLUP_SQL("sensor_rollup_1m") },
+    [Q_AGG_ROLLUP + 1] = { "aggregate(1h)", AGG_ROLLUP_SQL("sensor_rollup_1h") },
+    [Q_AGG_ROLLUP + 2] = { "aggregate(1d)", AGG_ROLLUP_SQL("sensor_rollup_1d") },
+    [Q_AGG_RAW] = { "aggregate(raw head)",
+        "SELECT COUNT(*), "
+        "SUM(temperature), MIN(temperature), MAX(temperature), "
+        "SUM(humidity), MIN(humidity), MAX(humidity), "
+        "SUM(light), MIN(light), MAX(light), "
+        "SUM(soil_moisture), MIN(soil_moisture), MAX(soil_moisture) "
+        "FROM sensor_data WHERE node_id = ?1 AND timestamp >= ?2 AND timestamp < ?3;" },
+    [Q_ROW_ESTIMATE] = { "range_estimate",
+        "SELECT SUM(count) FROM sensor_rollup_1h WHERE node_id = ?1 AND bucket >= ?2;" },
+    [Q_ACTUATOR_HISTORY] = { "actuator_history",
+        "SELECT datetime(timestamp, 'unixepoch', 'localtime'), "
+        "actuator, state, trigger_type, trigger_value "
+        "FROM actuator_logs WHERE node_id = ?1 ORDER BY timestamp DESC LIMIT ?2;" },
+    [Q_TOTALS] = { "totals",
+        "SELECT "
+        "(SELECT COUNT(*) FROM sensor_data), "
+        "(SELECT COUNT(*) FROM actuator_logs), "
+        "(SELECT COUNT(*) FROM command_history), "
+        "(SELECT COUNT(*) FROM sensor_partitions), "
+        "(SELECT IFNULL(SUM(count), 0) FROM sensor_archive), "
+        "(SELECT IFNULL(SUM(length(data)), 0) FROM sensor_archive);", 1 },
+    // Per node rather than GROUP BY, which can't use the partition
+    // indexes through the sensor_data view
+    [Q_NODE_STATS] = { "stats_per_node",
+        "SELECT datetime(MAX(t), 'unixepoch', 'localtime'), SUM(c) FROM ("
+        "SELECT MAX(timestamp) AS t, COUNT(*) AS c FROM sensor_data WHERE node_id = ?1 "
+        "UNION ALL "
+        "SELECT MAX(end_ts), IFNULL(SUM(count), 0) FROM sensor_archive WHERE node_id = ?1);" },
+    [Q_ARCHIVE_ASC] = { "archive_blocks",
+        "SELECT data FROM sensor_archive WHERE node_id = ?1 AND end_ts >= ?2 "
+        "AND start_ts <= ?3 ORDER BY end_ts ASC;" },
+    [Q_ARCHIVE_DESC] = { "archive_blocks(desc)",
+        "SELECT data FROM sensor_archive WHERE node_id = ?1 AND end_ts >= ?2 "
+        "AND start_ts <= ?3 ORDER BY end_ts DESC;" },
+};
+
+/*====================================================================
+ * TUNING PROFILES
+ * Connection pragmas as one named set. page_size only takes effect on
+ * a new file; the rest apply to every open (readers get the cache,
+ * mmap and temp_store ones).
+ *====================================================================*/
+
+static const db_profile_t profiles[] = {
+    { "baseline", "NORMAL", 4096, 2000, 0, "DEFAULT", 1000,
+      "SQLite defaults with synchronous=NORMAL (before profiles)" },
+    { "emmc", "NORMAL", 4096, 8192, 64, "MEMORY", 4000,
+      "8 MB cache, mmap reads, fewer and larger WAL checkpoints" },
+    { "durable", "FULL", 4096, 8192, 64, "MEMORY", 1000,
+      "as emmc, but every commit is fsynced - survives power loss" },
+    { "lowmem", "NORMAL", 4096, 1024, 0, "FILE", 1000,
+      "1 MB cache, no mmap, temp tables on disk" },
+};
+#define DB_PROFILES ((int)(sizeof(profiles) / sizeof(profiles[0])))
+
+static const db_profile_t *profile = NULL;
+
+int db_set_profile(const char *name) {
+    for (int i = 0; i < DB_PROFILES; i++) {
+        if (strcmp(profiles[i].name, name) == 0) {
+            profile = &profiles[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const db_profile_t *db_get_profile(void) {
+    if (profile == NULL) {
+        db_set_profile(DB_PROFILE_DEFAULT);
+    }
+    return profile;
+}
+
+const db_profile_t *db_list_profiles(int *count) {
+    *count = DB_PROFILES;
+    return profiles;
+}
+
+static void profile_apply(sqlite3 *db, int writer) {
+    const db_profile_t *p = db_get_profile();
+    char sql[256];
     
-    printf("\n╔═══════════════════════════════════╗\n");
-    printf("║   Database Initialization         ║\n");
-    printf("╚═══════════════════════════════════╝\n\n");
+    if (writer) {
+        // auto_vacuum and page_size only take effect on a new file,
+        // and must be set before WAL; existing files keep theirs
+        snprintf(sql, sizeof(sql),
+                 "PRAGMA page_size=%d;"
+                 "PRAGMA auto_vacuum=INCREMENTAL;"
+                 "PRAGMA journal_mode=WAL;"
+                 "PRAGMA synchronous=%s;"
+                 "PRAGMA wal_autocheckpoint=%d;"
+                 "PRAGMA journal_size_limit=%d;",
+                 p->page_size, p->synchronous, p->checkpoint_pages, DB_WAL_SIZE_LIMIT);
+        sqlite3_exec(db, sql, 0, 0, 0);
+    }
+    snprintf(sql, sizeof(sql),
+             "PRAGMA cache_size=-%d;"
+             "PRAGMA mmap_size=%lld;"
+             "PRAGMA temp_store=%s;",
+             p->cache_kib, (long long)p->mmap_mib << 20, p->temp_store);
+    sqlite3_exec(db, sql, 0, 0, 0);
+}
+
+/*====================================================================
+ * READ CONNECTIONS
+ * Queries never touch db_state.db, which belongs to the writer thread.
+ * Each query checks out one of DB_READERS read-only connections for
+ * its duration; under WAL they read a consistent snapshot alongside
+ * the writer. Every reader has its own copy of the cached statements.
+ *====================================================================*/
+
+typedef struct {
+    sqlite3 *db;
+    sqlite3_stmt *stmt[Q_COUNT];
+    int busy;
+} db_reader_t;
+
+static db_reader_t readers[DB_READERS];
+static int readers_open = 0;
+static pthread_mutex_t readers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t readers_cond = PTHREAD_COND_INITIALIZER;
+
+static int query_cache_on = 1;
+static int sensor_ring_on = 1;
+
+static int reader_open(db_reader_t *r, const char *path) {
+    memset(r, 0, sizeof(*r));
     
-    // 1. Open database (auto-create if not exists)
-    rc = sqlite3_open(DB_PATH, &db_state.db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "✗ Cannot open database: %s\n", 
-                sqlite3_errmsg(db_state.db));
+    if (sqlite3_open_v2(path, &r->db, 
+                        SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+        fprintf(stderr, "✗ Cannot open reader: %s\n", sqlite3_errmsg(r->db));
         return -1;
     }
-    printf("✓ Database: %s\n", DB_PATH);
+    sqlite3_busy_timeout(r->db, 1000);
+    profile_apply(r->db, 0);
+    
+    for (int i = 0; i < Q_COUNT; i++) {
+        if (sqlite3_prepare_v3(r->db, query_defs[i].sql, -1, 
+                               SQLITE_PREPARE_PERSISTENT, &r->stmt[i], 0) != SQLITE_OK) {
+            fprintf(stderr, "✗ Prepare %s failed: %s\n", 
+                    query_defs[i].name, sqlite3_errmsg(r->db));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void reader_close(db_reader_t *r) {
+    for (int i = 0; i < Q_COUNT; i++) {
+        if (r->stmt[i]) {
+            sqlite3_finalize(r->stmt[i]);
+        }
+    }
+    sqlite3_close(r->db);
+    memset(r, 0, sizeof(*r));
+}
+
+static int readers_init(void) {
+    const char *path = sqlite3_db_filename(db_state.db, "main");
     
-    // 2. Enable Write-Ahead Logging (better performance)
-    sqlite3_exec(db_state.db, "PRAGMA journal_mode=WAL;", 0, 0, 0);
+    for (int i = 0; i < DB_READERS; i++) {
+        if (reader_open(&readers[i], path) < 0) {
+            reader_close(&readers[i]);
+            return -1;
+        }
+        readers_open = i + 1;
+    }
+    return 0;
+}
+
+/* Callers (query workers, console) have finished by now */
+static void readers_cleanup(void) {
+    pthread_mutex_lock(&readers_lock);
+    for (int i = 0; i < readers_open; i++) {
+        reader_close(&readers[i]);
+    }
+    readers_open = 0;
+    pthread_mutex_unlock(&readers_lock);
+}
+
+/* Free reader, waiting for one if all are busy; NULL if not open */
+static db_reader_t *reader_checkout(void) {
+    db_reader_t *r = NULL;
+    
+    pthread_mutex_lock(&readers_lock);
+    while (readers_open > 0 && r == NULL) {
+        for (int i = 0; i < readers_open; i++) {
+            if (!readers[i].busy) {
+                r = &readers[i];
+                r->busy = 1;
+                break;
+            }
+        }
+        if (r == NULL) {
+            pthread_cond_wait(&readers_cond, &readers_lock);
+        }
+    }
+    pthread_mutex_unlock(&readers_lock);
     
-    // 3. Create SENSOR_DATA table
-    const char *sql_sensor = 
-        "CREATE TABLE IF NOT EXISTS sensor_data ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    return r;
+}
+
+static void reader_checkin(db_reader_t *r) {
+    pthread_mutex_lock(&readers_lock);
+    r->busy = 0;
+    pthread_cond_signal(&readers_cond);
+    pthread_mutex_unlock(&readers_lock);
+}
+
+/* Cached statement for id on r, to be handed back with query_release() */
+static sqlite3_stmt *query_acquire(db_reader_t *r, query_id_t id) {
+    sqlite3_stmt *stmt = NULL;
+    
+    if (!query_cache_on) {
+        sqlite3_prepare_v2(r->db, query_defs[id].sql, -1, &stmt, 0);
+        return stmt;
+    }
+    return r->stmt[id];
+}
+
+/* Reset ends the statement's read transaction, so WAL can checkpoint */
+static void query_release(db_reader_t *r, query_id_t id, sqlite3_stmt *stmt) {
+    if (stmt == NULL) return;
+    
+    if (stmt != r->stmt[id]) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+void db_query_cache_enable(int enable) {
+    query_cache_on = enable;
+}
+
+void db_sensor_ring_enable(int enable) {
+    sensor_ring_on = enable;
+}
+
+/*====================================================================
+ * SENSOR PARTITIONS
+ * Raw rows live in one table per DB_PARTITION_DAYS period, named
+ * sensor_p_YYYYMMDD after its UTC start day and listed in
+ * sensor_partitions. sensor_data is a UNION ALL view over all of
+ * them, so reads are unchanged; retention drops whole tables.
+ *====================================================================*/
+
+#define PARTITION_SEC   ((time_t)DB_PARTITION_DAYS * 86400)
+#define SENSOR_COLUMNS  "timestamp, node_id, temperature, humidity, " \
+                        "light, soil_moisture, rssi, snr"
+
+static int partition_exec(const char *sql, const char *what) {
+    char *err_msg = NULL;
+
+    if (sqlite3_exec(db_state.db, sql, 0, 0, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "✗ %s: %s\n", what, err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+    return 0;
+}
+
+/* Recreate the sensor_data view over every catalogued partition */
+static int partition_rebuild_view(void) {
+    sqlite3_stmt *stmt;
+    int count = 0;
+
+    if (sqlite3_prepare_v2(db_state.db,
+            "SELECT name FROM sensor_partitions ORDER BY start_ts;",
+            -1, &stmt, 0) != SQLITE_OK) {
+        return -1;
+    }
+
+    sqlite3_str *sql = sqlite3_str_new(db_state.db);
+    sqlite3_str_appendall(sql, "DROP VIEW IF EXISTS sensor_data; "
+                               "CREATE VIEW sensor_data AS ");
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        sqlite3_str_appendf(sql, "%sSELECT " SENSOR_COLUMNS " FROM %s",
+                            count++ ? " UNION ALL " : "",
+                            (const char *)sqlite3_column_text(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_str_appendall(sql, ";");
+
+    char *text = sqlite3_str_finish(sql);
+    int rc = (count > 0 && text) ? partition_exec(text, "Create view sensor_data") : -1;
+    sqlite3_free(text);
+
+    return rc;
+}
+
+static int partition_create(const char *name, time_t start, time_t end) {
+    char sql[1024];
+
+    snprintf(sql, sizeof(sql),
+        "CREATE TABLE IF NOT EXISTS %s ("
         "timestamp INTEGER NOT NULL,"
         "node_id INTEGER NOT NULL,"
         "temperature REAL,"
@@ -49,15 +396,575 @@ int db_init(void) {
         "soil_moisture INTEGER,"
         "rssi INTEGER,"
         "snr INTEGER"
-        ");";
+        ");"
+        "CREATE INDEX IF NOT EXISTS %s_time_node ON %s(timestamp, node_id);"
+        "CREATE INDEX IF NOT EXISTS %s_node_time ON %s(node_id, timestamp, "
+        "temperature, humidity, light, soil_moisture, rssi, snr);"
+        "INSERT OR IGNORE INTO sensor_partitions VALUES ('%s', %ld, %ld);",
+        name, name, name, name, name, name, (long)start, (long)end);
+
+    if (partition_exec(sql, "Create partition") < 0) {
+        return -1;
+    }
+    printf("✓ Partition: %s\n", name);
+
+    return partition_rebuild_view();
+}
+
+/*
+ * Point stmt_sensor at the partition holding ts, creating it if
+ * needed. Writer thread only (and db_init before it starts).
+ */
+int db_partition_prepare(time_t ts) {
+    sqlite3_stmt *stmt;
+    char name[32] = "";
+    time_t start = 0, end = 0;
+
+    if (sqlite3_prepare_v2(db_state.db,
+            "SELECT name, start_ts, end_ts FROM sensor_partitions "
+            "WHERE start_ts <= ?1 AND end_ts > ?1 "
+            "ORDER BY start_ts DESC LIMIT 1;", -1, &stmt, 0) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_int64(stmt, 1, ts);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        snprintf(name, sizeof(name), "%s", (const char *)sqlite3_column_text(stmt, 0));
+        start = sqlite3_column_int64(stmt, 1);
+        end = sqlite3_column_int64(stmt, 2);
+    }
+    sqlite3_finalize(stmt);
+
+    if (name[0] == '\0') {
+        start = ts - ts % PARTITION_SEC;
+        end = start + PARTITION_SEC;
+        strftime(name, sizeof(name), "sensor_p_%Y%m%d", gmtime(&start));
+
+        if (partition_create(name, start, end) < 0) {
+            return -1;
+        }
+    }
+
+    char sql[256];
+    snprintf(sql, sizeof(sql),
+        "INSERT INTO %s (" SENSOR_COLUMNS ") VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
+        name);
+
+    if (db_state.stmt_sensor) {
+        sqlite3_finalize(db_state.stmt_sensor);
+        db_state.stmt_sensor = NULL;
+    }
+    if (sqlite3_prepare_v2(db_state.db, sql, -1, &db_state.stmt_sensor, 0) != SQLITE_OK) {
+        fprintf(stderr, "✗ Prepare sensor statement failed: %s\n",
+                sqlite3_errmsg(db_state.db));
+        db_state.part_start = db_state.part_end = 0;
+        return -1;
+    }
+
+    db_state.part_start = start;
+    db_state.part_end = end;
+    return 0;
+}
+
+/*
+ * Catalog + view, migrating a pre-partition sensor_data table into
+ * the first partition (sensor_p_legacy) in place - a rename, no copy.
+ */
+static int partition_init(void) {
+    sqlite3_stmt *stmt;
+    int legacy = 0;
+
+    if (partition_exec(
+            "CREATE TABLE IF NOT EXISTS sensor_partitions ("
+            "name TEXT PRIMARY KEY,"
+            "start_ts INTEGER NOT NULL,"
+            "end_ts INTEGER NOT NULL"
+            ");", "Create sensor_partitions") < 0) {
+        return -1;
+    }
+    printf("✓ Table: sensor_partitions\n");
+
+    sqlite3_prepare_v2(db_state.db,
+        "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'sensor_data';",
+        -1, &stmt, 0);
+    legacy = (sqlite3_step(stmt) == SQLITE_ROW);
+    sqlite3_finalize(stmt);
+
+    if (legacy) {
+        int64_t lo = 0, hi = 0;
+        int rows = 0;
+
+        sqlite3_prepare_v2(db_state.db,
+            "SELECT MIN(timestamp), MAX(timestamp), COUNT(*) FROM sensor_data;",
+            -1, &stmt, 0);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            lo = sqlite3_column_int64(stmt, 0);
+            hi = sqlite3_column_int64(stmt, 1);
+            rows = sqlite3_column_int(stmt, 2);
+        }
+        sqlite3_finalize(stmt);
+
+        char sql[768];
+        if (rows > 0) {
+            snprintf(sql, sizeof(sql),
+                "BEGIN;"
+                "ALTER TABLE sensor_data RENAME TO sensor_p_legacy;"
+                "CREATE INDEX IF NOT EXISTS idx_time_node "
+                "ON sensor_p_legacy(timestamp, node_id);"
+                "CREATE INDEX IF NOT EXISTS idx_node_time "
+                "ON sensor_p_legacy(node_id, timestamp, temperature, humidity, "
+                "light, soil_moisture, rssi, snr);"
+                "INSERT INTO sensor_partitions VALUES ('sensor_p_legacy', %lld, %lld);"
+                "COMMIT;", (long long)lo, (long long)hi + 1);
+        } else {
+            snprintf(sql, sizeof(sql), "DROP TABLE sensor_data;");
+        }
+        if (partition_exec(sql, "Migrate sensor_data") < 0) {
+            sqlite3_exec(db_state.db, "ROLLBACK;", 0, 0, 0);
+            return -1;
+        }
+        if (rows > 0) {
+            printf("✓ Migrated sensor_data -> sensor_p_legacy (%d rows)\n", rows);
+        }
+    }
+
+    if (db_partition_prepare(time(NULL)) < 0) {
+        return -1;
+    }
+    if (partition_rebuild_view() < 0) {
+        return -1;
+    }
+    printf("✓ View: sensor_data (%d-day partitions)\n", DB_PARTITION_DAYS);
+
+    return 0;
+}
+
+/*====================================================================
+ * COLD ARCHIVE
+ * Partitions older than DB_ARCHIVE_AFTER_DAYS are re-encoded into
+ * sensor_archive as per-node ts_archive blocks (~7 bytes/reading
+ * instead of ~100 with the covering index) and the table dropped.
+ * archive_cursor_t decodes blocks back into rows for the queries.
+ *====================================================================*/
+
+typedef struct {
+    db_reader_t *reader;
+    sqlite3_stmt *stmt;
+    query_id_t query;
+    ts_point_t *pts;
+    int count;
+    int pos;
+    int desc;
+    int64_t lo, hi;
+} archive_cursor_t;
+
+static int archive_init(void) {
+    if (partition_exec(
+            "CREATE TABLE IF NOT EXISTS sensor_archive ("
+            "node_id INTEGER NOT NULL,"
+            "start_ts INTEGER NOT NULL,"
+            "end_ts INTEGER NOT NULL,"
+            "count INTEGER NOT NULL,"
+            "data BLOB NOT NULL"
+            ");"
+            "CREATE INDEX IF NOT EXISTS idx_archive_node_end "
+            "ON sensor_archive(node_id, end_ts, start_ts);"
+            // Retention, across nodes; blocks are few and written rarely
+            "CREATE INDEX IF NOT EXISTS idx_archive_end ON sensor_archive(end_ts);",
+            "Create sensor_archive") < 0) {
+        return -1;
+    }
+    printf("✓ Table: sensor_archive\n");
+    return 0;
+}
+
+/* Points of one node in [lo, hi], oldest first (or newest first) */
+static int archive_open(archive_cursor_t *cur, db_reader_t *r, int node_id, 
+                        int64_t lo, int64_t hi, int desc) {
+    memset(cur, 0, sizeof(*cur));
+    cur->lo = lo;
+    cur->hi = hi;
+    cur->desc = desc;
+    cur->reader = r;
+    cur->query = desc ? Q_ARCHIVE_DESC : Q_ARCHIVE_ASC;
+    
+    if ((cur->stmt = query_acquire(r, cur->query)) == NULL) {
+        return -1;
+    }
+    sqlite3_bind_int(cur->stmt, 1, node_id);
+    sqlite3_bind_int64(cur->stmt, 2, lo);
+    sqlite3_bind_int64(cur->stmt, 3, hi);
     
-    rc = sqlite3_exec(db_state.db, sql_sensor, 0, 0, &err_msg);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "✗ Create sensor_data: %s\n", err_msg);
+    cur->pts = malloc(sizeof(ts_point_t) * TS_BLOCK_MAX_POINTS);
+    return cur->pts ? 0 : -1;
+}
+
+/* Rows already in memory (sensor_ring), read through the same cursor */
+static int archive_open_ring(archive_cursor_t *cur, int node_id, int64_t lo) {
+    memset(cur, 0, sizeof(*cur));
+    cur->lo = lo;
+    cur->hi = INT64_MAX;
+    
+    if (!sensor_ring_on) {
+        return -1;
+    }
+    cur->pts = malloc(sizeof(ts_point_t) * SENSOR_RING_CAPACITY);
+    if (cur->pts == NULL) {
+        return -1;
+    }
+    cur->count = sensor_ring_range(node_id, lo, cur->pts, SENSOR_RING_CAPACITY);
+    if (cur->count < 0) {
+        free(cur->pts);
+        cur->pts = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static const ts_point_t *archive_next(archive_cursor_t *cur) {
+    for (;;) {
+        while (cur->pos < cur->count) {
+            int i = cur->pos++;
+            const ts_point_t *pt = &cur->pts[cur->desc ? cur->count - 1 - i : i];
+            if (pt->timestamp >= cur->lo && pt->timestamp <= cur->hi) {
+                return pt;
+            }
+        }
+        
+        if (cur->stmt == NULL) {
+            break;
+        }
+        if (sqlite3_step(cur->stmt) != SQLITE_ROW) {
+            query_release(cur->reader, cur->query, cur->stmt);
+            cur->stmt = NULL;
+            break;
+        }
+        cur->pos = 0;
+        cur->count = ts_block_decode(sqlite3_column_blob(cur->stmt, 0),
+                                     (size_t)sqlite3_column_bytes(cur->stmt, 0),
+                                     cur->pts, TS_BLOCK_MAX_POINTS);
+        if (cur->count < 0) {
+            fprintf(stderr, "✗ Corrupt archive block skipped\n");
+            cur->count = 0;
+        }
+    }
+    return NULL;
+}
+
+static void archive_close(archive_cursor_t *cur) {
+    if (cur->reader) {
+        query_release(cur->reader, cur->query, cur->stmt);
+    }
+    free(cur->pts);
+    cur->stmt = NULL;
+    cur->pts = NULL;
+}
+
+/* Newest SENSOR_RING_CAPACITY readings of one node into the ring,
+ * topping up from the archive like get_latest */
+static int ring_seed_node(db_reader_t *r, int node_id, ts_point_t *pts) {
+    sqlite3_stmt *stmt = query_acquire(r, Q_LATEST_NODE);
+    if (stmt == NULL) {
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, node_id);
+    sqlite3_bind_int(stmt, 2, SENSOR_RING_CAPACITY);
+    
+    int n = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        ts_point_t *pt = &pts[n++];
+        pt->timestamp = sqlite3_column_int64(stmt, 0);
+        pt->temperature = (float)sqlite3_column_double(stmt, 1);
+        pt->humidity = (float)sqlite3_column_double(stmt, 2);
+        pt->light = sqlite3_column_int(stmt, 3);
+        pt->soil_moisture = sqlite3_column_int(stmt, 4);
+        pt->rssi = sqlite3_column_int(stmt, 5);
+        pt->snr = sqlite3_column_int(stmt, 6);
+    }
+    query_release(r, Q_LATEST_NODE, stmt);
+    
+    archive_cursor_t cur = {0};
+    int64_t oldest = n > 0 ? pts[n - 1].timestamp : INT64_MAX;
+    if (n < SENSOR_RING_CAPACITY && 
+        archive_open(&cur, r, node_id, 0, oldest - 1, 1) == 0) {
+        const ts_point_t *pt;
+        while (n < SENSOR_RING_CAPACITY && (pt = archive_next(&cur)) != NULL) {
+            pts[n++] = *pt;
+        }
+    }
+    archive_close(&cur);
+    
+    // A full ring may have older rows behind it; SQLite answers those
+    sensor_ring_seed(node_id, pts, n, n < SENSOR_RING_CAPACITY);
+    
+    // Live window stats start from the same rows
+    for (int i = n - 1; i >= 0; i--) {
+        node_stats_add(node_id, &pts[i]);
+    }
+    node_stats_cover(node_id, n < SENSOR_RING_CAPACITY ? INT64_MIN : pts[n - 1].timestamp);
+    return n;
+}
+
+static int ring_seed(void) {
+    ts_point_t *pts = malloc(sizeof(ts_point_t) * SENSOR_RING_CAPACITY);
+    db_reader_t *r = reader_checkout();
+    if (pts == NULL || r == NULL) {
+        free(pts);
+        if (r) reader_checkin(r);
+        return -1;
+    }
+    
+    sensor_ring_reset();
+    node_stats_reset();
+    int total = 0;
+    for (int node = 1; node <= MAX_NODES; node++) {
+        int n = ring_seed_node(r, node, pts);
+        if (n < 0) {
+            total = -1;
+            break;
+        }
+        total += n;
+    }
+    reader_checkin(r);
+    free(pts);
+    return total;
+}
+
+/*====================================================================
+ * ROLLUP TABLES
+ * Per-node minute/hour/day aggregates, upserted by the writer thread
+ * for every sensor row so dashboards never aggregate raw data.
+ *====================================================================*/
+
+typedef struct {
+    const char *table;
+    int bucket_sec;
+} rollup_level_t;
+
+/* Finest first; each bucket size divides the next */
+static const rollup_level_t rollup_levels[DB_ROLLUP_LEVELS] = {
+    { "sensor_rollup_1m", 60 },
+    { "sensor_rollup_1h", 3600 },
+    { "sensor_rollup_1d", 86400 },
+};
+
+/* Running sums for one window, merged from rollup rows and raw rows */
+typedef struct {
+    int64_t count;
+    double temp_sum, temp_min, temp_max;
+    double hum_sum, hum_min, hum_max;
+    double light_sum, light_min, light_max;
+    double soil_sum, soil_min, soil_max;
+} rollup_acc_t;
+
+static int rollup_create(const rollup_level_t *level) {
+    char sql[1024];
+    char *err_msg = NULL;
+    
+    snprintf(sql, sizeof(sql),
+        "CREATE TABLE IF NOT EXISTS %s ("
+        "node_id INTEGER NOT NULL,"
+        "bucket INTEGER NOT NULL,"
+        "count INTEGER NOT NULL,"
+        "temp_sum REAL, temp_min REAL, temp_max REAL,"
+        "hum_sum REAL, hum_min REAL, hum_max REAL,"
+        "light_sum INTEGER, light_min INTEGER, light_max INTEGER,"
+        "soil_sum INTEGER, soil_min INTEGER, soil_max INTEGER,"
+        "rssi_sum INTEGER, snr_sum INTEGER,"
+        "PRIMARY KEY (node_id, bucket)"
+        ") WITHOUT ROWID;", level->table);
+    
+    if (sqlite3_exec(db_state.db, sql, 0, 0, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "✗ Create %s: %s\n", level->table, err_msg);
         sqlite3_free(err_msg);
         return -1;
     }
-    printf("✓ Table: sensor_data\n");
+    
+    // One-time backfill when upgrading a database that already has raw data
+    sqlite3_stmt *stmt;
+    snprintf(sql, sizeof(sql), "SELECT 1 FROM %s LIMIT 1;", level->table);
+    sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
+    int empty = (sqlite3_step(stmt) != SQLITE_ROW);
+    sqlite3_finalize(stmt);
+    
+    if (empty) {
+        snprintf(sql, sizeof(sql),
+            "INSERT INTO %s SELECT node_id, timestamp - timestamp %% %d, COUNT(*), "
+            "SUM(temperature), MIN(temperature), MAX(temperature), "
+            "SUM(humidity), MIN(humidity), MAX(humidity), "
+            "SUM(light), MIN(light), MAX(light), "
+            "SUM(soil_moisture), MIN(soil_moisture), MAX(soil_moisture), "
+            "SUM(rssi), SUM(snr) "
+            "FROM sensor_data GROUP BY node_id, timestamp / %d;",
+            level->table, level->bucket_sec, level->bucket_sec);
+        sqlite3_exec(db_state.db, sql, 0, 0, 0);
+        
+        int rows = sqlite3_changes(db_state.db);
+        if (rows > 0) {
+            printf("✓ Backfilled %s: %d buckets\n", level->table, rows);
+        }
+    }
+    
+    printf("✓ Table: %s\n", level->table);
+    return 0;
+}
+
+static int rollup_prepare(int lvl) {
+    char sql[1024];
+    const rollup_level_t *level = &rollup_levels[lvl];
+    
+    // ?1 node, ?2 timestamp, ?3 temp, ?4 hum, ?5 light, ?6 soil, ?7 rssi, ?8 snr
+    snprintf(sql, sizeof(sql),
+        "INSERT INTO %s VALUES (?1, ?2 - ?2 %% %d, 1, "
+        "?3, ?3, ?3, ?4, ?4, ?4, ?5, ?5, ?5, ?6, ?6, ?6, ?7, ?8) "
+        "ON CONFLICT(node_id, bucket) DO UPDATE SET "
+        "count = count + 1, "
+        "temp_sum = temp_sum + excluded.temp_sum, "
+        "temp_min = MIN(temp_min, excluded.temp_min), "
+        "temp_max = MAX(temp_max, excluded.temp_max), "
+        "hum_sum = hum_sum + excluded.hum_sum, "
+        "hum_min = MIN(hum_min, excluded.hum_min), "
+        "hum_max = MAX(hum_max, excluded.hum_max), "
+        "light_sum = light_sum + excluded.light_sum, "
+        "light_min = MIN(light_min, excluded.light_min), "
+        "light_max = MAX(light_max, excluded.light_max), "
+        "soil_sum = soil_sum + excluded.soil_sum, "
+        "soil_min = MIN(soil_min, excluded.soil_min), "
+        "soil_max = MAX(soil_max, excluded.soil_max), "
+        "rssi_sum = rssi_sum + excluded.rssi_sum, "
+        "snr_sum = snr_sum + excluded.snr_sum;",
+        level->table, level->bucket_sec);
+    
+    if (sqlite3_prepare_v2(db_state.db, sql, -1, &db_state.stmt_rollup[lvl], 0) != SQLITE_OK) {
+        fprintf(stderr, "✗ Prepare %s upsert: %s\n", level->table, 
+                sqlite3_errmsg(db_state.db));
+        return -1;
+    }
+    return 0;
+}
+
+/* Columns: count, then sum/min/max for temp, hum, light, soil */
+static void rollup_acc_add(rollup_acc_t *acc, sqlite3_stmt *stmt) {
+    int64_t count = sqlite3_column_int64(stmt, 0);
+    if (count == 0) return;
+    
+    int first = (acc->count == 0);
+    acc->count += count;
+    
+#define ACC_FIELD(name, col) \
+    acc->name##_sum += sqlite3_column_double(stmt, col); \
+    if (first || sqlite3_column_double(stmt, col + 1) < acc->name##_min) \
+        acc->name##_min = sqlite3_column_double(stmt, col + 1); \
+    if (first || sqlite3_column_double(stmt, col + 2) > acc->name##_max) \
+        acc->name##_max = sqlite3_column_double(stmt, col + 2);
+    
+    ACC_FIELD(temp, 1)
+    ACC_FIELD(hum, 4)
+    ACC_FIELD(light, 7)
+    ACC_FIELD(soil, 10)
+#undef ACC_FIELD
+}
+
+static void rollup_acc_query(db_reader_t *r, rollup_acc_t *acc, query_id_t query, 
+                             int node_id, int64_t lo, int64_t hi) {
+    sqlite3_stmt *stmt = query_acquire(r, query);
+    if (stmt == NULL) {
+        return;
+    }
+    sqlite3_bind_int(stmt, 1, node_id);
+    sqlite3_bind_int64(stmt, 2, lo);
+    sqlite3_bind_int64(stmt, 3, hi);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        rollup_acc_add(acc, stmt);
+    }
+    query_release(r, query, stmt);
+}
+
+/*
+ * Aggregate [start, now] for one node. The coarsest level that fits
+ * covers whole buckets from the first bucket boundary >= start; the
+ * head before that boundary is filled from successively finer levels
+ * and finally raw rows (< 1 minute). Exact, and reads a few hundred
+ * rows at most for any window.
+ */
+static void rollup_aggregate(db_reader_t *r, int node_id, time_t start, rollup_acc_t *acc) {
+    int64_t window = time(NULL) - start;
+    int64_t upper = INT64_MAX;
+    int top = -1;
+    
+    for (int lvl = 0; lvl < DB_ROLLUP_LEVELS; lvl++) {
+        if (rollup_levels[lvl].bucket_sec <= window) top = lvl;
+    }
+    
+    for (int lvl = top; lvl >= 0; lvl--) {
+        int64_t b = rollup_levels[lvl].bucket_sec;
+        int64_t first = ((start + b - 1) / b) * b;
+        
+        if (first < upper) {
+            rollup_acc_query(r, acc, Q_AGG_ROLLUP + lvl, node_id, first, upper);
+            upper = first;
+        }
+    }
+    
+    rollup_acc_query(r, acc, Q_AGG_RAW, node_id, start, upper);
+}
+
+/* Raw rows in [start, now] estimated from the hourly rollup */
+static int64_t rollup_estimate_rows(db_reader_t *r, int node_id, time_t start) {
+    sqlite3_stmt *stmt = query_acquire(r, Q_ROW_ESTIMATE);
+    int64_t rows = 0;
+    
+    if (stmt == NULL) {
+        return 0;
+    }
+    sqlite3_bind_int(stmt, 1, node_id);
+    sqlite3_bind_int64(stmt, 2, start - start % 3600);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        rows = sqlite3_column_int64(stmt, 0);
+    }
+    query_release(r, Q_ROW_ESTIMATE, stmt);
+    return rows;
+}
+
+/*====================================================================
+ * DATABASE INITIALIZATION
+ *====================================================================*/
+
+int db_init(void) {
+    return db_init_at(DB_PATH);
+}
+
+int db_init_at(const char *path) {
+    int rc;
+    char *err_msg = NULL;
+    
+    printf("\n╔═══════════════════════════════════╗\n");
+    printf("║   Database Initialization         ║\n");
+    printf("╚═══════════════════════════════════╝\n\n");
+    
+    // 1. Open database (auto-create if not exists)
+    rc = sqlite3_open(path, &db_state.db);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "✗ Cannot open database: %s\n", 
+                sqlite3_errmsg(db_state.db));
+        return -1;
+    }
+    printf("✓ Database: %s\n", path);
+    
+    // 2. Write-Ahead Logging and the tuning profile's pragmas
+    const db_profile_t *p = db_get_profile();
+    profile_apply(db_state.db, 1);
+    printf("✓ Profile: %s (WAL, synchronous=%s, cache %d KB, mmap %d MB, "
+           "temp_store=%s, checkpoint %d pages)\n",
+           p->name, p->synchronous, p->cache_kib, p->mmap_mib, 
+           p->temp_store, p->checkpoint_pages);
+
+    // 3. Create SENSOR_DATA partitions + view
+    if (partition_init() < 0) {
+        return -1;
+    }
+    if (archive_init() < 0) {
+        return -1;
+    }
     
     // 4. Create ACTUATOR_LOGS table
     const char *sql_actuator =
@@ -117,25 +1024,27 @@ int db_init(void) {
     }
     printf("✓ Table: gateway_stats\n");
     
-    // 7. Create INDEX for better query performance
-    const char *sql_index = 
-        "CREATE INDEX IF NOT EXISTS idx_time_node "
-        "ON sensor_data(timestamp, node_id);";
-    sqlite3_exec(db_state.db, sql_index, 0, 0, 0);
-    printf("✓ Index: idx_time_node\n");
-    
-    // 8. Prepare statements (for faster inserts)
-    const char *insert_sensor = 
-        "INSERT INTO sensor_data (timestamp, node_id, temperature, humidity, "
-        "light, soil_moisture, rssi, snr) VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
-    
-    rc = sqlite3_prepare_v2(db_state.db, insert_sensor, -1, 
-                           &db_state.stmt_sensor, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "✗ Prepare sensor statement failed\n");
-        return -1;
+    // 6b. Create ROLLUP tables (1m / 1h / 1d per node)
+    for (int lvl = 0; lvl < DB_ROLLUP_LEVELS; lvl++) {
+        if (rollup_create(&rollup_levels[lvl]) < 0) {
+            return -1;
+        }
     }
     
+    // 7. Create INDEXES for better query performance
+    //    Each sensor partition carries its own pair (see partition_create):
+    //    <part>_time_node  - all-node "latest" queries
+    //    <part>_node_time  - every per-node query filters node_id then a
+    //                        time range; covering, so those never touch
+    //                        the table
+    const char *sql_index_actuator =
+        "CREATE INDEX IF NOT EXISTS idx_actuator_node_time "
+        "ON actuator_logs(node_id, timestamp);";
+    sqlite3_exec(db_state.db, sql_index_actuator, 0, 0, 0);
+    printf("✓ Index: idx_actuator_node_time\n");
+    
+    // 8. Prepare statements (for faster inserts)
+    //    stmt_sensor already targets the current partition
     const char *insert_actuator =
         "INSERT INTO actuator_logs (timestamp, node_id, actuator, state, "
         "trigger_type, trigger_value) VALUES (?, ?, ?, ?, ?, ?);";
@@ -169,7 +1078,46 @@ int db_init(void) {
         return -1;
     }
     
+    for (int lvl = 0; lvl < DB_ROLLUP_LEVELS; lvl++) {
+        if (rollup_prepare(lvl) < 0) {
+            return -1;
+        }
+    }
+    
     printf("✓ Prepared statements ready\n");
+    
+    // Read-only connections, each with every read query prepared
+    if (readers_init() < 0) {
+        return -1;
+    }
+    printf("✓ Read connections: %d (%d queries cached each)\n", DB_READERS, Q_COUNT);
+    
+    // Recent readings in memory for get_latest / dbshow / short ranges
+    int seeded = ring_seed();
+    if (seeded < 0) {
+        return -1;
+    }
+    printf("✓ Recent readings: %d in memory (%d per node)\n", seeded, SENSOR_RING_CAPACITY);
+    
+    // 9. Start writer thread (owns all inserts from here on)
+    if (db_writer_start() < 0) {
+        return -1;
+    }
+    
+    // Checkpoints off the commit path; without the thread SQLite's
+    // own autocheckpoint stays in charge
+    if (db_checkpoint_start(db_state.db) < 0) {
+        fprintf(stderr, "✗ Checkpoint thread unavailable, using autocheckpoint\n");
+    }
+    
+    // Catch up on partitions that closed while the gateway was down
+    db_archive_old_data(DB_ARCHIVE_AFTER_DAYS);
+    
+    // 10. Query workers for db/query requests
+    if (db_query_pool_start() < 0) {
+        return -1;
+    }
+    
     printf("✓ Database initialized!\n\n");
     
     db_state.last_backup_time = time(NULL);
@@ -179,6 +1127,7 @@ int db_init(void) {
 
 /*====================================================================
  * DATABASE INSERT FUNCTIONS
+ * These only queue the record; db_writer.c commits them in batches.
  *====================================================================*/
 
 int db_save_sensor_data(int node_id, float temp, float hum, 
@@ -188,29 +1137,29 @@ int db_save_sensor_data(int node_id, float temp, float hum,
         return -1;
     }
 
-    time_t now = time(NULL);
-    
-    sqlite3_reset(db_state.stmt_sensor);
-    sqlite3_clear_bindings(db_state.stmt_sensor);
-    
-    sqlite3_bind_int64(db_state.stmt_sensor, 1, now);
-    sqlite3_bind_int(db_state.stmt_sensor, 2, node_id);
-    sqlite3_bind_double(db_state.stmt_sensor, 3, temp);
-    sqlite3_bind_double(db_state.stmt_sensor, 4, hum);
-    sqlite3_bind_int(db_state.stmt_sensor, 5, light);
-    sqlite3_bind_int(db_state.stmt_sensor, 6, soil);
-    sqlite3_bind_int(db_state.stmt_sensor, 7, rssi);
-    sqlite3_bind_int(db_state.stmt_sensor, 8, snr);
-    
-    int rc = sqlite3_step(db_state.stmt_sensor);
-    if (rc != SQLITE_DONE) {
-        fprintf(stderr, "✗ DB insert sensor failed: %s\n", 
-                sqlite3_errmsg(db_state.db));
-        db_state.insert_errors++;
+    db_record_t rec;
+    rec.type = DB_REC_SENSOR;
+    rec.timestamp = time(NULL);
+    rec.node_id = node_id;
+    rec.u.sensor.temp = temp;
+    rec.u.sensor.hum = hum;
+    rec.u.sensor.light = light;
+    rec.u.sensor.soil = soil;
+    rec.u.sensor.rssi = rssi;
+    rec.u.sensor.snr = snr;
+    
+    if (db_writer_enqueue(&rec) < 0) {
         return -1;
     }
     
-    db_state.total_inserts++;
+    // Queued rows are served from the ring before the writer commits them
+    ts_point_t pt = {
+        .timestamp = rec.timestamp, .temperature = temp, .humidity = hum,
+        .light = light, .soil_moisture = soil, .rssi = rssi, .snr = snr
+    };
+    sensor_ring_push(node_id, &pt);
+    node_stats_add(node_id, &pt);
+    db_cache_invalidate(node_id >= 1 && node_id <= MAX_NODES ? 1u << node_id : 0);
     return 0;
 }
 
@@ -218,55 +1167,59 @@ int db_log_actuator_change(int node_id, const char *actuator, int state,
                            const char *trigger_type, float trigger_value) {
     if (db_state.db == NULL) return -1;
     
-    time_t now = time(NULL);
-    
-    sqlite3_reset(db_state.stmt_actuator);
-    sqlite3_clear_bindings(db_state.stmt_actuator);
-    
-    sqlite3_bind_int64(db_state.stmt_actuator, 1, now);
-    sqlite3_bind_int(db_state.stmt_actuator, 2, node_id);
-    sqlite3_bind_text(db_state.stmt_actuator, 3, actuator, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(db_state.stmt_actuator, 4, state);
-    sqlite3_bind_text(db_state.stmt_actuator, 5, trigger_type, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_double(db_state.stmt_actuator, 6, trigger_value);
-    
-    int rc = sqlite3_step(db_state.stmt_actuator);
-    if (rc != SQLITE_DONE) {
-        db_state.insert_errors++;
-        return -1;
-    }
-    
-    return 0;
+    db_record_t rec;
+    rec.type = DB_REC_ACTUATOR;
+    rec.timestamp = time(NULL);
+    rec.node_id = node_id;
+    snprintf(rec.u.actuator.actuator, sizeof(rec.u.actuator.actuator), 
+             "%s", actuator);
+    rec.u.actuator.state = state;
+    snprintf(rec.u.actuator.trigger_type, sizeof(rec.u.actuator.trigger_type), 
+             "%s", trigger_type ? trigger_type : "");
+    rec.u.actuator.trigger_value = trigger_value;
+    
+    return db_writer_enqueue(&rec);
+}
+
+static void db_command_record(db_record_t *rec, int node_id, const char *cmd,
+                              const char *val, const char *source) {
+    rec->type = DB_REC_COMMAND;
+    rec->timestamp = time(NULL);
+    rec->node_id = node_id;
+    snprintf(rec->u.command.command, sizeof(rec->u.command.command), "%s", cmd);
+    snprintf(rec->u.command.value, sizeof(rec->u.command.value), "%s", val);
+    snprintf(rec->u.command.source, sizeof(rec->u.command.source), 
+             "%s", source ? source : "");
 }
 
 int db_log_command(int node_id, const char *cmd, const char *val, 
                    const char *source) {
     if (db_state.db == NULL) return -1;
     
-    time_t now = time(NULL);
+    db_record_t rec;
+    db_command_record(&rec, node_id, cmd, val, source);
     
-    sqlite3_reset(db_state.stmt_command);
-    sqlite3_clear_bindings(db_state.stmt_command);
+    return db_writer_enqueue(&rec);
+}
+
+int db_log_commands(const db_command_t *cmds, int count, const char *source) {
+    if (db_state.db == NULL || count < 1) return -1;
     
-    sqlite3_bind_int64(db_state.stmt_command, 1, now);
-    sqlite3_bind_int(db_state.stmt_command, 2, node_id);
-    sqlite3_bind_text(db_state.stmt_command, 3, cmd, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(db_state.stmt_command, 4, val, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(db_state.stmt_command, 5, source, -1, SQLITE_TRANSIENT);
+    db_record_t *recs = malloc(sizeof(db_record_t) * count);
+    if (recs == NULL) return -1;
     
-    int rc = sqlite3_step(db_state.stmt_command);
-    if (rc != SQLITE_DONE) {
-        db_state.insert_errors++;
-        return -1;
+    for (int i = 0; i < count; i++) {
+        db_command_record(&recs[i], cmds[i].node_id, cmds[i].cmd, cmds[i].val, source);
     }
     
-    return 0;
+    int rc = db_writer_enqueue_group(recs, count);
+    free(recs);
+    return rc;
 }
 
 int db_save_gateway_stats(void) {
     if (db_state.db == NULL) return -1;
     
-    time_t now = time(NULL);
     uint32_t total_rx = 0, total_tx = 0;
     
     for (int i = 0; i < MAX_NODES; i++) {
@@ -274,22 +1227,17 @@ int db_save_gateway_stats(void) {
         total_tx += gateway.nodes[i].tx_count;
     }
     
-    sqlite3_reset(db_state.stmt_stats);
-    sqlite3_clear_bindings(db_state.stmt_stats);
-    
-    sqlite3_bind_int64(db_state.stmt_stats, 1, now);
-    sqlite3_bind_int(db_state.stmt_stats, 2, total_rx);
-    sqlite3_bind_int(db_state.stmt_stats, 3, total_tx);
-    sqlite3_bind_int(db_state.stmt_stats, 4, gateway.rx_crc_error);
-    sqlite3_bind_int(db_state.stmt_stats, 5, gateway.json_parse_error);
-    sqlite3_bind_int(db_state.stmt_stats, 6, gateway.auto_commands);
-    
-    int rc = sqlite3_step(db_state.stmt_stats);
-    if (rc != SQLITE_DONE) {
-        return -1;
-    }
-    
-    return 0;
+    db_record_t rec;
+    rec.type = DB_REC_STATS;
+    rec.timestamp = time(NULL);
+    rec.node_id = 0;
+    rec.u.stats.rx_count = total_rx;
+    rec.u.stats.tx_count = total_tx;
+    rec.u.stats.crc_errors = gateway.rx_crc_error;
+    rec.u.stats.json_errors = gateway.json_parse_error;
+    rec.u.stats.auto_commands = gateway.auto_commands;
+    
+    return db_writer_enqueue(&rec);
 }
 
 /*====================================================================
@@ -297,6 +1245,12 @@ int db_save_gateway_stats(void) {
  *====================================================================*/
 
 void db_cleanup(void) {
+    // Flush queued rows before the statements go away
+    db_query_pool_stop();
+    db_backup_stop();
+    db_writer_stop();
+    db_checkpoint_stop();
+    
     if (db_state.stmt_sensor) {
         sqlite3_finalize(db_state.stmt_sensor);
     }
@@ -309,6 +1263,13 @@ void db_cleanup(void) {
     if (db_state.stmt_stats) {
         sqlite3_finalize(db_state.stmt_stats);
     }
+    for (int lvl = 0; lvl < DB_ROLLUP_LEVELS; lvl++) {
+        if (db_state.stmt_rollup[lvl]) {
+            sqlite3_finalize(db_state.stmt_rollup[lvl]);
+        }
+    }
+    readers_cleanup();
+    db_cache_clear();
     if (db_state.db) {
         sqlite3_close(db_state.db);
         printf("✓ Database closed\n");
@@ -316,177 +1277,531 @@ void db_cleanup(void) {
 }
 
 /*
- * src/database.c - PART 2/2
- * Query and Maintenance Functions
- * 
- * COPY THIS CONTENT AND APPEND TO database.c (Part 1)
- * Remove the "CONTINUED IN PART 2" comment and add this content
+ * src/database.c - PART 2/2
+ * Query and Maintenance Functions
+ * 
+ * COPY THIS CONTENT AND APPEND TO database.c (Part 1)
+ * Remove the "CONTINUED IN PART 2" comment and add this content
+ */
+
+/*====================================================================
+ * DATABASE QUERY FUNCTIONS - For MQTT/Web Interface
+ *====================================================================*/
+
+/*
+ * Same text as datetime(ts, 'unixepoch', 'localtime'). Done here so
+ * ordered queries select plain columns, which lets SQLite merge the
+ * partitions in index order instead of sorting the whole view.
+ */
+static const char *format_local_time(time_t ts, char *buf, size_t len) {
+    struct tm tm;
+    localtime_r(&ts, &tm);
+    strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+    return buf;
+}
+
+static void add_sensor_fields(cJSON *item, time_t ts, double temp, double hum,
+                              double light, double soil, int rssi, int snr) {
+    char time_buf[32];
+    
+    cJSON_AddStringToObject(item, "time", 
+        format_local_time(ts, time_buf, sizeof(time_buf)));
+    cJSON_AddNumberToObject(item, "temperature", temp);
+    cJSON_AddNumberToObject(item, "humidity", hum);
+    cJSON_AddNumberToObject(item, "light", light);
+    cJSON_AddNumberToObject(item, "soil_moisture", soil);
+    cJSON_AddNumberToObject(item, "rssi", rssi);
+    cJSON_AddNumberToObject(item, "snr", snr);
+}
+
+static void add_archived_item(cJSON *root, const ts_point_t *pt) {
+    cJSON *item = cJSON_CreateObject();
+    add_sensor_fields(item, (time_t)pt->timestamp, pt->temperature, pt->humidity,
+                      pt->light, pt->soil_moisture, pt->rssi, pt->snr);
+    cJSON_AddItemToArray(root, item);
+}
+
+/* Recent readings ring: newest first, or -1 when SQLite must answer */
+static int ring_latest(int node_id, int limit, ts_point_t **pts, int **node_ids) {
+    *pts = NULL;
+    *node_ids = NULL;
+    if (!sensor_ring_on || limit <= 0 || limit > SENSOR_RING_CAPACITY) {
+        return -1;
+    }
+    
+    int n = -1;
+    *pts = malloc(sizeof(ts_point_t) * limit);
+    if (*pts != NULL && node_id > 0) {
+        n = sensor_ring_latest(node_id, *pts, limit);
+    } else if (*pts != NULL && (*node_ids = malloc(sizeof(int) * limit)) != NULL) {
+        n = sensor_ring_latest_all(*pts, *node_ids, limit);
+    }
+    
+    if (n < 0) {
+        free(*pts);
+        free(*node_ids);
+        *pts = NULL;
+        *node_ids = NULL;
+    }
+    return n;
+}
+
+char* db_query_latest_sensors(int node_id, int limit) {
+    ts_point_t *pts;
+    int *node_ids;
+    int n = ring_latest(node_id, limit, &pts, &node_ids);
+    if (n >= 0) {
+        cJSON *root = cJSON_CreateArray();
+        for (int i = 0; i < n; i++) {
+            cJSON *item = cJSON_CreateObject();
+            if (node_id == 0) {
+                cJSON_AddNumberToObject(item, "node_id", node_ids[i]);
+            }
+            add_sensor_fields(item, (time_t)pts[i].timestamp, pts[i].temperature,
+                              pts[i].humidity, pts[i].light, pts[i].soil_moisture,
+                              pts[i].rssi, pts[i].snr);
+            cJSON_AddItemToArray(root, item);
+        }
+        free(pts);
+        free(node_ids);
+        
+        char *json_str = cJSON_PrintUnformatted(root);
+        cJSON_Delete(root);
+        return json_str;
+    }
+    
+    query_id_t query = node_id > 0 ? Q_LATEST_NODE : Q_LATEST_ALL;
+    
+    db_reader_t *r = reader_checkout();
+    if (r == NULL) {
+        return NULL;
+    }
+    sqlite3_stmt *stmt = query_acquire(r, query);
+    if (stmt == NULL) {
+        reader_checkin(r);
+        return NULL;
+    }
+    if (node_id > 0) {
+        sqlite3_bind_int(stmt, 1, node_id);
+        sqlite3_bind_int(stmt, 2, limit);
+    } else {
+        sqlite3_bind_int(stmt, 1, limit);
+    }
+    
+    cJSON *root = cJSON_CreateArray();
+    int count = 0;
+    int64_t oldest = INT64_MAX;
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        cJSON *item = cJSON_CreateObject();
+        
+        int col = 0;
+        if (node_id == 0) {
+            cJSON_AddNumberToObject(item, "node_id", sqlite3_column_int(stmt, col++));
+        }
+        
+        oldest = sqlite3_column_int64(stmt, col);
+        add_sensor_fields(item, (time_t)oldest,
+            sqlite3_column_double(stmt, col + 1),
+            sqlite3_column_double(stmt, col + 2),
+            sqlite3_column_int(stmt, col + 3),
+            sqlite3_column_int(stmt, col + 4),
+            sqlite3_column_int(stmt, col + 5),
+            sqlite3_column_int(stmt, col + 6));
+        
+        cJSON_AddItemToArray(root, item);
+        count++;
+    }
+    
+    query_release(r, query, stmt);
+    
+    // A node that has been quiet for a while: top up from the archive
+    if (node_id > 0 && count < limit) {
+        archive_cursor_t cur;
+        if (archive_open(&cur, r, node_id, 0, oldest - 1, 1) == 0) {
+            const ts_point_t *pt;
+            while (count < limit && (pt = archive_next(&cur)) != NULL) {
+                add_archived_item(root, pt);
+                count++;
+            }
+        }
+        archive_close(&cur);
+    }
+    reader_checkin(r);
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    
+    return json_str;
+}
+
+/*
+ * Streamed range rows. Each row is printed straight from the column
+ * values into one fixed buffer - no cJSON tree - so a query holds at
+ * most DB_RANGE_CHUNK_BYTES of output however long the window is.
+ */
+typedef struct {
+    char buf[DB_RANGE_CHUNK_BYTES + 2];     // + closing ']' and NUL
+    size_t len;
+    int rows;
+    int seq;
+    db_chunk_fn_t emit;
+    void *ctx;
+} range_chunk_t;
+
+static int range_chunk_flush(range_chunk_t *ch, int last, int64_t next_after_ts) {
+    ch->buf[ch->len++] = ']';
+    ch->buf[ch->len] = '\0';
+    
+    int rc = ch->emit(ch->buf, ch->len, ch->seq++, last, next_after_ts, ch->ctx);
+    
+    ch->buf[0] = '[';
+    ch->len = 1;
+    ch->rows = 0;
+    return rc;
+}
+
+/* Same text cJSON prints for a number: shortest of 15/17 digits that
+ * reads back exactly */
+static const char *format_number(double d, char *buf, size_t len) {
+    snprintf(buf, len, "%1.15g", d);
+    if (strtod(buf, NULL) != d) {
+        snprintf(buf, len, "%1.17g", d);
+    }
+    return buf;
+}
+
+static int range_chunk_add(range_chunk_t *ch, const ds_row_t *row) {
+    char time_buf[32];
+    char num[DS_FIELDS][32];
+    char rssi[32], snr[32];
+    char extra[32] = "";
+    
+    format_local_time((time_t)row->ts, time_buf, sizeof(time_buf));
+    for (int i = 0; i < DS_FIELDS; i++) {
+        format_number(row->value[i], num[i], sizeof(num[i]));
+    }
+    format_number(row->rssi, rssi, sizeof(rssi));
+    format_number(row->snr, snr, sizeof(snr));
+    if (row->samples >= 0) {
+        snprintf(extra, sizeof(extra), ",\"samples\":%d", row->samples);
+    }
+    
+    for (;;) {
+        size_t room = DB_RANGE_CHUNK_BYTES - ch->len;
+        int n = snprintf(ch->buf + ch->len, room + 1,
+            "%s{\"time\":\"%s\",\"temperature\":%s,\"humidity\":%s,"
+            "\"light\":%s,\"soil_moisture\":%s,\"rssi\":%s,\"snr\":%s%s}",
+            ch->rows ? "," : "", time_buf, num[0], num[1], num[2], num[3], 
+            rssi, snr, extra);
+        
+        if (n >= 0 && (size_t)n <= room) {
+            ch->len += n;
+            ch->rows++;
+            return 0;
+        }
+        if (ch->rows == 0) {
+            return -1;  // a single row never fits - buffer misconfigured
+        }
+        if (range_chunk_flush(ch, 0, 0) != 0) {
+            return -1;
+        }
+    }
+}
+
+static int range_chunk_emit(const ds_row_t *row, void *ctx) {
+    return range_chunk_add(ctx, row);
+}
+
+/*
+ * Rows from the source level (-1 = raw) for the window. max_points > 0
+ * and more raw rows than that picks a reduced source:
+ *   DB_DOWNSAMPLE_AVG     averages from the finest rollup level whose
+ *                         bucket count fits within max_points
+ *   LTTB / MINMAX         the coarsest level (or raw) that still has
+ *                         max_points rows, streamed through downsample.c
+ * Raw rows from archived partitions are decoded and merged in time
+ * order. The level is chosen from the whole window, so every page of
+ * one range comes from the same level.
  */
+static int range_source_level(db_reader_t *r, const db_range_query_t *q, 
+                              time_t start, int *reduce) {
+    int64_t window = (int64_t)q->hours * 3600;
+    
+    *reduce = 0;
+    if (q->max_points <= 0 || rollup_estimate_rows(r, q->node_id, start) <= q->max_points) {
+        return -1;
+    }
+    if (q->downsample == DB_DOWNSAMPLE_AVG) {
+        for (int i = 0; i < DB_ROLLUP_LEVELS; i++) {
+            if (window / rollup_levels[i].bucket_sec <= q->max_points) {
+                return i;
+            }
+        }
+        return DB_ROLLUP_LEVELS - 1;
+    }
+    
+    *reduce = 1;
+    int lvl = -1;
+    for (int i = 0; i < DB_ROLLUP_LEVELS; i++) {
+        if (window / rollup_levels[i].bucket_sec >= q->max_points) {
+            lvl = i;
+        }
+    }
+    return lvl;
+}
 
-/*====================================================================
- * DATABASE QUERY FUNCTIONS - For MQTT/Web Interface
- *====================================================================*/
-
-char* db_query_latest_sensors(int node_id, int limit) {
-    char sql[512];
+int db_stream_range_sensors(const db_range_query_t *q, db_chunk_fn_t emit, void *ctx) {
+    time_t now = time(NULL);
+    time_t start_time = now - (time_t)q->hours * 3600;
     
-    if (node_id > 0) {
-        snprintf(sql, sizeof(sql), 
-            "SELECT "
-            "datetime(timestamp, 'unixepoch', 'localtime') as time, "
-            "temperature, humidity, light, soil_moisture, rssi, snr "
-            "FROM sensor_data WHERE node_id = %d "
-            "ORDER BY timestamp DESC LIMIT %d;", 
-            node_id, limit);
-    } else {
-        snprintf(sql, sizeof(sql), 
-            "SELECT "
-            "node_id, "
-            "datetime(timestamp, 'unixepoch', 'localtime') as time, "
-            "temperature, humidity, light, soil_moisture, rssi, snr "
-            "FROM sensor_data "
-            "ORDER BY timestamp DESC LIMIT %d;", 
-            limit);
+    db_reader_t *r = reader_checkout();
+    if (r == NULL) {
+        return -1;
     }
     
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        return NULL;
+    int reduce;
+    int lvl = range_source_level(r, q, start_time, &reduce);
+    
+    int64_t lo = start_time;
+    if (lvl >= 0) {
+        lo -= start_time % rollup_levels[lvl].bucket_sec;
+    }
+    if (q->after_ts >= lo) {
+        lo = q->after_ts + 1;
     }
     
-    cJSON *root = cJSON_CreateArray();
+    // Raw rows of a short window straight from the recent readings ring
+    archive_cursor_t cur = {0};
+    int from_ring = (lvl < 0 && archive_open_ring(&cur, q->node_id, lo) == 0);
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        cJSON *item = cJSON_CreateObject();
+    query_id_t query = lvl < 0 ? Q_RANGE_RAW : Q_RANGE_ROLLUP + lvl;
+    sqlite3_stmt *stmt = NULL;
+    if (!from_ring) {
+        if ((stmt = query_acquire(r, query)) == NULL) {
+            reader_checkin(r);
+            return -1;
+        }
+        sqlite3_bind_int(stmt, 1, q->node_id);
+        sqlite3_bind_int64(stmt, 2, lo);
+    }
+    
+    range_chunk_t *ch = malloc(sizeof(*ch));
+    if (ch == NULL) {
+        archive_close(&cur);
+        query_release(r, query, stmt);
+        reader_checkin(r);
+        return -1;
+    }
+    ch->buf[0] = '[';
+    ch->len = 1;
+    ch->rows = 0;
+    ch->seq = 0;
+    ch->emit = emit;
+    ch->ctx = ctx;
+    
+    // A downsampled range never needs more than one page
+    int max_points = q->max_points;
+    if (q->limit > 0 && max_points > q->limit) {
+        max_points = q->limit;
+    }
+    if (max_points > 0 && max_points < DB_RANGE_MIN_POINTS) {
+        max_points = DB_RANGE_MIN_POINTS;
+    }
+    ds_state_t ds;
+    if (reduce) {
+        ds_init(&ds, q->downsample == DB_DOWNSAMPLE_MINMAX ? DS_MINMAX : DS_LTTB,
+                q->field, lo, now, max_points, range_chunk_emit, ch);
+    }
+    
+    const ts_point_t *pt = NULL;
+    if (from_ring || (lvl < 0 && archive_open(&cur, r, q->node_id, lo, INT64_MAX, 0) == 0)) {
+        pt = archive_next(&cur);
+    }
+    
+    int count = 0, rc = 0;
+    int64_t last_ts = 0, next_after_ts = 0;
+    int have_row = (stmt && sqlite3_step(stmt) == SQLITE_ROW);
+    
+    while (rc == 0 && (have_row || pt)) {
+        ds_row_t row;
         
-        int col = 0;
-        if (node_id == 0) {
-            cJSON_AddNumberToObject(item, "node_id", sqlite3_column_int(stmt, col++));
+        if (pt && (!have_row || pt->timestamp <= sqlite3_column_int64(stmt, 0))) {
+            row.ts = pt->timestamp;
+            row.value[DS_FIELD_TEMPERATURE] = pt->temperature;
+            row.value[DS_FIELD_HUMIDITY] = pt->humidity;
+            row.value[DS_FIELD_LIGHT] = pt->light;
+            row.value[DS_FIELD_SOIL] = pt->soil_moisture;
+            row.rssi = pt->rssi;
+            row.snr = pt->snr;
+            row.samples = -1;
+            pt = archive_next(&cur);
+        } else {
+            row.ts = sqlite3_column_int64(stmt, 0);
+            for (int i = 0; i < DS_FIELDS; i++) {
+                row.value[i] = sqlite3_column_double(stmt, 1 + i);
+            }
+            row.rssi = sqlite3_column_double(stmt, 5);
+            row.snr = sqlite3_column_double(stmt, 6);
+            row.samples = lvl >= 0 ? sqlite3_column_int(stmt, 7) : -1;
+            have_row = (sqlite3_step(stmt) == SQLITE_ROW);
         }
         
-        cJSON_AddStringToObject(item, "time", 
-            (const char*)sqlite3_column_text(stmt, col++));
-        cJSON_AddNumberToObject(item, "temperature", 
-            sqlite3_column_double(stmt, col++));
-        cJSON_AddNumberToObject(item, "humidity", 
-            sqlite3_column_double(stmt, col++));
-        cJSON_AddNumberToObject(item, "light", 
-            sqlite3_column_int(stmt, col++));
-        cJSON_AddNumberToObject(item, "soil_moisture", 
-            sqlite3_column_int(stmt, col++));
-        cJSON_AddNumberToObject(item, "rssi", 
-            sqlite3_column_int(stmt, col++));
-        cJSON_AddNumberToObject(item, "snr", 
-            sqlite3_column_int(stmt, col++));
+        if (reduce) {
+            rc = ds_add(&ds, &row);
+            count++;
+            continue;
+        }
         
-        cJSON_AddItemToArray(root, item);
+        // Page full - but never split rows sharing a timestamp, the
+        // next page starts after it
+        if (q->limit > 0 && count >= q->limit && row.ts != last_ts) {
+            next_after_ts = last_ts;
+            break;
+        }
+        rc = range_chunk_add(ch, &row);
+        last_ts = row.ts;
+        count++;
     }
     
-    sqlite3_finalize(stmt);
+    archive_close(&cur);
+    query_release(r, query, stmt);
+    reader_checkin(r);
     
-    char *json_str = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
+    if (reduce) {
+        int ds_rc = ds_finish(&ds);
+        if (rc == 0) rc = ds_rc;
+        count = ds.rows_out;
+    }
+    if (rc == 0) {
+        rc = range_chunk_flush(ch, 1, next_after_ts);
+    }
+    free(ch);
     
-    return json_str;
+    return rc == 0 ? count : -1;
 }
 
-char* db_query_range_sensors(int node_id, int hours) {
-    time_t start_time = time(NULL) - (hours * 3600);
+/* Whole window as one JSON array (console and benchmarks) */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} range_collect_t;
+
+static int range_collect(const char *rows, size_t len, int seq, int last,
+                         int64_t next_after_ts, void *ctx) {
+    range_collect_t *out = ctx;
+    (void)last;
+    (void)next_after_ts;
+    
+    // Chunks are "[...]": keep the '[' of the first only, join with ','
+    const char *body = rows + 1;
+    size_t body_len = len - 2;
+    
+    if (out->len + body_len + 3 > out->cap) {
+        size_t cap = out->cap ? out->cap * 2 : DB_RANGE_CHUNK_BYTES;
+        while (cap < out->len + body_len + 3) cap *= 2;
+        char *buf = realloc(out->buf, cap);
+        if (buf == NULL) {
+            return -1;
+        }
+        out->buf = buf;
+        out->cap = cap;
+    }
     
-    char sql[512];
-    snprintf(sql, sizeof(sql), 
-        "SELECT "
-        "datetime(timestamp, 'unixepoch', 'localtime') as time, "
-        "temperature, humidity, light, soil_moisture, rssi, snr "
-        "FROM sensor_data WHERE node_id = %d AND timestamp >= %ld "
-        "ORDER BY timestamp ASC;", 
-        node_id, start_time);
+    out->buf[out->len++] = (seq == 0) ? '[' : ',';
+    if (seq > 0 && body_len == 0) {
+        out->len--;     // empty closing chunk
+    }
+    memcpy(out->buf + out->len, body, body_len);
+    out->len += body_len;
+    return 0;
+}
+
+char* db_query_range_sensors(int node_id, int hours, int max_points) {
+    db_range_query_t q = { .node_id = node_id, .hours = hours, .max_points = max_points };
+    range_collect_t out = {0};
     
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
+    if (db_stream_range_sensors(&q, range_collect, &out) < 0) {
+        free(out.buf);
         return NULL;
     }
+    out.buf[out.len++] = ']';
+    out.buf[out.len] = '\0';
+    return out.buf;
+}
+
+char* db_query_aggregate(int node_id, int hours) {
+    if (hours < 1 || hours > DB_QUERY_MAX_HOURS) {
+        hours = hours < 1 ? 1 : DB_QUERY_MAX_HOURS;
+    }
+    return db_query_aggregate_window(node_id, hours * 3600);
+}
+
+/* Same fields from the live window stats - the response must not depend
+ * on which path answered; NULL when the window is not all in memory */
+static char *live_aggregate(int node_id, int seconds) {
+    ns_summary_t s[NS_CHANNELS];
+    int complete = 0;
     
-    cJSON *root = cJSON_CreateArray();
+    if (!sensor_ring_on || node_stats_get(node_id, seconds, s, &complete) < 0 || !complete) {
+        return NULL;
+    }
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        cJSON *item = cJSON_CreateObject();
-        
-        cJSON_AddStringToObject(item, "time", 
-            (const char*)sqlite3_column_text(stmt, 0));
-        cJSON_AddNumberToObject(item, "temperature", 
-            sqlite3_column_double(stmt, 1));
-        cJSON_AddNumberToObject(item, "humidity", 
-            sqlite3_column_double(stmt, 2));
-        cJSON_AddNumberToObject(item, "light", 
-            sqlite3_column_int(stmt, 3));
-        cJSON_AddNumberToObject(item, "soil_moisture", 
-            sqlite3_column_int(stmt, 4));
-        cJSON_AddNumberToObject(item, "rssi", 
-            sqlite3_column_int(stmt, 5));
-        cJSON_AddNumberToObject(item, "snr", 
-            sqlite3_column_int(stmt, 6));
+    static const char *names[NS_CHANNELS] = { "temp", "hum", "light", "soil" };
+    cJSON *root = cJSON_CreateObject();
+    for (int c = 0; c < NS_CHANNELS; c++) {
+        char key[16];
+        int whole = (c == NS_LIGHT || c == NS_SOIL);
         
-        cJSON_AddItemToArray(root, item);
+        snprintf(key, sizeof(key), "avg_%s", names[c]);
+        cJSON_AddNumberToObject(root, key, s[c].mean);
+        snprintf(key, sizeof(key), "min_%s", names[c]);
+        cJSON_AddNumberToObject(root, key, whole ? (int)s[c].min : s[c].min);
+        snprintf(key, sizeof(key), "max_%s", names[c]);
+        cJSON_AddNumberToObject(root, key, whole ? (int)s[c].max : s[c].max);
     }
-    
-    sqlite3_finalize(stmt);
+    cJSON_AddNumberToObject(root, "record_count", (double)s[0].count);
     
     char *json_str = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
-    
     return json_str;
 }
 
-char* db_query_aggregate(int node_id, int hours) {
-    time_t start_time = time(NULL) - (hours * 3600);
+char* db_query_aggregate_window(int node_id, int seconds) {
+    char *live = live_aggregate(node_id, seconds);
+    if (live != NULL) {
+        return live;
+    }
     
-    char sql[512];
-    snprintf(sql, sizeof(sql), 
-        "SELECT "
-        "AVG(temperature) as avg_temp, "
-        "MIN(temperature) as min_temp, "
-        "MAX(temperature) as max_temp, "
-        "AVG(humidity) as avg_hum, "
-        "MIN(humidity) as min_hum, "
-        "MAX(humidity) as max_hum, "
-        "AVG(light) as avg_light, "
-        "MIN(light) as min_light, "
-        "MAX(light) as max_light, "
-        "AVG(soil_moisture) as avg_soil, "
-        "MIN(soil_moisture) as min_soil, "
-        "MAX(soil_moisture) as max_soil, "
-        "COUNT(*) as record_count "
-        "FROM sensor_data WHERE node_id = %d AND timestamp >= %ld;", 
-        node_id, start_time);
+    time_t start_time = time(NULL) - seconds;
     
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
+    db_reader_t *r = reader_checkout();
+    if (r == NULL) {
         return NULL;
     }
     
-    cJSON *root = cJSON_CreateObject();
+    rollup_acc_t acc = {0};
+    rollup_aggregate(r, node_id, start_time, &acc);
+    reader_checkin(r);
     
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        cJSON_AddNumberToObject(root, "avg_temp", sqlite3_column_double(stmt, 0));
-        cJSON_AddNumberToObject(root, "min_temp", sqlite3_column_double(stmt, 1));
-        cJSON_AddNumberToObject(root, "max_temp", sqlite3_column_double(stmt, 2));
-        cJSON_AddNumberToObject(root, "avg_hum", sqlite3_column_double(stmt, 3));
-        cJSON_AddNumberToObject(root, "min_hum", sqlite3_column_double(stmt, 4));
-        cJSON_AddNumberToObject(root, "max_hum", sqlite3_column_double(stmt, 5));
-        cJSON_AddNumberToObject(root, "avg_light", sqlite3_column_double(stmt, 6));
-        cJSON_AddNumberToObject(root, "min_light", sqlite3_column_int(stmt, 7));
-        cJSON_AddNumberToObject(root, "max_light", sqlite3_column_int(stmt, 8));
-        cJSON_AddNumberToObject(root, "avg_soil", sqlite3_column_double(stmt, 9));
-        cJSON_AddNumberToObject(root, "min_soil", sqlite3_column_int(stmt, 10));
-        cJSON_AddNumberToObject(root, "max_soil", sqlite3_column_int(stmt, 11));
-        cJSON_AddNumberToObject(root, "record_count", sqlite3_column_int(stmt, 12));
-    }
+    // Empty window reports zeros, like AVG/MIN/MAX over no rows did
+    double n = acc.count > 0 ? (double)acc.count : 1.0;
     
-    sqlite3_finalize(stmt);
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "avg_temp", acc.temp_sum / n);
+    cJSON_AddNumberToObject(root, "min_temp", acc.temp_min);
+    cJSON_AddNumberToObject(root, "max_temp", acc.temp_max);
+    cJSON_AddNumberToObject(root, "avg_hum", acc.hum_sum / n);
+    cJSON_AddNumberToObject(root, "min_hum", acc.hum_min);
+    cJSON_AddNumberToObject(root, "max_hum", acc.hum_max);
+    cJSON_AddNumberToObject(root, "avg_light", acc.light_sum / n);
+    cJSON_AddNumberToObject(root, "min_light", (int)acc.light_min);
+    cJSON_AddNumberToObject(root, "max_light", (int)acc.light_max);
+    cJSON_AddNumberToObject(root, "avg_soil", acc.soil_sum / n);
+    cJSON_AddNumberToObject(root, "min_soil", (int)acc.soil_min);
+    cJSON_AddNumberToObject(root, "max_soil", (int)acc.soil_max);
+    cJSON_AddNumberToObject(root, "record_count", (double)acc.count);
     
     char *json_str = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
@@ -495,20 +1810,17 @@ char* db_query_aggregate(int node_id, int hours) {
 }
 
 char* db_query_actuator_history(int node_id, int limit) {
-    char sql[512];
-    snprintf(sql, sizeof(sql), 
-        "SELECT "
-        "datetime(timestamp, 'unixepoch', 'localtime') as time, "
-        "actuator, state, trigger_type, trigger_value "
-        "FROM actuator_logs WHERE node_id = %d "
-        "ORDER BY timestamp DESC LIMIT %d;", 
-        node_id, limit);
-    
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
+    db_reader_t *r = reader_checkout();
+    if (r == NULL) {
+        return NULL;
+    }
+    sqlite3_stmt *stmt = query_acquire(r, Q_ACTUATOR_HISTORY);
+    if (stmt == NULL) {
+        reader_checkin(r);
         return NULL;
     }
+    sqlite3_bind_int(stmt, 1, node_id);
+    sqlite3_bind_int(stmt, 2, limit);
     
     cJSON *root = cJSON_CreateArray();
     
@@ -529,7 +1841,8 @@ char* db_query_actuator_history(int node_id, int limit) {
         cJSON_AddItemToArray(root, item);
     }
     
-    sqlite3_finalize(stmt);
+    query_release(r, Q_ACTUATOR_HISTORY, stmt);
+    reader_checkin(r);
     
     char *json_str = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
@@ -538,46 +1851,46 @@ char* db_query_actuator_history(int node_id, int limit) {
 }
 
 char* db_query_stats(void) {
-    cJSON *root = cJSON_CreateObject();
-    
-    const char *sql = "SELECT COUNT(*) FROM sensor_data";
-    sqlite3_stmt *stmt;
-    
-    sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        cJSON_AddNumberToObject(root, "total_sensors", sqlite3_column_int(stmt, 0));
+    db_reader_t *r = reader_checkout();
+    if (r == NULL) {
+        return NULL;
     }
-    sqlite3_finalize(stmt);
-    
-    sql = "SELECT COUNT(*) FROM actuator_logs";
-    sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        cJSON_AddNumberToObject(root, "total_actuators", sqlite3_column_int(stmt, 0));
+    sqlite3_stmt *stmt = query_acquire(r, Q_TOTALS);
+    if (stmt == NULL) {
+        reader_checkin(r);
+        return NULL;
     }
-    sqlite3_finalize(stmt);
     
-    sql = "SELECT COUNT(*) FROM command_history";
-    sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
+    cJSON *root = cJSON_CreateObject();
+    
     if (sqlite3_step(stmt) == SQLITE_ROW) {
-        cJSON_AddNumberToObject(root, "total_commands", sqlite3_column_int(stmt, 0));
+        cJSON_AddNumberToObject(root, "total_sensors", 
+            sqlite3_column_int(stmt, 0) + sqlite3_column_int(stmt, 4));
+        cJSON_AddNumberToObject(root, "archived_sensors", sqlite3_column_int(stmt, 4));
+        cJSON_AddNumberToObject(root, "total_actuators", sqlite3_column_int(stmt, 1));
+        cJSON_AddNumberToObject(root, "total_commands", sqlite3_column_int(stmt, 2));
     }
-    sqlite3_finalize(stmt);
+    query_release(r, Q_TOTALS, stmt);
     
-    sql = "SELECT node_id, datetime(MAX(timestamp), 'unixepoch', 'localtime') as last_update, "
-          "COUNT(*) as count FROM sensor_data GROUP BY node_id";
-    sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
+    stmt = query_acquire(r, Q_NODE_STATS);
     
     cJSON *nodes = cJSON_CreateArray();
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    for (int node_id = 1; stmt && node_id <= MAX_NODES; node_id++) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int(stmt, 1, node_id);
+        if (sqlite3_step(stmt) != SQLITE_ROW || sqlite3_column_int(stmt, 1) == 0) {
+            continue;
+        }
         cJSON *node = cJSON_CreateObject();
-        cJSON_AddNumberToObject(node, "node_id", sqlite3_column_int(stmt, 0));
+        cJSON_AddNumberToObject(node, "node_id", node_id);
         cJSON_AddStringToObject(node, "last_update", 
-            (const char*)sqlite3_column_text(stmt, 1));
-        cJSON_AddNumberToObject(node, "record_count", sqlite3_column_int(stmt, 2));
+            (const char*)sqlite3_column_text(stmt, 0));
+        cJSON_AddNumberToObject(node, "record_count", sqlite3_column_int(stmt, 1));
         cJSON_AddItemToArray(nodes, node);
     }
     cJSON_AddItemToObject(root, "nodes", nodes);
-    sqlite3_finalize(stmt);
+    query_release(r, Q_NODE_STATS, stmt);
+    reader_checkin(r);
     
     char *json_str = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
@@ -589,20 +1902,34 @@ char* db_query_stats(void) {
  * DATABASE DISPLAY FUNCTIONS - For console output
  *====================================================================*/
 
-void db_show_recent_data(int node_id, int limit) {
-    char sql[512];
-    snprintf(sql, sizeof(sql), 
-        "SELECT datetime(timestamp, 'unixepoch', 'localtime'), "
-        "temperature, humidity, light, soil_moisture, rssi "
-        "FROM sensor_data WHERE node_id = %d "
-        "ORDER BY timestamp DESC LIMIT %d;", 
-        node_id, limit);
+static void show_recent_row(int64_t timestamp, double temp, double hum,
+                            int light, int soil, int rssi) {
+    char time_buf[32];
+    const char *time = format_local_time(timestamp, time_buf, sizeof(time_buf));
     
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Query failed: %s\n", sqlite3_errmsg(db_state.db));
-        return;
+    printf("║ %s  %.1f°C %.1f%%  %-5d  %-5d  %ddBm  ║\n",
+           time, temp, hum, light, soil, rssi);
+}
+
+void db_show_recent_data(int node_id, int limit) {
+    ts_point_t *pts = NULL;
+    int *node_ids = NULL;
+    int n = node_id > 0 ? ring_latest(node_id, limit, &pts, &node_ids) : -1;
+    
+    db_reader_t *r = NULL;
+    sqlite3_stmt *stmt = NULL;
+    if (n < 0) {
+        if ((r = reader_checkout()) == NULL) {
+            fprintf(stderr, "Query failed: database not open\n");
+            return;
+        }
+        if ((stmt = query_acquire(r, Q_LATEST_NODE)) == NULL) {
+            fprintf(stderr, "Query failed: %s\n", sqlite3_errmsg(r->db));
+            reader_checkin(r);
+            return;
+        }
+        sqlite3_bind_int(stmt, 1, node_id);
+        sqlite3_bind_int(stmt, 2, limit);
     }
     
     printf("\n╔═══════════════════════════════════════════════════════════╗\n");
@@ -613,16 +1940,18 @@ void db_show_recent_data(int node_id, int limit) {
     printf("╠═══════════════════════════════════════════════════════════╣\n");
     
     int count = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *time = (const char *)sqlite3_column_text(stmt, 0);
-        double temp = sqlite3_column_double(stmt, 1);
-        double hum = sqlite3_column_double(stmt, 2);
-        int light = sqlite3_column_int(stmt, 3);
-        int soil = sqlite3_column_int(stmt, 4);
-        int rssi = sqlite3_column_int(stmt, 5);
-        
-        printf("║ %s  %.1f°C %.1f%%  %-5d  %-5d  %ddBm  ║\n",
-               time, temp, hum, light, soil, rssi);
+    for (; count < n; count++) {
+        show_recent_row(pts[count].timestamp, pts[count].temperature,
+                        pts[count].humidity, pts[count].light,
+                        pts[count].soil_moisture, pts[count].rssi);
+    }
+    while (stmt && sqlite3_step(stmt) == SQLITE_ROW) {
+        show_recent_row(sqlite3_column_int64(stmt, 0),
+                        sqlite3_column_double(stmt, 1),
+                        sqlite3_column_double(stmt, 2),
+                        sqlite3_column_int(stmt, 3),
+                        sqlite3_column_int(stmt, 4),
+                        sqlite3_column_int(stmt, 5));
         count++;
     }
     
@@ -632,20 +1961,24 @@ void db_show_recent_data(int node_id, int limit) {
     
     printf("╚═══════════════════════════════════════════════════════════╝\n\n");
     
-    sqlite3_finalize(stmt);
+    free(pts);
+    free(node_ids);
+    if (r) {
+        query_release(r, Q_LATEST_NODE, stmt);
+        reader_checkin(r);
+    }
 }
 
 void db_show_statistics(void) {
-    const char *sql_count = 
-        "SELECT "
-        "(SELECT COUNT(*) FROM sensor_data) as sensor_count,"
-        "(SELECT COUNT(*) FROM actuator_logs) as actuator_count,"
-        "(SELECT COUNT(*) FROM command_history) as command_count;";
-    
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db_state.db, sql_count, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
+    db_reader_t *r = reader_checkout();
+    if (r == NULL) {
+        fprintf(stderr, "Statistics query failed\n");
+        return;
+    }
+    sqlite3_stmt *stmt = query_acquire(r, Q_TOTALS);
+    if (stmt == NULL) {
         fprintf(stderr, "Statistics query failed\n");
+        reader_checkin(r);
         return;
     }
     
@@ -657,71 +1990,388 @@ void db_show_statistics(void) {
         int sensor_count = sqlite3_column_int(stmt, 0);
         int actuator_count = sqlite3_column_int(stmt, 1);
         int command_count = sqlite3_column_int(stmt, 2);
+        int partition_count = sqlite3_column_int(stmt, 3);
+        int archived_count = sqlite3_column_int(stmt, 4);
+        int archived_kb = (int)(sqlite3_column_int64(stmt, 5) / 1024);
         
         printf("║ Sensor records:    %8d      ║\n", sensor_count);
+        printf("║ Sensor partitions: %8d      ║\n", partition_count);
+        printf("║ Archived records:  %8d      ║\n", archived_count);
+        printf("║ Archive size:      %8d KB   ║\n", archived_kb);
         printf("║ Actuator logs:     %8d      ║\n", actuator_count);
         printf("║ Command history:   %8d      ║\n", command_count);
     }
+    query_release(r, Q_TOTALS, stmt);
+    reader_checkin(r);
     
     printf("║ Total inserts:     %8u      ║\n", db_state.total_inserts);
     printf("║ Insert errors:     %8u      ║\n", db_state.insert_errors);
+    printf("╠═══════════════════════════════════╣\n");
+    printf("║ Insert rate:       %8.1f/s    ║\n", db_state.insert_rate);
+    printf("║ Queue depth:       %8u      ║\n", db_state.queue_depth);
+    printf("║ Queue high water:  %8u      ║\n", db_state.queue_high_water);
+    printf("║ Queue drops:       %8u      ║\n", db_state.queue_drops);
+    printf("║ Commits:           %8u      ║\n", db_state.commit_count);
+    printf("║ Commit errors:     %8u      ║\n", db_state.commit_errors);
+    printf("║ Last batch rows:   %8u      ║\n", db_state.last_batch_rows);
+    printf("║ Commit avg/max ms: %5.1f/%-6.1f  ║\n",
+           db_state.commit_count > 0 ?
+           db_state.commit_time_total_us / 1000.0 / db_state.commit_count : 0.0,
+           db_state.commit_time_max_us / 1000.0);
+    printf("║ Checkpoints/busy:  %6u/%-6u  ║\n",
+           db_state.checkpoint_count, db_state.checkpoint_busy);
+    printf("║ Checkpoint max ms: %8.1f      ║\n", db_state.checkpoint_time_max_us / 1000.0);
+    printf("║ WAL now/max KB:  %7llu/%-7llu ║\n",
+           (unsigned long long)(db_state.wal_bytes / 1024),
+           (unsigned long long)(db_state.wal_bytes_max / 1024));
+    printf("╠═══════════════════════════════════╣\n");
+    printf("║ Queries/rejected:  %6u/%-6u  ║\n",
+           db_state.query_count, db_state.query_rejects);
+    printf("║ Query queue:       %8u      ║\n", db_state.query_queue_depth);
+    printf("║ Query max ms:      %8.1f      ║\n", db_state.query_time_max_us / 1000.0);
+    printf("║ Cache hits/misses: %6u/%-6u  ║\n",
+           db_state.cache_hits, db_state.cache_misses);
+    printf("╠═══════════════════════════════════╣\n");
+    if (db_state.backup_running) {
+        printf("║ Backup:            %7d%%      ║\n", db_state.backup_percent);
+    }
+    printf("║ Backups/errors:    %4u/%-4u     ║\n",
+           db_state.backup_count, db_state.backup_errors);
+    printf("║ Last backup:  %6.1f s %6llu KB ║\n",
+           db_state.backup_last_ms / 1000.0,
+           (unsigned long long)(db_state.backup_last_bytes / 1024));
     printf("╚═══════════════════════════════════╝\n\n");
+}
+
+/*====================================================================
+ * QUERY PLAN CHECKS
+ * EXPLAIN QUERY PLAN for every statement in query_defs. A full table
+ * scan or a temp B-tree sort means an index stopped being used.
+ * Scanning the co-routine that feeds rows out of the sensor_data
+ * view is fine - each partition inside it is checked separately.
+ *====================================================================*/
+
+/* Returns number of queries whose plan regressed (0 = all good),
+ * -1 if the database is not open */
+int db_check_query_plans(int verbose) {
+    int regressions = 0;
+    char sql[1024];
+    
+    db_reader_t *r = reader_checkout();
+    if (r == NULL) return -1;
+    
+    for (int i = 0; i < Q_COUNT; i++) {
+        if (query_defs[i].full_scan) continue;
+        snprintf(sql, sizeof(sql), "EXPLAIN QUERY PLAN %s", query_defs[i].sql);
+        
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(r->db, sql, -1, &stmt, 0) != SQLITE_OK) {
+            fprintf(stderr, "✗ Plan %s: %s\n", query_defs[i].name, 
+                    sqlite3_errmsg(r->db));
+            regressions++;
+            continue;
+        }
+        
+        int bad = 0;
+        char coroutines[256] = "|";     // "|name|name|" - scanning these is fine
+        char scanned[80];
+        if (verbose) {
+            printf("%s:\n", query_defs[i].name);
+        }
+        
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+            if (detail == NULL) continue;
+            
+            if (strncmp(detail, "CO-ROUTINE ", 11) == 0) {
+                size_t used = strlen(coroutines);
+                snprintf(coroutines + used, sizeof(coroutines) - used, "%s|", detail + 11);
+            }
+            
+            snprintf(scanned, sizeof(scanned), "|%s|", detail + (strlen(detail) > 5 ? 5 : 0));
+            int full_scan = (strncmp(detail, "SCAN ", 5) == 0 && 
+                             strstr(detail, "INDEX") == NULL &&
+                             strstr(coroutines, scanned) == NULL);
+            int temp_sort = (strstr(detail, "TEMP B-TREE") != NULL);
+            
+            if (full_scan || temp_sort) bad = 1;
+            if (verbose) {
+                printf("  %s %s\n", (full_scan || temp_sort) ? "✗" : "✓", detail);
+            }
+        }
+        sqlite3_finalize(stmt);
+        
+        if (bad) {
+            regressions++;
+            if (!verbose) {
+                fprintf(stderr, "✗ Query plan regression: %s\n", 
+                        query_defs[i].name);
+            }
+        }
+    }
     
-    sqlite3_finalize(stmt);
+    reader_checkin(r);
+    return regressions;
 }
 
 /*====================================================================
  * DATABASE MAINTENANCE
  *====================================================================*/
 
+/*
+ * Queue a retention pass for the writer thread: partitions that end
+ * before the cutoff are dropped whole (db_partition_drop_before), so
+ * the CLI/RX thread never waits on a DELETE or VACUUM.
+ */
 int db_cleanup_old_data(int days_to_keep) {
-    time_t cutoff_time = time(NULL) - (days_to_keep * 24 * 3600);
+    db_record_t rec;
+    rec.type = DB_REC_RETENTION;
+    rec.timestamp = time(NULL) - (days_to_keep * 24 * 3600);
+    rec.node_id = 0;
     
-    char sql[256];
-    snprintf(sql, sizeof(sql), 
-             "DELETE FROM sensor_data WHERE timestamp < %ld;", cutoff_time);
+    if (db_writer_enqueue(&rec) < 0) {
+        fprintf(stderr, "Cleanup failed: writer queue full\n");
+        return -1;
+    }
     
-    int rc = sqlite3_exec(db_state.db, sql, 0, 0, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Cleanup failed: %s\n", sqlite3_errmsg(db_state.db));
+    printf("✓ Cleanup queued (keep last %d days, whole %d-day partitions)\n",
+           days_to_keep, DB_PARTITION_DAYS);
+    return 0;
+}
+
+/* Same, for re-encoding closed partitions into sensor_archive */
+int db_archive_old_data(int days_hot) {
+    db_record_t rec;
+    rec.type = DB_REC_ARCHIVE;
+    rec.timestamp = time(NULL) - (days_hot * 24 * 3600);
+    rec.node_id = 0;
+    
+    if (db_writer_enqueue(&rec) < 0) {
+        fprintf(stderr, "Archive failed: writer queue full\n");
         return -1;
     }
+    return 0;
+}
+
+/* Oldest partition that ends at or before cutoff, 0 if none */
+static int partition_next_before(time_t cutoff, char *name, size_t len) {
+    sqlite3_stmt *stmt;
+    int found = 0;
     
-    int deleted = sqlite3_changes(db_state.db);
-    printf("✓ Cleaned up %d old records (kept last %d days)\n", deleted, days_to_keep);
+    sqlite3_prepare_v2(db_state.db,
+        "SELECT name FROM sensor_partitions WHERE end_ts <= ? "
+        "ORDER BY start_ts LIMIT 1;", -1, &stmt, 0);
+    sqlite3_bind_int64(stmt, 1, cutoff);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        snprintf(name, len, "%s", (const char *)sqlite3_column_text(stmt, 0));
+        found = 1;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+/* Inside a transaction: drop the table, its catalog row and the view arm */
+static int partition_drop(const char *name, time_t cutoff) {
+    char sql[256];
     
-    sqlite3_exec(db_state.db, "VACUUM;", 0, 0, 0);
+    snprintf(sql, sizeof(sql),
+             "DROP TABLE IF EXISTS %s;"
+             "DELETE FROM sensor_partitions WHERE name = '%s';", name, name);
+    if (partition_exec(sql, "Drop partition") < 0) {
+        return -1;
+    }
     
-    return deleted;
+    // The current partition can't expire, but never keep a
+    // statement on a dropped table
+    if (db_state.part_end <= cutoff) {
+        db_state.part_start = db_state.part_end = 0;
+    }
+    return partition_rebuild_view();
 }
 
-int db_backup(void) {
-    char backup_path[256];
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
+static int freelist_count(void) {
+    sqlite3_stmt *stmt;
+    int pages = 0;
     
-    strftime(backup_path, sizeof(backup_path), 
-             "/home/debian/backups/lora_gateway_%Y%m%d_%H%M%S.db", t);
+    sqlite3_prepare_v2(db_state.db, "PRAGMA freelist_count;", -1, &stmt, 0);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        pages = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return pages;
+}
+
+/*
+ * Short autocommit steps so readers and the WAL never see one large
+ * truncation. No-op unless auto_vacuum=INCREMENTAL; returns pages.
+ */
+static int release_free_pages(void) {
+    char sql[64];
+    int pages = 0;
+    int freelist = freelist_count();
+    
+    while (freelist > 0) {
+        snprintf(sql, sizeof(sql), "PRAGMA incremental_vacuum(%d);", DB_VACUUM_STEP_PAGES);
+        sqlite3_exec(db_state.db, sql, 0, 0, 0);
+        
+        int left = freelist_count();
+        if (left >= freelist) break;    // auto_vacuum off: pages stay for reuse
+        pages += freelist - left;
+        freelist = left;
+    }
+    return pages;
+}
+
+/* One bound DELETE with ?1 = cutoff; 0, or -1 */
+static int retention_delete(const char *sql, time_t cutoff) {
+    sqlite3_stmt *stmt;
     
-    system("mkdir -p /home/debian/backups");
+    if (sqlite3_prepare_v2(db_state.db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        fprintf(stderr, "✗ Retention: %s\n", sqlite3_errmsg(db_state.db));
+        return -1;
+    }
+    sqlite3_bind_int64(stmt, 1, cutoff);
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "✗ Retention: %s\n", sqlite3_errmsg(db_state.db));
+    }
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+/*
+ * Writer thread only, outside a batch transaction. Cost is one
+ * DROP TABLE per expired partition regardless of row count; freed
+ * pages are reused by new partitions, and handed back to the OS a
+ * step at a time when the file uses incremental auto-vacuum.
+ */
+int db_partition_drop_before(time_t cutoff) {
+    char name[32];
+    char sql[256];
+    int dropped = 0;
     
-    sqlite3 *backup_db;
-    int rc = sqlite3_open(backup_path, &backup_db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Cannot create backup\n");
+    if (partition_exec("BEGIN;", "Retention") < 0) {
         return -1;
     }
     
-    sqlite3_backup *backup_obj = sqlite3_backup_init(backup_db, "main", 
-                                                      db_state.db, "main");
-    if (backup_obj) {
-        sqlite3_backup_step(backup_obj, -1);
-        sqlite3_backup_finish(backup_obj);
-        printf("✓ Database backed up: %s\n", backup_path);
+    while (partition_next_before(cutoff, name, sizeof(name))) {
+        if (partition_drop(name, cutoff) < 0) {
+            sqlite3_exec(db_state.db, "ROLLBACK;", 0, 0, 0);
+            return -1;
+        }
+        printf("✓ Dropped partition %s\n", name);
+        dropped++;
+    }
+    
+    // Minute rollups and archive blocks age out with the raw data, for
+    // every node id; hour/day rollups are kept. The rollup delete scans
+    // the table once per pass rather than indexing bucket for every upsert
+    snprintf(sql, sizeof(sql), "DELETE FROM %s WHERE bucket < ?1;", rollup_levels[0].table);
+    if (retention_delete(sql, cutoff) < 0 ||
+        retention_delete("DELETE FROM sensor_archive WHERE end_ts < ?1;", cutoff) < 0) {
+        sqlite3_exec(db_state.db, "ROLLBACK;", 0, 0, 0);
+        return -1;
     }
     
-    sqlite3_close(backup_db);
-    db_state.last_backup_time = now;
+    if (partition_exec("COMMIT;", "Retention") < 0) {
+        sqlite3_exec(db_state.db, "ROLLBACK;", 0, 0, 0);
+        return -1;
+    }
     
+    int pages = release_free_pages();
+    printf("✓ Retention: %d partition(s) dropped, %d pages released\n", dropped, pages);
+    return dropped;
+}
+
+static int archive_flush(sqlite3_stmt *ins, int node_id, 
+                         const ts_point_t *pts, int n, long *bytes) {
+    static uint8_t block[TS_BLOCK_MAX_BYTES(TS_BLOCK_MAX_POINTS)];
+    
+    size_t len = ts_block_encode(pts, n, block, sizeof(block));
+    if (len == 0) return -1;
+    
+    sqlite3_reset(ins);
+    sqlite3_bind_int(ins, 1, node_id);
+    sqlite3_bind_int64(ins, 2, pts[0].timestamp);
+    sqlite3_bind_int64(ins, 3, pts[n - 1].timestamp);
+    sqlite3_bind_int(ins, 4, n);
+    sqlite3_bind_blob(ins, 5, block, (int)len, SQLITE_STATIC);
+    if (sqlite3_step(ins) != SQLITE_DONE) return -1;
+    
+    *bytes += (long)len;
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Writer thread only, outside a batch transaction. Each partition
+ * that ended before the cutoff is read once in (node, time) order
+ * off its covering index, written as blocks of up to
+ * TS_BLOCK_MAX_POINTS and dropped - one transaction per partition.
+ */
+int db_partition_archive_before(time_t cutoff) {
+    static ts_point_t pts[TS_BLOCK_MAX_POINTS];
+    char name[32];
+    char sql[256];
+    int archived = 0;
+    
+    while (partition_next_before(cutoff, name, sizeof(name))) {
+        sqlite3_stmt *sel, *ins;
+        long rows = 0, bytes = 0;
+        int n = 0, node_id = 0, rc = 0;
+        
+        if (partition_exec("BEGIN;", "Archive") < 0) {
+            return -1;
+        }
+        
+        snprintf(sql, sizeof(sql), 
+                 "SELECT " SENSOR_COLUMNS " FROM %s ORDER BY node_id, timestamp;", name);
+        sqlite3_prepare_v2(db_state.db, sql, -1, &sel, 0);
+        sqlite3_prepare_v2(db_state.db, 
+            "INSERT INTO sensor_archive VALUES (?, ?, ?, ?, ?);", -1, &ins, 0);
+        
+        while (rc == 0 && sqlite3_step(sel) == SQLITE_ROW) {
+            int row_node = sqlite3_column_int(sel, 1);
+            if (n > 0 && (row_node != node_id || n == TS_BLOCK_MAX_POINTS)) {
+                rc = archive_flush(ins, node_id, pts, n, &bytes);
+                n = 0;
+            }
+            node_id = row_node;
+            
+            ts_point_t *pt = &pts[n++];
+            pt->timestamp = sqlite3_column_int64(sel, 0);
+            pt->temperature = (float)sqlite3_column_double(sel, 2);
+            pt->humidity = (float)sqlite3_column_double(sel, 3);
+            pt->light = sqlite3_column_int(sel, 4);
+            pt->soil_moisture = sqlite3_column_int(sel, 5);
+            pt->rssi = sqlite3_column_int(sel, 6);
+            pt->snr = sqlite3_column_int(sel, 7);
+            rows++;
+        }
+        if (rc == 0 && n > 0) {
+            rc = archive_flush(ins, node_id, pts, n, &bytes);
+        }
+        sqlite3_finalize(sel);
+        sqlite3_finalize(ins);
+        
+        if (rc < 0 || partition_drop(name, cutoff) < 0 ||
+            partition_exec("COMMIT;", "Archive") < 0) {
+            fprintf(stderr, "✗ Archive %s failed: %s\n", name, sqlite3_errmsg(db_state.db));
+            sqlite3_exec(db_state.db, "ROLLBACK;", 0, 0, 0);
+            return -1;
+        }
+        
+        printf("✓ Archived %s: %ld rows -> %ld KB\n", name, rows, bytes / 1024);
+        archived++;
+    }
+    
+    if (archived > 0) {
+        int pages = release_free_pages();
+        printf("✓ Archive: %d partition(s), %d pages released\n", archived, pages);
+    }
+    return archived;
+}
+
+/* Runs in the background (db_backup.c); -1 if one is already running */
+int db_backup(void) {
+    return db_backup_start();
+}
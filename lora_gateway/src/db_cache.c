@@ -0,0 +1,147 @@
+/*
+ * src/db_cache.c - db/query Result Cache
+ * A small fixed table, least recently used entry replaced. A hit is a
+ * memcpy of the bytes a miss would have produced; no SQL, no JSON.
+ */
+
+#include "db_cache.h"
+#include "database.h"
+#include "gateway.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct {
+    char key[DB_CACHE_KEY_LEN];
+    int scope;                  // node id, 0 = all nodes
+    uint32_t generation;
+    uint64_t created_us;
+    uint64_t used;              // LRU clock
+    char *data;
+    size_t len;
+} cache_entry_t;
+
+static cache_entry_t entries[DB_CACHE_ENTRIES];
+static uint32_t generations[MAX_NODES + 1];
+static uint64_t use_clock = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int cache_scope(int node_id) {
+    return (node_id >= 1 && node_id <= MAX_NODES) ? node_id : 0;
+}
+
+uint32_t db_cache_generation(int node_id) {
+    pthread_mutex_lock(&cache_lock);
+    uint32_t gen = generations[cache_scope(node_id)];
+    pthread_mutex_unlock(&cache_lock);
+    return gen;
+}
+
+static void entry_free(cache_entry_t *e) {
+    free(e->data);
+    memset(e, 0, sizeof(*e));
+}
+
+char *db_cache_get(const char *key, int node_id) {
+    int scope = cache_scope(node_id);
+    uint64_t now_us = get_monotonic_us();
+    char *copy = NULL;
+
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < DB_CACHE_ENTRIES; i++) {
+        cache_entry_t *e = &entries[i];
+        if (e->data == NULL || e->scope != scope || strcmp(e->key, key) != 0) {
+            continue;
+        }
+        // Windowed results move with the clock even when no rows arrive
+        if (e->generation != generations[scope] ||
+            now_us - e->created_us > DB_CACHE_TTL_MS * 1000ULL) {
+            entry_free(e);
+            break;
+        }
+        copy = malloc(e->len + 1);
+        if (copy) {
+            memcpy(copy, e->data, e->len + 1);
+            e->used = ++use_clock;
+        }
+        break;
+    }
+    if (copy) {
+        db_state.cache_hits++;
+    } else {
+        db_state.cache_misses++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    return copy;
+}
+
+void db_cache_put(const char *key, int node_id, uint32_t generation, const char *data) {
+    int scope = cache_scope(node_id);
+    size_t len = strlen(data);
+
+    if (len > DB_CACHE_MAX_BYTES || strlen(key) >= DB_CACHE_KEY_LEN) {
+        return;
+    }
+    char *copy = malloc(len + 1);
+    if (copy == NULL) {
+        return;
+    }
+    memcpy(copy, data, len + 1);
+
+    pthread_mutex_lock(&cache_lock);
+
+    // Already stale - a commit landed while the query ran
+    if (generation != generations[scope]) {
+        pthread_mutex_unlock(&cache_lock);
+        free(copy);
+        return;
+    }
+
+    // Same key (two workers raced on a miss), else a free or the LRU slot
+    cache_entry_t *slot = &entries[0];
+    for (int i = 0; i < DB_CACHE_ENTRIES; i++) {
+        cache_entry_t *e = &entries[i];
+        if (e->data && e->scope == scope && strcmp(e->key, key) == 0) {
+            slot = e;
+            break;
+        }
+        if (slot->data && (e->data == NULL || e->used < slot->used)) {
+            slot = e;
+        }
+    }
+    entry_free(slot);
+
+    strcpy(slot->key, key);
+    slot->scope = scope;
+    slot->generation = generation;
+    slot->created_us = get_monotonic_us();
+    slot->used = ++use_clock;
+    slot->data = copy;
+    slot->len = len;
+
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void db_cache_invalidate(uint32_t node_mask) {
+    pthread_mutex_lock(&cache_lock);
+    generations[0]++;
+    for (int node = 1; node <= MAX_NODES; node++) {
+        if (node_mask & (1u << node)) {
+            generations[node]++;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void db_cache_clear(void) {
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < DB_CACHE_ENTRIES; i++) {
+        entry_free(&entries[i]);
+    }
+    for (int i = 0; i <= MAX_NODES; i++) {
+        generations[i]++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,209 @@
+/*
+ * src/db_checkpoint.c - Background WAL Checkpoints
+ * The writer connection's WAL hook only records how many frames the
+ * WAL holds and wakes this thread; the checkpoint itself runs here,
+ * on a separate connection, so commits stay flat. PASSIVE never
+ * waits for readers or the writer. TRUNCATE (which does) is only
+ * tried once no commit has happened for DB_CHECKPOINT_IDLE_MS, and
+ * takes the WAL file back to zero bytes.
+ */
+
+#include "db_checkpoint.h"
+#include "database.h"
+#include "gateway.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+static pthread_t checkpoint_thread;
+static int checkpoint_running = 0;
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t checkpoint_cond = PTHREAD_COND_INITIALIZER;
+
+static sqlite3 *checkpoint_db = NULL;
+static char wal_path[300];
+static int threshold_pages;
+
+/* Under checkpoint_lock */
+static int wal_frames = 0;          // frames in the WAL, from the last commit
+static int backfilled = 0;          // of those, already copied to the database
+static uint64_t last_commit_us = 0;
+
+/* Writer thread, after every commit */
+static int checkpoint_wal_hook(void *arg, sqlite3 *db, const char *name, int frames) {
+    (void)arg;
+    (void)db;
+    (void)name;
+
+    pthread_mutex_lock(&checkpoint_lock);
+    if (frames < wal_frames) {
+        backfilled = 0;             // WAL restarted from the beginning
+    }
+    wal_frames = frames;
+    last_commit_us = get_monotonic_us();
+    if (wal_frames - backfilled >= threshold_pages) {
+        pthread_cond_signal(&checkpoint_cond);
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+    return SQLITE_OK;
+}
+
+static void checkpoint_run(int mode, int frames_seen) {
+    int log = 0, copied = 0;
+    uint64_t start = get_monotonic_us();
+
+    int rc = sqlite3_wal_checkpoint_v2(checkpoint_db, NULL, mode, &log, &copied);
+
+    uint32_t elapsed = (uint32_t)(get_monotonic_us() - start);
+    db_state.checkpoint_count++;
+    db_state.checkpoint_time_last_us = elapsed;
+    if (elapsed > db_state.checkpoint_time_max_us) {
+        db_state.checkpoint_time_max_us = elapsed;
+    }
+
+    if (rc == SQLITE_BUSY) {
+        db_state.checkpoint_busy++;     // readers in the way; next round
+        return;
+    }
+    if (rc != SQLITE_OK) {
+        db_state.checkpoint_errors++;
+        fprintf(stderr, "✗ WAL checkpoint failed: %s\n", sqlite3_errmsg(checkpoint_db));
+        return;
+    }
+
+    pthread_mutex_lock(&checkpoint_lock);
+    if (wal_frames == frames_seen) {
+        if (mode == SQLITE_CHECKPOINT_TRUNCATE) {
+            wal_frames = 0;
+            backfilled = 0;
+            db_state.checkpoint_truncates++;
+        } else if (copied > backfilled) {
+            backfilled = copied;
+        }
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+static void wal_size_update(void) {
+    struct stat st;
+    uint64_t bytes = stat(wal_path, &st) == 0 ? (uint64_t)st.st_size : 0;
+
+    db_state.wal_bytes = bytes;
+    if (bytes > db_state.wal_bytes_max) {
+        db_state.wal_bytes_max = bytes;
+    }
+}
+
+static void *checkpoint_main(void *arg) {
+    uint64_t last_checkpoint_us = get_monotonic_us();
+    (void)arg;
+
+    pthread_mutex_lock(&checkpoint_lock);
+    while (checkpoint_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += DB_CHECKPOINT_POLL_MS / 1000;
+        deadline.tv_nsec += (DB_CHECKPOINT_POLL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&checkpoint_cond, &checkpoint_lock, &deadline);
+        if (!checkpoint_running) break;
+
+        int frames = wal_frames;
+        int pending = wal_frames - backfilled;
+        uint64_t idle_us = get_monotonic_us() - last_commit_us;
+        pthread_mutex_unlock(&checkpoint_lock);
+
+        uint64_t now = get_monotonic_us();
+        int mode = -1;
+        if (frames > 0 && idle_us >= DB_CHECKPOINT_IDLE_MS * 1000ULL) {
+            mode = SQLITE_CHECKPOINT_TRUNCATE;
+        } else if (pending >= threshold_pages ||
+                   (pending > 0 && now - last_checkpoint_us >= DB_CHECKPOINT_INTERVAL_MS * 1000ULL)) {
+            mode = SQLITE_CHECKPOINT_PASSIVE;
+        }
+        if (mode >= 0) {
+            checkpoint_run(mode, frames);
+            last_checkpoint_us = get_monotonic_us();
+        }
+        wal_size_update();
+
+        pthread_mutex_lock(&checkpoint_lock);
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+    return NULL;
+}
+
+int db_checkpoint_start(sqlite3 *writer) {
+    const char *path = sqlite3_db_filename(writer, "main");
+    if (path == NULL || path[0] == '\0') return -1;
+
+    if (sqlite3_open_v2(path, &checkpoint_db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        fprintf(stderr, "✗ Cannot open checkpoint connection: %s\n", sqlite3_errmsg(checkpoint_db));
+        sqlite3_close(checkpoint_db);
+        checkpoint_db = NULL;
+        return -1;
+    }
+    // A connection that has not read the file yet is not in WAL mode,
+    // and its checkpoints would do nothing
+    if (sqlite3_exec(checkpoint_db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "✗ Checkpoint connection: %s\n", sqlite3_errmsg(checkpoint_db));
+        sqlite3_close(checkpoint_db);
+        checkpoint_db = NULL;
+        return -1;
+    }
+    // TRUNCATE gives up quickly rather than holding up the writer,
+    // and the writer waits out one instead of failing its inserts
+    sqlite3_busy_timeout(checkpoint_db, 100);
+    sqlite3_busy_timeout(writer, 1000);
+
+    snprintf(wal_path, sizeof(wal_path), "%s-wal", path);
+    threshold_pages = db_get_profile()->checkpoint_pages;
+    wal_frames = 0;
+    backfilled = 0;
+    last_commit_us = get_monotonic_us();
+
+    // Replaces the autocheckpoint hook: commits only report WAL size
+    sqlite3_wal_hook(writer, checkpoint_wal_hook, NULL);
+    checkpoint_running = 1;
+
+    if (pthread_create(&checkpoint_thread, NULL, checkpoint_main, NULL) != 0) {
+        fprintf(stderr, "✗ Cannot start checkpoint thread: %s\n", strerror(errno));
+        checkpoint_running = 0;
+        sqlite3_wal_hook(writer, NULL, NULL);
+        sqlite3_wal_autocheckpoint(writer, threshold_pages);
+        sqlite3_close(checkpoint_db);
+        checkpoint_db = NULL;
+        return -1;
+    }
+
+    printf("✓ Checkpoint thread: PASSIVE at %d pages or %d s, TRUNCATE after %d s idle\n",
+           threshold_pages, DB_CHECKPOINT_INTERVAL_MS / 1000, DB_CHECKPOINT_IDLE_MS / 1000);
+    return 0;
+}
+
+void db_checkpoint_stop(void) {
+    pthread_mutex_lock(&checkpoint_lock);
+    if (!checkpoint_running) {
+        pthread_mutex_unlock(&checkpoint_lock);
+        return;
+    }
+    checkpoint_running = 0;
+    pthread_cond_signal(&checkpoint_cond);
+    pthread_mutex_unlock(&checkpoint_lock);
+
+    pthread_join(checkpoint_thread, NULL);
+
+    // Writer has drained by now: leave an empty WAL behind
+    checkpoint_run(SQLITE_CHECKPOINT_TRUNCATE, wal_frames);
+    sqlite3_close(checkpoint_db);
+    checkpoint_db = NULL;
+    printf("✓ Checkpoint thread stopped (%u checkpoints, max %.1f ms)\n",
+           db_state.checkpoint_count, db_state.checkpoint_time_max_us / 1000.0);
+}
@@ -0,0 +1,162 @@
+/*
+ * src/db_query_pool.c - Query Worker Threads
+ * db/query requests are queued by the MQTT callback and run by a few
+ * worker threads. Each query checks out its own read-only connection,
+ * so a slow get_range neither holds up the MQTT loop nor waits on
+ * (or blocks) the writer thread.
+ */
+
+#include "db_query_pool.h"
+#include "database.h"
+#include "gateway.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+/*====================================================================
+ * QUEUE (bounded ring of pending requests)
+ *====================================================================*/
+
+typedef struct {
+    db_query_handler_t handler;
+    char *payload;
+    db_reply_to_t reply_to;
+} query_job_t;
+
+static query_job_t jobs[DB_QUERY_QUEUE_DEPTH];
+static uint32_t jobs_head = 0;      // next slot to pop
+static uint32_t jobs_count = 0;
+
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[DB_QUERY_WORKERS];
+static int workers_started = 0;
+static int pool_running = 0;
+
+static void reply_to_free(db_reply_to_t *reply_to) {
+    free(reply_to->topic);
+    free(reply_to->correlation);
+    reply_to->topic = NULL;
+    reply_to->correlation = NULL;
+}
+
+int db_query_submit(db_query_handler_t handler, const char *payload, size_t len,
+                    db_reply_to_t *reply_to) {
+    char *copy = malloc(len + 1);
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, payload, len);
+    copy[len] = '\0';
+
+    pthread_mutex_lock(&jobs_lock);
+
+    if (!pool_running || jobs_count >= DB_QUERY_QUEUE_DEPTH) {
+        db_state.query_rejects++;
+        pthread_mutex_unlock(&jobs_lock);
+        free(copy);
+        return -1;
+    }
+
+    query_job_t *job = &jobs[(jobs_head + jobs_count) % DB_QUERY_QUEUE_DEPTH];
+    job->handler = handler;
+    job->payload = copy;
+    memset(&job->reply_to, 0, sizeof(job->reply_to));
+    if (reply_to != NULL) {
+        job->reply_to = *reply_to;
+        memset(reply_to, 0, sizeof(*reply_to));
+    }
+    jobs_count++;
+    db_state.query_queue_depth = jobs_count;
+
+    pthread_cond_signal(&jobs_cond);
+    pthread_mutex_unlock(&jobs_lock);
+
+    return 0;
+}
+
+/*====================================================================
+ * WORKER THREADS
+ *====================================================================*/
+
+static void *worker_main(void *arg) {
+    pthread_mutex_lock(&jobs_lock);
+
+    while (pool_running) {
+        if (jobs_count == 0) {
+            pthread_cond_wait(&jobs_cond, &jobs_lock);
+            continue;
+        }
+
+        query_job_t job = jobs[jobs_head];
+        jobs_head = (jobs_head + 1) % DB_QUERY_QUEUE_DEPTH;
+        jobs_count--;
+        db_state.query_queue_depth = jobs_count;
+
+        pthread_mutex_unlock(&jobs_lock);
+
+        uint64_t start = get_monotonic_us();
+        job.handler(job.payload, &job.reply_to);
+        uint32_t elapsed = (uint32_t)(get_monotonic_us() - start);
+        free(job.payload);
+        reply_to_free(&job.reply_to);
+
+        pthread_mutex_lock(&jobs_lock);
+        db_state.query_count++;
+        if (elapsed > db_state.query_time_max_us) {
+            db_state.query_time_max_us = elapsed;
+        }
+    }
+
+    pthread_mutex_unlock(&jobs_lock);
+    return NULL;
+}
+
+int db_query_pool_start(void) {
+    jobs_head = 0;
+    jobs_count = 0;
+    pool_running = 1;
+
+    for (workers_started = 0; workers_started < DB_QUERY_WORKERS; workers_started++) {
+        if (pthread_create(&workers[workers_started], NULL, worker_main, NULL) != 0) {
+            fprintf(stderr, "✗ Cannot start query worker: %s\n", strerror(errno));
+            break;
+        }
+    }
+    if (workers_started == 0) {
+        pool_running = 0;
+        return -1;
+    }
+
+    printf("✓ Query workers: %d (queue %d)\n", workers_started, DB_QUERY_QUEUE_DEPTH);
+    return 0;
+}
+
+void db_query_pool_stop(void) {
+    pthread_mutex_lock(&jobs_lock);
+    if (!pool_running) {
+        pthread_mutex_unlock(&jobs_lock);
+        return;
+    }
+    pool_running = 0;
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_lock);
+
+    // Requests already running finish; queued ones are dropped
+    for (int i = 0; i < workers_started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    workers_started = 0;
+
+    while (jobs_count > 0) {
+        free(jobs[jobs_head].payload);
+        reply_to_free(&jobs[jobs_head].reply_to);
+        jobs_head = (jobs_head + 1) % DB_QUERY_QUEUE_DEPTH;
+        jobs_count--;
+        db_state.query_rejects++;
+    }
+    db_state.query_queue_depth = 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * src/db_writer.c - Asynchronous Database Writer
+ * All inserts are queued here and written by a single thread that
+ * groups them into explicit transactions (group commit), so the RX
+ * path never waits for sqlite3_step or a WAL fsync.
+ */
+
+#include "db_writer.h"
+#include "db_cache.h"
+#include "database.h"
+#include "gateway.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+/* Records popped from the queue per lock acquisition */
+#define DB_WRITER_CHUNK     64
+
+/* Commit latency histogram: 4 buckets per doubling of microseconds */
+#define COMMIT_HIST_STEPS   4
+#define COMMIT_HIST_BUCKETS 112     // up to 2^28 us
+
+/*====================================================================
+ * QUEUE (bounded ring, preallocated)
+ *====================================================================*/
+
+static db_record_t queue[DB_QUEUE_DEPTH];
+static uint32_t queue_head = 0;     // next slot to pop
+static uint32_t queue_count = 0;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer_thread;
+static int writer_running = 0;
+
+static uint32_t rate_rows_prev = 0;
+
+/* Nodes with rows in the open transaction (bit n = node n), writer only */
+static uint32_t txn_nodes = 0;
+
+static uint32_t commit_hist[COMMIT_HIST_BUCKETS];
+
+int db_writer_enqueue(const db_record_t *rec) {
+    return db_writer_enqueue_group(rec, 1);
+}
+
+/* A group is contiguous in the queue; the writer does not commit while
+ * the last row it inserted has group_left > 0 */
+int db_writer_enqueue_group(const db_record_t *recs, int count) {
+    if (count < 1 || count > UINT16_MAX) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&queue_lock);
+
+    if (!writer_running || queue_count + (uint32_t)count > DB_QUEUE_DEPTH) {
+        db_state.queue_drops += count;
+        pthread_mutex_unlock(&queue_lock);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        db_record_t *slot = &queue[(queue_head + queue_count) % DB_QUEUE_DEPTH];
+        *slot = recs[i];
+        slot->group_left = (uint16_t)(count - 1 - i);
+        queue_count++;
+    }
+
+    db_state.queue_depth = queue_count;
+    if (queue_count > db_state.queue_high_water) {
+        db_state.queue_high_water = queue_count;
+    }
+
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    return 0;
+}
+
+/*====================================================================
+ * STATEMENT EXECUTION (writer thread only)
+ *====================================================================*/
+
+static int writer_step(sqlite3_stmt *stmt) {
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "✗ DB insert failed: %s\n", sqlite3_errmsg(db_state.db));
+        db_state.insert_errors++;
+        return -1;
+    }
+    return 0;
+}
+
+static int writer_insert(const db_record_t *rec) {
+    sqlite3_stmt *stmt;
+
+    switch (rec->type) {
+    case DB_REC_SENSOR:
+        if (rec->timestamp < db_state.part_start || 
+            rec->timestamp >= db_state.part_end) {
+            time_t prev_start = db_state.part_start;
+            if (db_partition_prepare(rec->timestamp) < 0) {
+                db_state.insert_errors++;
+                return -1;
+            }
+            // Rolled over to a new partition: the last one is closed
+            if (prev_start != 0 && db_state.part_start > prev_start) {
+                db_archive_old_data(DB_ARCHIVE_AFTER_DAYS);
+            }
+        }
+        stmt = db_state.stmt_sensor;
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, rec->timestamp);
+        sqlite3_bind_int(stmt, 2, rec->node_id);
+        sqlite3_bind_double(stmt, 3, rec->u.sensor.temp);
+        sqlite3_bind_double(stmt, 4, rec->u.sensor.hum);
+        sqlite3_bind_int(stmt, 5, rec->u.sensor.light);
+        sqlite3_bind_int(stmt, 6, rec->u.sensor.soil);
+        sqlite3_bind_int(stmt, 7, rec->u.sensor.rssi);
+        sqlite3_bind_int(stmt, 8, rec->u.sensor.snr);
+        break;
+
+    case DB_REC_ACTUATOR:
+        stmt = db_state.stmt_actuator;
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, rec->timestamp);
+        sqlite3_bind_int(stmt, 2, rec->node_id);
+        sqlite3_bind_text(stmt, 3, rec->u.actuator.actuator, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 4, rec->u.actuator.state);
+        sqlite3_bind_text(stmt, 5, rec->u.actuator.trigger_type, -1, SQLITE_STATIC);
+        sqlite3_bind_double(stmt, 6, rec->u.actuator.trigger_value);
+        break;
+
+    case DB_REC_COMMAND:
+        stmt = db_state.stmt_command;
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, rec->timestamp);
+        sqlite3_bind_int(stmt, 2, rec->node_id);
+        sqlite3_bind_text(stmt, 3, rec->u.command.command, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, rec->u.command.value, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 5, rec->u.command.source, -1, SQLITE_STATIC);
+        break;
+
+    case DB_REC_STATS:
+        stmt = db_state.stmt_stats;
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, rec->timestamp);
+        sqlite3_bind_int(stmt, 2, rec->u.stats.rx_count);
+        sqlite3_bind_int(stmt, 3, rec->u.stats.tx_count);
+        sqlite3_bind_int(stmt, 4, rec->u.stats.crc_errors);
+        sqlite3_bind_int(stmt, 5, rec->u.stats.json_errors);
+        sqlite3_bind_int(stmt, 6, rec->u.stats.auto_commands);
+        break;
+
+    default:
+        return -1;
+    }
+
+    if (writer_step(stmt) < 0) {
+        return -1;
+    }
+
+    // Keep the 1m/1h/1d rollups in step with every sensor row
+    if (rec->type == DB_REC_SENSOR) {
+        for (int lvl = 0; lvl < DB_ROLLUP_LEVELS; lvl++) {
+            stmt = db_state.stmt_rollup[lvl];
+            sqlite3_reset(stmt);
+            sqlite3_bind_int(stmt, 1, rec->node_id);
+            sqlite3_bind_int64(stmt, 2, rec->timestamp);
+            sqlite3_bind_double(stmt, 3, rec->u.sensor.temp);
+            sqlite3_bind_double(stmt, 4, rec->u.sensor.hum);
+            sqlite3_bind_int(stmt, 5, rec->u.sensor.light);
+            sqlite3_bind_int(stmt, 6, rec->u.sensor.soil);
+            sqlite3_bind_int(stmt, 7, rec->u.sensor.rssi);
+            sqlite3_bind_int(stmt, 8, rec->u.sensor.snr);
+            writer_step(stmt);
+        }
+    }
+
+    return 0;
+}
+
+/*====================================================================
+ * TRANSACTION HANDLING
+ *====================================================================*/
+
+static int writer_begin(void) {
+    int rc = sqlite3_exec(db_state.db, "BEGIN;", 0, 0, 0);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "✗ DB begin failed: %s\n", sqlite3_errmsg(db_state.db));
+        return -1;
+    }
+    return 0;
+}
+
+static void writer_commit(uint32_t rows) {
+    uint64_t start = get_monotonic_us();
+
+    int rc = sqlite3_exec(db_state.db, "COMMIT;", 0, 0, 0);
+    for (int retry = 0; rc == SQLITE_BUSY && retry < 10; retry++) {
+        usleep(10000);
+        rc = sqlite3_exec(db_state.db, "COMMIT;", 0, 0, 0);
+    }
+
+    uint32_t elapsed = (uint32_t)(get_monotonic_us() - start);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "✗ DB commit failed (%u rows lost): %s\n",
+                rows, sqlite3_errmsg(db_state.db));
+        sqlite3_exec(db_state.db, "ROLLBACK;", 0, 0, 0);
+        db_state.commit_errors++;
+        db_state.insert_errors += rows;
+        txn_nodes = 0;
+        return;
+    }
+
+    // Cached query results for these nodes are now out of date
+    db_cache_invalidate(txn_nodes);
+    txn_nodes = 0;
+
+    db_state.commit_count++;
+    db_state.total_inserts += rows;
+    db_state.last_batch_rows = rows;
+    db_state.commit_time_last_us = elapsed;
+    db_state.commit_time_total_us += elapsed;
+    if (elapsed > db_state.commit_time_max_us) {
+        db_state.commit_time_max_us = elapsed;
+    }
+    
+    int b = (int)(log2(elapsed + 1.0) * COMMIT_HIST_STEPS);
+    commit_hist[b < COMMIT_HIST_BUCKETS ? b : COMMIT_HIST_BUCKETS - 1]++;
+}
+
+/*====================================================================
+ * WRITER THREAD
+ *====================================================================*/
+
+static void *writer_main(void *arg) {
+    db_record_t batch[DB_WRITER_CHUNK];
+    int in_txn = 0;
+    int in_group = 0;               // inserted part of a group, rest still queued
+    uint32_t txn_rows = 0;
+    uint64_t txn_start_us = 0;
+
+    pthread_mutex_lock(&queue_lock);
+
+    while (writer_running || queue_count > 0) {
+        if (queue_count == 0) {
+            if (in_txn) {
+                // Wait for more rows, but no longer than the batch deadline
+                uint64_t deadline_us = txn_start_us + DB_BATCH_MAX_MS * 1000ULL;
+                uint64_t now_us = get_monotonic_us();
+                if (now_us < deadline_us) {
+                    struct timespec ts;
+                    clock_gettime(CLOCK_REALTIME, &ts);
+                    uint64_t wait_ns = (deadline_us - now_us) * 1000ULL + ts.tv_nsec;
+                    ts.tv_sec += wait_ns / 1000000000ULL;
+                    ts.tv_nsec = wait_ns % 1000000000ULL;
+                    pthread_cond_timedwait(&queue_cond, &queue_lock, &ts);
+                }
+            } else if (writer_running) {
+                pthread_cond_wait(&queue_cond, &queue_lock);
+            }
+        }
+
+        // Pop a chunk, then release the lock while talking to SQLite
+        int n = 0;
+        while (queue_count > 0 && n < DB_WRITER_CHUNK) {
+            batch[n++] = queue[queue_head];
+            queue_head = (queue_head + 1) % DB_QUEUE_DEPTH;
+            queue_count--;
+        }
+        db_state.queue_depth = queue_count;
+        int stopping = !writer_running;
+
+        pthread_mutex_unlock(&queue_lock);
+
+        for (int i = 0; i < n; i++) {
+            // Retention/archive run in their own transactions between batches
+            if (batch[i].type == DB_REC_RETENTION || batch[i].type == DB_REC_ARCHIVE) {
+                if (in_txn) {
+                    writer_commit(txn_rows);
+                    in_txn = 0;
+                }
+                if (batch[i].type == DB_REC_RETENTION) {
+                    db_partition_drop_before(batch[i].timestamp);
+                    db_cache_invalidate(UINT32_MAX);
+                } else {
+                    db_partition_archive_before(batch[i].timestamp);
+                    db_cache_invalidate(0);     // same rows, only the totals move
+                }
+                continue;
+            }
+
+            if (!in_txn && writer_begin() == 0) {
+                in_txn = 1;
+                txn_rows = 0;
+                txn_start_us = get_monotonic_us();
+            }
+
+            in_group = batch[i].group_left > 0;
+            if (writer_insert(&batch[i]) == 0) {
+                uint32_t node_bit = (batch[i].node_id > 0 && batch[i].node_id < 32) ?
+                                    1u << batch[i].node_id : 0;
+                if (in_txn) {
+                    txn_rows++;
+                    txn_nodes |= node_bit;
+                } else {
+                    db_state.total_inserts++;   // BEGIN failed, row autocommitted
+                    db_cache_invalidate(node_bit);
+                }
+            }
+        }
+
+        if (in_txn && !in_group) {
+            uint64_t age_us = get_monotonic_us() - txn_start_us;
+            if (txn_rows >= DB_BATCH_MAX_ROWS ||
+                age_us >= DB_BATCH_MAX_MS * 1000ULL ||
+                stopping) {
+                writer_commit(txn_rows);
+                in_txn = 0;
+            }
+        }
+
+        pthread_mutex_lock(&queue_lock);
+    }
+
+    pthread_mutex_unlock(&queue_lock);
+
+    if (in_txn) {
+        writer_commit(txn_rows);
+    }
+
+    return NULL;
+}
+
+int db_writer_start(void) {
+    queue_head = 0;
+    queue_count = 0;
+    memset(commit_hist, 0, sizeof(commit_hist));
+    writer_running = 1;
+
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        fprintf(stderr, "✗ Cannot start DB writer thread: %s\n", strerror(errno));
+        writer_running = 0;
+        return -1;
+    }
+
+    printf("✓ Writer thread: batch %d rows / %d ms\n",
+           DB_BATCH_MAX_ROWS, DB_BATCH_MAX_MS);
+    return 0;
+}
+
+void db_writer_stop(void) {
+    pthread_mutex_lock(&queue_lock);
+    if (!writer_running) {
+        pthread_mutex_unlock(&queue_lock);
+        return;
+    }
+    writer_running = 0;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    // Writer drains whatever is still queued before exiting
+    pthread_join(writer_thread, NULL);
+    printf("✓ DB writer stopped (%u rows, %u commits)\n",
+           db_state.total_inserts, db_state.commit_count);
+}
+
+/* Upper edge of the histogram bucket holding the p-th commit (0 < p <= 1) */
+uint32_t db_writer_commit_percentile_us(double p) {
+    uint64_t total = 0;
+    for (int i = 0; i < COMMIT_HIST_BUCKETS; i++) {
+        total += commit_hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    
+    uint64_t rank = (uint64_t)ceil(p * total), seen = 0;
+    int i = 0;
+    while (i < COMMIT_HIST_BUCKETS - 1 && (seen += commit_hist[i]) < rank) {
+        i++;
+    }
+    return (uint32_t)exp2((double)(i + 1) / COMMIT_HIST_STEPS);
+}
+
+void db_writer_reset_commit_stats(void) {
+    memset(commit_hist, 0, sizeof(commit_hist));
+    db_state.commit_time_max_us = 0;
+}
+
+/* Called once per stats interval from the main loop */
+void db_writer_update_rate(int interval_sec) {
+    uint32_t rows = db_state.total_inserts;
+    if (interval_sec > 0) {
+        db_state.insert_rate = (float)(rows - rate_rows_prev) / interval_sec;
+    }
+    rate_rows_prev = rows;
+}
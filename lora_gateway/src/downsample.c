@@ -0,0 +1,203 @@
+/*
+ * src/downsample.c - Streaming Downsampling (LTTB, min/max)
+ * Buckets are fixed slices of the time window rather than equal row
+ * counts, so the row total need not be known before the query runs.
+ * Empty buckets (gaps in the data) produce no rows.
+ */
+
+#include "downsample.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static int ds_bucket(const ds_state_t *ds, int64_t ts) {
+    if (ts <= ds->lo) return 0;
+    int64_t b = (ts - ds->lo) * ds->buckets / ds->span;
+    return b >= ds->buckets ? ds->buckets - 1 : (int)b;
+}
+
+static int ds_emit(ds_state_t *ds, const ds_row_t *row) {
+    if (ds->error == 0) {
+        ds->error = ds->emit(row, ds->ctx);
+        ds->rows_out++;
+    }
+    return ds->error;
+}
+
+void ds_init(ds_state_t *ds, ds_mode_t mode, ds_field_t field,
+             int64_t lo, int64_t hi, int max_points,
+             ds_emit_fn_t emit, void *ctx) {
+    memset(ds, 0, sizeof(*ds));
+    ds->mode = mode;
+    ds->field = field;
+    ds->lo = lo;
+    ds->span = hi > lo ? hi - lo + 1 : 1;
+    ds->emit = emit;
+    ds->ctx = ctx;
+
+    // LTTB adds the first and last row to one per bucket,
+    // min/max emits up to two per bucket
+    ds->buckets = (mode == DS_LTTB) ? max_points - 2 : max_points / 2;
+    if (ds->buckets < 1) ds->buckets = 1;
+}
+
+/*====================================================================
+ * LTTB
+ *====================================================================*/
+
+static int lttb_append(ds_state_t *ds, const ds_row_t *row) {
+    if (ds->next_n == ds->next_cap) {
+        int cap = ds->next_cap ? ds->next_cap * 2 : 16;
+        ds_row_t *rows = realloc(ds->next, sizeof(ds_row_t) * cap);
+        if (rows == NULL) {
+            return -1;
+        }
+        ds->next = rows;
+        ds->next_cap = cap;
+    }
+    ds->next[ds->next_n++] = *row;
+    ds->next_ts_sum += (double)(row->ts - ds->lo);
+    ds->next_value_sum += row->value[ds->field];
+    return 0;
+}
+
+/* Row of rows[0..n) with the largest triangle against the last emitted
+ * row and point (ct, cy) */
+static const ds_row_t *lttb_pick(const ds_state_t *ds, const ds_row_t *rows, int n,
+                                 double ct, double cy) {
+    double at = (double)(ds->selected.ts - ds->lo);
+    double ay = ds->selected.value[ds->field];
+    const ds_row_t *best = &rows[0];
+    double best_area = -1.0;
+
+    for (int i = 0; i < n; i++) {
+        double bt = (double)(rows[i].ts - ds->lo);
+        double by = rows[i].value[ds->field];
+        double area = fabs((at - ct) * (by - ay) - (at - bt) * (cy - ay));
+        if (area > best_area) {
+            best_area = area;
+            best = &rows[i];
+        }
+    }
+    return best;
+}
+
+static void lttb_select_cur(ds_state_t *ds, double ct, double cy) {
+    if (ds->cur_n == 0) return;
+
+    ds->selected = *lttb_pick(ds, ds->cur, ds->cur_n, ct, cy);
+    ds_emit(ds, &ds->selected);
+}
+
+static int lttb_add(ds_state_t *ds, const ds_row_t *row) {
+    // The first row is always kept and belongs to no bucket
+    if (ds->rows_in == 0) {
+        ds->selected = *row;
+        return ds_emit(ds, row);
+    }
+
+    int b = ds_bucket(ds, row->ts);
+    if (ds->next_n > 0 && b != ds->next_bucket) {
+        // next is complete: its average decides cur, then it becomes cur
+        lttb_select_cur(ds, ds->next_ts_sum / ds->next_n,
+                        ds->next_value_sum / ds->next_n);
+
+        ds_row_t *rows = ds->cur;
+        int cap = ds->cur_cap;
+        ds->cur = ds->next;
+        ds->cur_cap = ds->next_cap;
+        ds->cur_n = ds->next_n;
+        ds->next = rows;
+        ds->next_cap = cap;
+        ds->next_n = 0;
+        ds->next_ts_sum = 0;
+        ds->next_value_sum = 0;
+    }
+
+    ds->next_bucket = b;
+    if (lttb_append(ds, row) < 0 && ds->error == 0) {
+        ds->error = -1;
+    }
+    return ds->error;
+}
+
+/* The last row is always kept; the open bucket picks against it */
+static void lttb_finish(ds_state_t *ds) {
+    if (ds->next_n == 0) {
+        return;
+    }
+    const ds_row_t last = ds->next[ds->next_n - 1];
+    double lt = (double)(last.ts - ds->lo);
+
+    lttb_select_cur(ds, ds->next_ts_sum / ds->next_n, ds->next_value_sum / ds->next_n);
+    if (ds->next_n > 1) {
+        ds->selected = *lttb_pick(ds, ds->next, ds->next_n - 1, lt, last.value[ds->field]);
+        ds_emit(ds, &ds->selected);
+    }
+    ds_emit(ds, &last);
+}
+
+/*====================================================================
+ * MIN/MAX
+ *====================================================================*/
+
+static void minmax_flush(ds_state_t *ds) {
+    if (ds->mm_n == 0) return;
+
+    // Keep time order; one row when it holds both extremes
+    const ds_row_t *first = ds->min.ts <= ds->max.ts ? &ds->min : &ds->max;
+    const ds_row_t *second = first == &ds->min ? &ds->max : &ds->min;
+    ds_emit(ds, first);
+    if (second->ts != first->ts || 
+        second->value[ds->field] != first->value[ds->field]) {
+        ds_emit(ds, second);
+    }
+    ds->mm_n = 0;
+}
+
+static int minmax_add(ds_state_t *ds, const ds_row_t *row) {
+    int b = ds_bucket(ds, row->ts);
+    if (ds->mm_n > 0 && b != ds->mm_bucket) {
+        minmax_flush(ds);
+    }
+
+    double v = row->value[ds->field];
+    if (ds->mm_n == 0) {
+        ds->min = *row;
+        ds->max = *row;
+        ds->mm_bucket = b;
+    } else if (v < ds->min.value[ds->field]) {
+        ds->min = *row;
+    } else if (v > ds->max.value[ds->field]) {
+        ds->max = *row;
+    }
+    ds->mm_n++;
+    return ds->error;
+}
+
+/*====================================================================
+ * PUBLIC
+ *====================================================================*/
+
+int ds_add(ds_state_t *ds, const ds_row_t *row) {
+    if (ds->error) {
+        return ds->error;
+    }
+    int rc = (ds->mode == DS_LTTB) ? lttb_add(ds, row) : minmax_add(ds, row);
+    ds->rows_in++;
+    return rc;
+}
+
+int ds_finish(ds_state_t *ds) {
+    if (ds->mode == DS_LTTB) {
+        lttb_finish(ds);
+    } else {
+        minmax_flush(ds);
+    }
+
+    free(ds->cur);
+    free(ds->next);
+    ds->cur = ds->next = NULL;
+    ds->cur_n = ds->next_n = 0;
+    return ds->error;
+}
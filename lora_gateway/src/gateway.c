@@ -4,8 +4,13 @@
  */
 
 #include "gateway.h"
+#include "config.h"
 #include "mqtt.h"
 #include "database.h"
+#include "db_writer.h"
+#include "db_backup.h"
+#include "node_stats.h"
+#include "snapshot.h"
 #include "utils.h"
 #include <stdio.h>
 #include <string.h>
@@ -254,70 +259,7 @@ void lora_clear_and_restart_rx() {
  *====================================================================*/
 
 void output_json_to_file() {
-    FILE *fp = fopen("/tmp/gateway_data.json", "w");
-    if (!fp) {
-        perror("Failed to open JSON file");
-        return;
-    }
-    
-    char timestamp[32];
-    get_timestamp(timestamp, sizeof(timestamp));
-    
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "timestamp", timestamp);
-    cJSON_AddNumberToObject(root, "unix_time", (double)time(NULL));
-    
-    // Nodes array
-    cJSON *nodes = cJSON_CreateObject();
-    
-    for (int i = 0; i < 3; i++) {
-        if (gateway.nodes[i].last_update > 0) {
-            char node_key[16];
-            snprintf(node_key, sizeof(node_key), "node%d", i+1);
-            
-            cJSON *node = cJSON_CreateObject();
-            cJSON_AddNumberToObject(node, "temp", gateway.nodes[i].temperature);
-            cJSON_AddNumberToObject(node, "humid", gateway.nodes[i].humidity);
-            cJSON_AddNumberToObject(node, "light", gateway.nodes[i].light);
-            cJSON_AddNumberToObject(node, "soil", gateway.nodes[i].soil_moisture);
-            cJSON_AddNumberToObject(node, "rssi", gateway.nodes[i].last_rssi);
-            cJSON_AddNumberToObject(node, "snr", gateway.nodes[i].last_snr);
-            cJSON_AddNumberToObject(node, "rx_count", gateway.nodes[i].rx_count);
-            cJSON_AddNumberToObject(node, "tx_count", gateway.nodes[i].tx_count);
-            cJSON_AddNumberToObject(node, "last_update", (double)gateway.nodes[i].last_update);
-            
-            // Actuators
-            cJSON *actuators = cJSON_CreateObject();
-            cJSON_AddNumberToObject(actuators, "fan", gateway.nodes[i].actuators.fan_state);
-            cJSON_AddNumberToObject(actuators, "light", gateway.nodes[i].actuators.light_state);
-            cJSON_AddNumberToObject(actuators, "pump", gateway.nodes[i].actuators.pump_state);
-            cJSON_AddItemToObject(node, "actuators", actuators);
-            
-            // Auto mode
-            cJSON_AddBoolToObject(node, "auto_mode", gateway.nodes[i].thresholds.enabled);
-            
-            cJSON_AddItemToObject(nodes, node_key, node);
-        }
-    }
-    
-    cJSON_AddItemToObject(root, "nodes", nodes);
-    
-    // Gateway stats
-    cJSON *gw_stats = cJSON_CreateObject();
-    cJSON_AddNumberToObject(gw_stats, "rx_nodata", gateway.rx_nodata);
-    cJSON_AddNumberToObject(gw_stats, "rx_crc_error", gateway.rx_crc_error);
-    cJSON_AddNumberToObject(gw_stats, "rx_crc_recovery", gateway.rx_crc_recovery);
-    cJSON_AddNumberToObject(gw_stats, "json_parse_error", gateway.json_parse_error);
-    cJSON_AddNumberToObject(gw_stats, "auto_commands", gateway.auto_commands);
-    cJSON_AddItemToObject(root, "gateway", gw_stats);
-    
-    // Pretty print JSON
-    char *json_string = cJSON_Print(root);
-    fprintf(fp, "%s", json_string);
-    
-    free(json_string);
-    cJSON_Delete(root);
-    fclose(fp);
+    snapshot_mark_dirty();
 }
 
 /*====================================================================
@@ -332,6 +274,16 @@ void check_auto_control(int node_id, float temp, float hum, uint16_t light, uint
     threshold_config_t *th = &node->thresholds;
     
     if (!th->enabled) return;
+
+    // Smoothed inputs: the node's live window means, not this one reading
+    ns_summary_t s[NS_CHANNELS];
+    if (AUTO_CONTROL_SMOOTH_SEC > 0 &&
+        node_stats_get(node_id, AUTO_CONTROL_SMOOTH_SEC, s, NULL) > 0) {
+        temp = (float)s[NS_TEMPERATURE].mean;
+        hum = (float)s[NS_HUMIDITY].mean;
+        light = (uint16_t)s[NS_LIGHT].mean;
+        soil = (uint16_t)s[NS_SOIL].mean;
+    }
     
     char timestamp[32];
     get_timestamp(timestamp, sizeof(timestamp));
@@ -349,6 +301,7 @@ void check_auto_control(int node_id, float temp, float hum, uint16_t light, uint
         gateway.auto_commands++;
         
         db_log_actuator_change(node_id, "fan", 1, "AUTO", temp);
+        mqtt_publish_alert(node_id, "fan", 1, temp);
         
         usleep(500000);
     } 
@@ -362,6 +315,7 @@ void check_auto_control(int node_id, float temp, float hum, uint16_t light, uint
         gateway.auto_commands++;
         
         db_log_actuator_change(node_id, "fan", 0, "AUTO", temp);
+        mqtt_publish_alert(node_id, "fan", 0, temp);
         
         usleep(500000);
     }
@@ -379,6 +333,7 @@ void check_auto_control(int node_id, float temp, float hum, uint16_t light, uint
         gateway.auto_commands++;
         
         db_log_actuator_change(node_id, "light", 1, "AUTO", (float)light);
+        mqtt_publish_alert(node_id, "light", 1, (float)light);
         
         usleep(500000);
     } 
@@ -392,6 +347,7 @@ void check_auto_control(int node_id, float temp, float hum, uint16_t light, uint
         gateway.auto_commands++;
         
         db_log_actuator_change(node_id, "light", 0, "AUTO", (float)light);
+        mqtt_publish_alert(node_id, "light", 0, (float)light);
         
         usleep(500000);
     }
@@ -409,6 +365,7 @@ void check_auto_control(int node_id, float temp, float hum, uint16_t light, uint
         gateway.auto_commands++;
         
         db_log_actuator_change(node_id, "pump", 1, "AUTO", (float)soil);
+        mqtt_publish_alert(node_id, "pump", 1, (float)soil);
         
         usleep(500000);
     } 
@@ -422,6 +379,7 @@ void check_auto_control(int node_id, float temp, float hum, uint16_t light, uint
         gateway.auto_commands++;
         
         db_log_actuator_change(node_id, "pump", 0, "AUTO", (float)soil);
+        mqtt_publish_alert(node_id, "pump", 0, (float)soil);
         
         usleep(500000);
     }
@@ -508,7 +466,9 @@ void print_help() {
     printf("  dbshow <node> [limit]   - Show recent data\n");
     printf("  dbstats                 - Show database stats\n");
     printf("  dbclean <days>          - Clean old data (keep N days)\n");
-    printf("  dbbackup                - Backup database now\n");
+    printf("  dbarchive <days>        - Compress partitions older than N days\n");
+    printf("  dbbackup                - Backup database now (background, gzip)\n");
+    printf("  dbplan                  - Check query plans use indexes\n");
     printf("\n");
     printf("SYSTEM:\n");
     printf("  help                    - Show this help\n");
@@ -607,6 +567,9 @@ void interactive_mode() {
             }
         }
         
+        // Dashboard file, if packets changed it and it is due
+        snapshot_tick();
+        
         // Print stats
         time_t now = time(NULL);
         if (now - gateway.last_stats_time >= STATS_INTERVAL) {
@@ -614,15 +577,27 @@ void interactive_mode() {
                                gateway.nodes[1].rx_count + 
                                gateway.nodes[2].rx_count;
             
+            db_writer_update_rate(STATS_INTERVAL);
+            
             printf("\n[STATS] Loops: %lu/%ds, RX: %u, JSON_ERR: %u, CRC: %u\n",
                    (unsigned long)gateway.loop_count, STATS_INTERVAL,
                    total_rx, gateway.json_parse_error, gateway.rx_crc_error);
+            printf("[STATS] DB: %.1f rows/s, queue %u (drops %u), commit %.1f ms\n",
+                   db_state.insert_rate, db_state.queue_depth, db_state.queue_drops,
+                   db_state.commit_time_last_us / 1000.0);
+            printf("[STATS] Dashboard: %u snapshots, %llu KB, %u packets coalesced\n",
+                   gateway.snapshot_writes, (unsigned long long)(gateway.snapshot_bytes / 1024),
+                   gateway.snapshot_coalesced);
             
             gateway.loop_count = 0;
             gateway.rx_nodata = 0;
             gateway.last_stats_time = now;
             mqtt_publish_gateway_stats();
+            for (int node = 1; node <= MAX_NODES; node++) {
+                mqtt_publish_node_stats(node);
+            }
             db_save_gateway_stats();
+            db_backup_schedule(now);
         }
         
         // Check user input
@@ -655,7 +630,10 @@ void interactive_mode() {
                            gateway.rx_crc_error > 0 ? 
                            (100.0 * gateway.rx_crc_recovery / gateway.rx_crc_error) : 0.0);
                     printf("JSON Parse Errors: %u\n", gateway.json_parse_error);
-                    printf("Auto Commands: %u\n\n", gateway.auto_commands);
+                    printf("Auto Commands: %u\n", gateway.auto_commands);
+                    printf("Dashboard Snapshots: %u (%llu bytes, %u packets coalesced)\n\n",
+                           gateway.snapshot_writes, (unsigned long long)gateway.snapshot_bytes,
+                           gateway.snapshot_coalesced);
                 }
                 
                 // DATABASE COMMANDS
@@ -679,9 +657,24 @@ void interactive_mode() {
                         printf("Usage: dbclean <days>  (1-365)\n");
                     }
                 }
+                else if (sscanf(input, "dbarchive %d", &node_id) == 1) {
+                    if (node_id > 0 && node_id <= 365) {
+                        db_archive_old_data(node_id);
+                    } else {
+                        printf("Usage: dbarchive <days>  (1-365)\n");
+                    }
+                }
                 else if (strcmp(input, "dbbackup") == 0) {
                     db_backup();
                 }
+                else if (strcmp(input, "dbplan") == 0) {
+                    int bad = db_check_query_plans(1);
+                    if (bad < 0) {
+                        printf("✗ Query plans not checked: database not open\n\n");
+                    } else {
+                        printf("%s %d query plan regression(s)\n\n", bad ? "✗" : "✓", bad);
+                    }
+                }
                 
                 // MANUAL CONTROL
                 else if (sscanf(input, "fan %d %s", &node_id, arg1) == 2) {
@@ -5,6 +5,7 @@
 
 #include "json_parser.h"
 #include "gateway.h"
+#include "snapshot.h"
 #include "utils.h"
 #include <stdio.h>
 #include <string.h>
@@ -94,100 +95,5 @@ int parse_text_sensor_data(const char *data, int *node_id, float *temp,
  *====================================================================*/
 
 void output_json_to_file(void) {
-    FILE *fp = fopen("/tmp/gateway_data.json", "w");
-    if (!fp) {
-        perror("Failed to open JSON file");
-        return;
-    }
-    
-    char timestamp[32];
-    get_timestamp(timestamp, sizeof(timestamp));
-    
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "timestamp", timestamp);
-    cJSON_AddNumberToObject(root, "unix_time", (double)time(NULL));
-    
-    // Create nodes object
-    cJSON *nodes = cJSON_CreateObject();
-    
-    for (int i = 0; i < MAX_NODES; i++) {
-        if (gateway.nodes[i].last_update > 0) {
-            char node_key[16];
-            snprintf(node_key, sizeof(node_key), "node%d", i+1);
-            
-            cJSON *node = cJSON_CreateObject();
-            
-            // Sensor data
-            cJSON_AddNumberToObject(node, "temp", gateway.nodes[i].temperature);
-            cJSON_AddNumberToObject(node, "humid", gateway.nodes[i].humidity);
-            cJSON_AddNumberToObject(node, "light", gateway.nodes[i].light);
-            cJSON_AddNumberToObject(node, "soil", gateway.nodes[i].soil_moisture);
-            
-            // Signal quality
-            cJSON_AddNumberToObject(node, "rssi", gateway.nodes[i].last_rssi);
-            cJSON_AddNumberToObject(node, "snr", gateway.nodes[i].last_snr);
-            
-            // Statistics
-            cJSON_AddNumberToObject(node, "rx_count", gateway.nodes[i].rx_count);
-            cJSON_AddNumberToObject(node, "tx_count", gateway.nodes[i].tx_count);
-            cJSON_AddNumberToObject(node, "last_update", (double)gateway.nodes[i].last_update);
-            
-            // Actuators
-            cJSON *actuators = cJSON_CreateObject();
-            cJSON_AddNumberToObject(actuators, "fan", gateway.nodes[i].actuators.fan_state);
-            cJSON_AddNumberToObject(actuators, "light", gateway.nodes[i].actuators.light_state);
-            cJSON_AddNumberToObject(actuators, "pump", gateway.nodes[i].actuators.pump_state);
-            cJSON_AddItemToObject(node, "actuators", actuators);
-            
-            // Auto mode status
-            cJSON_AddBoolToObject(node, "auto_mode", gateway.nodes[i].thresholds.enabled);
-            
-            // Thresholds (if auto mode enabled)
-            if (gateway.nodes[i].thresholds.enabled) {
-                cJSON *thresholds = cJSON_CreateObject();
-                
-                cJSON *temp_th = cJSON_CreateObject();
-                cJSON_AddNumberToObject(temp_th, "min", gateway.nodes[i].thresholds.temp_min);
-                cJSON_AddNumberToObject(temp_th, "max", gateway.nodes[i].thresholds.temp_max);
-                cJSON_AddItemToObject(thresholds, "temp", temp_th);
-                
-                cJSON *light_th = cJSON_CreateObject();
-                cJSON_AddNumberToObject(light_th, "min", gateway.nodes[i].thresholds.light_min);
-                cJSON_AddNumberToObject(light_th, "max", gateway.nodes[i].thresholds.light_max);
-                cJSON_AddItemToObject(thresholds, "light", light_th);
-                
-                cJSON *soil_th = cJSON_CreateObject();
-                cJSON_AddNumberToObject(soil_th, "min", gateway.nodes[i].thresholds.soil_min);
-                cJSON_AddNumberToObject(soil_th, "max", gateway.nodes[i].thresholds.soil_max);
-                cJSON_AddItemToObject(thresholds, "soil", soil_th);
-                
-                cJSON_AddItemToObject(node, "thresholds", thresholds);
-            }
-            
-            cJSON_AddItemToObject(nodes, node_key, node);
-        }
-    }
-    
-    cJSON_AddItemToObject(root, "nodes", nodes);
-    
-    // Gateway statistics
-    cJSON *gw_stats = cJSON_CreateObject();
-    cJSON_AddNumberToObject(gw_stats, "rx_nodata", gateway.rx_nodata);
-    cJSON_AddNumberToObject(gw_stats, "rx_crc_error", gateway.rx_crc_error);
-    cJSON_AddNumberToObject(gw_stats, "rx_crc_recovery", gateway.rx_crc_recovery);
-    cJSON_AddNumberToObject(gw_stats, "json_parse_error", gateway.json_parse_error);
-    cJSON_AddNumberToObject(gw_stats, "auto_commands", gateway.auto_commands);
-    cJSON_AddNumberToObject(gw_stats, "mqtt_connected", gateway.mqtt_connected);
-    cJSON_AddNumberToObject(gw_stats, "mqtt_publish_count", gateway.mqtt_publish_count);
-    cJSON_AddNumberToObject(gw_stats, "mqtt_error_count", gateway.mqtt_error_count);
-    
-    cJSON_AddItemToObject(root, "gateway", gw_stats);
-    
-    // Pretty print JSON to file
-    char *json_string = cJSON_Print(root);
-    fprintf(fp, "%s", json_string);
-    
-    free(json_string);
-    cJSON_Delete(root);
-    fclose(fp);
+    snapshot_mark_dirty();
 }
\ No newline at end of file
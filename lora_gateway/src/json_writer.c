@@ -0,0 +1,599 @@
+/*
+ * src/json_writer.c - Allocation-Free JSON / CBOR Writer
+ * Replaces cJSON trees on the publish path: a node document used to
+ * be ~25 mallocs for the tree plus one for the printed string, the
+ * dashboard file ~50. Here every document is appended to a buffer the
+ * thread keeps for its lifetime. The same calls write CBOR for
+ * subscribers that asked for it (--mqtt-format, db/query "format").
+ */
+
+#include "json_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static __thread char tls_buf[JW_BUFFER_BYTES];
+static __thread jw_t tls_writer;
+
+static const double pow10_d[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+static const uint64_t pow10_u[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+#define FLOAT_MAX_DECIMALS  6
+
+/* CBOR major types and simple values */
+#define CBOR_UINT       0x00
+#define CBOR_NEGINT     0x20
+#define CBOR_TEXT       0x60
+#define CBOR_ARRAY_INDEF 0x9f
+#define CBOR_MAP_INDEF  0xbf
+#define CBOR_FALSE      0xf4
+#define CBOR_TRUE       0xf5
+#define CBOR_NULL       0xf6
+#define CBOR_FLOAT32    0xfa
+#define CBOR_FLOAT64    0xfb
+#define CBOR_BREAK      0xff
+
+void jw_init(jw_t *w, char *buf, size_t cap, int format) {
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->depth = 0;
+    w->has_items = 0;
+    w->overflow = 0;
+    w->format = format;
+}
+
+jw_t *jw_begin_as(int format) {
+    jw_init(&tls_writer, tls_buf, sizeof(tls_buf), format);
+    return &tls_writer;
+}
+
+jw_t *jw_begin(void) {
+    return jw_begin_as(JW_JSON);
+}
+
+static void put(jw_t *w, const char *s, size_t n) {
+    if (w->overflow || w->len + n >= w->cap) {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static inline void put_char(jw_t *w, char c) {
+    put(w, &c, 1);
+}
+
+/* Major type and argument, shortest form */
+static void cbor_head(jw_t *w, uint8_t major, uint64_t v) {
+    uint8_t h[9];
+    size_t n;
+    if (v < 24) {
+        h[0] = major | (uint8_t)v;
+        n = 1;
+    } else if (v <= 0xff) {
+        h[0] = major | 24;
+        h[1] = (uint8_t)v;
+        n = 2;
+    } else if (v <= 0xffff) {
+        h[0] = major | 25;
+        h[1] = (uint8_t)(v >> 8);
+        h[2] = (uint8_t)v;
+        n = 3;
+    } else if (v <= 0xffffffffULL) {
+        h[0] = major | 26;
+        for (int i = 0; i < 4; i++) {
+            h[1 + i] = (uint8_t)(v >> (24 - 8 * i));
+        }
+        n = 5;
+    } else {
+        h[0] = major | 27;
+        for (int i = 0; i < 8; i++) {
+            h[1 + i] = (uint8_t)(v >> (56 - 8 * i));
+        }
+        n = 9;
+    }
+    put(w, (const char *)h, n);
+}
+
+static void cbor_int(jw_t *w, int64_t v) {
+    if (v < 0) {
+        cbor_head(w, CBOR_NEGINT, (uint64_t)(-(v + 1)));
+    } else {
+        cbor_head(w, CBOR_UINT, (uint64_t)v);
+    }
+}
+
+static void cbor_text(jw_t *w, const char *s, size_t n) {
+    cbor_head(w, CBOR_TEXT, n);
+    put(w, s, n);
+}
+
+/* Integral: integer; else float32 when that is exact, else float64 */
+static void cbor_number(jw_t *w, double v) {
+    if (!isfinite(v)) {
+        put_char(w, (char)CBOR_NULL);
+        return;
+    }
+    if (v == (double)(int64_t)v && fabs(v) < 1e15) {
+        cbor_int(w, (int64_t)v);
+        return;
+    }
+
+    uint8_t b[9];
+    float f = (float)v;
+    if ((double)f == v) {
+        uint32_t u;
+        memcpy(&u, &f, sizeof(u));
+        b[0] = CBOR_FLOAT32;
+        for (int i = 0; i < 4; i++) {
+            b[1 + i] = (uint8_t)(u >> (24 - 8 * i));
+        }
+        put(w, (const char *)b, 5);
+    } else {
+        uint64_t u;
+        memcpy(&u, &v, sizeof(u));
+        b[0] = CBOR_FLOAT64;
+        for (int i = 0; i < 8; i++) {
+            b[1 + i] = (uint8_t)(u >> (56 - 8 * i));
+        }
+        put(w, (const char *)b, 9);
+    }
+}
+
+/* Separator and "key": for the next member of the current level */
+static void member(jw_t *w, const char *key) {
+    if (w->format == JW_CBOR) {
+        if (key != NULL) {
+            cbor_text(w, key, strlen(key));
+        }
+        return;
+    }
+
+    uint32_t bit = 1u << w->depth;
+    if (w->has_items & bit) {
+        put_char(w, ',');
+    }
+    w->has_items |= bit;
+
+    if (key != NULL) {
+        put_char(w, '"');
+        put(w, key, strlen(key));
+        put(w, "\":", 2);
+    }
+}
+
+static void open_level(jw_t *w, const char *key, char c) {
+    member(w, key);
+    if (w->format == JW_CBOR) {
+        put_char(w, (char)(c == '{' ? CBOR_MAP_INDEF : CBOR_ARRAY_INDEF));
+    } else {
+        put_char(w, c);
+    }
+    if (w->depth + 1 >= JW_MAX_DEPTH) {
+        w->overflow = 1;
+        return;
+    }
+    w->depth++;
+    w->has_items &= ~(1u << w->depth);
+}
+
+static void close_level(jw_t *w, char c) {
+    put_char(w, w->format == JW_CBOR ? (char)CBOR_BREAK : c);
+    if (w->depth > 0) {
+        w->depth--;
+    }
+}
+
+void jw_object(jw_t *w, const char *key)  { open_level(w, key, '{'); }
+void jw_object_end(jw_t *w)               { close_level(w, '}'); }
+void jw_array(jw_t *w, const char *key)   { open_level(w, key, '['); }
+void jw_array_end(jw_t *w)                { close_level(w, ']'); }
+
+/* Digits of v at out (at most 20), returns the count */
+static size_t format_u64(char *out, uint64_t v) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+static void put_int(jw_t *w, int64_t v) {
+    char num[24];
+    size_t n = 0;
+    uint64_t u = (uint64_t)v;
+    if (v < 0) {
+        num[n++] = '-';
+        u = 0 - u;
+    }
+    n += format_u64(num + n, u);
+    put(w, num, n);
+}
+
+void jw_int(jw_t *w, const char *key, int64_t v) {
+    member(w, key);
+    if (w->format == JW_CBOR) {
+        cbor_int(w, v);
+        return;
+    }
+    put_int(w, v);
+}
+
+void jw_bool(jw_t *w, const char *key, int v) {
+    member(w, key);
+    if (w->format == JW_CBOR) {
+        put_char(w, (char)(v ? CBOR_TRUE : CBOR_FALSE));
+        return;
+    }
+    if (v) {
+        put(w, "true", 4);
+    } else {
+        put(w, "false", 5);
+    }
+}
+
+void jw_string(jw_t *w, const char *key, const char *s) {
+    member(w, key);
+    if (w->format == JW_CBOR) {
+        cbor_text(w, s, strlen(s));
+        return;
+    }
+    put_char(w, '"');
+    for (const char *run = s; ; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c != '\0' && c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+        put(w, run, (size_t)(s - run));
+        if (c == '\0') {
+            break;
+        }
+        char esc[8];
+        switch (c) {
+        case '"':  put(w, "\\\"", 2); break;
+        case '\\': put(w, "\\\\", 2); break;
+        case '\n': put(w, "\\n", 2); break;
+        case '\r': put(w, "\\r", 2); break;
+        case '\t': put(w, "\\t", 2); break;
+        default:
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            put(w, esc, 6);
+            break;
+        }
+        run = s + 1;
+    }
+    put_char(w, '"');
+}
+
+/*
+ * JSON text to CBOR for jw_raw(): one pass over the text, nothing
+ * allocated. Covers what cJSON and database.c print - objects,
+ * arrays, strings with escapes, numbers, true/false/null.
+ */
+typedef struct {
+    const char *p;
+    const char *end;
+} json_src_t;
+
+static void skip_ws(json_src_t *src) {
+    while (src->p < src->end &&
+           (*src->p == ' ' || *src->p == '\t' || *src->p == '\n' || *src->p == '\r')) {
+        src->p++;
+    }
+}
+
+static int hex4(const char *p, uint32_t *out) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') v |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v |= (uint32_t)(c - 'A' + 10);
+        else return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+/* Decodes the escape at p (after the backslash) into out (up to 4
+ * UTF-8 bytes); returns its length, advances *p, -1 if malformed */
+static int unescape(const char **p, const char *end, char *out) {
+    char c = *(*p)++;
+    switch (c) {
+    case '"': case '\\': case '/': out[0] = c; return 1;
+    case 'b': out[0] = '\b'; return 1;
+    case 'f': out[0] = '\f'; return 1;
+    case 'n': out[0] = '\n'; return 1;
+    case 'r': out[0] = '\r'; return 1;
+    case 't': out[0] = '\t'; return 1;
+    case 'u': break;
+    default: return -1;
+    }
+
+    uint32_t cp;
+    if (end - *p < 4 || hex4(*p, &cp) < 0) {
+        return -1;
+    }
+    *p += 4;
+    if (cp >= 0xd800 && cp <= 0xdbff) {
+        uint32_t lo;
+        if (end - *p < 6 || (*p)[0] != '\\' || (*p)[1] != 'u' ||
+            hex4(*p + 2, &lo) < 0 || lo < 0xdc00 || lo > 0xdfff) {
+            return -1;
+        }
+        *p += 6;
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+    }
+
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xc0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3f));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xe0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        out[2] = (char)(0x80 | (cp & 0x3f));
+        return 3;
+    }
+    out[0] = (char)(0xf0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    out[3] = (char)(0x80 | (cp & 0x3f));
+    return 4;
+}
+
+/* A string at src->p (opening quote): measured, then written */
+static int tc_string(jw_t *w, json_src_t *src) {
+    const char *start = ++src->p;
+    size_t n = 0;
+    char tmp[4];
+
+    while (src->p < src->end && *src->p != '"') {
+        if (*src->p == '\\') {
+            src->p++;
+            int k = unescape(&src->p, src->end, tmp);
+            if (k < 0) {
+                return -1;
+            }
+            n += (size_t)k;
+        } else {
+            src->p++;
+            n++;
+        }
+    }
+    if (src->p >= src->end) {
+        return -1;
+    }
+
+    cbor_head(w, CBOR_TEXT, n);
+    for (const char *p = start; p < src->p; ) {
+        const char *run = p;
+        while (p < src->p && *p != '\\') {
+            p++;
+        }
+        put(w, run, (size_t)(p - run));
+        if (p < src->p) {
+            p++;
+            int k = unescape(&p, src->p, tmp);
+            put(w, tmp, (size_t)k);
+        }
+    }
+    src->p++;       // closing quote
+    return 0;
+}
+
+static int tc_number(jw_t *w, json_src_t *src) {
+    char num[48];
+    size_t n = 0;
+    int integral = 1;
+
+    while (src->p < src->end && n < sizeof(num) - 1 &&
+           strchr("+-0123456789.eE", *src->p) != NULL) {
+        if (*src->p == '.' || *src->p == 'e' || *src->p == 'E') {
+            integral = 0;
+        }
+        num[n++] = *src->p++;
+    }
+    num[n] = '\0';
+
+    char *stop;
+    if (integral) {
+        long long v = strtoll(num, &stop, 10);
+        if (stop == num + n && n > 0 && n < 19) {
+            cbor_int(w, v);
+            return 0;
+        }
+    }
+    double d = strtod(num, &stop);
+    if (stop != num + n || n == 0) {
+        return -1;
+    }
+    cbor_number(w, d);
+    return 0;
+}
+
+static int tc_literal(json_src_t *src, const char *word) {
+    size_t n = strlen(word);
+    if ((size_t)(src->end - src->p) < n || memcmp(src->p, word, n) != 0) {
+        return -1;
+    }
+    src->p += n;
+    return 0;
+}
+
+static int tc_value(jw_t *w, json_src_t *src, int depth) {
+    skip_ws(src);
+    if (src->p >= src->end || depth >= JW_MAX_DEPTH) {
+        return -1;
+    }
+
+    char c = *src->p;
+    if (c == '{' || c == '[') {
+        char close = c == '{' ? '}' : ']';
+        put_char(w, (char)(c == '{' ? CBOR_MAP_INDEF : CBOR_ARRAY_INDEF));
+        src->p++;
+        skip_ws(src);
+        if (src->p < src->end && *src->p == close) {
+            src->p++;
+            put_char(w, (char)CBOR_BREAK);
+            return 0;
+        }
+        for (;;) {
+            if (c == '{') {
+                skip_ws(src);
+                if (src->p >= src->end || *src->p != '"' || tc_string(w, src) < 0) {
+                    return -1;
+                }
+                skip_ws(src);
+                if (src->p >= src->end || *src->p++ != ':') {
+                    return -1;
+                }
+            }
+            if (tc_value(w, src, depth + 1) < 0) {
+                return -1;
+            }
+            skip_ws(src);
+            if (src->p >= src->end) {
+                return -1;
+            }
+            if (*src->p == ',') {
+                src->p++;
+                continue;
+            }
+            if (*src->p++ != close) {
+                return -1;
+            }
+            put_char(w, (char)CBOR_BREAK);
+            return 0;
+        }
+    }
+    if (c == '"') {
+        return tc_string(w, src);
+    }
+    if (c == 't') {
+        put_char(w, (char)CBOR_TRUE);
+        return tc_literal(src, "true");
+    }
+    if (c == 'f') {
+        put_char(w, (char)CBOR_FALSE);
+        return tc_literal(src, "false");
+    }
+    if (c == 'n') {
+        put_char(w, (char)CBOR_NULL);
+        return tc_literal(src, "null");
+    }
+    return tc_number(w, src);
+}
+
+void jw_raw(jw_t *w, const char *key, const char *json, size_t len) {
+    member(w, key);
+    if (w->format == JW_CBOR) {
+        json_src_t src = { json, json + len };
+        if (tc_value(w, &src, w->depth) < 0) {
+            w->overflow = 1;
+        }
+        return;
+    }
+    put(w, json, len);
+}
+
+/*
+ * Sensor values are floats parsed from short decimals, so the fewest
+ * decimals (up to FLOAT_MAX_DECIMALS) that give back the same float
+ * are found with a multiply and a compare each - no snprintf/strtod
+ * round trips. Anything else falls back to %.9g, which always does.
+ */
+void jw_float(jw_t *w, const char *key, float v) {
+    member(w, key);
+    if (w->format == JW_CBOR) {
+        cbor_number(w, v);
+        return;
+    }
+    if (!isfinite(v)) {
+        put(w, "null", 4);
+        return;
+    }
+
+    double d = v;
+    for (int k = 0; k <= FLOAT_MAX_DECIMALS; k++) {
+        double scaled = nearbyint(d * pow10_d[k]);
+        if (fabs(scaled) >= 1e15) {
+            break;
+        }
+        if ((float)(scaled / pow10_d[k]) != v) {
+            continue;
+        }
+
+        char num[48];
+        size_t n = 0;
+        uint64_t u = (uint64_t)fabs(scaled);
+        if (scaled < 0) {
+            num[n++] = '-';
+        }
+        n += format_u64(num + n, u / pow10_u[k]);
+        if (k > 0) {
+            uint64_t frac = u % pow10_u[k];
+            num[n++] = '.';
+            for (int i = k - 1; i >= 0; i--) {
+                num[n + i] = (char)('0' + frac % 10);
+                frac /= 10;
+            }
+            n += k;
+        }
+        put(w, num, n);
+        return;
+    }
+
+    char num[32];
+    int n = snprintf(num, sizeof(num), "%.9g", d);
+    put(w, num, (size_t)n);
+}
+
+/* Integers without printf; the rest as cJSON prints them (shortest
+ * of 15/17 significant digits that reads back exactly) */
+void jw_double(jw_t *w, const char *key, double v) {
+    member(w, key);
+    if (w->format == JW_CBOR) {
+        cbor_number(w, v);
+        return;
+    }
+    if (!isfinite(v)) {
+        put(w, "null", 4);
+        return;
+    }
+    if (v == (double)(int64_t)v && fabs(v) < 1e15) {
+        put_int(w, (int64_t)v);
+        return;
+    }
+
+    char num[32];
+    int n = snprintf(num, sizeof(num), "%1.15g", v);
+    if (strtod(num, NULL) != v) {
+        n = snprintf(num, sizeof(num), "%1.17g", v);
+    }
+    put(w, num, (size_t)n);
+}
+
+const char *jw_finish(jw_t *w, size_t *len) {
+    if (w->overflow) {
+        return NULL;
+    }
+    w->buf[w->len] = '\0';
+    if (len) {
+        *len = w->len;
+    }
+    return w->buf;
+}
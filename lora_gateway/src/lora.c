@@ -139,6 +139,44 @@ int lora_send_command(int node_id, const char *cmd, const char *val) {
     return lora_send_command_json(node_id, cmd, val);
 }
 
+/* Downlinks back to back in one standby period: the radio leaves RX
+ * once, and each packet gets TX_WAIT_TIME on air before the next */
+int lora_send_batch(const lora_cmd_t *cmds, int count) {
+    uint32_t state;
+    int sent = 0;
+    char timestamp[32];
+    char packet[MAX_PACKET_SIZE];
+    
+    if (count < 1) {
+        return 0;
+    }
+    
+    state = LORA_STATE_STANDBY;
+    ioctl(lora_fd, LORA_SET_STATE, &state);
+    usleep(10000);
+    
+    for (int i = 0; i < count; i++) {
+        int len = snprintf(packet, sizeof(packet), "{\"node\":%d,\"cmd\":\"%s\",\"val\":\"%s\"}",
+                           cmds[i].node_id, cmds[i].cmd, cmds[i].val);
+        int ret = write(lora_fd, packet, len);
+        
+        get_timestamp(timestamp, sizeof(timestamp));
+        if (ret > 0) {
+            printf("[%s] TX JSON %d/%d (%d bytes): %s\n", timestamp, i + 1, count, ret, packet);
+            sent++;
+        } else {
+            printf("[%s] TX failed: %s\n", timestamp, strerror(errno));
+        }
+        
+        usleep(TX_WAIT_TIME * 1000);
+    }
+    
+    state = LORA_STATE_RX;
+    ioctl(lora_fd, LORA_SET_STATE, &state);
+    
+    return sent;
+}
+
 int lora_read_packet(char *buffer, int max_len) {
     return read(lora_fd, buffer, max_len - 1);
 }
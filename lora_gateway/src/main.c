@@ -26,6 +26,10 @@
 
 #include "gateway.h"
 #include "mqtt.h"
+#include "mqtt_spool.h"
+#include "mqtt_batch.h"
+#include "mqtt_outq.h"
+#include "snapshot.h"
 #include "database.h"
 #include "lora.h"
 #include "utils.h"
@@ -64,6 +68,57 @@ int main(int argc, char *argv[]) {
     printf("║  ✓ Outputs /tmp/gateway_data.json for web        ║\n");
     printf("╚═══════════════════════════════════════════════════╝\n");
     
+    // Options: --db-profile NAME (SQLite tuning, see database.h)
+    //          --mqtt-nodes per-node|batch|both (node data topics, see mqtt.h)
+    //          --mqtt-delta (per-node topics carry changed fields only)
+    //          --mqtt-aliases (per-node topics as MQTT v5 topic aliases)
+    //          --mqtt-format json|cbor (nodes/# and stats payload encoding)
+    //          --mqtt-debug (log every inbound MQTT message and command)
+    //          --snapshot-ms N (dashboard file at most every N ms, see snapshot.h)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mqtt-delta") == 0) {
+            mqtt_set_node_delta(1);
+        }
+        if (strcmp(argv[i], "--mqtt-aliases") == 0) {
+            mqtt_set_topic_aliases(1);
+        }
+        if (strcmp(argv[i], "--mqtt-debug") == 0) {
+            mqtt_set_debug(1);
+        }
+        if (strcmp(argv[i], "--mqtt-nodes") == 0 && i + 1 < argc) {
+            if (mqtt_set_node_publish(argv[++i]) < 0) {
+                fprintf(stderr, "Unknown --mqtt-nodes '%s' (per-node, batch or both)\n", argv[i]);
+                return 1;
+            }
+        }
+        if (strcmp(argv[i], "--mqtt-format") == 0 && i + 1 < argc) {
+            if (mqtt_set_payload_format(argv[++i]) < 0) {
+                fprintf(stderr, "Unknown --mqtt-format '%s' (json or cbor)\n", argv[i]);
+                return 1;
+            }
+        }
+        if (strcmp(argv[i], "--snapshot-ms") == 0 && i + 1 < argc) {
+            char *end;
+            long ms = strtol(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || ms < 0 || ms > SNAPSHOT_INTERVAL_MAX_MS) {
+                fprintf(stderr, "Bad --snapshot-ms '%s' (0 to %d)\n", argv[i], SNAPSHOT_INTERVAL_MAX_MS);
+                return 1;
+            }
+            snapshot_configure(SNAPSHOT_PATH, (int)ms);
+        }
+        if (strcmp(argv[i], "--db-profile") == 0 && i + 1 < argc) {
+            if (db_set_profile(argv[++i]) < 0) {
+                int count;
+                const db_profile_t *profiles = db_list_profiles(&count);
+                fprintf(stderr, "Unknown DB profile '%s'. Profiles:\n", argv[i]);
+                for (int p = 0; p < count; p++) {
+                    fprintf(stderr, "  %-10s %s\n", profiles[p].name, profiles[p].about);
+                }
+                return 1;
+            }
+        }
+    }
+    
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
@@ -111,7 +166,11 @@ int main(int argc, char *argv[]) {
     signal(SIGALRM, shutdown_timeout_handler);
     alarm(5);  // 5 second timeout
     
+    snapshot_flush();       // last packets into the dashboard file
     db_cleanup();
+    mqtt_batch_stop();      // last batch goes out (or to the spool)
+    mqtt_outq_stop();       // node data not yet sent goes to the spool
+    mqtt_spool_close();     // unsent data stays on disk for the next start
     
     if (gateway.lora_fd >= 0) {
         uint32_t state = LORA_STATE_SLEEP;
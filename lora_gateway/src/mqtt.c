@@ -4,13 +4,27 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <math.h>
 #include <cjson/cJSON.h>
 #include <mosquitto.h>
+#include <mqtt_protocol.h>
 
 #include "mqtt.h"
+#include "mqtt_spool.h"
+#include "mqtt_outq.h"
+#include "mqtt_router.h"
+#include "mqtt_bulk.h"
+#include "mqtt_batch.h"
+#include "json_writer.h"
+#include "payload.h"
 #include "database.h"
+#include "db_query_pool.h"
+#include "db_cache.h"
+#include "downsample.h"
+#include "node_stats.h"
 #include "gateway.h"
 #include "utils.h"
 
@@ -18,17 +32,68 @@
 extern gateway_state_t gateway;
 extern database_state_t db_state;
 
+/* Inbound messages are logged with --mqtt-debug only (mqtt_set_debug) */
+static int mqtt_debug = 0;
+
+#define MQTT_DEBUG(...) do {                                \
+        if (mqtt_debug) {                                   \
+            char ts_[32];                                   \
+            get_timestamp(ts_, sizeof(ts_));                \
+            printf("[%s] ", ts_);                           \
+            printf(__VA_ARGS__);                            \
+            putchar('\n');                                  \
+        }                                                   \
+    } while (0)
+
+/* Where node data goes (mqtt_set_node_publish) */
+static int node_topics = 1;
+static int node_batches = 0;
+
+/* nodes/# and stats payloads (mqtt_set_payload_format): JW_JSON / JW_CBOR */
+static int payload_format = JW_JSON;
+
+/* Delta publishing (mqtt_set_node_delta): what subscribers of
+ * nodes/node{id} have been sent, per node. RX thread only */
+typedef struct {
+    node_data_t sent;
+    time_t keyframe_at;
+    uint32_t seq;
+    int valid;                  // 0: next message is a keyframe
+} node_delta_t;
+
+static int node_deltas = 0;
+static node_delta_t delta_state[MAX_NODES];
+static volatile int delta_resync = 0;   // set on (re)connect
+
+/* Topic aliases (mqtt_set_topic_aliases): nodes/node{id} goes out in
+ * full once per connection, binding alias {id}, then as the alias only,
+ * for ids up to the broker's Topic Alias Maximum. Alias-only messages
+ * are QoS 0 - libmosquitto resends unacknowledged QoS 1 messages after
+ * a reconnect, when the broker no longer knows the alias */
+static int topic_aliases = 0;
+static volatile uint16_t alias_max = 0;     // from CONNACK, 0: none
+static volatile uint32_t alias_conn = 0;    // bumped on connect and disconnect
+static uint32_t alias_bound[MAX_NODES];     // alias_conn when bound, sender thread
+
 /*====================================================================
  * MQTT CALLBACK FUNCTIONS
  *====================================================================*/
 
-void mqtt_on_connect(struct mosquitto *mosq, void *obj, int rc) {
+void mqtt_on_connect(struct mosquitto *mosq, void *obj, int rc, int flags,
+                     const mosquitto_property *props) {
     char timestamp[32];
     get_timestamp(timestamp, sizeof(timestamp));
     
     if (rc == 0) {
         printf("[%s]  MQTT Connected to %s:%d\n", timestamp, MQTT_BROKER, MQTT_PORT);
+        
+        // Aliases are per connection; absent maximum means none allowed
+        uint16_t max = 0;
+        mosquitto_property_read_int16(props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &max, false);
+        alias_max = max;
+        alias_conn++;
         gateway.mqtt_connected = 1;
+        mqtt_outq_connected();
         
         // Publish online status
         char topic[128];
@@ -51,6 +116,16 @@ void mqtt_on_connect(struct mosquitto *mosq, void *obj, int rc) {
         snprintf(topic, sizeof(topic), "%s/db/query", MQTT_TOPIC_PREFIX);
         mosquitto_subscribe(mosq, NULL, topic, MQTT_QOS);
         printf("[%s]  MQTT Subscribed (DB): %s\n", timestamp, topic);
+        
+        // Fresh keyframes for anyone who subscribed while we were away
+        delta_resync = 1;
+        
+        // Replay what was published while we were away
+        if (mqtt_spool_pending() > 0) {
+            printf("[%s]  MQTT Replaying %u spooled messages\n",
+                   timestamp, mqtt_spool_pending());
+            mqtt_spool_kick();
+        }
     } else {
         printf("[%s]  MQTT Connect failed: %s\n", timestamp, mosquitto_connack_string(rc));
         gateway.mqtt_connected = 0;
@@ -62,6 +137,7 @@ void mqtt_on_disconnect(struct mosquitto *mosq, void *obj, int rc) {
     get_timestamp(timestamp, sizeof(timestamp));
     printf("[%s]   MQTT Disconnected (rc=%d)\n", timestamp, rc);
     gateway.mqtt_connected = 0;
+    alias_conn++;
     
     if (gateway.running && rc != 0) {
         printf("[%s]   MQTT Auto-reconnect in %d seconds...\n", 
@@ -71,327 +147,680 @@ void mqtt_on_disconnect(struct mosquitto *mosq, void *obj, int rc) {
 
 void mqtt_on_publish(struct mosquitto *mosq, void *obj, int mid) {
     gateway.mqtt_publish_count++;
+    mqtt_outq_acked(mid);
 }
 
-void mqtt_on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg) {
-    char timestamp[32];
-    get_timestamp(timestamp, sizeof(timestamp));
+/* mqtt_outq.c sender thread: one queued message to libmosquitto. The
+ * alias is decided here, not when queued, so an alias-only message can
+ * never reach a connection that has not bound it */
+static int mqtt_send(const mq_msg_t *m, int *mid) {
+    mosquitto_property *props = NULL;
+    const char *topic = m->topic;
+    int qos = m->qos;
+    int bound = 0;
+    uint32_t conn = alias_conn;
     
-    printf("[%s]  MQTT RX: %s => %s\n", timestamp, msg->topic, (char*)msg->payload);
-    
-    char *topic = msg->topic;
-    char *payload = (char*)msg->payload;
-    
-    // Handle database queries
-    if (strstr(topic, "/db/query") != NULL) {
-        if (db_state.db == NULL) {
-            printf("[%s]   Database not available\n", timestamp);
-            
-            cJSON *error = cJSON_CreateObject();
-            cJSON_AddBoolToObject(error, "success", false);
-            cJSON_AddStringToObject(error, "error", "Database not available");
-            char *error_str = cJSON_PrintUnformatted(error);
-            
-            char response_topic[128];
-            snprintf(response_topic, sizeof(response_topic), "%s/db/response", MQTT_TOPIC_PREFIX);
-            mosquitto_publish(mosq, NULL, response_topic, strlen(error_str), error_str, MQTT_QOS, false);
-            
-            free(error_str);
-            cJSON_Delete(error);
-            return;
+    int alias = topic_aliases && m->alias > 0 && m->alias <= alias_max;
+    if (alias) {
+        mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, m->alias);
+        // First message of the connection binds the alias (topic + alias)
+        bound = alias_bound[m->alias - 1] == conn;
+        if (bound) {
+            topic = NULL;
+            qos = 0;
         }
-        
-        cJSON *request = cJSON_Parse(payload);
-        if (request == NULL) {
-            printf("[%s]   Invalid JSON query\n", timestamp);
-            return;
+    }
+    if (m->correlation != NULL) {
+        mosquitto_property_add_binary(&props, MQTT_PROP_CORRELATION_DATA,
+                                      m->correlation, m->correlation_len);
+    }
+    if (m->format == JW_CBOR) {
+        mosquitto_property_add_string(&props, MQTT_PROP_CONTENT_TYPE, "application/cbor");
+    }
+    
+    int rc = mosquitto_publish_v5(gateway.mqtt, mid, topic, (int)m->len, m->payload,
+                                  qos, m->retain, props);
+    mosquitto_property_free_all(&props);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        return -1;
+    }
+    if (bound) {
+        gateway.mqtt_aliased++;
+    } else if (alias) {
+        alias_bound[m->alias - 1] = conn;
+    }
+    return 0;
+}
+
+/*====================================================================
+ * DB QUERY HANDLING - runs on the query worker threads
+ *====================================================================*/
+
+/* One response message: to the request's response topic with its
+ * correlation data when it had them (MQTT v5), else to the shared
+ * MQTT_DB_RESPONSE_TOPIC that every dashboard reads. Query workers wait
+ * up to MQTT_OUTQ_DB_WAIT_MS for queue room, so a streamed get_range
+ * goes no faster than the broker takes it; the loop thread never waits */
+static int mqtt_publish_db_reply(const db_reply_to_t *reply_to, const char *payload,
+                                 size_t len, int format, int wait_ms) {
+    int direct = reply_to != NULL && reply_to->topic != NULL;
+    mq_msg_t m = {
+        .topic = direct ? reply_to->topic : MQTT_DB_RESPONSE_TOPIC,
+        .payload = payload,
+        .len = len,
+        .qos = MQTT_QOS,
+        .format = format,
+    };
+    
+    if (reply_to != NULL && reply_to->correlation != NULL) {
+        m.correlation = reply_to->correlation;
+        m.correlation_len = reply_to->correlation_len;
+    }
+    
+    if (mqtt_outq_submit(MQ_DB, &m, wait_ms) < 0) {
+        gateway.mqtt_error_count++;
+        return -1;
+    }
+    if (direct) {
+        gateway.mqtt_db_direct++;
+    }
+    return 0;
+}
+
+static void mqtt_publish_db_error(const db_reply_to_t *reply_to, const char *message) {
+    cJSON *error = cJSON_CreateObject();
+    cJSON_AddBoolToObject(error, "success", false);
+    cJSON_AddStringToObject(error, "error", message);
+    char *error_str = cJSON_PrintUnformatted(error);
+    
+    mqtt_publish_db_reply(reply_to, error_str, strlen(error_str), JW_JSON, 0);
+    
+    free(error_str);
+    cJSON_Delete(error);
+}
+
+/* Response topics are the requester's, except under our own prefix:
+ * there only below MQTT_DB_RESPONSE_TOPIC/, never control/# or db/query */
+static int mqtt_response_topic_ok(const char *topic) {
+    size_t prefix = strlen(MQTT_TOPIC_PREFIX);
+    size_t own = strlen(MQTT_DB_RESPONSE_TOPIC);
+    
+    if (topic[0] == '\0' || strpbrk(topic, "+#") != NULL) {
+        return 0;
+    }
+    if (strncmp(topic, MQTT_TOPIC_PREFIX, prefix) != 0 ||
+        (topic[prefix] != '/' && topic[prefix] != '\0')) {
+        return 1;
+    }
+    return strncmp(topic, MQTT_DB_RESPONSE_TOPIC, own) == 0 &&
+           (topic[own] == '\0' || (topic[own] == '/' && topic[own + 1] != '\0'));
+}
+
+/*
+ * get_range replies - one message per chunk of rows:
+ * {"success":true,"request_id":..,"action":"get_range","seq":N,
+ *  "last":false|true[,"max_points":M][,"next_after_ts":T],"data":[...]}
+ * max_points is the downsampling bound actually used, after clamping.
+ * next_after_ts on the last chunk means the page was cut at "limit";
+ * repeat the request with "after_ts" set to it for the next page.
+ * With "format":"cbor" the same map as CBOR, rows converted from the
+ * chunk's JSON text by jw_raw().
+ */
+#define DB_RESPONSE_HEADER_MAX  256
+#define DB_CBOR_EXPANSION       3       // worst case CBOR/JSON size ("0.1": 9 bytes)
+
+typedef struct {
+    const db_reply_to_t *reply_to;
+    int format;                 // JW_JSON / JW_CBOR
+    char request_id[80];        // JSON-quoted
+    int max_points;             // 0: not downsampled
+    char *msg;                  // header + one chunk
+    size_t cap;
+    size_t sent;
+} range_reply_t;
+
+static int mqtt_publish_range_chunk_cbor(range_reply_t *reply, const char *rows, size_t len,
+                                         int seq, int last, int64_t next_after_ts) {
+    jw_t w;
+    jw_init(&w, reply->msg, reply->cap, JW_CBOR);
+    jw_object(&w, NULL);
+    jw_bool(&w, "success", 1);
+    jw_raw(&w, "request_id", reply->request_id, strlen(reply->request_id));
+    jw_string(&w, "action", "get_range");
+    jw_int(&w, "seq", seq);
+    jw_bool(&w, "last", last);
+    if (reply->max_points > 0) {
+        jw_int(&w, "max_points", reply->max_points);
+    }
+    if (next_after_ts > 0) {
+        jw_int(&w, "next_after_ts", next_after_ts);
+    }
+    jw_raw(&w, "data", rows, len);
+    jw_object_end(&w);
+    
+    size_t n;
+    const char *msg = jw_finish(&w, &n);
+    if (msg == NULL ||
+        mqtt_publish_db_reply(reply->reply_to, msg, n, JW_CBOR, MQTT_OUTQ_DB_WAIT_MS) < 0) {
+        return -1;
+    }
+    reply->sent += n;
+    return 0;
+}
+
+static int mqtt_publish_range_chunk(const char *rows, size_t len, int seq, int last,
+                                    int64_t next_after_ts, void *ctx) {
+    range_reply_t *reply = ctx;
+    char points[32] = "";
+    char cursor[48] = "";
+    
+    if (reply->format == JW_CBOR) {
+        return mqtt_publish_range_chunk_cbor(reply, rows, len, seq, last, next_after_ts);
+    }
+    if (reply->max_points > 0) {
+        snprintf(points, sizeof(points), ",\"max_points\":%d", reply->max_points);
+    }
+    if (next_after_ts > 0) {
+        snprintf(cursor, sizeof(cursor), ",\"next_after_ts\":%lld", (long long)next_after_ts);
+    }
+    int n = snprintf(reply->msg, DB_RESPONSE_HEADER_MAX,
+        "{\"success\":true,\"request_id\":%s,\"action\":\"get_range\","
+        "\"seq\":%d,\"last\":%s%s%s,\"data\":",
+        reply->request_id, seq, last ? "true" : "false", points, cursor);
+    if (n < 0 || n >= DB_RESPONSE_HEADER_MAX) {
+        return -1;
+    }
+    memcpy(reply->msg + n, rows, len);
+    reply->msg[n + len] = '}';
+    
+    if (mqtt_publish_db_reply(reply->reply_to, reply->msg, n + len + 1, JW_JSON,
+                              MQTT_OUTQ_DB_WAIT_MS) < 0) {
+        return -1;
+    }
+    reply->sent += n + len + 1;
+    return 0;
+}
+
+/* Request numbers are untrusted: bounded before any arithmetic */
+static int clamp_int(int v, int lo, int hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* Index of name in names[], or fallback when absent / unknown */
+static int mqtt_lookup(const cJSON *item, const char *const names[], int count, int fallback) {
+    if (!cJSON_IsString(item)) {
+        return fallback;
+    }
+    for (int i = 0; i < count; i++) {
+        if (strcmp(item->valuestring, names[i]) == 0) {
+            return i;
+        }
+    }
+    return fallback;
+}
+
+/* Returns rows sent, -1 if nothing could be sent */
+static int mqtt_stream_range(cJSON *request, const char *request_id, int format,
+                             const db_reply_to_t *reply_to, size_t *sent) {
+    // DB_DOWNSAMPLE_* and ds_field_t order
+    static const char *const downsample_names[] = { "lttb", "minmax", "avg" };
+    static const char *const field_names[DS_FIELDS] = {
+        "temperature", "humidity", "light", "soil_moisture"
+    };
+    
+    cJSON *node_json = cJSON_GetObjectItem(request, "node_id");
+    cJSON *hours_json = cJSON_GetObjectItem(request, "hours");
+    cJSON *points_json = cJSON_GetObjectItem(request, "max_points");
+    cJSON *after_json = cJSON_GetObjectItem(request, "after_ts");
+    cJSON *limit_json = cJSON_GetObjectItem(request, "limit");
+    
+    db_range_query_t q = {
+        .node_id = cJSON_IsNumber(node_json) ? node_json->valueint : 1,
+        .hours = cJSON_IsNumber(hours_json) ? hours_json->valueint : 24,
+        .max_points = cJSON_IsNumber(points_json) ? points_json->valueint : 0,
+        .downsample = mqtt_lookup(cJSON_GetObjectItem(request, "downsample"),
+                                  downsample_names, 3, DB_DOWNSAMPLE_LTTB),
+        .field = mqtt_lookup(cJSON_GetObjectItem(request, "field"),
+                             field_names, DS_FIELDS, DS_FIELD_TEMPERATURE),
+        .after_ts = cJSON_IsNumber(after_json) ? (int64_t)after_json->valuedouble : 0,
+        .limit = cJSON_IsNumber(limit_json) ? limit_json->valueint : DB_RANGE_PAGE_ROWS,
+    };
+    
+    if (q.limit <= 0 || q.limit > DB_RANGE_PAGE_ROWS) {
+        q.limit = DB_RANGE_PAGE_ROWS;
+    }
+    q.hours = clamp_int(q.hours, 1, DB_QUERY_MAX_HOURS);
+    // 0 (or less): every raw row. Otherwise enough for LTTB's first and
+    // last row plus a bucket, and no more than one page
+    if (q.max_points > 0) {
+        int most = q.limit < DB_RANGE_MAX_POINTS ? q.limit : DB_RANGE_MAX_POINTS;
+        q.max_points = clamp_int(q.max_points, DB_RANGE_MIN_POINTS,
+                                 most > DB_RANGE_MIN_POINTS ? most : DB_RANGE_MIN_POINTS);
+    } else {
+        q.max_points = 0;
+    }
+    
+    range_reply_t reply = { .reply_to = reply_to, .format = format, .max_points = q.max_points };
+    
+    cJSON *id = cJSON_CreateString(request_id);
+    char *id_str = cJSON_PrintUnformatted(id);
+    cJSON_Delete(id);
+    if (id_str == NULL || strlen(id_str) >= sizeof(reply.request_id)) {
+        free(id_str);
+        return -1;
+    }
+    strcpy(reply.request_id, id_str);
+    free(id_str);
+    
+    reply.cap = DB_RESPONSE_HEADER_MAX + DB_RANGE_CHUNK_BYTES + 2;
+    if (format == JW_CBOR) {
+        reply.cap = DB_RESPONSE_HEADER_MAX + DB_RANGE_CHUNK_BYTES * DB_CBOR_EXPANSION;
+    }
+    reply.msg = malloc(reply.cap);
+    if (reply.msg == NULL) {
+        return -1;
+    }
+    
+    int rows = db_stream_range_sensors(&q, mqtt_publish_range_chunk, &reply);
+    free(reply.msg);
+    
+    *sent = reply.sent;
+    return rows;
+}
+
+/* The same response as CBOR; data_str converted without a tree */
+static char *mqtt_db_response_cbor(const char *request_id, const char *action,
+                                   const char *data_str, size_t *len) {
+    size_t data_len = data_str ? strlen(data_str) : 0;
+    size_t cap = DB_RESPONSE_HEADER_MAX + strlen(request_id) + strlen(action) +
+                 data_len * DB_CBOR_EXPANSION;
+    char *buf = malloc(cap);
+    if (buf == NULL) {
+        return NULL;
+    }
+    
+    jw_t w;
+    jw_init(&w, buf, cap, JW_CBOR);
+    jw_object(&w, NULL);
+    jw_bool(&w, "success", data_str != NULL);
+    jw_string(&w, "request_id", request_id);
+    jw_string(&w, "action", action);
+    if (data_str == NULL) {
+        jw_string(&w, "error", "Query failed");
+    } else {
+        jw_raw(&w, "data", data_str, data_len);
+    }
+    jw_object_end(&w);
+    
+    if (jw_finish(&w, len) == NULL) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/*
+ * {"success":..,"request_id":..,"action":..,"data":<data_str>} - the
+ * data text is spliced in as is (it is already JSON), so neither a
+ * cached nor a fresh result is parsed and printed a second time.
+ */
+static char *mqtt_db_response(const char *request_id, const char *action, 
+                              const char *data_str, int format, size_t *len) {
+    if (format == JW_CBOR) {
+        return mqtt_db_response_cbor(request_id, action, data_str, len);
+    }
+    
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response, "success", data_str != NULL);
+    cJSON_AddStringToObject(response, "request_id", request_id);
+    cJSON_AddStringToObject(response, "action", action);
+    if (data_str == NULL) {
+        cJSON_AddStringToObject(response, "error", "Query failed");
+    }
+    
+    char *head = cJSON_PrintUnformatted(response);
+    cJSON_Delete(response);
+    if (head == NULL || data_str == NULL) {
+        if (head != NULL) {
+            *len = strlen(head);
         }
+        return head;
+    }
+    
+    size_t head_len = strlen(head) - 1;     // without the closing '}'
+    size_t data_len = strlen(data_str);
+    char *out = malloc(head_len + data_len + sizeof(",\"data\":}"));
+    if (out) {
+        memcpy(out, head, head_len);
+        memcpy(out + head_len, ",\"data\":", 8);
+        memcpy(out + head_len + 8, data_str, data_len);
+        strcpy(out + head_len + 8 + data_len, "}");
+        *len = head_len + 8 + data_len + 1;
+    }
+    free(head);
+    return out;
+}
+
+static void mqtt_handle_db_query(const char *payload, const db_reply_to_t *reply_to) {
+    char timestamp[32];
+    get_timestamp(timestamp, sizeof(timestamp));
+    
+    cJSON *request = cJSON_Parse(payload);
+    if (request == NULL) {
+        printf("[%s]   Invalid JSON query\n", timestamp);
+        return;
+    }
+    
+    cJSON *action_json = cJSON_GetObjectItem(request, "action");
+    cJSON *request_id_json = cJSON_GetObjectItem(request, "request_id");
+    
+    if (!cJSON_IsString(action_json)) {
+        cJSON_Delete(request);
+        return;
+    }
+    
+    const char *action = action_json->valuestring;
+    const char *request_id = cJSON_IsString(request_id_json) ? 
+                              request_id_json->valuestring : "unknown";
+    
+    // "format":"cbor" - binary response (errors before this point stay JSON)
+    cJSON *format_json = cJSON_GetObjectItem(request, "format");
+    int format = cJSON_IsString(format_json) &&
+                 strcmp(format_json->valuestring, "cbor") == 0 ? JW_CBOR : JW_JSON;
+    
+    MQTT_DEBUG("  DB Query: %s (ID: %s)", action, request_id);
+    
+    char *data_str = NULL;
+    char key[DB_CACHE_KEY_LEN];
+    int cache_node = 0;
+    int cache_store = 0;
+    uint32_t generation = 0;
+    
+    // Repeated requests (dashboards polling) are served from db_cache.c;
+    // the generation is read before the query runs, see db_cache.h
+    if (strcmp(action, "get_latest") == 0) {
+        cJSON *node_json = cJSON_GetObjectItem(request, "node_id");
+        cJSON *limit_json = cJSON_GetObjectItem(request, "limit");
         
-        cJSON *action_json = cJSON_GetObjectItem(request, "action");
-        cJSON *request_id_json = cJSON_GetObjectItem(request, "request_id");
+        int node_id = cJSON_IsNumber(node_json) ? node_json->valueint : 0;
+        int limit = cJSON_IsNumber(limit_json) ? limit_json->valueint : 10;
         
-        if (!cJSON_IsString(action_json)) {
+        snprintf(key, sizeof(key), "get_latest|%d|%d", node_id, limit);
+        if ((data_str = db_cache_get(key, node_id)) == NULL) {
+            generation = db_cache_generation(node_id);
+            data_str = db_query_latest_sensors(node_id, limit);
+            cache_node = node_id;
+            cache_store = 1;
+        }
+    }
+    else if (strcmp(action, "get_range") == 0) {
+        // Streamed in chunks; a failure is reported below like any other
+        size_t sent = 0;
+        int rows = mqtt_stream_range(request, request_id, format, reply_to, &sent);
+        if (rows >= 0) {
+            MQTT_DEBUG("  DB Response streamed (%d rows, %zu bytes)", rows, sent);
             cJSON_Delete(request);
             return;
         }
+    }
+    else if (strcmp(action, "get_aggregate") == 0) {
+        cJSON *node_json = cJSON_GetObjectItem(request, "node_id");
+        cJSON *hours_json = cJSON_GetObjectItem(request, "hours");
+        cJSON *minutes_json = cJSON_GetObjectItem(request, "minutes");
         
-        const char *action = action_json->valuestring;
-        const char *request_id = cJSON_IsString(request_id_json) ? 
-                                  request_id_json->valuestring : "unknown";
+        int node_id = cJSON_IsNumber(node_json) ? node_json->valueint : 1;
+        int hours = cJSON_IsNumber(hours_json) ? hours_json->valueint : 24;
+        int seconds = cJSON_IsNumber(minutes_json) ?
+                      clamp_int(minutes_json->valueint, 1, DB_QUERY_MAX_HOURS * 60) * 60 :
+                      clamp_int(hours, 1, DB_QUERY_MAX_HOURS) * 3600;
         
-        printf("[%s]   DB Query: %s (ID: %s)\n", timestamp, action, request_id);
+        snprintf(key, sizeof(key), "get_aggregate|%d|%d", node_id, seconds);
+        if ((data_str = db_cache_get(key, node_id)) == NULL) {
+            generation = db_cache_generation(node_id);
+            data_str = db_query_aggregate_window(node_id, seconds);
+            cache_node = node_id;
+            cache_store = 1;
+        }
+    }
+    else if (strcmp(action, "get_actuator_history") == 0) {
+        cJSON *node_json = cJSON_GetObjectItem(request, "node_id");
+        cJSON *limit_json = cJSON_GetObjectItem(request, "limit");
         
-        char *data_str = NULL;
+        int node_id = cJSON_IsNumber(node_json) ? node_json->valueint : 1;
+        int limit = cJSON_IsNumber(limit_json) ? limit_json->valueint : 20;
         
-        if (strcmp(action, "get_latest") == 0) {
-            cJSON *node_json = cJSON_GetObjectItem(request, "node_id");
-            cJSON *limit_json = cJSON_GetObjectItem(request, "limit");
-            
-            int node_id = cJSON_IsNumber(node_json) ? node_json->valueint : 0;
-            int limit = cJSON_IsNumber(limit_json) ? limit_json->valueint : 10;
-            
-            data_str = db_query_latest_sensors(node_id, limit);
-        }
-        else if (strcmp(action, "get_range") == 0) {
-            cJSON *node_json = cJSON_GetObjectItem(request, "node_id");
-            cJSON *hours_json = cJSON_GetObjectItem(request, "hours");
-            
-            int node_id = cJSON_IsNumber(node_json) ? node_json->valueint : 1;
-            int hours = cJSON_IsNumber(hours_json) ? hours_json->valueint : 24;
-            
-            data_str = db_query_range_sensors(node_id, hours);
-        }
-        else if (strcmp(action, "get_aggregate") == 0) {
-            cJSON *node_json = cJSON_GetObjectItem(request, "node_id");
-            cJSON *hours_json = cJSON_GetObjectItem(request, "hours");
-            
-            int node_id = cJSON_IsNumber(node_json) ? node_json->valueint : 1;
-            int hours = cJSON_IsNumber(hours_json) ? hours_json->valueint : 24;
-            
-            data_str = db_query_aggregate(node_id, hours);
-        }
-        else if (strcmp(action, "get_actuator_history") == 0) {
-            cJSON *node_json = cJSON_GetObjectItem(request, "node_id");
-            cJSON *limit_json = cJSON_GetObjectItem(request, "limit");
-            
-            int node_id = cJSON_IsNumber(node_json) ? node_json->valueint : 1;
-            int limit = cJSON_IsNumber(limit_json) ? limit_json->valueint : 20;
-            
+        snprintf(key, sizeof(key), "get_actuator_history|%d|%d", node_id, limit);
+        if ((data_str = db_cache_get(key, node_id)) == NULL) {
+            generation = db_cache_generation(node_id);
             data_str = db_query_actuator_history(node_id, limit);
+            cache_node = node_id;
+            cache_store = 1;
         }
-        else if (strcmp(action, "get_stats") == 0) {
+    }
+    else if (strcmp(action, "get_stats") == 0) {
+        snprintf(key, sizeof(key), "get_stats");
+        if ((data_str = db_cache_get(key, 0)) == NULL) {
+            generation = db_cache_generation(0);
             data_str = db_query_stats();
+            cache_store = 1;
         }
-        
-        cJSON *response = cJSON_CreateObject();
-        cJSON_AddBoolToObject(response, "success", data_str != NULL);
-        cJSON_AddStringToObject(response, "request_id", request_id);
-        cJSON_AddStringToObject(response, "action", action);
-        
-        if (data_str != NULL) {
-            cJSON *data_json = cJSON_Parse(data_str);
-            if (data_json) {
-                cJSON_AddItemToObject(response, "data", data_json);
-            }
-            free(data_str);
-        } else {
-            cJSON_AddStringToObject(response, "error", "Query failed");
-        }
-        
-        char *response_str = cJSON_PrintUnformatted(response);
-        char response_topic[128];
-        snprintf(response_topic, sizeof(response_topic), "%s/db/response", MQTT_TOPIC_PREFIX);
-        
-        mosquitto_publish(mosq, NULL, response_topic, strlen(response_str), 
-                         response_str, MQTT_QOS, false);
-        
-        printf("[%s]   DB Response sent (%zu bytes)\n", timestamp, strlen(response_str));
-        
-        free(response_str);
-        cJSON_Delete(response);
+    }
+    
+    if (cache_store && data_str != NULL) {
+        db_cache_put(key, cache_node, generation, data_str);
+    }
+    
+    size_t response_len = 0;
+    char *response_str = mqtt_db_response(request_id, action, data_str, format, &response_len);
+    free(data_str);
+    if (response_str == NULL) {
         cJSON_Delete(request);
-        
         return;
     }
     
-    // Handle text commands
-    if (strstr(topic, "/command") != NULL) {
-        printf("[%s]  MQTT TEXT CMD: %s\n", timestamp, payload);
-        
-        int node_id;
-        char val[32];
-        float val1, val2;
-        
-        if (sscanf(payload, "fan %d %s", &node_id, val) == 2) {
-            if (node_id >= 1 && node_id <= 3) {
-                int node_idx = node_id - 1;
-                if (!gateway.nodes[node_idx].thresholds.enabled) {
-                    lora_send_command(node_id, "fan", val);
-                    gateway.nodes[node_idx].actuators.fan_state = (strcmp(val, "on") == 0);
-                    gateway.nodes[node_idx].tx_count++;
-                } else {
-                    printf("[%s]   Node %d is in AUTO mode\n", timestamp, node_id);
-                }
-            }
-        }
-        else if (sscanf(payload, "light %d %s", &node_id, val) == 2) {
-            if (node_id >= 1 && node_id <= 3) {
-                int node_idx = node_id - 1;
-                if (!gateway.nodes[node_idx].thresholds.enabled) {
-                    lora_send_command(node_id, "light", val);
-                    gateway.nodes[node_idx].actuators.light_state = (strcmp(val, "on") == 0);
-                    gateway.nodes[node_idx].tx_count++;
-                } else {
-                    printf("[%s]   Node %d is in AUTO mode\n", timestamp, node_id);
-                }
-            }
-        }
-        else if (sscanf(payload, "pump %d %s", &node_id, val) == 2) {
-            if (node_id >= 1 && node_id <= 3) {
-                int node_idx = node_id - 1;
-                if (!gateway.nodes[node_idx].thresholds.enabled) {
-                    lora_send_command(node_id, "pump", val);
-                    gateway.nodes[node_idx].actuators.pump_state = (strcmp(val, "on") == 0);
-                    gateway.nodes[node_idx].tx_count++;
-                } else {
-                    printf("[%s]   Node %d is in AUTO mode\n", timestamp, node_id);
-                }
-            }
-        }
-        else if (sscanf(payload, "all %d %s", &node_id, val) == 2) {
-            if (node_id >= 1 && node_id <= 3) {
-                int node_idx = node_id - 1;
-                if (!gateway.nodes[node_idx].thresholds.enabled) {
-                    lora_send_command(node_id, "all", val);
-                    int state = (strcmp(val, "on") == 0);
-                    gateway.nodes[node_idx].actuators.fan_state = state;
-                    gateway.nodes[node_idx].actuators.light_state = state;
-                    gateway.nodes[node_idx].actuators.pump_state = state;
-                    gateway.nodes[node_idx].tx_count++;
-                } else {
-                    printf("[%s]   Node %d is in AUTO mode\n", timestamp, node_id);
-                }
-            }
-        }
-        else if (sscanf(payload, "auto %d %s", &node_id, val) == 2) {
-            if (node_id >= 1 && node_id <= 3) {
-                int node_idx = node_id - 1;
-                int enable = (strcmp(val, "on") == 0);
-                gateway.nodes[node_idx].thresholds.enabled = enable;
-                printf("[%s]   Node %d AUTO mode %s\n", 
-                       timestamp, node_id, enable ? "ENABLED" : "DISABLED");
-                
-                if (!enable) {
-                    lora_send_command(node_id, "all", "off");
-                    gateway.nodes[node_idx].actuators.fan_state = 0;
-                    gateway.nodes[node_idx].actuators.light_state = 0;
-                    gateway.nodes[node_idx].actuators.pump_state = 0;
-                    gateway.nodes[node_idx].tx_count++;
-                }
-            }
-        }
-        else if (sscanf(payload, "settemp %d %f %f", &node_id, &val1, &val2) == 3) {
-            if (node_id >= 1 && node_id <= 3) {
-                gateway.nodes[node_id-1].thresholds.temp_min = val1;
-                gateway.nodes[node_id-1].thresholds.temp_max = val2;
-                printf("[%s]   Node %d temp threshold: [%.1f, %.1f]°C\n", 
-                       timestamp, node_id, val1, val2);
-            }
-        }
-        else if (sscanf(payload, "setlight %d %f %f", &node_id, &val1, &val2) == 3) {
-            if (node_id >= 1 && node_id <= 3) {
-                gateway.nodes[node_id-1].thresholds.light_min = (uint16_t)val1;
-                gateway.nodes[node_id-1].thresholds.light_max = (uint16_t)val2;
-                printf("[%s]   Node %d light threshold: [%u, %u] lux\n", 
-                       timestamp, node_id, (uint16_t)val1, (uint16_t)val2);
-            }
-        }
-        else if (sscanf(payload, "setsoil %d %f %f", &node_id, &val1, &val2) == 3) {
-            if (node_id >= 1 && node_id <= 3) {
-                gateway.nodes[node_id-1].thresholds.soil_min = (uint16_t)val1;
-                gateway.nodes[node_id-1].thresholds.soil_max = (uint16_t)val2;
-                printf("[%s]   Node %d soil threshold: [%u, %u]\n", 
-                       timestamp, node_id, (uint16_t)val1, (uint16_t)val2);
-            }
-        }
-        else {
-            printf("[%s]   Unknown TEXT command: %s\n", timestamp, payload);
-        }
-        
+    mqtt_publish_db_reply(reply_to, response_str, response_len, format, MQTT_OUTQ_DB_WAIT_MS);
+    
+    MQTT_DEBUG("  DB Response sent (%zu bytes%s)", response_len,
+               format == JW_CBOR ? ", CBOR" : "");
+    
+    free(response_str);
+    cJSON_Delete(request);
+}
+
+/*====================================================================
+ * CONTROL COMMANDS - one handler per route of mqtt_router.c
+ *====================================================================*/
+
+static void cmd_actuator(const mr_cmd_t *cmd) {
+    node_data_t *node = &gateway.nodes[cmd->node_id - 1];
+    const char *name = mqtt_route_actuator(cmd->arg);
+    const char *value = cmd->on ? "on" : "off";
+    
+    if (node->thresholds.enabled) {
+        MQTT_DEBUG("  Node %d is in AUTO mode, ignoring manual command", cmd->node_id);
         return;
     }
     
-    // Handle structured control commands
-    int node_id = 0;
-    char command[32] = {0};
-    char value[32] = {0};
+    lora_send_command(cmd->node_id, name, value);
+    switch (cmd->arg) {
+    case MR_FAN:
+        node->actuators.fan_state = cmd->on;
+        break;
+    case MR_LIGHT:
+        node->actuators.light_state = cmd->on;
+        break;
+    case MR_PUMP:
+        node->actuators.pump_state = cmd->on;
+        break;
+    default:
+        node->actuators.fan_state = cmd->on;
+        node->actuators.light_state = cmd->on;
+        node->actuators.pump_state = cmd->on;
+        break;
+    }
+    node->tx_count++;
+    db_log_command(cmd->node_id, name, value, "MQTT");
+}
+
+static void cmd_auto(const mr_cmd_t *cmd) {
+    node_data_t *node = &gateway.nodes[cmd->node_id - 1];
     
-    if (sscanf(topic, "lora/gateway/control/node%d/%s", &node_id, command) == 2) {
-        strncpy(value, payload, sizeof(value) - 1);
-        
-        printf("[%s]  MQTT CMD: Node%d %s=%s\n", timestamp, node_id, command, value);
-        
-        if (node_id >= 1 && node_id <= 3) {
-            int node_idx = node_id - 1;
-            
-            if (gateway.nodes[node_idx].thresholds.enabled && 
-                strcmp(command, "auto") != 0) {
-                printf("[%s]   Node %d is in AUTO mode, ignoring manual command\n", 
-                       timestamp, node_id);
-                return;
-            }
-            
-            if (strcmp(command, "fan") == 0) {
-                lora_send_command(node_id, "fan", value);
-                gateway.nodes[node_idx].actuators.fan_state = (strcmp(value, "on") == 0);
-                gateway.nodes[node_idx].tx_count++;
-                db_log_command(node_id, "fan", value, "MQTT");
-            }
-            else if (strcmp(command, "light") == 0) {
-                lora_send_command(node_id, "light", value);
-                gateway.nodes[node_idx].actuators.light_state = (strcmp(value, "on") == 0);
-                gateway.nodes[node_idx].tx_count++;
-                db_log_command(node_id, "light", value, "MQTT");
-            }
-            else if (strcmp(command, "pump") == 0) {
-                lora_send_command(node_id, "pump", value);
-                gateway.nodes[node_idx].actuators.pump_state = (strcmp(value, "on") == 0);
-                gateway.nodes[node_idx].tx_count++;
-                db_log_command(node_id, "pump", value, "MQTT");
-            }
-            else if (strcmp(command, "all") == 0) {
-                lora_send_command(node_id, "all", value);
-                int state = (strcmp(value, "on") == 0);
-                gateway.nodes[node_idx].actuators.fan_state = state;
-                gateway.nodes[node_idx].actuators.light_state = state;
-                gateway.nodes[node_idx].actuators.pump_state = state;
-                gateway.nodes[node_idx].tx_count++;
-                db_log_command(node_id, "all", value, "MQTT");
-            }
-            else if (strcmp(command, "auto") == 0) {
-                int enable = (strcmp(value, "on") == 0);
-                gateway.nodes[node_idx].thresholds.enabled = enable;
-                printf("[%s]   Node %d AUTO mode %s\n", 
-                       timestamp, node_id, enable ? "ENABLED" : "DISABLED");
-                
-                if (!enable) {
-                    lora_send_command(node_id, "all", "off");
-                    gateway.nodes[node_idx].actuators.fan_state = 0;
-                    gateway.nodes[node_idx].actuators.light_state = 0;
-                    gateway.nodes[node_idx].actuators.pump_state = 0;
-                }
+    node->thresholds.enabled = cmd->on;
+    MQTT_DEBUG("  Node %d AUTO mode %s", cmd->node_id, cmd->on ? "ENABLED" : "DISABLED");
+    
+    if (!cmd->on) {
+        lora_send_command(cmd->node_id, "all", "off");
+        node->actuators.fan_state = 0;
+        node->actuators.light_state = 0;
+        node->actuators.pump_state = 0;
+        node->tx_count++;
+    }
+}
+
+static void cmd_threshold(const mr_cmd_t *cmd) {
+    threshold_config_t *th = &gateway.nodes[cmd->node_id - 1].thresholds;
+    
+    switch (cmd->arg) {
+    case MR_TH_TEMP:
+        th->temp_min = cmd->min;
+        th->temp_max = cmd->max;
+        break;
+    case MR_TH_LIGHT:
+        th->light_min = (uint16_t)cmd->min;
+        th->light_max = (uint16_t)cmd->max;
+        break;
+    default:
+        th->soil_min = (uint16_t)cmd->min;
+        th->soil_max = (uint16_t)cmd->max;
+        break;
+    }
+    MQTT_DEBUG("  Node %d %s threshold: [%g, %g]", cmd->node_id,
+               mqtt_route_threshold(cmd->arg), cmd->min, cmd->max);
+}
+
+/* Queued for the query workers so a slow query never stalls this
+ * (network) thread */
+static void mqtt_submit_db_query(const char *payload, size_t len,
+                                 const mosquitto_property *props) {
+    db_reply_to_t reply_to = {0};
+    mosquitto_property_read_string(props, MQTT_PROP_RESPONSE_TOPIC,
+                                   &reply_to.topic, false);
+    mosquitto_property_read_binary(props, MQTT_PROP_CORRELATION_DATA,
+                                   &reply_to.correlation, &reply_to.correlation_len, false);
+    if (reply_to.topic != NULL && !mqtt_response_topic_ok(reply_to.topic)) {
+        MQTT_DEBUG("  Response topic '%s' refused, using %s",
+                   reply_to.topic, MQTT_DB_RESPONSE_TOPIC);
+        free(reply_to.topic);
+        reply_to.topic = NULL;
+    }
+    
+    if (db_state.db == NULL) {
+        MQTT_DEBUG("  Database not available");
+        mqtt_publish_db_error(&reply_to, "Database not available");
+    }
+    else if (db_query_submit(mqtt_handle_db_query, payload, len, &reply_to) < 0) {
+        MQTT_DEBUG("  DB query rejected (queue full)");
+        mqtt_publish_db_error(&reply_to, "Query queue full");
+    }
+    // Still ours unless the pool took it
+    free(reply_to.topic);
+    free(reply_to.correlation);
+}
+
+/* control/bulk: checked and applied here like the single commands,
+ * then answered on the request's response topic (with its correlation
+ * data) or MQTT_BULK_RESULT_TOPIC */
+static void mqtt_handle_bulk(const char *payload, size_t len,
+                             const mosquitto_property *props) {
+    mb_request_t req;
+    mb_result_t result;
+    char *reply_topic = NULL;
+    void *correlation = NULL;
+    uint16_t correlation_len = 0;
+    
+    mosquitto_property_read_string(props, MQTT_PROP_RESPONSE_TOPIC, &reply_topic, false);
+    mosquitto_property_read_binary(props, MQTT_PROP_CORRELATION_DATA,
+                                   &correlation, &correlation_len, false);
+    if (reply_topic != NULL && !mqtt_response_topic_ok(reply_topic)) {
+        MQTT_DEBUG("  Response topic '%s' refused, using %s",
+                   reply_topic, MQTT_BULK_RESULT_TOPIC);
+        free(reply_topic);
+        reply_topic = NULL;
+    }
+    
+    int rc = mqtt_bulk_parse(payload, len, &req, &result);
+    if (rc == 0) {
+        rc = mqtt_bulk_apply(&req, &result);
+    }
+    if (rc == 0) {
+        MQTT_DEBUG("  Bulk: %d entries, nodes 0x%x, %d commands, %d downlinks",
+                   req.count, result.nodes, result.commands, result.downlinks);
+    } else {
+        MQTT_DEBUG("  Bulk rejected: %s", result.error);
+    }
+    
+    jw_t *w = jw_begin();
+    jw_object(w, NULL);
+    jw_bool(w, "success", rc == 0);
+    if (req.request_id[0] != '\0') {
+        jw_string(w, "request_id", req.request_id);
+    }
+    if (rc == 0) {
+        jw_array(w, "nodes");
+        for (int id = 1; id <= MAX_NODES; id++) {
+            if (result.nodes & (1u << id)) {
+                jw_int(w, NULL, id);
             }
         }
+        jw_array_end(w);
+        jw_int(w, "commands", result.commands);
+        jw_int(w, "downlinks", result.downlinks);
+    } else {
+        jw_string(w, "error", result.error);
     }
-    // Handle threshold settings
-    else if (sscanf(topic, "lora/gateway/control/node%d/threshold/%s", 
-                    &node_id, command) == 2) {
-        if (node_id >= 1 && node_id <= 3) {
-            int node_idx = node_id - 1;
-            float min_val, max_val;
-            
-            if (sscanf(payload, "%f,%f", &min_val, &max_val) == 2) {
-                if (strcmp(command, "temp") == 0) {
-                    gateway.nodes[node_idx].thresholds.temp_min = min_val;
-                    gateway.nodes[node_idx].thresholds.temp_max = max_val;
-                    printf("[%s]   Node %d temp threshold: [%.1f, %.1f]°C\n", 
-                           timestamp, node_id, min_val, max_val);
-                }
-                else if (strcmp(command, "light") == 0) {
-                    gateway.nodes[node_idx].thresholds.light_min = (uint16_t)min_val;
-                    gateway.nodes[node_idx].thresholds.light_max = (uint16_t)max_val;
-                    printf("[%s]   Node %d light threshold: [%u, %u] lux\n", 
-                           timestamp, node_id, (uint16_t)min_val, (uint16_t)max_val);
-                }
-                else if (strcmp(command, "soil") == 0) {
-                    gateway.nodes[node_idx].thresholds.soil_min = (uint16_t)min_val;
-                    gateway.nodes[node_idx].thresholds.soil_max = (uint16_t)max_val;
-                    printf("[%s]   Node %d soil threshold: [%u, %u]\n", 
-                           timestamp, node_id, (uint16_t)min_val, (uint16_t)max_val);
-                }
-            }
+    jw_object_end(w);
+    
+    size_t out_len;
+    const char *out = jw_finish(w, &out_len);
+    if (out != NULL) {
+        mq_msg_t m = {
+            .topic = reply_topic != NULL ? reply_topic : MQTT_BULK_RESULT_TOPIC,
+            .payload = out,
+            .len = out_len,
+            .qos = MQTT_QOS,
+            .correlation = correlation,
+            .correlation_len = correlation_len,
+        };
+        if (mqtt_outq_submit(MQ_DB, &m, 0) < 0) {
+            gateway.mqtt_error_count++;
         }
     }
+    free(reply_topic);
+    free(correlation);
+}
+
+static void (*const cmd_handlers[MR_ROUTES])(const mr_cmd_t *cmd) = {
+    [MR_ACTUATOR] = cmd_actuator,
+    [MR_AUTO] = cmd_auto,
+    [MR_THRESHOLD] = cmd_threshold,
+};
+
+void mqtt_on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg,
+                     const mosquitto_property *props) {
+    // libmosquitto NUL-terminates payloads, but an empty one is NULL
+    const char *payload = msg->payload != NULL ? (const char *)msg->payload : "";
+    mr_cmd_t cmd;
+    int route = mqtt_route(msg->topic, payload, (size_t)msg->payloadlen, &cmd);
+    
+    MQTT_DEBUG(" MQTT RX: %s => %s%s", msg->topic, payload, route < 0 ? " (ignored)" : "");
+    
+    if (route == MR_DB_QUERY) {
+        mqtt_submit_db_query(payload, (size_t)msg->payloadlen, props);
+    } else if (route == MR_BULK) {
+        mqtt_handle_bulk(payload, (size_t)msg->payloadlen, props);
+    } else if (route >= 0) {
+        cmd_handlers[route](&cmd);
+    }
 }
 
 /*====================================================================
@@ -413,10 +842,26 @@ int mqtt_init() {
         return -1;
     }
     
-    mosquitto_connect_callback_set(gateway.mqtt, mqtt_on_connect);
+    // v5 for response topics / correlation data on db queries and topic
+    // aliases; v3.1.1 clients still talk to the broker as before
+    mosquitto_int_option(gateway.mqtt, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+    
+    if (mqtt_spool_open(MQTT_SPOOL_PATH) < 0) {
+        printf(" Warning: no MQTT spool, data published while offline is lost\n");
+    }
+    if (mqtt_outq_start(mqtt_send) < 0) {
+        return -1;
+    }
+    mosquitto_reconnect_delay_set(gateway.mqtt, MQTT_RECONNECT_INTERVAL,
+                                  MQTT_RECONNECT_INTERVAL, false);
+    if (node_batches && mqtt_batch_start() < 0) {
+        node_topics = 1;    // per-node topics rather than nothing
+    }
+    
+    mosquitto_connect_v5_callback_set(gateway.mqtt, mqtt_on_connect);
     mosquitto_disconnect_callback_set(gateway.mqtt, mqtt_on_disconnect);
     mosquitto_publish_callback_set(gateway.mqtt, mqtt_on_publish);
-    mosquitto_message_callback_set(gateway.mqtt, mqtt_on_message);
+    mosquitto_message_v5_callback_set(gateway.mqtt, mqtt_on_message);
     
     char topic[128];
     snprintf(topic, sizeof(topic), "%s/status", MQTT_TOPIC_PREFIX);
@@ -426,8 +871,9 @@ int mqtt_init() {
     rc = mosquitto_connect(gateway.mqtt, MQTT_BROKER, MQTT_PORT, MQTT_KEEPALIVE);
     
     if (rc != MOSQ_ERR_SUCCESS) {
-        printf(" MQTT connect failed: %s\n", mosquitto_strerror(rc));
-        return -1;
+        // The loop thread keeps retrying; node data is spooled meanwhile
+        printf(" MQTT connect failed: %s (retrying every %d s)\n",
+               mosquitto_strerror(rc), MQTT_RECONNECT_INTERVAL);
     }
     
     rc = mosquitto_loop_start(gateway.mqtt);
@@ -447,58 +893,331 @@ int mqtt_init() {
  * MQTT PUBLISH FUNCTIONS
  *====================================================================*/
 
+int mqtt_set_node_publish(const char *mode) {
+    if (strcmp(mode, "per-node") == 0) {
+        node_topics = 1;
+        node_batches = 0;
+    } else if (strcmp(mode, "batch") == 0) {
+        node_topics = 0;
+        node_batches = 1;
+    } else if (strcmp(mode, "both") == 0) {
+        node_topics = 1;
+        node_batches = 1;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int mqtt_set_node_delta(int enable) {
+    node_deltas = enable;
+    memset(delta_state, 0, sizeof(delta_state));
+    return 0;
+}
+
+int mqtt_set_payload_format(const char *name) {
+    if (strcmp(name, "json") == 0) {
+        payload_format = JW_JSON;
+    } else if (strcmp(name, "cbor") == 0) {
+        payload_format = JW_CBOR;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int mqtt_payload_format(void) {
+    return payload_format;
+}
+
+int mqtt_set_debug(int enable) {
+    mqtt_debug = enable;
+    return 0;
+}
+
+int mqtt_set_topic_aliases(int enable) {
+    topic_aliases = enable;
+    memset(alias_bound, 0, sizeof(alias_bound));
+    return 0;
+}
+
+/* Data that must not be lost: queued, or spooled while offline, while
+ * older data is still spooled (to keep order) and when its queue class
+ * is full */
+static int mqtt_publish_node_msg(const mq_msg_t *m) {
+    if (!gateway.mqtt_connected || mqtt_spool_pending() > 0 ||
+        mqtt_outq_submit(MQ_NODE, m, 0) < 0) {
+        return mqtt_spool_append(m->topic, m->payload, m->len, m->format);
+    }
+    return 0;
+}
+
+int mqtt_publish_data(const char *topic, const char *payload, size_t len) {
+    mq_msg_t m = { .topic = topic, .payload = payload, .len = len, .qos = MQTT_QOS };
+    return mqtt_publish_node_msg(&m);
+}
+
+/* nodes/node{id}: as mqtt_publish_data(), through alias {id} when
+ * aliases are on and the broker allows that many (mqtt_send) */
+static void mqtt_publish_node_doc(int node_id, const char *payload, size_t len) {
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/nodes/node%d", MQTT_TOPIC_PREFIX, node_id);
+    
+    mq_msg_t m = {
+        .topic = topic,
+        .payload = payload,
+        .len = len,
+        .qos = MQTT_QOS,
+        .alias = topic_aliases ? (uint16_t)node_id : 0,
+    };
+    mqtt_publish_node_msg(&m);
+}
+
+/* Low-priority publish: queued in MQ_STATS, where the oldest give way */
+static void mqtt_publish_stats(const char *topic, const char *payload, size_t len,
+                               int retain) {
+    mq_msg_t m = {
+        .topic = topic,
+        .payload = payload,
+        .len = len,
+        .qos = MQTT_QOS,
+        .retain = retain,
+    };
+    mqtt_outq_submit(MQ_STATS, &m, 0);
+}
+
+/* Moved by band or more (any change for band 0) from what subscribers have */
+static int delta_moved(double cur, double sent, double band) {
+    return band > 0 ? fabs(cur - sent) >= band : cur != sent;
+}
+
+/* Changed fields only, against d->sent (updated for what goes out, so
+ * slow drift still crosses the deadband). Nothing written, 0 returned,
+ * when nothing changed. Counters under "stats" change with every
+ * packet: keyframes only */
+static int node_delta_document(jw_t *w, int node_id, const node_data_t *node, node_delta_t *d) {
+    node_data_t *s = &d->sent;
+    
+    int temp = delta_moved(node->temperature, s->temperature, MQTT_DELTA_TEMPERATURE);
+    int hum = delta_moved(node->humidity, s->humidity, MQTT_DELTA_HUMIDITY);
+    int light = delta_moved(node->light, s->light, MQTT_DELTA_LIGHT);
+    int soil = delta_moved(node->soil_moisture, s->soil_moisture, MQTT_DELTA_SOIL);
+    int fan = node->actuators.fan_state != s->actuators.fan_state;
+    int lamp = node->actuators.light_state != s->actuators.light_state;
+    int pump = node->actuators.pump_state != s->actuators.pump_state;
+    int rssi = delta_moved(node->last_rssi, s->last_rssi, MQTT_DELTA_RSSI);
+    int snr = delta_moved(node->last_snr, s->last_snr, MQTT_DELTA_SNR);
+    int automode = node->thresholds.enabled != s->thresholds.enabled;
+    
+    int changed = temp + hum + light + soil + fan + lamp + pump + rssi + snr + automode;
+    if (changed == 0) {
+        return 0;
+    }
+    
+    jw_object(w, NULL);
+    jw_int(w, "node_id", node_id);
+    jw_int(w, "timestamp", node->last_update);
+    jw_int(w, "seq", d->seq + 1);
+    
+    if (temp || hum || light || soil) {
+        jw_object(w, "sensors");
+        if (temp) {
+            jw_float(w, "temperature", node->temperature);
+            s->temperature = node->temperature;
+        }
+        if (hum) {
+            jw_float(w, "humidity", node->humidity);
+            s->humidity = node->humidity;
+        }
+        if (light) {
+            jw_int(w, "light", node->light);
+            s->light = node->light;
+        }
+        if (soil) {
+            jw_int(w, "soil_moisture", node->soil_moisture);
+            s->soil_moisture = node->soil_moisture;
+        }
+        jw_object_end(w);
+    }
+    if (fan || lamp || pump) {
+        jw_object(w, "actuators");
+        if (fan) jw_int(w, "fan", node->actuators.fan_state);
+        if (lamp) jw_int(w, "light", node->actuators.light_state);
+        if (pump) jw_int(w, "pump", node->actuators.pump_state);
+        jw_object_end(w);
+        s->actuators = node->actuators;
+    }
+    if (rssi || snr) {
+        jw_object(w, "signal");
+        if (rssi) {
+            jw_int(w, "rssi", node->last_rssi);
+            s->last_rssi = node->last_rssi;
+        }
+        if (snr) {
+            jw_int(w, "snr", node->last_snr);
+            s->last_snr = node->last_snr;
+        }
+        jw_object_end(w);
+    }
+    if (automode) {
+        jw_bool(w, "auto_mode", node->thresholds.enabled);
+        s->thresholds.enabled = node->thresholds.enabled;
+    }
+    jw_object_end(w);
+    
+    return changed;
+}
+
+/*
+ * nodes/node{id} in delta mode: a full keyframe ("keyframe":true) first,
+ * after a (re)connect and every MQTT_DELTA_KEYFRAME_SEC, changed fields
+ * in between, nothing when no field moved past its deadband. Every
+ * message has "seq"; a subscriber that sees a gap waits for the next
+ * keyframe, or reads the retained keyframe on nodes/node{id}/state.
+ */
+static void mqtt_publish_node_delta(int node_id, const node_data_t *node) {
+    node_delta_t *d = &delta_state[node_id - 1];
+    char topic[128];
+    
+    if (delta_resync) {
+        delta_resync = 0;
+        for (int i = 0; i < MAX_NODES; i++) {
+            delta_state[i].valid = 0;
+        }
+    }
+    
+    int keyframe = !d->valid || node->last_update - d->keyframe_at >= MQTT_DELTA_KEYFRAME_SEC;
+    jw_t *w = jw_begin_as(payload_format);
+    if (keyframe) {
+        jw_object(w, NULL);
+        payload_node_fields(w, node_id, node);
+        jw_int(w, "seq", d->seq + 1);
+        jw_bool(w, "keyframe", 1);
+        jw_object_end(w);
+    } else if (node_delta_document(w, node_id, node, d) == 0) {
+        gateway.mqtt_deltas_suppressed++;
+        return;
+    }
+    
+    size_t len;
+    const char *json_string = jw_finish(w, &len);
+    if (json_string == NULL) {
+        gateway.mqtt_error_count++;
+        return;
+    }
+    
+    mqtt_publish_node_doc(node_id, json_string, len);
+    d->seq++;
+    
+    if (keyframe) {
+        d->sent = *node;
+        d->keyframe_at = node->last_update;
+        d->valid = 1;
+        gateway.mqtt_keyframes++;
+        
+        // Latest full state for late subscribers; stale ones are replaced
+        // by the next keyframe, so this one is not spooled
+        if (gateway.mqtt_connected) {
+            snprintf(topic, sizeof(topic), "%s/nodes/node%d/state", MQTT_TOPIC_PREFIX, node_id);
+            mqtt_publish_stats(topic, json_string, len, true);
+        }
+    } else {
+        gateway.mqtt_deltas++;
+    }
+}
+
 void mqtt_publish_node_data(int node_id) {
-    if (!gateway.mqtt_connected || node_id < 1 || node_id > 3) {
+    if (node_id < 1 || node_id > 3) {
         return;
     }
     
     int node_idx = node_id - 1;
     node_data_t *node = &gateway.nodes[node_idx];
     
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "node_id", node_id);
-    cJSON_AddNumberToObject(root, "timestamp", (double)node->last_update);
-    
-    cJSON *sensors = cJSON_CreateObject();
-    cJSON_AddNumberToObject(sensors, "temperature", node->temperature);
-    cJSON_AddNumberToObject(sensors, "humidity", node->humidity);
-    cJSON_AddNumberToObject(sensors, "light", node->light);
-    cJSON_AddNumberToObject(sensors, "soil_moisture", node->soil_moisture);
-    cJSON_AddItemToObject(root, "sensors", sensors);
+    if (node_batches) {
+        mqtt_batch_add(node_id, node);
+    }
+    if (!node_topics) {
+        return;
+    }
+    if (node_deltas) {
+        mqtt_publish_node_delta(node_id, node);
+        return;
+    }
     
-    cJSON *actuators = cJSON_CreateObject();
-    cJSON_AddNumberToObject(actuators, "fan", node->actuators.fan_state);
-    cJSON_AddNumberToObject(actuators, "light", node->actuators.light_state);
-    cJSON_AddNumberToObject(actuators, "pump", node->actuators.pump_state);
-    cJSON_AddItemToObject(root, "actuators", actuators);
+    jw_t *w = jw_begin_as(payload_format);
+    jw_object(w, NULL);
+    payload_node_fields(w, node_id, node);
+    jw_object_end(w);
     
-    cJSON *signal = cJSON_CreateObject();
-    cJSON_AddNumberToObject(signal, "rssi", node->last_rssi);
-    cJSON_AddNumberToObject(signal, "snr", node->last_snr);
-    cJSON_AddItemToObject(root, "signal", signal);
+    size_t len;
+    const char *json_string = jw_finish(w, &len);
+    if (json_string == NULL) {
+        gateway.mqtt_error_count++;
+        return;
+    }
     
-    cJSON *stats = cJSON_CreateObject();
-    cJSON_AddNumberToObject(stats, "rx_count", node->rx_count);
-    cJSON_AddNumberToObject(stats, "tx_count", node->tx_count);
-    cJSON_AddItemToObject(root, "stats", stats);
+    mqtt_publish_node_doc(node_id, json_string, len);
+}
+
+/* Live window stats of one node (node_stats.c), one object per window.
+ * Under stats/, not nodes/#: that is node documents only */
+void mqtt_publish_node_stats(int node_id) {
+    static const int windows[NODE_STATS_WINDOWS] = NODE_STATS_WINDOW_SEC;
+    static const char *channels[NS_CHANNELS] = {
+        "temperature", "humidity", "light", "soil_moisture"
+    };
     
-    cJSON_AddBoolToObject(root, "auto_mode", node->thresholds.enabled);
+    ns_summary_t s[NS_CHANNELS];
     
-    char *json_string = cJSON_PrintUnformatted(root);
+    if (!gateway.mqtt_connected || node_id < 1 || node_id > MAX_NODES) {
+        return;
+    }
+    // Nothing in the longest window: the node has not reported (lately)
+    if (node_stats_get(node_id, windows[NODE_STATS_WINDOWS - 1], s, NULL) <= 0) {
+        return;
+    }
     
-    char topic[128];
-    snprintf(topic, sizeof(topic), "%s/nodes/node%d", MQTT_TOPIC_PREFIX, node_id);
+    jw_t *w = jw_begin_as(payload_format);
+    jw_object(w, NULL);
+    jw_int(w, "node_id", node_id);
+    jw_int(w, "timestamp", time(NULL));
     
-    int rc = mosquitto_publish(gateway.mqtt, NULL, topic, 
-                              strlen(json_string), json_string, 
-                              MQTT_QOS, false);
+    jw_array(w, "windows");
+    for (int i = 0; i < NODE_STATS_WINDOWS; i++) {
+        int complete = 0;
+        if (node_stats_get(node_id, windows[i], s, &complete) < 0) {
+            continue;
+        }
+        
+        jw_object(w, NULL);
+        jw_int(w, "window_sec", windows[i]);
+        jw_int(w, "count", s[0].count);
+        jw_bool(w, "complete", complete);
+        for (int c = 0; c < NS_CHANNELS && s[0].count > 0; c++) {
+            jw_object(w, channels[c]);
+            jw_double(w, "mean", s[c].mean);
+            jw_double(w, "stddev", ns_stddev(&s[c]));
+            jw_double(w, "min", s[c].min);
+            jw_double(w, "max", s[c].max);
+            jw_object_end(w);
+        }
+        jw_object_end(w);
+    }
+    jw_array_end(w);
+    jw_object_end(w);
     
-    if (rc != MOSQ_ERR_SUCCESS) {
+    size_t len;
+    const char *json_string = jw_finish(w, &len);
+    if (json_string == NULL) {
         gateway.mqtt_error_count++;
+        return;
     }
     
-    free(json_string);
-    cJSON_Delete(root);
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/stats/node%d", MQTT_TOPIC_PREFIX, node_id);
+    
+    mqtt_publish_stats(topic, json_string, len, false);
 }
 
 void mqtt_publish_gateway_stats() {
@@ -506,25 +1225,118 @@ void mqtt_publish_gateway_stats() {
         return;
     }
     
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "timestamp", (double)time(NULL));
-    cJSON_AddNumberToObject(root, "rx_nodata", gateway.rx_nodata);
-    cJSON_AddNumberToObject(root, "rx_crc_error", gateway.rx_crc_error);
-    cJSON_AddNumberToObject(root, "rx_crc_recovery", gateway.rx_crc_recovery);
-    cJSON_AddNumberToObject(root, "json_parse_error", gateway.json_parse_error);
-    cJSON_AddNumberToObject(root, "auto_commands", gateway.auto_commands);
-    cJSON_AddNumberToObject(root, "mqtt_publish_count", gateway.mqtt_publish_count);
-    cJSON_AddNumberToObject(root, "mqtt_error_count", gateway.mqtt_error_count);
+    jw_t *w = jw_begin_as(payload_format);
+    jw_object(w, NULL);
+    jw_int(w, "timestamp", time(NULL));
+    jw_int(w, "rx_nodata", gateway.rx_nodata);
+    jw_int(w, "rx_crc_error", gateway.rx_crc_error);
+    jw_int(w, "rx_crc_recovery", gateway.rx_crc_recovery);
+    jw_int(w, "json_parse_error", gateway.json_parse_error);
+    jw_int(w, "auto_commands", gateway.auto_commands);
+    jw_int(w, "mqtt_publish_count", gateway.mqtt_publish_count);
+    jw_int(w, "mqtt_error_count", gateway.mqtt_error_count);
+    jw_int(w, "mqtt_spool_pending", gateway.mqtt_spool_pending);
+    jw_int(w, "mqtt_spool_replayed", gateway.mqtt_spool_replayed);
+    jw_int(w, "mqtt_spool_dropped", gateway.mqtt_spool_dropped);
+    if (gateway.mqtt_keyframes > 0) {
+        jw_int(w, "mqtt_keyframes", gateway.mqtt_keyframes);
+        jw_int(w, "mqtt_deltas", gateway.mqtt_deltas);
+        jw_int(w, "mqtt_deltas_suppressed", gateway.mqtt_deltas_suppressed);
+    }
+    if (topic_aliases) {
+        jw_int(w, "mqtt_aliased", gateway.mqtt_aliased);
+    }
+    jw_int(w, "mqtt_db_direct", gateway.mqtt_db_direct);
+    jw_int(w, "snapshot_writes", gateway.snapshot_writes);
+    jw_int(w, "snapshot_bytes", (int64_t)gateway.snapshot_bytes);
+    jw_int(w, "snapshot_coalesced", gateway.snapshot_coalesced);
+    {
+        static const char *class_names[MQ_CLASSES] = { "alert", "node", "stats", "db" };
+        mq_stats_t q;
+        mqtt_outq_stats(&q);
+        
+        jw_int(w, "mqtt_inflight", q.inflight);
+        jw_double(w, "mqtt_publish_ms", q.latency_avg_ms);
+        jw_double(w, "mqtt_publish_max_ms", q.latency_max_ms);
+        jw_object(w, "mqtt_queue");
+        for (int c = 0; c < MQ_CLASSES; c++) {
+            jw_object(w, class_names[c]);
+            jw_int(w, "depth", q.depth[c]);
+            jw_int(w, "bytes", q.bytes[c]);
+            jw_int(w, "dropped", q.dropped[c]);
+            jw_object_end(w);
+        }
+        jw_object_end(w);
+    }
+    if (gateway.mqtt_batches > 0) {
+        static const char *bucket_names[MQTT_BATCH_HIST_BUCKETS] = {
+            "1", "2", "4", "8", "16", "32", "64", "more"
+        };
+        uint32_t hist[MQTT_BATCH_HIST_BUCKETS];
+        mqtt_batch_histogram(hist);
+        
+        jw_int(w, "mqtt_batches", gateway.mqtt_batches);
+        jw_int(w, "mqtt_batch_readings", gateway.mqtt_batch_readings);
+        jw_object(w, "mqtt_batch_sizes");
+        for (int i = 0; i < MQTT_BATCH_HIST_BUCKETS; i++) {
+            jw_int(w, bucket_names[i], hist[i]);
+        }
+        jw_object_end(w);
+    }
+    jw_float(w, "db_insert_rate", db_state.insert_rate);
+    jw_int(w, "db_queue_depth", db_state.queue_depth);
+    jw_int(w, "db_queue_drops", db_state.queue_drops);
+    jw_double(w, "db_commit_ms", db_state.commit_time_last_us / 1000.0);
+    jw_double(w, "db_commit_max_ms", db_state.commit_time_max_us / 1000.0);
+    jw_double(w, "db_checkpoint_ms", db_state.checkpoint_time_last_us / 1000.0);
+    jw_double(w, "db_checkpoint_max_ms", db_state.checkpoint_time_max_us / 1000.0);
+    jw_int(w, "db_wal_kb", (int64_t)(db_state.wal_bytes / 1024));
+    jw_int(w, "db_backup_running", db_state.backup_running);
+    jw_int(w, "db_backup_percent", db_state.backup_percent);
+    jw_int(w, "db_cache_hits", db_state.cache_hits);
+    jw_int(w, "db_cache_misses", db_state.cache_misses);
+    jw_object_end(w);
     
-    char *json_string = cJSON_PrintUnformatted(root);
+    size_t len;
+    const char *json_string = jw_finish(w, &len);
+    if (json_string == NULL) {
+        gateway.mqtt_error_count++;
+        return;
+    }
     
     char topic[128];
     snprintf(topic, sizeof(topic), "%s/stats", MQTT_TOPIC_PREFIX);
     
-    mosquitto_publish(gateway.mqtt, NULL, topic, 
-                     strlen(json_string), json_string, 
-                     MQTT_QOS, false);
+    mqtt_publish_stats(topic, json_string, len, false);
+}
+
+/* An auto-control action, ahead of everything else in the queue */
+void mqtt_publish_alert(int node_id, const char *actuator, int state, float value) {
+    jw_t *w = jw_begin_as(payload_format);
+    jw_object(w, NULL);
+    jw_int(w, "node_id", node_id);
+    jw_int(w, "timestamp", time(NULL));
+    jw_string(w, "source", "AUTO");
+    jw_string(w, "actuator", actuator);
+    jw_int(w, "state", state);
+    jw_float(w, "value", value);
+    jw_object_end(w);
+    
+    size_t len;
+    const char *json_string = jw_finish(w, &len);
+    if (json_string == NULL) {
+        gateway.mqtt_error_count++;
+        return;
+    }
+    
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/alerts/node%d", MQTT_TOPIC_PREFIX, node_id);
     
-    free(json_string);
-    cJSON_Delete(root);
+    mq_msg_t m = {
+        .topic = topic,
+        .payload = json_string,
+        .len = len,
+        .qos = MQTT_QOS,
+    };
+    mqtt_outq_submit(MQ_ALERT, &m, 0);
 }
@@ -0,0 +1,208 @@
+/*
+ * src/mqtt_batch.c - Batched Node Data Publishing
+ * One message per batch instead of one per reading: fewer PUBACK
+ * round-trips and less broker fan-out with many nodes. The payload
+ * names the fields once and carries one array per reading:
+ *   {"ts":..,"fields":["node_id",..],"readings":[[1,..],[2,..]]}
+ */
+
+#include "mqtt_batch.h"
+#include "mqtt.h"
+#include "json_writer.h"
+#include "gateway.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define BATCH_FIELDS    "[\"node_id\",\"timestamp\",\"temperature\",\"humidity\"," \
+                        "\"light\",\"soil_moisture\",\"rssi\",\"snr\"]"
+
+typedef struct {
+    int node_id;
+    time_t timestamp;
+    float temperature;
+    float humidity;
+    uint16_t light;
+    uint16_t soil_moisture;
+    int32_t rssi;
+    int32_t snr;
+} batch_entry_t;
+
+static batch_entry_t entries[MQTT_BATCH_MAX_ENTRIES];
+static int entry_count = 0;
+static uint64_t first_entry_us;
+
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t batch_thread;
+static int batch_running = 0;
+
+static uint32_t size_hist[MQTT_BATCH_HIST_BUCKETS];
+
+/* Bucket of a batch of n: 0 for 1, then one per doubling */
+static int hist_bucket(int n) {
+    int b = n <= 1 ? 0 : 32 - __builtin_clz((unsigned)(n - 1));
+    return b < MQTT_BATCH_HIST_BUCKETS ? b : MQTT_BATCH_HIST_BUCKETS - 1;
+}
+
+static void batch_publish(const batch_entry_t *batch, int n) {
+    jw_t *w = jw_begin_as(mqtt_payload_format());
+    jw_object(w, NULL);
+    jw_int(w, "ts", time(NULL));
+    jw_raw(w, "fields", BATCH_FIELDS, sizeof(BATCH_FIELDS) - 1);
+    jw_array(w, "readings");
+    for (int i = 0; i < n; i++) {
+        const batch_entry_t *e = &batch[i];
+        jw_array(w, NULL);
+        jw_int(w, NULL, e->node_id);
+        jw_int(w, NULL, e->timestamp);
+        jw_float(w, NULL, e->temperature);
+        jw_float(w, NULL, e->humidity);
+        jw_int(w, NULL, e->light);
+        jw_int(w, NULL, e->soil_moisture);
+        jw_int(w, NULL, e->rssi);
+        jw_int(w, NULL, e->snr);
+        jw_array_end(w);
+    }
+    jw_array_end(w);
+    jw_object_end(w);
+
+    size_t len;
+    const char *payload = jw_finish(w, &len);
+    if (payload != NULL) {
+        mqtt_publish_data(MQTT_BATCH_TOPIC, payload, len);
+    }
+
+    pthread_mutex_lock(&batch_lock);
+    size_hist[hist_bucket(n)]++;
+    gateway.mqtt_batches++;
+    gateway.mqtt_batch_readings += n;
+    pthread_mutex_unlock(&batch_lock);
+}
+
+/* Under batch_lock: move the open batch out */
+static int batch_take(batch_entry_t *out) {
+    int n = entry_count;
+    memcpy(out, entries, sizeof(entries[0]) * n);
+    entry_count = 0;
+    return n;
+}
+
+void mqtt_batch_add(int node_id, const node_data_t *node) {
+    batch_entry_t full[MQTT_BATCH_MAX_ENTRIES];
+    int n = 0;
+
+    pthread_mutex_lock(&batch_lock);
+    if (!batch_running) {
+        pthread_mutex_unlock(&batch_lock);
+        return;
+    }
+
+    batch_entry_t *e = &entries[entry_count];
+    e->node_id = node_id;
+    e->timestamp = node->last_update;
+    e->temperature = node->temperature;
+    e->humidity = node->humidity;
+    e->light = node->light;
+    e->soil_moisture = node->soil_moisture;
+    e->rssi = node->last_rssi;
+    e->snr = node->last_snr;
+
+    if (entry_count++ == 0) {
+        first_entry_us = get_monotonic_us();
+        pthread_cond_signal(&batch_cond);
+    }
+    if (entry_count == MQTT_BATCH_MAX_ENTRIES) {
+        n = batch_take(full);
+    }
+    pthread_mutex_unlock(&batch_lock);
+
+    if (n > 0) {
+        batch_publish(full, n);
+    }
+}
+
+/* Publishes batches that reach MQTT_BATCH_LINGER_MS before filling up */
+static void *batch_main(void *arg) {
+    static batch_entry_t out[MQTT_BATCH_MAX_ENTRIES];
+    (void)arg;
+
+    pthread_mutex_lock(&batch_lock);
+    while (batch_running) {
+        if (entry_count == 0) {
+            pthread_cond_wait(&batch_cond, &batch_lock);
+            continue;
+        }
+
+        uint64_t age_us = get_monotonic_us() - first_entry_us;
+        if (age_us < MQTT_BATCH_LINGER_MS * 1000ULL) {
+            uint64_t wait_ns = (MQTT_BATCH_LINGER_MS * 1000ULL - age_us) * 1000ULL;
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += wait_ns / 1000000000ULL;
+            deadline.tv_nsec += wait_ns % 1000000000ULL;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&batch_cond, &batch_lock, &deadline);
+            continue;
+        }
+
+        int n = batch_take(out);
+        pthread_mutex_unlock(&batch_lock);
+        batch_publish(out, n);
+        pthread_mutex_lock(&batch_lock);
+    }
+    pthread_mutex_unlock(&batch_lock);
+    return NULL;
+}
+
+int mqtt_batch_start(void) {
+    pthread_mutex_lock(&batch_lock);
+    entry_count = 0;
+    memset(size_hist, 0, sizeof(size_hist));
+    batch_running = 1;
+    pthread_mutex_unlock(&batch_lock);
+
+    if (pthread_create(&batch_thread, NULL, batch_main, NULL) != 0) {
+        fprintf(stderr, "✗ Cannot start MQTT batch thread: %s\n", strerror(errno));
+        batch_running = 0;
+        return -1;
+    }
+
+    printf(" MQTT batches: %s, up to %d readings or %d ms\n",
+           MQTT_BATCH_TOPIC, MQTT_BATCH_MAX_ENTRIES, MQTT_BATCH_LINGER_MS);
+    return 0;
+}
+
+void mqtt_batch_stop(void) {
+    static batch_entry_t out[MQTT_BATCH_MAX_ENTRIES];
+
+    pthread_mutex_lock(&batch_lock);
+    if (!batch_running) {
+        pthread_mutex_unlock(&batch_lock);
+        return;
+    }
+    batch_running = 0;
+    pthread_cond_signal(&batch_cond);
+    pthread_mutex_unlock(&batch_lock);
+
+    pthread_join(batch_thread, NULL);
+
+    pthread_mutex_lock(&batch_lock);
+    int n = batch_take(out);
+    pthread_mutex_unlock(&batch_lock);
+    if (n > 0) {
+        batch_publish(out, n);
+    }
+}
+
+void mqtt_batch_histogram(uint32_t out[MQTT_BATCH_HIST_BUCKETS]) {
+    pthread_mutex_lock(&batch_lock);
+    memcpy(out, size_hist, sizeof(size_hist));
+    pthread_mutex_unlock(&batch_lock);
+}
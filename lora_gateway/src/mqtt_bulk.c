@@ -0,0 +1,381 @@
+/*
+ * src/mqtt_bulk.c - Bulk Control Requests
+ * Parses control/bulk into entries, stages them on a copy of every
+ * node's thresholds and actuators, and only when all of it checks out
+ * copies the result into gateway.nodes[], logs it as one command_history
+ * transaction and sends the downlinks as one paced LoRa batch.
+ */
+
+#include "mqtt_bulk.h"
+#include "database.h"
+#include "gateway.h"
+#include "lora.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <cjson/cJSON.h>
+
+#define MB_ALL_NODES    (((1u << MAX_NODES) - 1) << 1)
+
+/* command_history rows per node: auto, three thresholds, three actuators */
+#define MB_ROWS_PER_NODE 7
+
+static int fail(mb_result_t *result, const char *fmt, int value) {
+    snprintf(result->error, sizeof(result->error), fmt, value);
+    return -1;
+}
+
+/*====================================================================
+ * JSON FORM
+ *====================================================================*/
+
+static int json_on_off(const cJSON *item) {
+    const char *s = cJSON_GetStringValue(item);
+    if (s == NULL) return -1;
+    if (strcmp(s, "on") == 0) return 1;
+    if (strcmp(s, "off") == 0) return 0;
+    return -1;
+}
+
+static int json_node(const cJSON *item, uint32_t *nodes) {
+    if (!cJSON_IsNumber(item) || item->valuedouble < 1 || item->valuedouble > MAX_NODES ||
+        item->valuedouble != item->valueint) {
+        return -1;
+    }
+    *nodes |= 1u << item->valueint;
+    return 0;
+}
+
+static int json_nodes(const cJSON *item, uint32_t *nodes) {
+    const char *s = cJSON_GetStringValue(item);
+    *nodes = 0;
+    if (s != NULL) {
+        if (strcmp(s, "all") != 0) return -1;
+        *nodes = MB_ALL_NODES;
+        return 0;
+    }
+    if (cJSON_IsArray(item)) {
+        const cJSON *id;
+        cJSON_ArrayForEach(id, item) {
+            if (json_node(id, nodes) < 0) return -1;
+        }
+        return *nodes != 0 ? 0 : -1;
+    }
+    return json_node(item, nodes);
+}
+
+/* [min, max] within [0, limit]; 0, or -1 */
+static int json_range(const cJSON *item, double limit, float *min, float *max) {
+    if (!cJSON_IsArray(item) || cJSON_GetArraySize(item) != 2) return -1;
+    const cJSON *lo = cJSON_GetArrayItem(item, 0);
+    const cJSON *hi = cJSON_GetArrayItem(item, 1);
+    if (!cJSON_IsNumber(lo) || !cJSON_IsNumber(hi) ||
+        lo->valuedouble > hi->valuedouble ||
+        (limit > 0 && (lo->valuedouble < 0 || hi->valuedouble > limit))) {
+        return -1;
+    }
+    *min = (float)lo->valuedouble;
+    *max = (float)hi->valuedouble;
+    return 0;
+}
+
+static int json_range16(const cJSON *item, uint16_t *min, uint16_t *max) {
+    float lo, hi;
+    if (json_range(item, UINT16_MAX, &lo, &hi) < 0) return -1;
+    *min = (uint16_t)lo;
+    *max = (uint16_t)hi;
+    return 0;
+}
+
+static int json_entry(const cJSON *item, mb_entry_t *e) {
+    static const struct {
+        const char *key;
+        uint8_t bits;
+    } switches[] = {
+        { "auto",  MB_AUTO },
+        { "fan",   MB_FAN },
+        { "light", MB_LIGHT },
+        { "pump",  MB_PUMP },
+        { "all",   MB_ACTUATORS },
+    };
+    const cJSON *field;
+
+    memset(e, 0, sizeof(*e));
+    if (!cJSON_IsObject(item) || json_nodes(cJSON_GetObjectItem(item, "nodes"), &e->nodes) < 0) {
+        return -1;
+    }
+
+    cJSON_ArrayForEach(field, item) {
+        if (strcmp(field->string, "nodes") == 0) {
+            continue;
+        }
+        if (strcmp(field->string, "threshold") == 0 && cJSON_IsObject(field)) {
+            const cJSON *th;
+            cJSON_ArrayForEach(th, field) {
+                int rc = -1;
+                if (strcmp(th->string, "temp") == 0) {
+                    rc = json_range(th, 0, &e->temp_min, &e->temp_max);
+                    e->set |= MB_TEMP;
+                } else if (strcmp(th->string, "light") == 0) {
+                    rc = json_range16(th, &e->light_min, &e->light_max);
+                    e->set |= MB_LIGHT_TH;
+                } else if (strcmp(th->string, "soil") == 0) {
+                    rc = json_range16(th, &e->soil_min, &e->soil_max);
+                    e->set |= MB_SOIL;
+                }
+                if (rc < 0) return -1;
+            }
+            continue;
+        }
+
+        size_t i;
+        for (i = 0; i < sizeof(switches) / sizeof(switches[0]); i++) {
+            if (strcmp(field->string, switches[i].key) == 0) break;
+        }
+        int on = i < sizeof(switches) / sizeof(switches[0]) ? json_on_off(field) : -1;
+        if (on < 0) {
+            return -1;
+        }
+        e->set |= switches[i].bits;
+        e->on = on ? e->on | switches[i].bits : e->on & ~switches[i].bits;
+    }
+    return e->set != 0 ? 0 : -1;
+}
+
+static int parse_json(const char *payload, mb_request_t *req, mb_result_t *result) {
+    cJSON *root = cJSON_Parse(payload);
+    if (root == NULL) {
+        return fail(result, "Invalid JSON", 0);
+    }
+
+    int rc = 0;
+    const char *request_id = cJSON_GetStringValue(cJSON_GetObjectItem(root, "request_id"));
+    if (request_id != NULL) {
+        snprintf(req->request_id, sizeof(req->request_id), "%s", request_id);
+    }
+
+    const cJSON *set = cJSON_GetObjectItem(root, "set");
+    int count = cJSON_GetArraySize(set);
+    if (!cJSON_IsArray(set) || count < 1 || count > MQTT_BULK_MAX_ENTRIES) {
+        rc = fail(result, "\"set\" must list 1 to %d entries", MQTT_BULK_MAX_ENTRIES);
+    }
+    for (int i = 0; rc == 0 && i < count; i++) {
+        if (json_entry(cJSON_GetArrayItem(set, i), &req->entries[i]) < 0) {
+            rc = fail(result, "Invalid entry %d", i);
+        }
+    }
+    req->count = rc == 0 ? count : 0;
+
+    cJSON_Delete(root);
+    return rc;
+}
+
+/*====================================================================
+ * BINARY FORM
+ *====================================================================*/
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static float get_f32(const uint8_t *p) {
+    uint32_t bits = get_u32(p);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static int parse_binary(const uint8_t *p, size_t len, mb_request_t *req, mb_result_t *result) {
+    int count = p[MB_HEADER_BYTES - 1];
+    if (count < 1 || count > MQTT_BULK_MAX_ENTRIES ||
+        len != MB_HEADER_BYTES + (size_t)count * MB_ENTRY_BYTES) {
+        return fail(result, "Binary request must carry 1 to %d whole entries",
+                    MQTT_BULK_MAX_ENTRIES);
+    }
+    p += MB_HEADER_BYTES;
+
+    for (int i = 0; i < count; i++, p += MB_ENTRY_BYTES) {
+        mb_entry_t *e = &req->entries[i];
+        e->nodes = get_u32(p);
+        e->set = p[4];
+        e->on = p[5];
+        e->temp_min = get_f32(p + 8);
+        e->temp_max = get_f32(p + 12);
+        e->light_min = get_u16(p + 16);
+        e->light_max = get_u16(p + 18);
+        e->soil_min = get_u16(p + 20);
+        e->soil_max = get_u16(p + 22);
+
+        // The float compare is false for NaN, so NaN ranges fail too
+        if (e->nodes == 0 || (e->nodes & ~MB_ALL_NODES) != 0 ||
+            e->set == 0 || (e->set & ~MB_FIELDS) != 0 ||
+            get_u16(p + 6) != 0 ||
+            ((e->set & MB_TEMP) && !(e->temp_min <= e->temp_max)) ||
+            ((e->set & MB_LIGHT_TH) && e->light_min > e->light_max) ||
+            ((e->set & MB_SOIL) && e->soil_min > e->soil_max)) {
+            return fail(result, "Invalid entry %d", i);
+        }
+    }
+    req->count = count;
+    return 0;
+}
+
+int mqtt_bulk_parse(const char *payload, size_t len, mb_request_t *req, mb_result_t *result) {
+    memset(req, 0, sizeof(*req));
+    memset(result, 0, sizeof(*result));
+
+    if (len >= MB_HEADER_BYTES && memcmp(payload, MB_MAGIC, MB_HEADER_BYTES - 1) == 0) {
+        return parse_binary((const uint8_t *)payload, len, req, result);
+    }
+    return parse_json(payload, req, result);
+}
+
+/*====================================================================
+ * APPLY
+ *====================================================================*/
+
+typedef struct {
+    threshold_config_t thresholds;
+    actuator_state_t actuators;
+    uint8_t set;                // MB_* touched, auto-off counts as all actuators
+} mb_stage_t;
+
+typedef struct {
+    db_command_t rows[MAX_NODES * MB_ROWS_PER_NODE];
+    char values[MAX_NODES * MB_ROWS_PER_NODE][24];
+    int count;
+} mb_rows_t;
+
+static void add_row(mb_rows_t *r, int node_id, const char *cmd, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(r->values[r->count], sizeof(r->values[0]), fmt, ap);
+    va_end(ap);
+    r->rows[r->count] = (db_command_t){ node_id, cmd, r->values[r->count] };
+    r->count++;
+}
+
+static int stage_entry(mb_stage_t stage[MAX_NODES], const mb_entry_t *e, mb_result_t *result) {
+    for (int id = 1; id <= MAX_NODES; id++) {
+        if (!(e->nodes & (1u << id))) {
+            continue;
+        }
+        mb_stage_t *st = &stage[id - 1];
+
+        if (e->set & MB_AUTO) {
+            st->thresholds.enabled = (e->on & MB_AUTO) != 0;
+            st->set |= MB_AUTO;
+            if (!st->thresholds.enabled) {
+                // As the auto command does: everything off
+                memset(&st->actuators, 0, sizeof(st->actuators));
+                st->set |= MB_ACTUATORS;
+            }
+        }
+        if (e->set & MB_TEMP) {
+            st->thresholds.temp_min = e->temp_min;
+            st->thresholds.temp_max = e->temp_max;
+        }
+        if (e->set & MB_LIGHT_TH) {
+            st->thresholds.light_min = e->light_min;
+            st->thresholds.light_max = e->light_max;
+        }
+        if (e->set & MB_SOIL) {
+            st->thresholds.soil_min = e->soil_min;
+            st->thresholds.soil_max = e->soil_max;
+        }
+        st->set |= e->set & (MB_TEMP | MB_LIGHT_TH | MB_SOIL);
+
+        if (e->set & MB_ACTUATORS) {
+            if (st->thresholds.enabled) {
+                return fail(result, "Node %d is in AUTO mode", id);
+            }
+            if (e->set & MB_FAN) st->actuators.fan_state = (e->on & MB_FAN) != 0;
+            if (e->set & MB_LIGHT) st->actuators.light_state = (e->on & MB_LIGHT) != 0;
+            if (e->set & MB_PUMP) st->actuators.pump_state = (e->on & MB_PUMP) != 0;
+            st->set |= e->set & MB_ACTUATORS;
+        }
+    }
+    return 0;
+}
+
+int mqtt_bulk_apply(const mb_request_t *req, mb_result_t *result) {
+    mb_stage_t stage[MAX_NODES];
+    mb_rows_t log = { .count = 0 };
+    lora_cmd_t downlinks[MAX_NODES * 3];
+    int downlink_count = 0;
+
+    for (int i = 0; i < MAX_NODES; i++) {
+        stage[i].thresholds = gateway.nodes[i].thresholds;
+        stage[i].actuators = gateway.nodes[i].actuators;
+        stage[i].set = 0;
+    }
+    for (int i = 0; i < req->count; i++) {
+        if (stage_entry(stage, &req->entries[i], result) < 0) {
+            return -1;
+        }
+    }
+
+    // Checked: commit node by node, collecting rows and downlinks
+    for (int i = 0; i < MAX_NODES; i++) {
+        const mb_stage_t *st = &stage[i];
+        node_data_t *node = &gateway.nodes[i];
+        int id = i + 1;
+
+        if (st->set == 0) {
+            continue;
+        }
+        node->thresholds = st->thresholds;
+        node->actuators = st->actuators;
+        result->nodes |= 1u << id;
+
+        if (st->set & MB_AUTO) {
+            add_row(&log, id, "auto", "%s", st->thresholds.enabled ? "on" : "off");
+        }
+        if (st->set & MB_TEMP) {
+            add_row(&log, id, "settemp", "%.1f,%.1f", st->thresholds.temp_min, st->thresholds.temp_max);
+        }
+        if (st->set & MB_LIGHT_TH) {
+            add_row(&log, id, "setlight", "%u,%u", st->thresholds.light_min, st->thresholds.light_max);
+        }
+        if (st->set & MB_SOIL) {
+            add_row(&log, id, "setsoil", "%u,%u", st->thresholds.soil_min, st->thresholds.soil_max);
+        }
+
+        // One "all" downlink when the three actuators end up alike
+        const actuator_state_t *a = &st->actuators;
+        int alike = a->fan_state == a->light_state && a->light_state == a->pump_state;
+        const struct {
+            uint8_t bits;
+            const char *name;
+            uint8_t on;
+        } switches[] = {
+            { MB_ACTUATORS, "all",   a->fan_state },
+            { MB_FAN,       "fan",   a->fan_state },
+            { MB_LIGHT,     "light", a->light_state },
+            { MB_PUMP,      "pump",  a->pump_state },
+        };
+        for (int s = (st->set & MB_ACTUATORS) == MB_ACTUATORS && alike ? 0 : 1; s < 4; s++) {
+            if ((st->set & switches[s].bits) != switches[s].bits) {
+                continue;
+            }
+            const char *val = switches[s].on ? "on" : "off";
+            add_row(&log, id, switches[s].name, "%s", val);
+            downlinks[downlink_count++] = (lora_cmd_t){ id, switches[s].name, val };
+            node->tx_count++;
+            if (s == 0) {
+                break;
+            }
+        }
+    }
+
+    if (log.count > 0 && db_log_commands(log.rows, log.count, "MQTT") == 0) {
+        result->commands = log.count;
+    }
+    result->downlinks = lora_send_batch(downlinks, downlink_count);
+    return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * src/mqtt_outq.c - Prioritized Outbound Publish Queue
+ * One FIFO per class, each holding at most its byte cap of copied
+ * messages. The sender thread takes the first message of the highest
+ * class that has one whenever fewer than MQTT_OUTQ_MAX_INFLIGHT are
+ * unacknowledged and the broker is connected. It publishes with
+ * outq_lock held: the acknowledgement for a mid cannot be looked up
+ * before the mid is recorded (callbacks run on the loop thread, and
+ * mosquitto_publish never waits for it).
+ */
+
+#include "mqtt_outq.h"
+#include "mqtt.h"
+#include "mqtt_spool.h"
+#include "gateway.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct mq_entry {
+    struct mq_entry *next;
+    uint64_t queued_us;
+    size_t bytes;               // charged against the class cap
+    mq_msg_t msg;               // pointers into data
+    char data[];                // topic, correlation, payload
+} mq_entry_t;
+
+typedef struct {
+    mq_entry_t *head;
+    mq_entry_t *tail;
+    uint32_t depth;
+    size_t bytes;
+    uint32_t dropped;
+} mq_fifo_t;
+
+typedef struct {
+    int mid;
+    uint64_t queued_us;
+} mq_inflight_t;
+
+static const size_t class_cap[MQ_CLASSES] = {
+    MQTT_OUTQ_ALERT_BYTES, MQTT_OUTQ_NODE_BYTES, MQTT_OUTQ_STATS_BYTES, MQTT_OUTQ_DB_BYTES
+};
+
+static mq_fifo_t fifo[MQ_CLASSES];
+static mq_inflight_t inflight[MQTT_OUTQ_MAX_INFLIGHT];
+static int inflight_count = 0;
+
+static uint32_t acked = 0;
+static uint64_t latency_sum_us = 0;
+static uint64_t latency_max_us = 0;
+
+static pthread_mutex_t outq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t send_cond = PTHREAD_COND_INITIALIZER;    // work for the sender
+static pthread_cond_t room_cond = PTHREAD_COND_INITIALIZER;    // bytes freed
+static pthread_t send_thread;
+static int outq_running = 0;
+static mq_send_fn send_fn;
+
+static mq_entry_t *fifo_pop(mq_fifo_t *f) {
+    mq_entry_t *e = f->head;
+    f->head = e->next;
+    if (f->head == NULL) {
+        f->tail = NULL;
+    }
+    f->depth--;
+    f->bytes -= e->bytes;
+    pthread_cond_broadcast(&room_cond);
+    return e;
+}
+
+static void fifo_push(mq_fifo_t *f, mq_entry_t *e) {
+    e->next = NULL;
+    if (f->tail != NULL) {
+        f->tail->next = e;
+    } else {
+        f->head = e;
+    }
+    f->tail = e;
+    f->depth++;
+    f->bytes += e->bytes;
+}
+
+/* Under outq_lock: every queued node message to the spool, oldest first,
+ * so node data after them (spooled while the spool is not empty) keeps
+ * its order */
+static void spill_node_data(void) {
+    mq_fifo_t *f = &fifo[MQ_NODE];
+    while (f->head != NULL) {
+        mq_entry_t *e = fifo_pop(f);
+        if (mqtt_spool_append(e->msg.topic, e->msg.payload, e->msg.len, e->msg.format) < 0) {
+            f->dropped++;
+        }
+        free(e);
+    }
+}
+
+static mq_entry_t *entry_new(const mq_msg_t *msg) {
+    size_t topic_len = strlen(msg->topic);
+    size_t bytes = sizeof(mq_entry_t) + topic_len + 1 + msg->correlation_len + msg->len;
+    mq_entry_t *e = malloc(bytes);
+    if (e == NULL) {
+        return NULL;
+    }
+
+    char *p = e->data;
+    e->bytes = bytes;
+    e->msg = *msg;
+    e->msg.topic = memcpy(p, msg->topic, topic_len + 1);
+    p += topic_len + 1;
+    if (msg->correlation != NULL) {
+        e->msg.correlation = memcpy(p, msg->correlation, msg->correlation_len);
+        p += msg->correlation_len;
+    }
+    e->msg.payload = memcpy(p, msg->payload, msg->len);
+    e->queued_us = get_monotonic_us();
+    return e;
+}
+
+/* Under outq_lock: room for bytes in cls by its policy; 0, or -1 */
+static int make_room(mq_class_t cls, size_t bytes, int wait_ms) {
+    mq_fifo_t *f = &fifo[cls];
+
+    if (bytes > class_cap[cls]) {
+        return -1;
+    }
+    if (cls == MQ_ALERT || cls == MQ_STATS) {
+        while (f->bytes + bytes > class_cap[cls]) {
+            free(fifo_pop(f));
+            f->dropped++;
+        }
+        return 0;
+    }
+    if (wait_ms > 0 && f->bytes + bytes > class_cap[cls]) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (wait_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (outq_running && f->bytes + bytes > class_cap[cls]) {
+            if (pthread_cond_timedwait(&room_cond, &outq_lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+    }
+    return outq_running && f->bytes + bytes <= class_cap[cls] ? 0 : -1;
+}
+
+int mqtt_outq_submit(mq_class_t cls, const mq_msg_t *msg, int wait_ms) {
+    mq_entry_t *e = entry_new(msg);
+    if (e == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&outq_lock);
+    if (!outq_running || make_room(cls, e->bytes, wait_ms) < 0) {
+        // Node data is not lost here: the caller spools it
+        if (outq_running && cls != MQ_NODE) {
+            fifo[cls].dropped++;
+        }
+        pthread_mutex_unlock(&outq_lock);
+        free(e);
+        return -1;
+    }
+    fifo_push(&fifo[cls], e);
+    pthread_cond_signal(&send_cond);
+    pthread_mutex_unlock(&outq_lock);
+    return 0;
+}
+
+void mqtt_outq_acked(int mid) {
+    uint64_t now = get_monotonic_us();
+
+    pthread_mutex_lock(&outq_lock);
+    for (int i = 0; i < inflight_count; i++) {
+        if (inflight[i].mid != mid) {
+            continue;
+        }
+        uint64_t us = now - inflight[i].queued_us;
+        latency_sum_us += us;
+        if (us > latency_max_us) {
+            latency_max_us = us;
+        }
+        acked++;
+        inflight[i] = inflight[--inflight_count];
+        pthread_cond_signal(&send_cond);
+        break;
+    }
+    pthread_mutex_unlock(&outq_lock);
+}
+
+void mqtt_outq_connected(void) {
+    pthread_mutex_lock(&outq_lock);
+    inflight_count = 0;
+    pthread_cond_signal(&send_cond);
+    pthread_mutex_unlock(&outq_lock);
+}
+
+/* Under outq_lock: highest class with a message, or -1 */
+static int next_class(void) {
+    for (int c = 0; c < MQ_CLASSES; c++) {
+        if (fifo[c].head != NULL) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+static void *send_main(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&outq_lock);
+    while (outq_running) {
+        int cls = -1;
+        if (gateway.mqtt_connected && inflight_count < MQTT_OUTQ_MAX_INFLIGHT) {
+            cls = next_class();
+        }
+        if (cls < 0) {
+            // Disconnects do not signal; look again every 100 ms
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100 * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&send_cond, &outq_lock, &deadline);
+            continue;
+        }
+
+        mq_entry_t *e = fifo_pop(&fifo[cls]);
+        int mid = 0;
+        if (send_fn(&e->msg, &mid) == 0) {
+            inflight[inflight_count].mid = mid;
+            inflight[inflight_count].queued_us = e->queued_us;
+            inflight_count++;
+        } else {
+            gateway.mqtt_error_count++;
+            if (cls == MQ_NODE) {
+                // Broker gone: this one and everything after it waits on disk
+                mqtt_spool_append(e->msg.topic, e->msg.payload, e->msg.len, e->msg.format);
+                spill_node_data();
+            } else {
+                fifo[cls].dropped++;
+            }
+        }
+        free(e);
+    }
+    pthread_mutex_unlock(&outq_lock);
+    return NULL;
+}
+
+int mqtt_outq_start(mq_send_fn send) {
+    pthread_mutex_lock(&outq_lock);
+    memset(fifo, 0, sizeof(fifo));
+    inflight_count = 0;
+    send_fn = send;
+    outq_running = 1;
+    pthread_mutex_unlock(&outq_lock);
+
+    if (pthread_create(&send_thread, NULL, send_main, NULL) != 0) {
+        fprintf(stderr, "✗ Cannot start MQTT send thread: %s\n", strerror(errno));
+        outq_running = 0;
+        return -1;
+    }
+
+    printf(" MQTT outbound queue: %d in flight, %zu KB queued at most\n",
+           MQTT_OUTQ_MAX_INFLIGHT,
+           (class_cap[MQ_ALERT] + class_cap[MQ_NODE] +
+            class_cap[MQ_STATS] + class_cap[MQ_DB]) / 1024);
+    return 0;
+}
+
+void mqtt_outq_stop(void) {
+    pthread_mutex_lock(&outq_lock);
+    if (!outq_running) {
+        pthread_mutex_unlock(&outq_lock);
+        return;
+    }
+    outq_running = 0;
+    pthread_cond_signal(&send_cond);
+    pthread_cond_broadcast(&room_cond);
+    pthread_mutex_unlock(&outq_lock);
+
+    pthread_join(send_thread, NULL);
+
+    pthread_mutex_lock(&outq_lock);
+    spill_node_data();
+    for (int c = 0; c < MQ_CLASSES; c++) {
+        while (fifo[c].head != NULL) {
+            free(fifo_pop(&fifo[c]));
+        }
+    }
+    pthread_mutex_unlock(&outq_lock);
+}
+
+void mqtt_outq_stats(mq_stats_t *out) {
+    pthread_mutex_lock(&outq_lock);
+    for (int c = 0; c < MQ_CLASSES; c++) {
+        out->depth[c] = fifo[c].depth;
+        out->bytes[c] = (uint32_t)fifo[c].bytes;
+        out->dropped[c] = fifo[c].dropped;
+    }
+    out->inflight = inflight_count;
+    out->acked = acked;
+    out->latency_avg_ms = acked > 0 ? latency_sum_us / 1000.0 / acked : 0.0;
+    out->latency_max_ms = latency_max_us / 1000.0;
+    acked = 0;
+    latency_sum_us = 0;
+    latency_max_us = 0;
+    pthread_mutex_unlock(&outq_lock);
+}
@@ -0,0 +1,246 @@
+/*
+ * src/mqtt_router.c - Inbound Topic Router
+ * The trie is static data, one array of levels per trie node; matching
+ * a level compares its length first, so a topic is read once with no
+ * copies, sscanf or strstr. Replaces the strstr/sscanf/strcmp chains
+ * in mqtt_on_message().
+ */
+
+#include "mqtt_router.h"
+#include "mqtt.h"
+#include "types.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct mr_node {
+    const char *level;
+    size_t level_len;
+    int numbered;                   // level is the name followed by a node id
+    int route;                      // when the topic ends here; -1 none
+    int arg;
+    const struct mr_node *children;
+    int child_count;
+} mr_node_t;
+
+#define MR_TEXT         MR_ROUTES   // command: route comes from the payload
+#define LEVEL(s)        s, sizeof(s) - 1
+#define CHILDREN(a)     a, (int)(sizeof(a) / sizeof(a[0]))
+
+static const mr_node_t threshold_levels[] = {
+    { LEVEL("temp"),  0, MR_THRESHOLD, MR_TH_TEMP,  NULL, 0 },
+    { LEVEL("light"), 0, MR_THRESHOLD, MR_TH_LIGHT, NULL, 0 },
+    { LEVEL("soil"),  0, MR_THRESHOLD, MR_TH_SOIL,  NULL, 0 },
+};
+
+static const mr_node_t node_levels[] = {
+    { LEVEL("fan"),       0, MR_ACTUATOR, MR_FAN,   NULL, 0 },
+    { LEVEL("light"),     0, MR_ACTUATOR, MR_LIGHT, NULL, 0 },
+    { LEVEL("pump"),      0, MR_ACTUATOR, MR_PUMP,  NULL, 0 },
+    { LEVEL("all"),       0, MR_ACTUATOR, MR_ALL,   NULL, 0 },
+    { LEVEL("auto"),      0, MR_AUTO,     0,        NULL, 0 },
+    { LEVEL("threshold"), 0, -1,          0,        CHILDREN(threshold_levels) },
+};
+
+static const mr_node_t control_levels[] = {
+    { LEVEL("node"), 1, -1,      0, CHILDREN(node_levels) },
+    { LEVEL("bulk"), 0, MR_BULK, 0, NULL, 0 },
+};
+
+static const mr_node_t db_levels[] = {
+    { LEVEL("query"), 0, MR_DB_QUERY, 0, NULL, 0 },
+};
+
+static const mr_node_t root_levels[] = {
+    { LEVEL("control"), 0, -1,      0, CHILDREN(control_levels) },
+    { LEVEL("command"), 0, MR_TEXT, 0, NULL, 0 },
+    { LEVEL("db"),      0, -1,      0, CHILDREN(db_levels) },
+};
+
+/* Text commands: "<verb> <node> on|off" or "<verb> <node> <min> <max>" */
+static const struct {
+    const char *verb;
+    size_t verb_len;
+    int route;
+    int arg;
+} text_verbs[] = {
+    { LEVEL("fan"),      MR_ACTUATOR,  MR_FAN },
+    { LEVEL("light"),    MR_ACTUATOR,  MR_LIGHT },
+    { LEVEL("pump"),     MR_ACTUATOR,  MR_PUMP },
+    { LEVEL("all"),      MR_ACTUATOR,  MR_ALL },
+    { LEVEL("auto"),     MR_AUTO,      0 },
+    { LEVEL("settemp"),  MR_THRESHOLD, MR_TH_TEMP },
+    { LEVEL("setlight"), MR_THRESHOLD, MR_TH_LIGHT },
+    { LEVEL("setsoil"),  MR_THRESHOLD, MR_TH_SOIL },
+};
+
+static const char *actuator_names[] = { "fan", "light", "pump", "all" };
+static const char *threshold_names[] = { "temp", "light", "soil" };
+
+const char *mqtt_route_actuator(int arg) {
+    return actuator_names[arg];
+}
+
+const char *mqtt_route_threshold(int arg) {
+    return threshold_names[arg];
+}
+
+/* Decimal node id filling [p, end), or -1 */
+static int parse_node_id(const char *p, const char *end) {
+    int id = 0;
+    if (p == end || end - p > 6) {
+        return -1;
+    }
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        id = id * 10 + (*p - '0');
+    }
+    return id;
+}
+
+/* "on" / "off" filling [p, end): 1 / 0, else -1 */
+static int parse_on_off(const char *p, const char *end) {
+    size_t n = (size_t)(end - p);
+    if (n == 2 && memcmp(p, "on", 2) == 0) return 1;
+    if (n == 3 && memcmp(p, "off", 3) == 0) return 0;
+    return -1;
+}
+
+/* Only trailing spaces and a line ending left */
+static int at_end(const char *p) {
+    while (*p == ' ' || *p == '\n' || *p == '\r') {
+        p++;
+    }
+    return *p == '\0';
+}
+
+/* Two floats separated by sep (',' or ' ') and nothing else; 0, or -1 */
+static int parse_range(const char *p, char sep, mr_cmd_t *cmd) {
+    char *end;
+    cmd->min = strtof(p, &end);
+    if (end == p || *end != sep) {
+        return -1;
+    }
+    p = end + 1;
+    cmd->max = strtof(p, &end);
+    if (end == p) {
+        return -1;
+    }
+    return at_end(end) && cmd->min <= cmd->max ? 0 : -1;
+}
+
+static const char *skip_spaces(const char *p) {
+    while (*p == ' ') {
+        p++;
+    }
+    return p;
+}
+
+static const char *word_end(const char *p) {
+    while (*p != '\0' && *p != ' ' && *p != '\n' && *p != '\r') {
+        p++;
+    }
+    return p;
+}
+
+static int route_text(const char *payload, mr_cmd_t *cmd) {
+    const char *p = skip_spaces(payload);
+    const char *end = word_end(p);
+    size_t n = (size_t)(end - p);
+    int route = -1;
+
+    for (size_t i = 0; i < sizeof(text_verbs) / sizeof(text_verbs[0]); i++) {
+        if (n == text_verbs[i].verb_len && memcmp(p, text_verbs[i].verb, n) == 0) {
+            route = text_verbs[i].route;
+            cmd->arg = text_verbs[i].arg;
+            break;
+        }
+    }
+    if (route < 0) {
+        return -1;
+    }
+
+    p = skip_spaces(end);
+    end = word_end(p);
+    cmd->node_id = parse_node_id(p, end);
+    p = skip_spaces(end);
+
+    if (route == MR_THRESHOLD) {
+        return parse_range(p, ' ', cmd) == 0 ? route : -1;
+    }
+    end = word_end(p);
+    cmd->on = parse_on_off(p, end);
+    return cmd->on >= 0 && at_end(end) ? route : -1;
+}
+
+int mqtt_route(const char *topic, const char *payload, size_t len, mr_cmd_t *cmd) {
+    static const char prefix[] = MQTT_TOPIC_PREFIX "/";
+    const mr_node_t *levels = root_levels;
+    int count = (int)(sizeof(root_levels) / sizeof(root_levels[0]));
+    const mr_node_t *match = NULL;
+    const char *p = topic + sizeof(prefix) - 1;
+
+    if (strncmp(topic, prefix, sizeof(prefix) - 1) != 0) {
+        return -1;
+    }
+    cmd->node_id = 0;
+
+    for (;;) {
+        const char *end = p;
+        while (*end != '\0' && *end != '/') {
+            end++;
+        }
+        size_t n = (size_t)(end - p);
+
+        match = NULL;
+        for (int i = 0; i < count; i++) {
+            const mr_node_t *c = &levels[i];
+            if (c->numbered) {
+                if (n > c->level_len && memcmp(p, c->level, c->level_len) == 0) {
+                    cmd->node_id = parse_node_id(p + c->level_len, end);
+                    match = c;
+                    break;
+                }
+            } else if (n == c->level_len && memcmp(p, c->level, n) == 0) {
+                match = c;
+                break;
+            }
+        }
+        if (match == NULL) {
+            return -1;
+        }
+        if (*end == '\0') {
+            break;
+        }
+        levels = match->children;
+        count = match->child_count;
+        p = end + 1;
+    }
+
+    int route = match->route;
+    cmd->arg = match->arg;
+    switch (route) {
+    case MR_DB_QUERY:
+    case MR_BULK:
+        return len > 0 ? route : -1;
+    case MR_TEXT:
+        route = route_text(payload, cmd);
+        break;
+    case MR_ACTUATOR:
+    case MR_AUTO:
+        cmd->on = parse_on_off(payload, payload + len);
+        if (cmd->on < 0) {
+            return -1;
+        }
+        break;
+    case MR_THRESHOLD:
+        if (parse_range(payload, ',', cmd) < 0) {
+            return -1;
+        }
+        break;
+    default:
+        return -1;
+    }
+    return route >= 0 && cmd->node_id >= 1 && cmd->node_id <= MAX_NODES ? route : -1;
+}
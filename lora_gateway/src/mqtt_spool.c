@@ -0,0 +1,378 @@
+/*
+ * src/mqtt_spool.c - Offline Store-and-Forward Spool
+ * A header page and MQTT_SPOOL_BYTES of records in one mmap'd file,
+ * used as a ring. head/tail are byte positions that only grow; the
+ * file offset is position % capacity. A record never wraps: the space
+ * left before the end is skipped with a pad record (or implicitly,
+ * when not even a record header fits). Record data is written before
+ * the header's tail moves past it, so after a crash the tail can only
+ * be behind - anything that fails its CRC on open is cut off.
+ */
+
+#include "mqtt_spool.h"
+#include "mqtt.h"
+#include "mqtt_outq.h"
+#include "gateway.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define SPOOL_MAGIC         0x50534c4cu     // "LLSP"
+#define SPOOL_VERSION       1
+#define SPOOL_DATA_OFFSET   4096            // header page
+#define SPOOL_RECORD_MAX    16384           // topic + payload
+#define REC_MAGIC           0x43455250u     // "PREC"
+#define PAD_MAGIC           0x44415050u     // "PPAD"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;          // data bytes after the header page
+    uint64_t head;              // oldest record
+    uint64_t tail;              // next append
+    uint32_t count;
+    uint32_t dropped;           // oldest records overwritten, ever
+} spool_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;              // whole record, 8-byte aligned
+    uint32_t crc;               // crc32 of everything after this field
+    uint32_t payload_len;
+    uint32_t written;           // time() of the append
+    uint16_t topic_len;
+    uint8_t format;             // JW_JSON (0, also older files) / JW_CBOR
+    uint8_t reserved;
+} spool_record_t;
+
+static int spool_fd = -1;
+static uint8_t *spool_map = NULL;
+static size_t spool_map_len;
+static spool_header_t *hdr;
+static uint8_t *data;
+static int dirty = 0;
+
+static pthread_mutex_t spool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t spool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t drain_thread;
+static int drain_running = 0;
+
+/* Drain thread only: the record being published, copied out of the map */
+static char drain_buf[SPOOL_RECORD_MAX + 1];
+
+static inline uint32_t rec_align(size_t n) {
+    return (uint32_t)((n + 7) & ~(size_t)7);
+}
+
+static uint32_t rec_crc(const spool_record_t *r) {
+    const uint8_t *p = (const uint8_t *)&r->payload_len;
+    size_t n = sizeof(*r) - offsetof(spool_record_t, payload_len) + r->topic_len + r->payload_len;
+    return (uint32_t)crc32(0L, p, (uInt)n);
+}
+
+/* Bytes from pos to the end of the ring */
+static inline uint64_t room_to_end(uint64_t pos) {
+    return hdr->capacity - pos % hdr->capacity;
+}
+
+/* Record at pos, or NULL when pos starts a skip to the end of the ring
+ * (*skip set to its length) */
+static spool_record_t *rec_at(uint64_t pos, uint64_t *skip) {
+    uint64_t room = room_to_end(pos);
+    if (room < sizeof(spool_record_t)) {
+        *skip = room;
+        return NULL;
+    }
+    spool_record_t *r = (spool_record_t *)(data + pos % hdr->capacity);
+    if (r->magic == PAD_MAGIC) {
+        *skip = room;
+        return NULL;
+    }
+    return r;
+}
+
+/* Skip any pad at head; under spool_lock */
+static void head_skip_pad(void) {
+    uint64_t skip;
+    while (hdr->head < hdr->tail && rec_at(hdr->head, &skip) == NULL) {
+        hdr->head += skip;
+    }
+}
+
+/* Overwrite the oldest record; under spool_lock */
+static void drop_oldest(void) {
+    head_skip_pad();
+    if (hdr->head >= hdr->tail) return;
+
+    uint64_t skip;
+    spool_record_t *r = rec_at(hdr->head, &skip);
+    hdr->head += r->size;
+    hdr->count--;
+    hdr->dropped++;
+    gateway.mqtt_spool_dropped++;
+}
+
+static void header_init(void) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = SPOOL_MAGIC;
+    hdr->version = SPOOL_VERSION;
+    hdr->capacity = MQTT_SPOOL_BYTES;
+}
+
+/* Walk head..tail after open: keep every record whose CRC holds, cut
+ * the spool at the first one that does not */
+static void spool_recover(void) {
+    if (hdr->magic != SPOOL_MAGIC || hdr->version != SPOOL_VERSION ||
+        hdr->capacity != MQTT_SPOOL_BYTES || hdr->tail < hdr->head ||
+        hdr->tail - hdr->head > hdr->capacity) {
+        header_init();
+        return;
+    }
+
+    uint64_t pos = hdr->head;
+    uint32_t count = 0;
+    while (pos < hdr->tail) {
+        uint64_t skip;
+        spool_record_t *r = rec_at(pos, &skip);
+        if (r == NULL) {
+            pos += skip;
+            continue;
+        }
+        if (r->magic != REC_MAGIC || r->size < sizeof(*r) ||
+            r->size > room_to_end(pos) || pos + r->size > hdr->tail ||
+            sizeof(*r) + r->topic_len + r->payload_len > r->size ||
+            r->crc != rec_crc(r)) {
+            fprintf(stderr, "✗ MQTT spool: bad record at %llu, dropping %llu bytes\n",
+                    (unsigned long long)pos, (unsigned long long)(hdr->tail - pos));
+            break;
+        }
+        pos += r->size;
+        count++;
+    }
+    hdr->tail = pos;
+    hdr->count = count;
+}
+
+int mqtt_spool_append(const char *topic, const void *payload, size_t len, int format) {
+    size_t topic_len = strlen(topic);
+    if (topic_len + len > SPOOL_RECORD_MAX) return -1;
+
+    uint32_t need = rec_align(sizeof(spool_record_t) + topic_len + len);
+
+    pthread_mutex_lock(&spool_lock);
+    if (spool_map == NULL) {
+        pthread_mutex_unlock(&spool_lock);
+        return -1;
+    }
+
+    uint64_t pad = room_to_end(hdr->tail) < need ? room_to_end(hdr->tail) : 0;
+    while (hdr->tail + pad + need - hdr->head > hdr->capacity) {
+        drop_oldest();
+    }
+
+    if (pad >= sizeof(spool_record_t)) {
+        spool_record_t *p = (spool_record_t *)(data + hdr->tail % hdr->capacity);
+        p->magic = PAD_MAGIC;
+        p->size = (uint32_t)pad;
+    }
+    uint64_t pos = hdr->tail + pad;
+
+    spool_record_t *r = (spool_record_t *)(data + pos % hdr->capacity);
+    r->size = need;
+    r->payload_len = (uint32_t)len;
+    r->written = (uint32_t)time(NULL);
+    r->topic_len = (uint16_t)topic_len;
+    r->format = (uint8_t)format;
+    r->reserved = 0;
+    memcpy((uint8_t *)(r + 1), topic, topic_len);
+    memcpy((uint8_t *)(r + 1) + topic_len, payload, len);
+    r->crc = rec_crc(r);
+    r->magic = REC_MAGIC;
+
+    // Record first, then the tail that makes it visible
+    __sync_synchronize();
+    hdr->tail = pos + need;
+    hdr->count++;
+    dirty = 1;
+
+    gateway.mqtt_spooled++;
+    gateway.mqtt_spool_pending = hdr->count;
+    pthread_mutex_unlock(&spool_lock);
+    return 0;
+}
+
+uint32_t mqtt_spool_pending(void) {
+    pthread_mutex_lock(&spool_lock);
+    uint32_t n = spool_map ? hdr->count : 0;
+    pthread_mutex_unlock(&spool_lock);
+    return n;
+}
+
+void mqtt_spool_kick(void) {
+    pthread_mutex_lock(&spool_lock);
+    pthread_cond_signal(&spool_cond);
+    pthread_mutex_unlock(&spool_lock);
+}
+
+/* Queue the oldest record; 1 queued, 0 spool empty, -1 queue full.
+ * The record is copied out first so appends can go on meanwhile, and
+ * only removed if no append overwrote it while it was in flight */
+static int drain_one(void) {
+    pthread_mutex_lock(&spool_lock);
+    head_skip_pad();
+    if (hdr->head >= hdr->tail) {
+        pthread_mutex_unlock(&spool_lock);
+        return 0;
+    }
+    uint64_t pos = hdr->head, skip;
+    spool_record_t *r = rec_at(pos, &skip);
+    uint16_t topic_len = r->topic_len;
+    uint32_t payload_len = r->payload_len;
+    int format = r->format;
+    memcpy(drain_buf, r + 1, topic_len);
+    drain_buf[topic_len] = '\0';
+    memcpy(drain_buf + topic_len + 1, (uint8_t *)(r + 1) + topic_len, payload_len);
+    uint32_t size = r->size;
+    pthread_mutex_unlock(&spool_lock);
+
+    // Into the outbound queue's node class; full means replay waits
+    mq_msg_t m = {
+        .topic = drain_buf,
+        .payload = drain_buf + topic_len + 1,
+        .len = payload_len,
+        .qos = MQTT_QOS,
+        .format = format,
+    };
+    if (mqtt_outq_submit(MQ_NODE, &m, 0) < 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&spool_lock);
+    if (hdr->head == pos) {
+        hdr->head += size;
+        hdr->count--;
+        dirty = 1;
+    }
+    gateway.mqtt_spool_replayed++;
+    gateway.mqtt_spool_pending = hdr->count;
+    pthread_mutex_unlock(&spool_lock);
+    return 1;
+}
+
+/* Every MQTT_SPOOL_DRAIN_TICK_MS: while connected, replay up to this
+ * tick's share of MQTT_SPOOL_DRAIN_PER_SEC, then push dirty pages out */
+static void *drain_main(void *arg) {
+    int budget = MQTT_SPOOL_DRAIN_PER_SEC * MQTT_SPOOL_DRAIN_TICK_MS / 1000;
+    (void)arg;
+    if (budget < 1) budget = 1;
+
+    pthread_mutex_lock(&spool_lock);
+    while (drain_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += MQTT_SPOOL_DRAIN_TICK_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&spool_cond, &spool_lock, &deadline);
+        if (!drain_running) break;
+
+        int waiting = hdr->count > 0;
+        pthread_mutex_unlock(&spool_lock);
+
+        if (waiting && gateway.mqtt != NULL && gateway.mqtt_connected) {
+            for (int i = 0; i < budget; i++) {
+                if (drain_one() <= 0) break;
+            }
+        }
+
+        pthread_mutex_lock(&spool_lock);
+        if (dirty) {
+            msync(spool_map, spool_map_len, MS_ASYNC);
+            dirty = 0;
+        }
+    }
+    pthread_mutex_unlock(&spool_lock);
+    return NULL;
+}
+
+int mqtt_spool_open(const char *path) {
+    spool_map_len = SPOOL_DATA_OFFSET + MQTT_SPOOL_BYTES;
+
+    spool_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (spool_fd < 0) {
+        fprintf(stderr, "✗ MQTT spool: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(spool_fd, &st) < 0 ||
+        ((size_t)st.st_size != spool_map_len && ftruncate(spool_fd, spool_map_len) < 0)) {
+        fprintf(stderr, "✗ MQTT spool: cannot size %s: %s\n", path, strerror(errno));
+        close(spool_fd);
+        spool_fd = -1;
+        return -1;
+    }
+
+    void *map = mmap(NULL, spool_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, spool_fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "✗ MQTT spool: mmap failed: %s\n", strerror(errno));
+        close(spool_fd);
+        spool_fd = -1;
+        return -1;
+    }
+
+    pthread_mutex_lock(&spool_lock);
+    spool_map = map;
+    hdr = (spool_header_t *)spool_map;
+    data = spool_map + SPOOL_DATA_OFFSET;
+    spool_recover();
+    gateway.mqtt_spool_pending = hdr->count;
+    drain_running = 1;
+    pthread_mutex_unlock(&spool_lock);
+
+    if (pthread_create(&drain_thread, NULL, drain_main, NULL) != 0) {
+        fprintf(stderr, "✗ MQTT spool: cannot start drain thread: %s\n", strerror(errno));
+        drain_running = 0;
+        mqtt_spool_close();
+        return -1;
+    }
+
+    printf("✓ MQTT spool: %u waiting, %d KB (%s)\n",
+           hdr->count, MQTT_SPOOL_BYTES / 1024, path);
+    return 0;
+}
+
+void mqtt_spool_close(void) {
+    pthread_mutex_lock(&spool_lock);
+    int joinable = drain_running;
+    drain_running = 0;
+    pthread_cond_signal(&spool_cond);
+    pthread_mutex_unlock(&spool_lock);
+
+    if (joinable) {
+        pthread_join(drain_thread, NULL);
+    }
+
+    pthread_mutex_lock(&spool_lock);
+    if (spool_map != NULL) {
+        uint32_t left = hdr->count;
+        msync(spool_map, spool_map_len, MS_SYNC);
+        munmap(spool_map, spool_map_len);
+        spool_map = NULL;
+        if (left > 0) {
+            printf("✓ MQTT spool: %u kept for the next start\n", left);
+        }
+    }
+    if (spool_fd >= 0) {
+        close(spool_fd);
+        spool_fd = -1;
+    }
+    pthread_mutex_unlock(&spool_lock);
+}
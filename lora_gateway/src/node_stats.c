@@ -0,0 +1,167 @@
+/*
+ * src/node_stats.c - Live Window Statistics (per node, in memory)
+ * Welford's update for each reading, Chan's pairwise merge to combine
+ * buckets into the window total.
+ */
+
+#include "node_stats.h"
+#include "gateway.h"
+#include "config.h"
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct {
+    int64_t width;                          // bucket length, seconds
+    int64_t head;                           // bucket number (ts / width) of the newest
+    ns_summary_t bucket[NODE_STATS_BUCKETS][NS_CHANNELS];
+    ns_summary_t total[NS_CHANNELS];        // merge of the live buckets
+} ns_window_t;
+
+typedef struct {
+    ns_window_t window[NODE_STATS_WINDOWS];
+    int64_t covered_from;
+} ns_node_t;
+
+static const int window_sec[NODE_STATS_WINDOWS] = NODE_STATS_WINDOW_SEC;
+
+/* node_stats_get() has nothing for any other length: smoothing would
+ * silently fall back to single readings */
+_Static_assert(AUTO_CONTROL_SMOOTH_SEC == 0 || AUTO_CONTROL_SMOOTH_SEC == 300 ||
+               AUTO_CONTROL_SMOOTH_SEC == 3600 || AUTO_CONTROL_SMOOTH_SEC == 86400,
+               "AUTO_CONTROL_SMOOTH_SEC must be 0 or one of NODE_STATS_WINDOW_SEC");
+static ns_node_t nodes[MAX_NODES];
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void summary_add(ns_summary_t *s, double v) {
+    s->count++;
+    double delta = v - s->mean;
+    s->mean += delta / s->count;
+    s->m2 += delta * (v - s->mean);
+
+    if (s->count == 1 || v < s->min) s->min = v;
+    if (s->count == 1 || v > s->max) s->max = v;
+}
+
+static void summary_merge(ns_summary_t *s, const ns_summary_t *b) {
+    if (b->count == 0) return;
+    if (s->count == 0) {
+        *s = *b;
+        return;
+    }
+
+    double n = (double)s->count + b->count;
+    double delta = b->mean - s->mean;
+    s->mean += delta * b->count / n;
+    s->m2 += b->m2 + delta * delta * s->count * b->count / n;
+    s->count += b->count;
+
+    if (b->min < s->min) s->min = b->min;
+    if (b->max > s->max) s->max = b->max;
+}
+
+/* Move the newest bucket up to ts's; expired buckets are cleared and
+ * the total rebuilt from the ones left */
+static void window_advance(ns_window_t *w, int64_t ts) {
+    int64_t b = ts / w->width;
+    if (b <= w->head) return;
+
+    int64_t expired = b - w->head;
+    if (expired > NODE_STATS_BUCKETS) expired = NODE_STATS_BUCKETS;
+    for (int64_t i = 1; i <= expired; i++) {
+        memset(w->bucket[(w->head + i) % NODE_STATS_BUCKETS], 0,
+               sizeof(w->bucket[0]));
+    }
+    w->head = b;
+
+    memset(w->total, 0, sizeof(w->total));
+    for (int i = 0; i < NODE_STATS_BUCKETS; i++) {
+        for (int c = 0; c < NS_CHANNELS; c++) {
+            summary_merge(&w->total[c], &w->bucket[i][c]);
+        }
+    }
+}
+
+static void window_add(ns_window_t *w, const ts_point_t *pt) {
+    if (w->width == 0) return;      // before node_stats_reset()
+    window_advance(w, pt->timestamp);
+
+    int64_t b = pt->timestamp / w->width;
+    if (b <= w->head - NODE_STATS_BUCKETS) return;     // already expired
+
+    const double v[NS_CHANNELS] = {
+        pt->temperature, pt->humidity, pt->light, pt->soil_moisture
+    };
+    ns_summary_t *bucket = w->bucket[b % NODE_STATS_BUCKETS];
+    for (int c = 0; c < NS_CHANNELS; c++) {
+        summary_add(&bucket[c], v[c]);
+        summary_add(&w->total[c], v[c]);
+    }
+}
+
+void node_stats_reset(void) {
+    int64_t now = time(NULL);
+
+    pthread_mutex_lock(&stats_lock);
+    memset(nodes, 0, sizeof(nodes));
+    for (int n = 0; n < MAX_NODES; n++) {
+        nodes[n].covered_from = now;
+        for (int i = 0; i < NODE_STATS_WINDOWS; i++) {
+            ns_window_t *w = &nodes[n].window[i];
+            w->width = window_sec[i] / NODE_STATS_BUCKETS;
+            if (w->width < 1) w->width = 1;
+            w->head = now / w->width;
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void node_stats_add(int node_id, const ts_point_t *pt) {
+    if (node_id < 1 || node_id > MAX_NODES) return;
+
+    pthread_mutex_lock(&stats_lock);
+    for (int i = 0; i < NODE_STATS_WINDOWS; i++) {
+        window_add(&nodes[node_id - 1].window[i], pt);
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void node_stats_cover(int node_id, int64_t from) {
+    if (node_id < 1 || node_id > MAX_NODES) return;
+
+    pthread_mutex_lock(&stats_lock);
+    nodes[node_id - 1].covered_from = from;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+int node_stats_get(int node_id, int seconds, ns_summary_t out[NS_CHANNELS],
+                   int *complete) {
+    if (node_id < 1 || node_id > MAX_NODES) return -1;
+
+    int i = 0;
+    while (i < NODE_STATS_WINDOWS && window_sec[i] != seconds) i++;
+    if (i == NODE_STATS_WINDOWS) return -1;
+
+    int64_t now = time(NULL);
+    ns_node_t *node = &nodes[node_id - 1];
+    ns_window_t *w = &node->window[i];
+
+    pthread_mutex_lock(&stats_lock);
+    if (w->width == 0) {
+        pthread_mutex_unlock(&stats_lock);
+        return -1;
+    }
+    window_advance(w, now);
+    memcpy(out, w->total, sizeof(w->total));
+    if (complete) {
+        *complete = (node->covered_from <= now - seconds);
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    return (int)out[0].count;
+}
+
+double ns_stddev(const ns_summary_t *s) {
+    return s->count > 1 ? sqrt(s->m2 / (s->count - 1)) : 0.0;
+}
@@ -0,0 +1,120 @@
+/*
+ * src/payload.c - Per-Packet JSON Documents
+ * Same keys and order as the cJSON versions they replace; floats are
+ * printed as their shortest decimal.
+ */
+
+#include "payload.h"
+#include "gateway.h"
+#include "utils.h"
+#include <stdio.h>
+#include <time.h>
+
+void payload_node_fields(jw_t *w, int node_id, const node_data_t *node) {
+    jw_int(w, "node_id", node_id);
+    jw_int(w, "timestamp", node->last_update);
+
+    jw_object(w, "sensors");
+    jw_float(w, "temperature", node->temperature);
+    jw_float(w, "humidity", node->humidity);
+    jw_int(w, "light", node->light);
+    jw_int(w, "soil_moisture", node->soil_moisture);
+    jw_object_end(w);
+
+    jw_object(w, "actuators");
+    jw_int(w, "fan", node->actuators.fan_state);
+    jw_int(w, "light", node->actuators.light_state);
+    jw_int(w, "pump", node->actuators.pump_state);
+    jw_object_end(w);
+
+    jw_object(w, "signal");
+    jw_int(w, "rssi", node->last_rssi);
+    jw_int(w, "snr", node->last_snr);
+    jw_object_end(w);
+
+    jw_object(w, "stats");
+    jw_int(w, "rx_count", node->rx_count);
+    jw_int(w, "tx_count", node->tx_count);
+    jw_object_end(w);
+
+    jw_bool(w, "auto_mode", node->thresholds.enabled);
+}
+
+static void dashboard_node(jw_t *w, const node_data_t *node) {
+    // Sensor data
+    jw_float(w, "temp", node->temperature);
+    jw_float(w, "humid", node->humidity);
+    jw_int(w, "light", node->light);
+    jw_int(w, "soil", node->soil_moisture);
+
+    // Signal quality
+    jw_int(w, "rssi", node->last_rssi);
+    jw_int(w, "snr", node->last_snr);
+
+    // Statistics
+    jw_int(w, "rx_count", node->rx_count);
+    jw_int(w, "tx_count", node->tx_count);
+    jw_int(w, "last_update", node->last_update);
+
+    jw_object(w, "actuators");
+    jw_int(w, "fan", node->actuators.fan_state);
+    jw_int(w, "light", node->actuators.light_state);
+    jw_int(w, "pump", node->actuators.pump_state);
+    jw_object_end(w);
+
+    jw_bool(w, "auto_mode", node->thresholds.enabled);
+
+    // Thresholds (if auto mode enabled)
+    if (node->thresholds.enabled) {
+        const threshold_config_t *th = &node->thresholds;
+        jw_object(w, "thresholds");
+        jw_object(w, "temp");
+        jw_float(w, "min", th->temp_min);
+        jw_float(w, "max", th->temp_max);
+        jw_object_end(w);
+        jw_object(w, "light");
+        jw_int(w, "min", th->light_min);
+        jw_int(w, "max", th->light_max);
+        jw_object_end(w);
+        jw_object(w, "soil");
+        jw_int(w, "min", th->soil_min);
+        jw_int(w, "max", th->soil_max);
+        jw_object_end(w);
+        jw_object_end(w);
+    }
+}
+
+void payload_dashboard(jw_t *w) {
+    char timestamp[32];
+    get_timestamp(timestamp, sizeof(timestamp));
+
+    jw_object(w, NULL);
+    jw_string(w, "timestamp", timestamp);
+    jw_int(w, "unix_time", time(NULL));
+
+    jw_object(w, "nodes");
+    for (int i = 0; i < MAX_NODES; i++) {
+        if (gateway.nodes[i].last_update > 0) {
+            char node_key[16];
+            snprintf(node_key, sizeof(node_key), "node%d", i+1);
+            jw_object(w, node_key);
+            dashboard_node(w, &gateway.nodes[i]);
+            jw_object_end(w);
+        }
+    }
+    jw_object_end(w);
+
+    // Gateway statistics
+    jw_object(w, "gateway");
+    jw_int(w, "rx_nodata", gateway.rx_nodata);
+    jw_int(w, "rx_crc_error", gateway.rx_crc_error);
+    jw_int(w, "rx_crc_recovery", gateway.rx_crc_recovery);
+    jw_int(w, "json_parse_error", gateway.json_parse_error);
+    jw_int(w, "auto_commands", gateway.auto_commands);
+    jw_int(w, "mqtt_connected", gateway.mqtt_connected);
+    jw_int(w, "mqtt_publish_count", gateway.mqtt_publish_count);
+    jw_int(w, "mqtt_error_count", gateway.mqtt_error_count);
+    jw_object_end(w);
+
+    jw_object_end(w);
+}
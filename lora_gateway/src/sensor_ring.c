@@ -0,0 +1,183 @@
+/*
+ * src/sensor_ring.c - Recent Readings Ring (per node, in memory)
+ * Structure of arrays: a scan over timestamps for a range touches only
+ * the timestamp column, and the whole ring is allocated up front.
+ */
+
+#include "sensor_ring.h"
+#include "gateway.h"
+#include <string.h>
+#include <pthread.h>
+
+typedef struct {
+    int64_t timestamp[SENSOR_RING_CAPACITY];
+    float temperature[SENSOR_RING_CAPACITY];
+    float humidity[SENSOR_RING_CAPACITY];
+    uint16_t light[SENSOR_RING_CAPACITY];
+    uint16_t soil_moisture[SENSOR_RING_CAPACITY];
+    int32_t rssi[SENSOR_RING_CAPACITY];
+    int32_t snr[SENSOR_RING_CAPACITY];
+    uint32_t next;          // slot the next reading goes to
+    uint32_t count;
+    int complete;           // holds every reading the node ever had
+} node_ring_t;
+
+static node_ring_t rings[MAX_NODES];
+static int foreign_rows = 0;        // readings from nodes without a ring
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static node_ring_t *ring_of(int node_id) {
+    return (node_id >= 1 && node_id <= MAX_NODES) ? &rings[node_id - 1] : NULL;
+}
+
+/* i-th newest reading (0 = newest) */
+static uint32_t ring_slot(const node_ring_t *ring, uint32_t i) {
+    return (ring->next + SENSOR_RING_CAPACITY - 1 - i) % SENSOR_RING_CAPACITY;
+}
+
+static void ring_get(const node_ring_t *ring, uint32_t slot, ts_point_t *pt) {
+    pt->timestamp = ring->timestamp[slot];
+    pt->temperature = ring->temperature[slot];
+    pt->humidity = ring->humidity[slot];
+    pt->light = ring->light[slot];
+    pt->soil_moisture = ring->soil_moisture[slot];
+    pt->rssi = ring->rssi[slot];
+    pt->snr = ring->snr[slot];
+}
+
+static void ring_put(node_ring_t *ring, const ts_point_t *pt) {
+    uint32_t slot = ring->next;
+
+    ring->timestamp[slot] = pt->timestamp;
+    ring->temperature[slot] = pt->temperature;
+    ring->humidity[slot] = pt->humidity;
+    ring->light[slot] = (uint16_t)pt->light;
+    ring->soil_moisture[slot] = (uint16_t)pt->soil_moisture;
+    ring->rssi[slot] = pt->rssi;
+    ring->snr[slot] = pt->snr;
+
+    ring->next = (slot + 1) % SENSOR_RING_CAPACITY;
+    if (ring->count < SENSOR_RING_CAPACITY) {
+        ring->count++;
+    } else {
+        ring->complete = 0;     // oldest reading overwritten
+    }
+}
+
+void sensor_ring_reset(void) {
+    pthread_mutex_lock(&ring_lock);
+    for (int i = 0; i < MAX_NODES; i++) {
+        rings[i].next = 0;
+        rings[i].count = 0;
+        rings[i].complete = 0;
+    }
+    foreign_rows = 0;
+    pthread_mutex_unlock(&ring_lock);
+}
+
+void sensor_ring_seed(int node_id, const ts_point_t *pts, int n, int complete) {
+    node_ring_t *ring = ring_of(node_id);
+    if (ring == NULL) return;
+
+    pthread_mutex_lock(&ring_lock);
+    ring->next = 0;
+    ring->count = 0;
+    ring->complete = 1;
+    for (int i = n - 1; i >= 0; i--) {
+        ring_put(ring, &pts[i]);
+    }
+    ring->complete = complete;
+    pthread_mutex_unlock(&ring_lock);
+}
+
+void sensor_ring_push(int node_id, const ts_point_t *pt) {
+    node_ring_t *ring = ring_of(node_id);
+
+    pthread_mutex_lock(&ring_lock);
+    if (ring) {
+        ring_put(ring, pt);
+    } else {
+        foreign_rows = 1;
+    }
+    pthread_mutex_unlock(&ring_lock);
+}
+
+int sensor_ring_latest(int node_id, ts_point_t *out, int max) {
+    node_ring_t *ring = ring_of(node_id);
+    if (ring == NULL || max < 0) return -1;
+
+    pthread_mutex_lock(&ring_lock);
+    if ((uint32_t)max > ring->count && !ring->complete) {
+        pthread_mutex_unlock(&ring_lock);
+        return -1;
+    }
+    int n = (uint32_t)max < ring->count ? max : (int)ring->count;
+    for (int i = 0; i < n; i++) {
+        ring_get(ring, ring_slot(ring, i), &out[i]);
+    }
+    pthread_mutex_unlock(&ring_lock);
+    return n;
+}
+
+int sensor_ring_latest_all(ts_point_t *out, int *node_ids, int max) {
+    uint32_t pos[MAX_NODES] = {0};
+    int n = 0;
+
+    pthread_mutex_lock(&ring_lock);
+    if (foreign_rows) {
+        pthread_mutex_unlock(&ring_lock);
+        return -1;
+    }
+
+    // Merge newest first; a ring that runs out before max rows are
+    // taken may have older rows in SQLite that belong in between
+    while (n < max) {
+        int best = -1;
+        for (int i = 0; i < MAX_NODES; i++) {
+            const node_ring_t *ring = &rings[i];
+            if (pos[i] == ring->count) {
+                if (!ring->complete) {
+                    pthread_mutex_unlock(&ring_lock);
+                    return -1;
+                }
+                continue;
+            }
+            // Ties go to the higher node id, as the (timestamp, node_id)
+            // index scanned backwards returns them
+            if (best < 0 || ring->timestamp[ring_slot(ring, pos[i])] >=
+                            rings[best].timestamp[ring_slot(&rings[best], pos[best])]) {
+                best = i;
+            }
+        }
+        if (best < 0) break;    // every node's full history taken
+
+        ring_get(&rings[best], ring_slot(&rings[best], pos[best]), &out[n]);
+        node_ids[n++] = best + 1;
+        pos[best]++;
+    }
+    pthread_mutex_unlock(&ring_lock);
+    return n;
+}
+
+int sensor_ring_range(int node_id, int64_t lo, ts_point_t *out, int max) {
+    node_ring_t *ring = ring_of(node_id);
+    if (ring == NULL) return -1;
+
+    pthread_mutex_lock(&ring_lock);
+
+    // Count back to the first reading >= lo on the timestamp column only
+    uint32_t n = 0;
+    while (n < ring->count && ring->timestamp[ring_slot(ring, n)] >= lo) {
+        n++;
+    }
+    // Reaching the end means older readings (maybe >= lo) were dropped
+    if ((n == ring->count && !ring->complete) || n > (uint32_t)max) {
+        pthread_mutex_unlock(&ring_lock);
+        return -1;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        ring_get(ring, ring_slot(ring, n - 1 - i), &out[i]);
+    }
+    pthread_mutex_unlock(&ring_lock);
+    return (int)n;
+}
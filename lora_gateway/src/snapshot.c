@@ -0,0 +1,86 @@
+/*
+ * src/snapshot.c - Coalesced Dashboard Snapshot
+ * A burst of packets costs one serialization and one write per
+ * SNAPSHOT_INTERVAL_MS instead of one per packet. The document is built
+ * in the thread's json_writer buffer, so nothing is allocated.
+ */
+
+#include "snapshot.h"
+#include "payload.h"
+#include "gateway.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char *snapshot_path = SNAPSHOT_PATH;
+static char snapshot_tmp[256] = SNAPSHOT_PATH ".tmp";
+static uint64_t interval_us = SNAPSHOT_INTERVAL_MS * 1000ULL;
+
+static int dirty = 0;
+static uint64_t last_write_us = 0;     // 0: none yet
+
+void snapshot_configure(const char *path, int interval_ms) {
+    snapshot_path = path;
+    snprintf(snapshot_tmp, sizeof(snapshot_tmp), "%s.tmp", path);
+    interval_us = interval_ms > 0 ? interval_ms * 1000ULL : 0;
+}
+
+static void snapshot_write(uint64_t now_us) {
+    jw_t *w = jw_begin();
+    payload_dashboard(w);
+
+    size_t len;
+    const char *json = jw_finish(w, &len);
+    dirty = 0;
+    last_write_us = now_us;
+    if (json == NULL) {
+        fprintf(stderr, "Dashboard JSON does not fit in %d bytes\n", JW_BUFFER_BYTES);
+        return;
+    }
+
+    int fd = open(snapshot_tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to open JSON file");
+        return;
+    }
+    ssize_t written = write(fd, json, len);
+    close(fd);
+    if (written != (ssize_t)len) {
+        perror("Failed to write JSON file");
+        unlink(snapshot_tmp);
+        return;
+    }
+    if (rename(snapshot_tmp, snapshot_path) < 0) {
+        perror("Failed to replace JSON file");
+        unlink(snapshot_tmp);
+        return;
+    }
+    gateway.snapshot_writes++;
+    gateway.snapshot_bytes += len;
+}
+
+void snapshot_mark_dirty(void) {
+    if (dirty) {
+        gateway.snapshot_coalesced++;
+    }
+    dirty = 1;
+    snapshot_tick();
+}
+
+void snapshot_tick(void) {
+    if (!dirty) {
+        return;
+    }
+    uint64_t now_us = get_monotonic_us();
+    if (last_write_us == 0 || now_us - last_write_us >= interval_us) {
+        snapshot_write(now_us);
+    }
+}
+
+void snapshot_flush(void) {
+    if (dirty) {
+        snapshot_write(get_monotonic_us());
+    }
+}
@@ -0,0 +1,330 @@
+/*
+ * src/ts_archive.c - Compressed Time-Series Blocks
+ * Block layout: version byte, varint point count, then one section
+ * per channel (varint byte length + payload) so a reader can skip
+ * channels it does not need.
+ */
+
+#include "ts_archive.h"
+#include <string.h>
+
+#define TS_BLOCK_VERSION    1
+#define TS_CHANNELS         7
+
+/*====================================================================
+ * BIT STREAM (MSB first)
+ *====================================================================*/
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;         // bytes
+    size_t pos;         // bits written / read
+    int error;
+} bitstream_t;
+
+static void bits_put(bitstream_t *bs, uint64_t value, int nbits) {
+    if (bs->pos + nbits > bs->cap * 8) {
+        bs->error = 1;
+        return;
+    }
+    for (int i = nbits - 1; i >= 0; i--) {
+        size_t byte = bs->pos >> 3;
+        int bit = 7 - (int)(bs->pos & 7);
+        if (bit == 7) bs->buf[byte] = 0;
+        if ((value >> i) & 1) bs->buf[byte] |= (uint8_t)(1 << bit);
+        bs->pos++;
+    }
+}
+
+static uint64_t bits_get(bitstream_t *bs, int nbits) {
+    uint64_t value = 0;
+
+    if (bs->pos + nbits > bs->cap * 8) {
+        bs->error = 1;
+        return 0;
+    }
+    for (int i = 0; i < nbits; i++) {
+        value = (value << 1) | ((bs->buf[bs->pos >> 3] >> (7 - (bs->pos & 7))) & 1);
+        bs->pos++;
+    }
+    return value;
+}
+
+static size_t bits_bytes(const bitstream_t *bs) {
+    return (bs->pos + 7) / 8;
+}
+
+/*====================================================================
+ * VARINT / ZIGZAG
+ *====================================================================*/
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static size_t varint_put(uint8_t *out, size_t cap, size_t pos, uint64_t v) {
+    do {
+        if (pos >= cap) return 0;
+        out[pos++] = (uint8_t)((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+        v >>= 7;
+    } while (v);
+    return pos;
+}
+
+static size_t varint_get(const uint8_t *in, size_t len, size_t pos, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= len) return 0;
+        uint8_t b = in[pos++];
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return pos;
+    }
+    return 0;
+}
+
+/*====================================================================
+ * CHANNEL CODECS
+ *====================================================================*/
+
+/* Timestamps: first value raw, then delta-of-delta in 1/9/12/16/68-bit
+ * buckets. A steady reporting interval costs one bit per point. */
+static void encode_timestamps(bitstream_t *bs, const ts_point_t *pts, int n) {
+    int64_t prev_delta = 0;
+
+    bits_put(bs, (uint64_t)pts[0].timestamp, 64);
+    for (int i = 1; i < n; i++) {
+        int64_t delta = pts[i].timestamp - pts[i - 1].timestamp;
+        uint64_t dod = zigzag(delta - prev_delta);
+        prev_delta = delta;
+
+        if (dod == 0) {
+            bits_put(bs, 0x0, 1);
+        } else if (dod < (1 << 7)) {
+            bits_put(bs, 0x2, 2);
+            bits_put(bs, dod, 7);
+        } else if (dod < (1 << 9)) {
+            bits_put(bs, 0x6, 3);
+            bits_put(bs, dod, 9);
+        } else if (dod < (1 << 12)) {
+            bits_put(bs, 0xe, 4);
+            bits_put(bs, dod, 12);
+        } else {
+            bits_put(bs, 0xf, 4);
+            bits_put(bs, dod, 64);
+        }
+    }
+}
+
+static void decode_timestamps(bitstream_t *bs, ts_point_t *pts, int n) {
+    int64_t prev_delta = 0;
+
+    pts[0].timestamp = (int64_t)bits_get(bs, 64);
+    for (int i = 1; i < n && !bs->error; i++) {
+        uint64_t dod;
+        if (bits_get(bs, 1) == 0) {
+            dod = 0;
+        } else if (bits_get(bs, 1) == 0) {
+            dod = bits_get(bs, 7);
+        } else if (bits_get(bs, 1) == 0) {
+            dod = bits_get(bs, 9);
+        } else if (bits_get(bs, 1) == 0) {
+            dod = bits_get(bs, 12);
+        } else {
+            dod = bits_get(bs, 64);
+        }
+        // Unsigned math: a corrupt block must not be undefined behaviour
+        prev_delta = (int64_t)((uint64_t)prev_delta + (uint64_t)unzigzag(dod));
+        pts[i].timestamp = (int64_t)((uint64_t)pts[i - 1].timestamp + (uint64_t)prev_delta);
+    }
+}
+
+static uint32_t float_bits(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static float bits_float(uint32_t u) {
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/* Floats: XOR with the previous value. '0' = unchanged, '10' = fits the
+ * previous leading/trailing-zero window, '11' = new window (5+5 bits). */
+static void encode_floats(bitstream_t *bs, const ts_point_t *pts, int n, size_t offset) {
+    uint32_t prev = float_bits(*(const float *)((const char *)&pts[0] + offset));
+    int prev_lead = -1, prev_trail = 0;
+
+    bits_put(bs, prev, 32);
+    for (int i = 1; i < n; i++) {
+        uint32_t cur = float_bits(*(const float *)((const char *)&pts[i] + offset));
+        uint32_t x = cur ^ prev;
+        prev = cur;
+
+        if (x == 0) {
+            bits_put(bs, 0x0, 1);
+            continue;
+        }
+
+        int lead = __builtin_clz(x);
+        int trail = __builtin_ctz(x);
+
+        if (prev_lead >= 0 && lead >= prev_lead && trail >= prev_trail) {
+            bits_put(bs, 0x2, 2);
+            bits_put(bs, x >> prev_trail, 32 - prev_lead - prev_trail);
+        } else {
+            int sig = 32 - lead - trail;
+            bits_put(bs, 0x3, 2);
+            bits_put(bs, (uint64_t)lead, 5);
+            bits_put(bs, (uint64_t)(sig - 1), 5);
+            bits_put(bs, x >> trail, sig);
+            prev_lead = lead;
+            prev_trail = trail;
+        }
+    }
+}
+
+static void decode_floats(bitstream_t *bs, ts_point_t *pts, int n, size_t offset) {
+    uint32_t prev = (uint32_t)bits_get(bs, 32);
+    int prev_lead = -1, prev_trail = 0;
+
+    *(float *)((char *)&pts[0] + offset) = bits_float(prev);
+    for (int i = 1; i < n && !bs->error; i++) {
+        if (bits_get(bs, 1) == 1) {
+            uint32_t x;
+            if (bits_get(bs, 1) == 0) {
+                if (prev_lead < 0) {
+                    bs->error = 1;
+                    return;
+                }
+                x = (uint32_t)bits_get(bs, 32 - prev_lead - prev_trail) << prev_trail;
+            } else {
+                int lead = (int)bits_get(bs, 5);
+                int sig = (int)bits_get(bs, 5) + 1;
+                int trail = 32 - lead - sig;
+                if (trail < 0) {
+                    bs->error = 1;
+                    return;
+                }
+                x = (uint32_t)bits_get(bs, sig) << trail;
+                prev_lead = lead;
+                prev_trail = trail;
+            }
+            prev ^= x;
+        }
+        *(float *)((char *)&pts[i] + offset) = bits_float(prev);
+    }
+}
+
+/* Integers: zigzag varint of the delta, byte aligned */
+static size_t encode_ints(uint8_t *out, size_t cap, const ts_point_t *pts, int n, size_t offset) {
+    int64_t prev = 0;
+    size_t pos = 0;
+
+    for (int i = 0; i < n; i++) {
+        int64_t cur = *(const int32_t *)((const char *)&pts[i] + offset);
+        pos = varint_put(out, cap, pos, zigzag(cur - prev));
+        if (pos == 0) return 0;
+        prev = cur;
+    }
+    return pos;
+}
+
+static int decode_ints(const uint8_t *in, size_t len, ts_point_t *pts, int n, size_t offset) {
+    int64_t prev = 0;
+    size_t pos = 0;
+
+    for (int i = 0; i < n; i++) {
+        uint64_t v;
+        pos = varint_get(in, len, pos, &v);
+        if (pos == 0) return -1;
+        prev = (int64_t)((uint64_t)prev + (uint64_t)unzigzag(v));
+        *(int32_t *)((char *)&pts[i] + offset) = (int32_t)prev;
+    }
+    return 0;
+}
+
+/*====================================================================
+ * BLOCKS
+ *====================================================================*/
+
+static const size_t float_channels[] = {
+    offsetof(ts_point_t, temperature),
+    offsetof(ts_point_t, humidity),
+};
+
+static const size_t int_channels[] = {
+    offsetof(ts_point_t, light),
+    offsetof(ts_point_t, soil_moisture),
+    offsetof(ts_point_t, rssi),
+    offsetof(ts_point_t, snr),
+};
+
+size_t ts_block_encode(const ts_point_t *pts, int n, uint8_t *out, size_t cap) {
+    uint8_t scratch[TS_BLOCK_MAX_BYTES(TS_BLOCK_MAX_POINTS)];
+    size_t pos = 0;
+
+    if (n <= 0 || n > TS_BLOCK_MAX_POINTS || cap < 1) return 0;
+
+    out[pos++] = TS_BLOCK_VERSION;
+    if ((pos = varint_put(out, cap, pos, (uint64_t)n)) == 0) return 0;
+
+    // Each channel goes to scratch first so its length can prefix it
+    for (int ch = 0; ch < TS_CHANNELS; ch++) {
+        size_t size;
+
+        if (ch < 3) {
+            bitstream_t bs = { scratch, sizeof(scratch), 0, 0 };
+            if (ch == 0) {
+                encode_timestamps(&bs, pts, n);
+            } else {
+                encode_floats(&bs, pts, n, float_channels[ch - 1]);
+            }
+            if (bs.error) return 0;
+            size = bits_bytes(&bs);
+        } else {
+            size = encode_ints(scratch, sizeof(scratch), pts, n, int_channels[ch - 3]);
+            if (size == 0) return 0;
+        }
+
+        if ((pos = varint_put(out, cap, pos, size)) == 0 || pos + size > cap) return 0;
+        memcpy(out + pos, scratch, size);
+        pos += size;
+    }
+
+    return pos;
+}
+
+int ts_block_decode(const uint8_t *in, size_t len, ts_point_t *out, int max) {
+    size_t pos = 0;
+    uint64_t n;
+
+    if (len < 1 || in[pos++] != TS_BLOCK_VERSION) return -1;
+    if ((pos = varint_get(in, len, pos, &n)) == 0) return -1;
+    if (n == 0 || n > (uint64_t)max) return -1;
+
+    for (int ch = 0; ch < TS_CHANNELS; ch++) {
+        uint64_t size;
+        if ((pos = varint_get(in, len, pos, &size)) == 0 || size > len - pos) return -1;
+
+        if (ch < 3) {
+            bitstream_t bs = { (uint8_t *)(in + pos), (size_t)size, 0, 0 };
+            if (ch == 0) {
+                decode_timestamps(&bs, out, (int)n);
+            } else {
+                decode_floats(&bs, out, (int)n, float_channels[ch - 1]);
+            }
+            if (bs.error) return -1;
+        } else if (decode_ints(in + pos, (size_t)size, out, (int)n, int_channels[ch - 3]) < 0) {
+            return -1;
+        }
+        pos += size;
+    }
+
+    return (int)n;
+}
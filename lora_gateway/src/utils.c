@@ -1,13 +1,46 @@
 #include "utils.h"
 #include "gateway.h"
-#include 
-#include 
-#include 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
 
 void get_timestamp(char *buf, size_t len) {
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    strftime(buf, len, "%H:%M:%S", t);
+    struct tm t;
+    localtime_r(&now, &t);     // also called from the query workers
+    strftime(buf, len, "%H:%M:%S", &t);
+}
+
+uint64_t get_monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* mkdir -p without a shell: creates each missing path component */
+int mkdir_p(const char *path, mode_t mode) {
+    char buf[256];
+    
+    if (snprintf(buf, sizeof(buf), "%s", path) >= (int)sizeof(buf)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    
+    for (char *p = buf + 1; ; p++) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            if (mkdir(buf, mode) < 0 && errno != EEXIST) {
+                return -1;
+            }
+            if (c == '\0') break;
+            *p = c;
+        }
+    }
+    return 0;
 }
 
 void signal_handler(int sig) {